@@ -0,0 +1,21 @@
+#include <cstdlib>
+#include <new>
+
+#include "alloc_count.h"
+
+std::atomic<size_t> allocCount( 0 );
+std::atomic<size_t> allocBytes( 0 );
+
+void* operator new( size_t size ) {
+    ++allocCount;
+    allocBytes += size;
+    void *p = std::malloc( size ? size : 1 );
+    if ( p == nullptr ) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete( void *p ) noexcept {
+    std::free( p );
+}
@@ -0,0 +1,16 @@
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+#include <atomic>
+#include <cstddef>
+
+/*
+ * The number of allocations and bytes asked for through C++ new so far, the bench
+ * adds SDL_malloc's to them too. The replacement operator new and delete are in
+ * alloc_count.cpp on their own, where the compiler can't inline them into code it
+ * would then see freeing memory from new.
+ */
+extern std::atomic<size_t> allocCount;
+extern std::atomic<size_t> allocBytes;
+
+#endif
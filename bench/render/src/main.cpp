@@ -0,0 +1,901 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <SDL2/SDL.h>
+#include <SDL2_image/SDL_Image.h>
+#include <SDL2_ttf/SDL_TTF.h>
+
+#include "res_path.h"
+#include "alloc_count.h"
+#include "animation.h"
+#include "cleanup.h"
+#include "font_cleanup.h"
+#include "glyph_cache.h"
+#include "mip_chain.h"
+#include "particles.h"
+#include "soft_raster.h"
+#include "spatial_grid.h"
+#include "sprite_batch.h"
+#include "sprite_store.h"
+#include "texture_cache.h"
+#include "tilemap.h"
+
+using namespace std;
+
+/*
+ * Renders scenes equivalent to lessons 2-6 without a display for a fixed number of
+ * frames and prints one JSON object per line with the results of each run.
+ *
+ * usage: render_bench [--frames N] [--sprites N,N,...] [--scene name] [--target] [--raster] [--copy] [--res dir]
+ *
+ * By default we draw with the software renderer straight into a surface. --target
+ * instead creates a hidden window (on the dummy video driver unless SDL_VIDEODRIVER
+ * says otherwise) and draws into a render target texture. --raster runs the tile, sprite
+ * and particles scenes through a SoftRasterizer instead of an SDL_Renderer, once on a
+ * single thread ("serial") and once on a thread per CPU ("parallel").
+ *
+ * Every scene is run at each sprite count, once drawing each sprite with its own
+ * SDL_RenderCopy the way the lessons do ("direct") and once through a SpriteBatch
+ * ("batch"). --copy makes the batch draw each run of quads with SDL_RenderCopy
+ * ("batch_copy") rather than SDL_RenderGeometry, to compare the two. mixed_tiles is
+ * the tiles scene taking turns between MIXED_TEXTURES textures, which makes drawing
+ * in order switch texture on every tile. The particles scene keeps count particles alive in a ParticlePool and draws
+ * them with an SDL_RenderCopy each ("direct") or as one SDL_RenderGeometry call ("batch"),
+ * try it with --scene particles --sprites 1000000, and with --raster to see how a
+ * SoftRasterizer keeps up with that many. Allocations count C++ new and, on SDL 2.0.7 and later, SDL_malloc;
+ * allocations made inside SDL_image, SDL_ttf or the libraries they use aren't seen.
+ */
+
+const int SCREEN_WIDTH  = 640;
+const int SCREEN_HEIGHT = 480;
+const int TILE_SIZE     = 40;
+const int SPRITE_SIZE   = 100;
+const int TEXT_COLUMNS  = 64;
+// Textures the mixed_tiles scene takes turns with
+const size_t MIXED_TEXTURES = 2;
+// Average distance between sprites in the world scene, and one in how many move each frame
+const int WORLD_SPACING = 64;
+const int WORLD_MOVERS  = 16;
+// Size in pixels of a particle in the particles scene
+const int PARTICLE_SIZE = 4;
+
+#if SDL_VERSION_ATLEAST(2, 0, 7)
+static SDL_malloc_func sdlMalloc;
+static SDL_calloc_func sdlCalloc;
+static SDL_realloc_func sdlRealloc;
+static SDL_free_func sdlFree;
+
+static void* SDLCALL countingMalloc( size_t size ) {
+    ++allocCount;
+    allocBytes += size;
+    return sdlMalloc( size );
+}
+
+static void* SDLCALL countingCalloc( size_t n, size_t size ) {
+    ++allocCount;
+    allocBytes += n * size;
+    return sdlCalloc( n, size );
+}
+
+static void* SDLCALL countingRealloc( void *mem, size_t size ) {
+    ++allocCount;
+    allocBytes += size;
+    return sdlRealloc( mem, size );
+}
+#endif
+
+/**
+ * Log an SDL error with some error message to the output stream of our choice
+ * @param os The output stream to write the message to
+ * @param msg The error message to write, format will be msg error: SDL_GetError()
+ */
+void logSDLError( ostream &os, const string &msg ) {
+    os << msg << " error: " << SDL_GetError() << endl;
+}
+
+/*
+ * A scene draws some number of sprites per frame, either directly or through a batch
+ */
+class Scene {
+public:
+    virtual ~Scene() {}
+    virtual const char* name() const = 0;
+    virtual void setup( int count ) = 0;
+    /**
+     * Draw a frame
+     * @param batch The batch to queue on, or nullptr to draw directly
+     * @return the number of draw calls made
+     */
+    virtual size_t frame( SDL_Renderer *ren, SpriteBatch *batch, int frame ) = 0;
+};
+
+/**
+ * Create a solid colored texture to use as a tile
+ * @param ren The renderer to create the texture on
+ * @param size The width and height of the texture
+ * @param seed Used to pick the color so each texture is distinguishable
+ */
+SDL_Texture* createTileTexture( SDL_Renderer *ren, int size, int seed ) {
+    SurfacePtr surf( SDL_CreateRGBSurfaceWithFormat( 0, size, size, 32, SDL_PIXELFORMAT_ARGB8888 ) );
+    if ( surf == nullptr ) {
+        return nullptr;
+    }
+    SDL_FillRect( surf.get(), NULL, SDL_MapRGBA( surf->format, 40 * seed % 256, 90, 255 - 30 * seed % 256, 255 ) );
+    return SDL_CreateTextureFromSurface( ren, surf.get() );
+}
+
+/**
+ * Draw a texture the way the lessons' renderTexture does
+ */
+size_t drawDirect( SDL_Renderer *ren, SDL_Texture *tex, const SDL_Rect &dst, const SDL_Rect *clip ) {
+    SDL_RenderCopy( ren, tex, clip, &dst );
+    return 1;
+}
+
+/*
+ * lesson2 and lesson3: a grid of tiles, drawn at their own size or squeezed into TILE_SIZE cells.
+ * Once the screen is covered the grid wraps around and draws over itself. Given more
+ * than one texture the tiles take turns with them, so drawing in order has to switch
+ * texture on every tile and a batch has to sort them back together.
+ */
+class TileScene : public Scene {
+public:
+    TileScene( const char *sceneName, SDL_Texture *tex, bool scaled ) : label( sceneName ), textures( 1, tex ), count( 0 ) {
+        if ( scaled ) {
+            tileW = tileH = TILE_SIZE;
+        } else {
+            SDL_QueryTexture( tex, NULL, NULL, &tileW, &tileH );
+        }
+    }
+
+    TileScene( const char *sceneName, const vector<SDL_Texture*> &texs ) : label( sceneName ), textures( texs ),
+        tileW( TILE_SIZE ), tileH( TILE_SIZE ), count( 0 )
+    {}
+
+    const char* name() const {
+        return label;
+    }
+
+    void setup( int n ) {
+        count = n;
+    }
+
+    size_t frame( SDL_Renderer *ren, SpriteBatch *batch, int ) {
+        const int cols = SDL_max( SCREEN_WIDTH / tileW, 1 );
+        const int rows = SDL_max( SCREEN_HEIGHT / tileH, 1 );
+        size_t calls = 0;
+        for ( int i = 0; i < count; ++i ) {
+            SDL_Texture *texture = textures[i % textures.size()];
+            SDL_Rect dst = { i % cols * tileW, i / cols % rows * tileH, tileW, tileH };
+            if ( batch != nullptr ) {
+                batch->draw( texture, dst );
+            } else {
+                SDL_QueryTexture( texture, NULL, NULL, NULL, NULL );
+                calls += drawDirect( ren, texture, dst, nullptr );
+            }
+        }
+        return calls;
+    }
+
+private:
+    const char *label;
+    vector<SDL_Texture*> textures;
+    int tileW, tileH;
+    int count;
+};
+
+/*
+ * lesson4 and lesson5: sprites bouncing around the screen, optionally cycling through
+ * the clips of a sprite sheet. Movement and culling run over a SpriteStore and the
+ * clips are played by an Animator, with an instance for each sprite.
+ */
+class SpriteScene : public Scene {
+public:
+    SpriteScene( const char *sceneName, SDL_Texture *tex, const vector<SDL_Rect> &sheetClips )
+        : label( sceneName ), texture( tex ), clips( sheetClips ), animator( animations )
+    {
+        // Every sprite plays the sheet in a loop, moving on a frame every 8 frames
+        animations.addClip( "cycle", ANIMATION_LOOP, clips, 8 / 60.0f );
+        if ( clips.empty() ) {
+            SDL_QueryTexture( tex, NULL, NULL, &spriteW, &spriteH );
+            spriteW = SDL_min( spriteW, SPRITE_SIZE );
+            spriteH = SDL_min( spriteH, SPRITE_SIZE );
+        } else {
+            spriteW = clips[0].w;
+            spriteH = clips[0].h;
+        }
+    }
+
+    const char* name() const {
+        return label;
+    }
+
+    void setup( int n ) {
+        sprites.clear();
+        animator.clear();
+        srand( 1 );
+        for ( int i = 0; i < n; ++i ) {
+            const float x = static_cast<float>( rand() % ( SCREEN_WIDTH - spriteW ) );
+            const float y = static_cast<float>( rand() % ( SCREEN_HEIGHT - spriteH ) );
+            const Uint16 clip = clips.empty() ? 0 : static_cast<Uint16>( i % clips.size() );
+            SpriteHandle sprite = sprites.create( x, y, static_cast<float>( spriteW ), static_cast<float>( spriteH ),
+                    0, clip );
+            sprites.setVelocity( sprite, static_cast<float>( rand() % 7 - 3 ), static_cast<float>( rand() % 7 - 3 ) );
+            if ( !clips.empty() ) {
+                animator.add( 0, clip * 8 / 60.0f );
+            }
+        }
+    }
+
+    size_t frame( SDL_Renderer *ren, SpriteBatch *batch, int ) {
+        const SDL_Rect screen = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+        sprites.integrate( 1 );
+        animator.advance( 1 / 60.0f );
+        sprites.bounce( screen );
+        const vector<Uint32> &visible = sprites.cull( screen );
+
+        const float *x = sprites.x(), *y = sprites.y();
+        size_t calls = 0;
+        for ( size_t v = 0; v < visible.size(); ++v ) {
+            const Uint32 i = visible[v];
+            SDL_Rect dst = { static_cast<int>( x[i] ), static_cast<int>( y[i] ), spriteW, spriteH };
+            const SDL_Rect *src = clips.empty() ? nullptr : &animator.rect( i );
+            if ( batch != nullptr ) {
+                batch->draw( texture, dst, src );
+            } else {
+                calls += drawDirect( ren, texture, dst, src );
+            }
+        }
+        return calls;
+    }
+
+private:
+    const char *label;
+    SDL_Texture *texture;
+    vector<SDL_Rect> clips;
+    int spriteW, spriteH;
+    SpriteStore sprites;
+    AnimationSet animations;
+    Animator animator;
+};
+
+/*
+ * A world much larger than the screen with a camera panning across it. Only the
+ * sprites the spatial grid finds under the camera are drawn, so the cost per frame
+ * should track what's on screen rather than the sprite count. One in WORLD_MOVERS
+ * sprites wanders around each frame to keep the grid updating.
+ */
+class WorldScene : public Scene {
+public:
+    explicit WorldScene( SDL_Texture *tex ) : texture( tex ), worldSize( 0 ) {}
+
+    const char* name() const {
+        return "world";
+    }
+
+    void setup( int n ) {
+        // Keep the density constant so a screen holds about the same number of sprites at any count
+        worldSize = static_cast<int>( SDL_sqrt( static_cast<double>( n ) ) * WORLD_SPACING ) + SCREEN_WIDTH;
+        grid.clear();
+        rects.resize( n );
+        srand( 1 );
+        for ( int i = 0; i < n; ++i ) {
+            SDL_Rect r = { rand() % worldSize, rand() % worldSize, TILE_SIZE, TILE_SIZE };
+            rects[i] = r;
+            grid.insert( static_cast<SpatialGrid::Id>( i ), r );
+        }
+    }
+
+    size_t frame( SDL_Renderer *ren, SpriteBatch *batch, int frame ) {
+        for ( size_t i = frame % WORLD_MOVERS; i < rects.size(); i += WORLD_MOVERS ) {
+            rects[i].x = ( rects[i].x + rand() % 9 - 4 + worldSize ) % worldSize;
+            rects[i].y = ( rects[i].y + rand() % 9 - 4 + worldSize ) % worldSize;
+            grid.move( static_cast<SpatialGrid::Id>( i ), rects[i] );
+        }
+
+        const int range = worldSize - SCREEN_WIDTH;
+        const SDL_Rect camera = { frame * 7 % range, frame * 5 % range, SCREEN_WIDTH, SCREEN_HEIGHT };
+        visible.clear();
+        grid.query( camera, visible );
+
+        size_t calls = 0;
+        for ( size_t v = 0; v < visible.size(); ++v ) {
+            const SDL_Rect &r = rects[visible[v]];
+            SDL_Rect dst = { r.x - camera.x, r.y - camera.y, r.w, r.h };
+            if ( batch != nullptr ) {
+                batch->draw( texture, dst );
+            } else {
+                calls += drawDirect( ren, texture, dst, nullptr );
+            }
+        }
+        return calls;
+    }
+
+private:
+    SDL_Texture *texture;
+    int worldSize;
+    SpatialGrid grid;
+    vector<SDL_Rect> rects;
+    vector<SpatialGrid::Id> visible;
+};
+
+/*
+ * lesson2 and lesson3's backgrounds as a scrolling tilemap of count tiles, using
+ * the cells of lesson5's sheet as the tileset. "direct" draws each visible tile
+ * with its own copy, "batch" draws the chunk textures of a TileMapRenderer. A tile
+ * changes every few frames so chunks get re-rendered too.
+ */
+class TileMapScene : public Scene {
+public:
+    TileMapScene( SDL_Renderer *ren, SDL_Texture *sheet ) : renderer( ren ), texture( sheet ) {}
+
+    const char* name() const {
+        return "tilemap";
+    }
+
+    void setup( int n ) {
+        const int side = SDL_max( static_cast<int>( SDL_sqrt( static_cast<double>( n ) ) ), 1 );
+        map.resize( side, side );
+        srand( 1 );
+        for ( int i = 0; i < side * side; ++i ) {
+            map.data()[i] = static_cast<Uint16>( rand() % 4 );
+        }
+        const TileSet tileSet = { texture, SPRITE_SIZE, SPRITE_SIZE };
+        chunks.reset( new TileMapRenderer( renderer, map, tileSet, TILE_SIZE, TILE_SIZE ) );
+    }
+
+    size_t frame( SDL_Renderer *ren, SpriteBatch *batch, int frame ) {
+        const int worldW = map.width() * TILE_SIZE, worldH = map.height() * TILE_SIZE;
+        const int rangeX = SDL_max( worldW - SCREEN_WIDTH, 1 ), rangeY = SDL_max( worldH - SCREEN_HEIGHT, 1 );
+        const SDL_Rect camera = { frame * 7 % rangeX, frame * 5 % rangeY, SCREEN_WIDTH, SCREEN_HEIGHT };
+        if ( frame % 8 == 0 ) {
+            const int tx = ( camera.x + SCREEN_WIDTH / 2 ) / TILE_SIZE % map.width();
+            const int ty = ( camera.y + SCREEN_HEIGHT / 2 ) / TILE_SIZE % map.height();
+            chunks->setTile( tx, ty, static_cast<Uint16>( ( map.at( tx, ty ) + 1 ) % 4 ) );
+        }
+
+        if ( batch != nullptr ) {
+            return chunks->draw( camera );
+        }
+
+        size_t calls = 0;
+        const int tx1 = SDL_min( ( camera.x + camera.w - 1 ) / TILE_SIZE + 1, map.width() );
+        const int ty1 = SDL_min( ( camera.y + camera.h - 1 ) / TILE_SIZE + 1, map.height() );
+        for ( int ty = camera.y / TILE_SIZE; ty < ty1; ++ty ) {
+            for ( int tx = camera.x / TILE_SIZE; tx < tx1; ++tx ) {
+                const Uint16 tile = map.at( tx, ty );
+                SDL_Rect clip = { tile % 2 * SPRITE_SIZE, tile / 2 * SPRITE_SIZE, SPRITE_SIZE, SPRITE_SIZE };
+                SDL_Rect dst = { tx * TILE_SIZE - camera.x, ty * TILE_SIZE - camera.y, TILE_SIZE, TILE_SIZE };
+                calls += drawDirect( ren, texture, dst, &clip );
+            }
+        }
+        return calls;
+    }
+
+private:
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+    TileMap map;
+    unique_ptr<TileMapRenderer> chunks;
+};
+
+/*
+ * lesson6: lines of text totalling count characters, rendered to a texture per line each
+ * frame the way lesson6 used to ("direct") or from the glyph cache ("batch")
+ */
+class TextScene : public Scene {
+public:
+    TextScene( TTF_Font *ttf, GlyphCache &cache ) : font( ttf ), glyphs( cache ) {}
+
+    const char* name() const {
+        return "text";
+    }
+
+    void setup( int n ) {
+        lines.clear();
+        for ( int i = 0; i < n; i += TEXT_COLUMNS ) {
+            ostringstream line;
+            for ( int c = 0; c < TEXT_COLUMNS && i + c < n; ++c ) {
+                line << static_cast<char>( 'A' + ( i / TEXT_COLUMNS + c ) % 26 );
+            }
+            lines.push_back( line.str() );
+        }
+    }
+
+    size_t frame( SDL_Renderer *ren, SpriteBatch *batch, int ) {
+        const SDL_Color color = { 255, 255, 255, 255 };
+        const int lineSkip = TTF_FontLineSkip( font );
+        size_t calls = 0;
+        for ( size_t i = 0; i < lines.size(); ++i ) {
+            const int y = static_cast<int>( i ) * lineSkip % SCREEN_HEIGHT;
+            if ( batch != nullptr ) {
+                glyphs.drawText( *batch, font, lines[i], 0, y, color );
+                continue;
+            }
+
+            SurfacePtr surf( TTF_RenderText_Blended( font, lines[i].c_str(), color ) );
+            if ( surf == nullptr ) {
+                continue;
+            }
+            TexturePtr tex( SDL_CreateTextureFromSurface( ren, surf.get() ) );
+            if ( tex != nullptr ) {
+                const SDL_Rect dst = { 0, y, surf->w, surf->h };
+                calls += drawDirect( ren, tex.get(), dst, nullptr );
+            }
+        }
+        return calls;
+    }
+
+private:
+    TTF_Font *font;
+    GlyphCache &glyphs;
+    vector<string> lines;
+};
+
+/*
+ * A fountain of particles in the middle of the screen, spawned at the rate they die
+ * so the pool stays about full
+ */
+class Fountain {
+public:
+    Fountain() {
+        emitter.x = SCREEN_WIDTH / 2.0f;
+        emitter.y = SCREEN_HEIGHT / 2.0f;
+        emitter.angle = -1.5707963f;
+        emitter.spread = 1.2f;
+        emitter.speedMin = 40;
+        emitter.speedMax = 240;
+        emitter.lifeMin = 1;
+        emitter.lifeMax = 3;
+        const SDL_Color start = { 255, 200, 80, 255 };
+        const SDL_Color end = { 255, 40, 0, 0 };
+        emitter.startColor = start;
+        emitter.endColor = end;
+    }
+
+    /**
+     * Fill a new pool of n particles
+     * @param tex The texture to draw the particles with, nullptr if they're only rasterized
+     */
+    void setup( int n, SDL_Texture *tex ) {
+        pool.reset( new ParticlePool( n, tex, nullptr, PARTICLE_SIZE ) );
+        pool->setGravity( 0, 120 );
+        // Run for the longest lifetime first so the particles' ages are spread out like a running fountain's
+        emitter.rate = n / ( ( emitter.lifeMin + emitter.lifeMax ) / 2 );
+        emitter.carry = 0;
+        for ( int f = 0; f < static_cast<int>( emitter.lifeMax * 60 ); ++f ) {
+            pool->emit( emitter, 1 / 60.0f );
+            pool->update( 1 / 60.0f );
+        }
+    }
+
+    // Run the simulation for a frame
+    ParticlePool& step() {
+        pool->emit( emitter, 1 / 60.0f );
+        pool->update( 1 / 60.0f );
+        return *pool;
+    }
+
+private:
+    ParticleEmitter emitter;
+    unique_ptr<ParticlePool> pool;
+};
+
+/*
+ * A fountain of count particles. The simulation runs every frame in both modes,
+ * only the submission differs.
+ */
+class ParticleScene : public Scene {
+public:
+    explicit ParticleScene( SDL_Texture *tex ) : texture( tex ) {}
+
+    const char* name() const {
+        return "particles";
+    }
+
+    void setup( int n ) {
+        fountain.setup( n, texture );
+    }
+
+    size_t frame( SDL_Renderer *ren, SpriteBatch *batch, int ) {
+        ParticlePool &pool = fountain.step();
+        pool.setSubmitMode( batch != nullptr ? batch->submitMode() : SpriteBatch::SUBMIT_COPY );
+        return pool.draw( ren );
+    }
+
+private:
+    SDL_Texture *texture;
+    Fountain fountain;
+};
+
+/*
+ * A scene drawn by queueing on a SoftRasterizer
+ */
+class RasterScene {
+public:
+    virtual ~RasterScene() {}
+    virtual const char* name() const = 0;
+    virtual void setup( int count ) = 0;
+    virtual void frame( SoftRasterizer &raster, int frame ) = 0;
+};
+
+/*
+ * The tiles, scaled_tiles, moving_sprite and sheet_clips scenes drawn with a
+ * SoftRasterizer, laid out the same as TileScene and SpriteScene
+ */
+class SpriteRasterScene : public RasterScene {
+public:
+    SpriteRasterScene( const char *sceneName, const SoftImage &img, int drawW, int drawH, const vector<SDL_Rect> &sheetClips,
+            bool moving )
+        : label( sceneName ), image( img ), spriteW( drawW ), spriteH( drawH ), clips( sheetClips ), move( moving )
+    {}
+
+    const char* name() const {
+        return label;
+    }
+
+    void setup( int n ) {
+        sprites.clear();
+        srand( 1 );
+        const int cols = SDL_max( SCREEN_WIDTH / spriteW, 1 ), rows = SDL_max( SCREEN_HEIGHT / spriteH, 1 );
+        for ( int i = 0; i < n; ++i ) {
+            float x = static_cast<float>( i % cols * spriteW ), y = static_cast<float>( i / cols % rows * spriteH );
+            if ( move ) {
+                x = static_cast<float>( rand() % ( SCREEN_WIDTH - spriteW ) );
+                y = static_cast<float>( rand() % ( SCREEN_HEIGHT - spriteH ) );
+            }
+            const Uint16 clip = clips.empty() ? 0 : static_cast<Uint16>( i % clips.size() );
+            SpriteHandle sprite = sprites.create( x, y, static_cast<float>( spriteW ), static_cast<float>( spriteH ),
+                    0, clip );
+            if ( move ) {
+                sprites.setVelocity( sprite, static_cast<float>( rand() % 7 - 3 ), static_cast<float>( rand() % 7 - 3 ) );
+            }
+        }
+    }
+
+    void frame( SoftRasterizer &raster, int frame ) {
+        const SDL_Rect screen = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+        if ( move ) {
+            sprites.integrate( 1 );
+            sprites.bounce( screen );
+        }
+        const vector<Uint32> &visible = sprites.cull( screen );
+        const float *x = sprites.x(), *y = sprites.y();
+        const Uint16 *clip = sprites.clip();
+        for ( size_t v = 0; v < visible.size(); ++v ) {
+            const Uint32 i = visible[v];
+            SDL_Rect dst = { static_cast<int>( x[i] ), static_cast<int>( y[i] ), spriteW, spriteH };
+            raster.draw( image, dst, clips.empty() ? nullptr : &clips[( clip[i] + frame / 8 ) % clips.size()] );
+        }
+    }
+
+private:
+    const char *label;
+    const SoftImage &image;
+    int spriteW, spriteH;
+    vector<SDL_Rect> clips;
+    bool move;
+    SpriteStore sprites;
+};
+
+/*
+ * The particles scene drawn with a SoftRasterizer, the way to draw lots of particles
+ * without a GPU
+ */
+class ParticleRasterScene : public RasterScene {
+public:
+    explicit ParticleRasterScene( const SoftImage &img ) : image( img ) {}
+
+    const char* name() const {
+        return "particles";
+    }
+
+    void setup( int n ) {
+        fountain.setup( n, nullptr );
+    }
+
+    void frame( SoftRasterizer &raster, int ) {
+        fountain.step().draw( raster, &image );
+    }
+
+private:
+    const SoftImage &image;
+    Fountain fountain;
+};
+
+/**
+ * Run a raster scene at some size on some number of threads and print the results as a line of JSON
+ */
+void runRaster( RasterScene &scene, int count, size_t threads, int frames ) {
+    SoftRasterizer raster( SCREEN_WIDTH, SCREEN_HEIGHT, threads );
+    const SDL_Color black = { 0, 0, 0, 255 };
+    scene.setup( count );
+
+    raster.clear( black );
+    scene.frame( raster, 0 );
+    raster.flush();
+
+    size_t draws = 0;
+    const size_t allocsBefore = allocCount, bytesBefore = allocBytes;
+    const Uint64 start = SDL_GetPerformanceCounter();
+    for ( int f = 1; f <= frames; ++f ) {
+        raster.clear( black );
+        scene.frame( raster, f );
+        draws += raster.flush();
+    }
+    const double secs = static_cast<double>( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+    const size_t allocs = allocCount - allocsBefore, bytes = allocBytes - bytesBefore;
+
+    printf( "{\"scene\":\"%s\",\"mode\":\"%s\",\"renderer\":\"raster\",\"threads\":%u,\"sprites\":%d,"
+            "\"frames\":%d,\"fps\":%.2f,\"ms_per_frame\":%.4f,\"draw_calls_per_frame\":%.1f,"
+            "\"ns_per_sprite\":%.2f,\"allocs_per_frame\":%.2f,\"alloc_bytes_per_frame\":%.1f}\n",
+            scene.name(), threads == 1 ? "serial" : "parallel", static_cast<unsigned>( raster.threadCount() ), count,
+            frames, frames / secs, secs * 1000.0 / frames, static_cast<double>( draws ) / frames,
+            count ? secs * 1e9 / ( static_cast<double>( count ) * frames ) : 0.0,
+            static_cast<double>( allocs ) / frames, static_cast<double>( bytes ) / frames );
+    fflush( stdout );
+}
+
+/**
+ * Load an image from a file into a SoftImage
+ */
+bool loadSoftImage( const string &file, SoftImage &image ) {
+    SurfacePtr surf( IMG_Load( file.c_str() ) );
+    return surf != nullptr && image.load( surf.get() );
+}
+
+/**
+ * Run the scenes that have raster versions through SoftRasterizer
+ * @return the exit status
+ */
+int runRasterScenes( const string &res, const vector<int> &counts, const string &only, int frames ) {
+    SoftImage tile, scaledTile, sprite, sheet;
+    if ( !loadSoftImage( res + "lesson2/background.bmp", tile ) || !loadSoftImage( res + "lesson3/background.png", scaledTile )
+            || !loadSoftImage( res + "lesson4/image.png", sprite ) || !loadSoftImage( res + "lesson5/image.png", sheet ) )
+    {
+        logSDLError( cerr, "Loading bench assets from " + res );
+        return 1;
+    }
+
+    vector<SDL_Rect> sheetClips;
+    for ( int i = 0; i < 4; ++i ) {
+        SDL_Rect clip = { i % 2 * SPRITE_SIZE, i / 2 * SPRITE_SIZE, SPRITE_SIZE, SPRITE_SIZE };
+        sheetClips.push_back( clip );
+    }
+    SpriteRasterScene tiles( "tiles", tile, tile.w(), tile.h(), vector<SDL_Rect>(), false );
+    SpriteRasterScene scaled( "scaled_tiles", scaledTile, TILE_SIZE, TILE_SIZE, vector<SDL_Rect>(), false );
+    SpriteRasterScene moving( "moving_sprite", sprite, SDL_min( sprite.w(), SPRITE_SIZE ),
+            SDL_min( sprite.h(), SPRITE_SIZE ), vector<SDL_Rect>(), true );
+    SpriteRasterScene clips( "sheet_clips", sheet, SPRITE_SIZE, SPRITE_SIZE, sheetClips, true );
+    ParticleRasterScene particles( sprite );
+    RasterScene *scenes[] = { &tiles, &scaled, &moving, &clips, &particles };
+
+    for ( size_t s = 0; s < sizeof( scenes ) / sizeof( scenes[0] ); ++s ) {
+        if ( !only.empty() && only != scenes[s]->name() ) {
+            continue;
+        }
+        for ( size_t c = 0; c < counts.size(); ++c ) {
+            runRaster( *scenes[s], counts[c], 1, frames );
+            runRaster( *scenes[s], counts[c], 0, frames );
+        }
+    }
+    return 0;
+}
+
+/**
+ * Run a scene at some size in one mode and print the results as a line of JSON
+ * @param copy Have the batch submit with SDL_RenderCopy even if it could use geometry
+ */
+void runScene( SDL_Renderer *ren, Scene &scene, int count, bool batched, bool copy, int frames, bool target ) {
+    SpriteBatch batch( ren );
+    if ( copy ) {
+        batch.setSubmitMode( SpriteBatch::SUBMIT_COPY );
+    }
+    scene.setup( count );
+
+    // One frame to warm up caches (glyphs, batch buffers) before we start counting
+    SDL_RenderClear( ren );
+    scene.frame( ren, batched ? &batch : nullptr, 0 );
+    batch.flush();
+    SDL_RenderPresent( ren );
+
+    size_t drawCalls = 0;
+    const size_t allocsBefore = allocCount, bytesBefore = allocBytes;
+    const Uint64 start = SDL_GetPerformanceCounter();
+    for ( int f = 1; f <= frames; ++f ) {
+        SDL_RenderClear( ren );
+        drawCalls += scene.frame( ren, batched ? &batch : nullptr, f );
+        drawCalls += batch.flush();
+        SDL_RenderPresent( ren );
+    }
+    const double secs = static_cast<double>( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+    const size_t allocs = allocCount - allocsBefore, bytes = allocBytes - bytesBefore;
+
+    printf( "{\"scene\":\"%s\",\"mode\":\"%s\",\"renderer\":\"%s\",\"sprites\":%d,\"frames\":%d,"
+            "\"fps\":%.2f,\"ms_per_frame\":%.4f,\"draw_calls_per_frame\":%.1f,\"ns_per_draw_call\":%.1f,"
+            "\"ns_per_sprite\":%.2f,\"allocs_per_frame\":%.2f,\"alloc_bytes_per_frame\":%.1f}\n",
+            scene.name(), batched ? ( copy ? "batch_copy" : "batch" ) : "direct", target ? "target" : "software", count, frames,
+            frames / secs, secs * 1000.0 / frames, static_cast<double>( drawCalls ) / frames,
+            drawCalls ? secs * 1e9 / drawCalls : 0.0, count ? secs * 1e9 / ( static_cast<double>( count ) * frames ) : 0.0,
+            static_cast<double>( allocs ) / frames, static_cast<double>( bytes ) / frames );
+    fflush( stdout );
+}
+
+/**
+ * Parse a comma separated list of sprite counts
+ */
+vector<int> parseCounts( const string &list ) {
+    vector<int> counts;
+    istringstream in( list );
+    string item;
+    while ( getline( in, item, ',' ) ) {
+        const int n = atoi( item.c_str() );
+        if ( n > 0 ) {
+            counts.push_back( n );
+        }
+    }
+    return counts;
+}
+
+int main( int argc, char **argv ) {
+    int frames = 60;
+    vector<int> counts = parseCounts( "1000,10000,100000" );
+    string only, resDir;
+    bool target = false, raster = false, copy = false;
+    for ( int i = 1; i < argc; ++i ) {
+        const string arg = argv[i];
+        if ( arg == "--frames" && i + 1 < argc ) {
+            frames = atoi( argv[++i] );
+        } else if ( arg == "--sprites" && i + 1 < argc ) {
+            counts = parseCounts( argv[++i] );
+        } else if ( arg == "--scene" && i + 1 < argc ) {
+            only = argv[++i];
+        } else if ( arg == "--res" && i + 1 < argc ) {
+            resDir = string( argv[++i] ) + "/";
+        } else if ( arg == "--target" ) {
+            target = true;
+        } else if ( arg == "--raster" ) {
+            raster = true;
+        } else if ( arg == "--copy" ) {
+            copy = true;
+        } else {
+            cerr << "usage: " << argv[0] << " [--frames N] [--sprites N,N,...] [--scene name] [--target] [--raster] [--copy] [--res dir]" << endl;
+            return 1;
+        }
+    }
+    if ( frames <= 0 || counts.empty() ) {
+        cerr << "Need a positive frame count and at least one sprite count" << endl;
+        return 1;
+    }
+
+#if SDL_VERSION_ATLEAST(2, 0, 7)
+    SDL_GetMemoryFunctions( &sdlMalloc, &sdlCalloc, &sdlRealloc, &sdlFree );
+    SDL_SetMemoryFunctions( countingMalloc, countingCalloc, countingRealloc, sdlFree );
+#endif
+
+    if ( target ) {
+        SDL_setenv( "SDL_VIDEODRIVER", "dummy", 0 );
+    }
+    if ( SDL_Init( target ? SDL_INIT_VIDEO : 0 ) != 0 ) {
+        logSDLError( cerr, "SDL_Init" );
+        return 1;
+    }
+    ScopeExit quitSDL( SDL_Quit );
+    if ( ( IMG_Init( IMG_INIT_PNG ) & IMG_INIT_PNG ) != IMG_INIT_PNG ) {
+        logSDLError( cerr, "IMG_Init" );
+        return 1;
+    }
+    ScopeExit quitIMG( IMG_Quit );
+    if ( TTF_Init() != 0 ) {
+        logSDLError( cerr, "TTF_Init" );
+        return 1;
+    }
+    ScopeExit quitTTF( TTF_Quit );
+
+    const string res = resDir.empty() ? getResourcePath() : resDir;
+    if ( raster ) {
+        return runRasterScenes( res, counts, only, frames );
+    }
+
+    // Declared so the target texture goes before the renderer, and the renderer
+    // before the window or surface it draws to
+    WindowPtr win;
+    SurfacePtr screen;
+    RendererPtr ren;
+    TexturePtr targetTex;
+    if ( target ) {
+        win.reset( SDL_CreateWindow( "render_bench", 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_HIDDEN ) );
+        if ( win != nullptr ) {
+            ren.reset( SDL_CreateRenderer( win.get(), -1, SDL_RENDERER_TARGETTEXTURE ) );
+        }
+        if ( ren != nullptr ) {
+            targetTex.reset( SDL_CreateTexture( ren.get(), SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                    SCREEN_WIDTH, SCREEN_HEIGHT ) );
+        }
+        if ( targetTex == nullptr || SDL_SetRenderTarget( ren.get(), targetTex.get() ) != 0 ) {
+            logSDLError( cerr, "Creating render target" );
+            return 1;
+        }
+    } else {
+        screen.reset( SDL_CreateRGBSurfaceWithFormat( 0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888 ) );
+        if ( screen != nullptr ) {
+            ren.reset( SDL_CreateSoftwareRenderer( screen.get() ) );
+        }
+        if ( ren == nullptr ) {
+            logSDLError( cerr, "SDL_CreateSoftwareRenderer" );
+            return 1;
+        }
+    }
+
+    TextureCache textures( ren.get(), 0, []( SDL_Renderer *r, const string &file ) {
+        return IMG_LoadTexture( r, file.c_str() );
+    });
+    TextureHandle tile = textures.get( res + "lesson2/background.bmp" );
+    TextureHandle scaledTile = textures.get( res + "lesson3/background.png" );
+    // lesson3's background again, for drawing scaled_tiles from the closest mip level
+    MipChain scaledMips;
+    SurfacePtr scaledSource( IMG_Load( ( res + "lesson3/background.png" ).c_str() ) );
+    if ( scaledSource != nullptr ) {
+        scaledMips.build( ren.get(), scaledSource.get() );
+    }
+    TextureHandle sprite = textures.get( res + "lesson4/image.png" );
+    TextureHandle sheet = textures.get( res + "lesson5/image.png" );
+    FontPtr font( TTF_OpenFont( ( res + "lesson6/sample.ttf" ).c_str(), 16 ) );
+    vector<TexturePtr> mixedTiles;
+    for ( size_t i = 0; i < MIXED_TEXTURES; ++i ) {
+        TexturePtr tex( createTileTexture( ren.get(), TILE_SIZE, static_cast<int>( i ) ) );
+        if ( tex == nullptr ) {
+            break;
+        }
+        mixedTiles.push_back( std::move( tex ) );
+    }
+
+    int status = 0;
+    if ( !tile || !scaledTile || scaledMips.levels() == 0 || !sprite || !sheet || font == nullptr
+            || mixedTiles.size() != MIXED_TEXTURES )
+    {
+        logSDLError( cerr, "Loading bench assets from " + res );
+        status = 1;
+    } else {
+        // lesson5's sheet is a 2x2 grid of 100x100 sprites
+        vector<SDL_Rect> sheetClips;
+        for ( int i = 0; i < 4; ++i ) {
+            SDL_Rect clip = { i % 2 * SPRITE_SIZE, i / 2 * SPRITE_SIZE, SPRITE_SIZE, SPRITE_SIZE };
+            sheetClips.push_back( clip );
+        }
+
+        GlyphCache glyphs( ren.get() );
+        TileScene tiles( "tiles", tile.get(), false );
+        TileScene scaled( "scaled_tiles", scaledTile.get(), true );
+        TileScene mipped( "mip_tiles", scaledMips.texture( scaledMips.pick( TILE_SIZE, TILE_SIZE ) ), true );
+        vector<SDL_Texture*> mixedTextures;
+        for ( size_t i = 0; i < mixedTiles.size(); ++i ) {
+            mixedTextures.push_back( mixedTiles[i].get() );
+        }
+        TileScene mixed( "mixed_tiles", mixedTextures );
+        SpriteScene moving( "moving_sprite", sprite.get(), vector<SDL_Rect>() );
+        SpriteScene clips( "sheet_clips", sheet.get(), sheetClips );
+        WorldScene world( scaledTile.get() );
+        TileMapScene tilemap( ren.get(), sheet.get() );
+        TextScene text( font.get(), glyphs );
+        ParticleScene particles( sprite.get() );
+        Scene *scenes[] = { &tiles, &scaled, &mipped, &mixed, &tilemap, &moving, &clips, &world, &text, &particles };
+
+        for ( size_t s = 0; s < sizeof( scenes ) / sizeof( scenes[0] ); ++s ) {
+            if ( !only.empty() && only != scenes[s]->name() ) {
+                continue;
+            }
+            for ( size_t c = 0; c < counts.size(); ++c ) {
+                runScene( ren.get(), *scenes[s], counts[c], false, false, frames, target );
+                runScene( ren.get(), *scenes[s], counts[c], true, copy, frames, target );
+            }
+        }
+    }
+    return status;
+}
@@ -0,0 +1,420 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+
+#include "atlas.h"
+#include "simd.h"
+#include "sprite_store.h"
+
+/*
+ * Animation files hold named clips, each a run of frames cut from a sprite sheet.
+ * Everything is little endian:
+ *
+ * char[4] magic "ANIM"
+ * u16 version
+ * u16 clip count (at least 1)
+ * u32 frame count
+ * clips:  u16 name length, name bytes, u16 loop mode, u32 first frame, u32 frame count
+ * frames: u16 x, u16 y, u16 w, u16 h, u16 duration in milliseconds (at least 1)
+ *
+ * Frame rects are relative to the sheet they're cut from, eg. an atlas sprite's clip.
+ */
+const Uint16 ANIMATION_VERSION = 1;
+
+enum AnimationLoop {
+    // Start over from the first frame after the last
+    ANIMATION_LOOP = 0,
+    // Stop on the last frame
+    ANIMATION_ONCE = 1,
+    // Run back and forth between the first and last frames
+    ANIMATION_PING_PONG = 2
+};
+
+struct AnimationSet {
+    struct Frame {
+        SDL_Rect rect;
+        // In seconds
+        float duration;
+    };
+
+    struct Clip {
+        std::string name;
+        AnimationLoop loop;
+        Uint32 first, count;
+        // The sum of the frame durations
+        float length;
+    };
+
+    std::vector<Clip> clips;
+    std::vector<Frame> frames;
+
+    /**
+     * Find a clip by name
+     * @return the clip's index, or -1 if there's no such clip
+     */
+    int find( const std::string &name ) const {
+        for ( size_t i = 0; i < clips.size(); ++i ) {
+            if ( clips[i].name == name ) {
+                return static_cast<int>( i );
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * Add a clip of frames all the same length, for building sets in code
+     * @return the clip's index
+     */
+    Uint16 addClip( const std::string &name, AnimationLoop loop, const std::vector<SDL_Rect> &rects, float frameDuration ) {
+        Clip c = { name, loop, static_cast<Uint32>( frames.size() ), static_cast<Uint32>( rects.size() ),
+            frameDuration * rects.size() };
+        for ( size_t i = 0; i < rects.size(); ++i ) {
+            Frame f = { rects[i], frameDuration };
+            frames.push_back( f );
+        }
+        clips.push_back( c );
+        return static_cast<Uint16>( clips.size() - 1 );
+    }
+};
+
+/**
+ * Write an animation set to a file, durations are rounded to whole milliseconds
+ * @return false if the file couldn't be written, the error is in SDL_GetError
+ */
+inline bool writeAnimationSet( const std::string &file, const AnimationSet &set ) {
+    std::vector<Uint8> out;
+    const char magic[] = { 'A', 'N', 'I', 'M' };
+    out.insert( out.end(), magic, magic + 4 );
+    atlas_detail::put16( out, ANIMATION_VERSION );
+    atlas_detail::put16( out, static_cast<Uint16>( set.clips.size() ) );
+    atlas_detail::put32( out, static_cast<Uint32>( set.frames.size() ) );
+
+    for ( size_t i = 0; i < set.clips.size(); ++i ) {
+        const AnimationSet::Clip &c = set.clips[i];
+        atlas_detail::putString( out, c.name );
+        atlas_detail::put16( out, static_cast<Uint16>( c.loop ) );
+        atlas_detail::put32( out, c.first );
+        atlas_detail::put32( out, c.count );
+    }
+    for ( size_t i = 0; i < set.frames.size(); ++i ) {
+        const AnimationSet::Frame &f = set.frames[i];
+        atlas_detail::put16( out, static_cast<Uint16>( f.rect.x ) );
+        atlas_detail::put16( out, static_cast<Uint16>( f.rect.y ) );
+        atlas_detail::put16( out, static_cast<Uint16>( f.rect.w ) );
+        atlas_detail::put16( out, static_cast<Uint16>( f.rect.h ) );
+        atlas_detail::put16( out, static_cast<Uint16>( SDL_max( static_cast<int>( f.duration * 1000 + 0.5f ), 1 ) ) );
+    }
+
+    SDL_RWops *rw = SDL_RWFromFile( file.c_str(), "wb" );
+    if ( rw == nullptr ) {
+        return false;
+    }
+    const bool ok = SDL_RWwrite( rw, out.data(), 1, out.size() ) == out.size();
+    SDL_RWclose( rw );
+    return ok;
+}
+
+/**
+ * Parse an animation set from memory
+ * @return false if the data isn't a valid animation file, the error is in SDL_GetError
+ */
+inline bool parseAnimationSet( const void *data, size_t size, AnimationSet &set ) {
+    atlas_detail::Reader in = { static_cast<const Uint8*>( data ), size, 0 };
+    Uint16 version, clipCount;
+    Uint32 frameCount;
+    if ( size < 4 || SDL_memcmp( data, "ANIM", 4 ) != 0 ) {
+        SDL_SetError( "Not an animation file" );
+        return false;
+    }
+    in.pos = 4;
+    if ( !in.get16( version ) || !in.get16( clipCount ) || !in.get32( frameCount ) ) {
+        SDL_SetError( "Truncated animation header" );
+        return false;
+    }
+    if ( version != ANIMATION_VERSION ) {
+        SDL_SetError( "Unsupported animation version %d", version );
+        return false;
+    }
+    // Players start instances on clip 0, so a set always has one
+    if ( clipCount == 0 ) {
+        SDL_SetError( "Animation file has no clips" );
+        return false;
+    }
+
+    set.clips.resize( clipCount );
+    for ( Uint16 i = 0; i < clipCount; ++i ) {
+        AnimationSet::Clip &c = set.clips[i];
+        Uint16 loop;
+        if ( !in.getString( c.name ) || !in.get16( loop ) || !in.get32( c.first ) || !in.get32( c.count ) ) {
+            SDL_SetError( "Truncated animation clips" );
+            return false;
+        }
+        if ( loop > ANIMATION_PING_PONG || c.count == 0 || c.first > frameCount || c.count > frameCount - c.first ) {
+            SDL_SetError( "Animation clip %s is corrupt", c.name.c_str() );
+            return false;
+        }
+        c.loop = static_cast<AnimationLoop>( loop );
+    }
+
+    // Check the frames are all there before allocating for them
+    if ( size - in.pos < static_cast<size_t>( frameCount ) * 10 ) {
+        SDL_SetError( "Truncated animation frames" );
+        return false;
+    }
+    set.frames.resize( frameCount );
+    for ( Uint32 i = 0; i < frameCount; ++i ) {
+        Uint16 x, y, w, h, ms;
+        if ( !in.get16( x ) || !in.get16( y ) || !in.get16( w ) || !in.get16( h ) || !in.get16( ms ) ) {
+            SDL_SetError( "Truncated animation frames" );
+            return false;
+        }
+        if ( ms == 0 ) {
+            SDL_SetError( "Animation frame %d has no duration", static_cast<int>( i ) );
+            return false;
+        }
+        AnimationSet::Frame &f = set.frames[i];
+        f.rect.x = x;
+        f.rect.y = y;
+        f.rect.w = w;
+        f.rect.h = h;
+        f.duration = ms / 1000.0f;
+    }
+
+    for ( size_t i = 0; i < set.clips.size(); ++i ) {
+        AnimationSet::Clip &c = set.clips[i];
+        c.length = 0;
+        for ( Uint32 f = c.first; f < c.first + c.count; ++f ) {
+            c.length += set.frames[f].duration;
+        }
+    }
+    return true;
+}
+
+/**
+ * Read an animation set from some SDL_RWops
+ * @param rw The stream to read, it's always closed
+ * @return false if reading failed, the error is in SDL_GetError
+ */
+inline bool readAnimationSet( SDL_RWops *rw, AnimationSet &set ) {
+    if ( rw == nullptr ) {
+        return false;
+    }
+
+    const Sint64 size = SDL_RWsize( rw );
+    if ( size < 0 ) {
+        SDL_RWclose( rw );
+        return false;
+    }
+    std::vector<Uint8> data( static_cast<size_t>( size ) );
+    const bool read = data.empty() || SDL_RWread( rw, data.data(), data.size(), 1 ) == 1;
+    SDL_RWclose( rw );
+    if ( !read ) {
+        return false;
+    }
+    return parseAnimationSet( data.data(), data.size(), set );
+}
+
+/*
+ * Plays clips from an AnimationSet on any number of instances, eg. one per sprite.
+ * Instances are stored as a structure of arrays so advancing them all is one pass
+ * counting down the time left on each frame, 4 at a time with SSE2, and only the
+ * instances whose frame ran out get any further work:
+ *
+ * Animator animator( set );
+ * size_t walker = animator.add( set.find( "walk" ) );
+ * while ( !quit ) {
+ *     animator.advance( loop.dt() );
+ *     SDL_RenderCopy( ren, sheet, &animator.rect( walker ), &dst );
+ * }
+ *
+ * Like SpriteStore the arrays stay dense: removing an instance moves the last one
+ * into its place, so instances added alongside a SpriteStore's sprites can share
+ * their indices.
+ */
+class Animator {
+public:
+    /**
+     * @param animations The clips to play, they have to outlive the animator
+     */
+    explicit Animator( const AnimationSet &animations ) : set( animations ) {}
+
+    /**
+     * Start an instance playing a clip
+     * @param clip The clip's index in the set
+     * @param offset How far into the clip to start, in seconds, eg. to stagger a crowd
+     * @return the instance's index
+     */
+    size_t add( Uint16 clip, float offset = 0 ) {
+        clipIds.push_back( clip );
+        frameIds.push_back( 0 );
+        remaining.push_back( 0 );
+        directions.push_back( 1 );
+        const size_t i = clipIds.size() - 1;
+        play( i, clip, offset );
+        return i;
+    }
+
+    /**
+     * Remove an instance, the last instance moves into its index
+     */
+    void remove( size_t i ) {
+        const size_t last = clipIds.size() - 1;
+        clipIds[i] = clipIds[last];
+        frameIds[i] = frameIds[last];
+        remaining[i] = remaining[last];
+        directions[i] = directions[last];
+        clipIds.pop_back();
+        frameIds.pop_back();
+        remaining.pop_back();
+        directions.pop_back();
+    }
+
+    void clear() {
+        clipIds.clear();
+        frameIds.clear();
+        remaining.clear();
+        directions.clear();
+    }
+
+    void reserve( size_t n ) {
+        clipIds.reserve( n );
+        frameIds.reserve( n );
+        remaining.reserve( n );
+        directions.reserve( n );
+    }
+
+    /**
+     * Restart an instance on some clip
+     * @param offset How far into the clip to start, in seconds
+     */
+    void play( size_t i, Uint16 clip, float offset = 0 ) {
+        const AnimationSet::Clip &c = set.clips[clip];
+        clipIds[i] = clip;
+        frameIds[i] = c.first;
+        directions[i] = 1;
+        remaining[i] = set.frames[c.first].duration - offset;
+        if ( remaining[i] <= 0 ) {
+            nextFrame( i );
+        }
+    }
+
+    /**
+     * Move every instance on by some time
+     * @param dt The time that's passed, in seconds
+     */
+    void advance( float dt ) {
+        float *left = remaining.data();
+        const size_t n = remaining.size();
+        size_t i = 0;
+#if SIMD_SSE2
+        const __m128 step = _mm_set1_ps( dt ), zero = _mm_setzero_ps();
+        for ( ; i + 4 <= n; i += 4 ) {
+            const __m128 t = _mm_sub_ps( _mm_load_ps( left + i ), step );
+            _mm_store_ps( left + i, t );
+            int expired = _mm_movemask_ps( _mm_cmple_ps( t, zero ) );
+            while ( expired != 0 ) {
+                const int lane = lowestBit( expired );
+                nextFrame( i + lane );
+                expired &= expired - 1;
+            }
+        }
+#endif
+        for ( ; i < n; ++i ) {
+            left[i] -= dt;
+            if ( left[i] <= 0 ) {
+                nextFrame( i );
+            }
+        }
+    }
+
+    size_t size() const {
+        return clipIds.size();
+    }
+
+    Uint16 clip( size_t i ) const {
+        return clipIds[i];
+    }
+
+    // The index in the set of the frame an instance is showing
+    Uint32 frame( size_t i ) const {
+        return frameIds[i];
+    }
+
+    // The part of the sheet to draw for an instance
+    const SDL_Rect& rect( size_t i ) const {
+        return set.frames[frameIds[i]].rect;
+    }
+
+    // Whether a clip that plays once has reached its last frame
+    bool finished( size_t i ) const {
+        return directions[i] == 0;
+    }
+
+    // The frame every instance is showing, for passes over all of them
+    const Uint32* frames() const {
+        return frameIds.data();
+    }
+
+private:
+    Animator( const Animator& );
+    Animator& operator=( const Animator& );
+
+    static int lowestBit( int mask ) {
+        int bit = 0;
+        while ( ( mask & 1 ) == 0 ) {
+            mask >>= 1;
+            ++bit;
+        }
+        return bit;
+    }
+
+    /**
+     * Step an instance whose frame has run out on to the frame it should be showing now
+     */
+    void nextFrame( size_t i ) {
+        const AnimationSet::Clip &c = set.clips[clipIds[i]];
+        const Uint32 last = c.first + c.count - 1;
+        float t = remaining[i];
+        Uint32 f = frameIds[i];
+        // A looping clip comes back to the same frame after a whole run through it
+        if ( c.loop == ANIMATION_LOOP && -t > c.length ) {
+            t = -std::fmod( -t, c.length );
+        }
+        while ( t <= 0 ) {
+            if ( c.loop == ANIMATION_LOOP ) {
+                f = f == last ? c.first : f + 1;
+            } else if ( c.loop == ANIMATION_ONCE ) {
+                if ( f == last ) {
+                    directions[i] = 0;
+                    t = std::numeric_limits<float>::max();
+                    break;
+                }
+                ++f;
+            } else if ( c.count > 1 ) {
+                if ( ( directions[i] > 0 && f == last ) || ( directions[i] < 0 && f == c.first ) ) {
+                    directions[i] = -directions[i];
+                }
+                f = directions[i] > 0 ? f + 1 : f - 1;
+            }
+            t += set.frames[f].duration;
+        }
+        remaining[i] = t;
+        frameIds[i] = f;
+    }
+
+    const AnimationSet &set;
+    AlignedArray<Uint16> clipIds;
+    AlignedArray<Uint32> frameIds;
+    // Seconds until each instance's frame runs out
+    AlignedArray<float> remaining;
+    // 1 or -1 for the way a ping pong clip's going, 0 once a clip that plays once has finished
+    AlignedArray<Sint8> directions;
+};
+
+#endif
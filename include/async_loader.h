@@ -0,0 +1,400 @@
+#ifndef ASYNC_LOADER_H
+#define ASYNC_LOADER_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <SDL2/SDL.h>
+#include <SDL2_image/SDL_Image.h>
+#include <SDL2_ttf/SDL_TTF.h>
+
+#include "frame_arena.h"
+#include "texture_cache.h"
+#include "texture_normalizer.h"
+#include "thread_pool.h"
+
+/*
+ * A reference counted handle to a font opened by the AsyncLoader, it's closed once
+ * the last handle is released so all handles must be released before TTF_Quit.
+ */
+typedef std::shared_ptr<TTF_Font> FontHandle;
+
+/*
+ * Loads assets in the background so a window can come up and start drawing
+ * right away while its assets stream in. Images are decoded to surfaces and
+ * fonts are opened on a pool of worker threads, decoded surfaces are then turned
+ * into textures on the main thread in update(), since SDL renderers may only be
+ * used from the thread that created them. update() stops uploading once it's used
+ * up its time budget so a large batch of loads finishing at once doesn't stall a
+ * frame.
+ *
+ * Each load returns a request that can be polled. Until a texture is ready
+ * the request hands out a placeholder texture, so drawing code doesn't need to
+ * care whether loading has finished:
+ *
+ * AsyncLoader loader( ren, &textures );
+ * AsyncLoader::TextureRequest image = loader.loadTexture( file );
+ * while ( !quit ) {
+ *     loader.update();
+ *     renderTexture( image->texture(), ren, x, y );
+ * }
+ *
+ * With a TextureNormalizer set, images are also converted to the renderer's format
+ * on the workers, leaving only the copy to the texture for the main thread.
+ *
+ * Requests come from object pools, so streaming lots of small assets in and out
+ * reuses the same request memory. The pools are shared with the requests, which may
+ * be released after the loader is gone and from any thread.
+ *
+ * IMG_Init and TTF_Init must be called before any loads are started.
+ */
+class AsyncLoader {
+public:
+    typedef std::function<SDL_Surface*( const std::string& )> Decoder;
+
+    enum State {
+        // Queued or being decoded on a worker
+        LOAD_PENDING,
+        // Decoded on a worker and waiting for update to upload it
+        LOAD_DECODED,
+        LOAD_READY,
+        LOAD_FAILED
+    };
+
+    class PendingTexture {
+    public:
+        bool ready() const {
+            return state == LOAD_READY;
+        }
+
+        bool failed() const {
+            return state == LOAD_FAILED;
+        }
+
+        /**
+         * Get the texture to draw, this is the placeholder until the real texture is ready
+         * and only changes when the main thread calls update. Once the loader's been
+         * cleared a request that isn't ready has no placeholder and this is null.
+         */
+        SDL_Texture* texture() const {
+            return handle ? handle.get() : placeholder.lock().get();
+        }
+
+        // The loaded texture, empty until the load is ready
+        const TextureHandle& get() const {
+            return handle;
+        }
+
+        const std::string& file() const {
+            return path;
+        }
+
+        // Why the load failed, only valid once failed() is true
+        const std::string& error() const {
+            return message;
+        }
+
+    private:
+        friend class AsyncLoader;
+
+        std::atomic<int> state;
+        std::string path;
+        std::weak_ptr<SDL_Texture> placeholder;
+        SDL_Surface *surface;
+        TextureConversion conversion;
+        TextureHandle handle;
+        std::string message;
+    };
+
+    class PendingFont {
+    public:
+        bool ready() const {
+            return state == LOAD_READY;
+        }
+
+        bool failed() const {
+            return state == LOAD_FAILED;
+        }
+
+        // The opened font, null until the load is ready
+        FontHandle get() const {
+            return ready() ? font : FontHandle();
+        }
+
+        const std::string& error() const {
+            return message;
+        }
+
+    private:
+        friend class AsyncLoader;
+
+        std::atomic<int> state;
+        FontHandle font;
+        std::string message;
+    };
+
+    typedef std::shared_ptr<PendingTexture> TextureRequest;
+    typedef std::shared_ptr<PendingFont> FontRequest;
+
+    /**
+     * Create a loader for some renderer
+     * @param ren The renderer to upload textures to
+     * @param cache If not null, finished textures are adopted into this cache and
+     *        files it already holds are ready immediately
+     * @param threads The number of worker threads, 0 picks based on the CPU count
+     * @param decode The function used to decode an image on a worker, it should return
+     *        nullptr and leave the error in SDL_GetError if something went wrong
+     */
+    explicit AsyncLoader( SDL_Renderer *ren, TextureCache *cache = nullptr, size_t threads = 0,
+            Decoder decode = decodeImage )
+        : renderer( ren ), textures( cache ), decoder( decode ), normalizer( nullptr ),
+        placeholder( createPlaceholder( ren ) ), requests( std::make_shared<RequestPools>() ), pool( threads )
+    {}
+
+    ~AsyncLoader() {
+        clear();
+    }
+
+    /**
+     * Normalize images with some normalizer before uploading them, this only affects
+     * loads started afterwards
+     * @param norm The normalizer, made for this loader's renderer, or nullptr to upload
+     *        decoded images as they are. It has to outlive the loader.
+     */
+    void setNormalizer( TextureNormalizer *norm ) {
+        normalizer = norm;
+    }
+
+    /**
+     * Start loading an image into a texture
+     * @param file The resolved path of the image to load
+     * @return a request to poll for the texture
+     */
+    TextureRequest loadTexture( const std::string &file ) {
+        TextureRequest request = newRequest( requests->textures );
+        request->state = LOAD_PENDING;
+        request->path = file;
+        request->placeholder = placeholder;
+        request->surface = nullptr;
+
+        if ( textures != nullptr && textures->contains( file ) ) {
+            request->handle = textures->get( file );
+            request->state = LOAD_READY;
+            return request;
+        }
+
+        Decoder decode = decoder;
+        const TextureNormalizer *norm = normalizer;
+        pool.submit( [this, request, decode, norm]() {
+            request->surface = decode( request->path );
+            if ( request->surface != nullptr && norm != nullptr ) {
+                request->conversion.name = request->path;
+                SDL_Surface *normalized = norm->normalize( request->surface, request->conversion );
+                SDL_FreeSurface( request->surface );
+                request->surface = normalized;
+            }
+            if ( request->surface == nullptr ) {
+                request->message = SDL_GetError();
+                request->state = LOAD_FAILED;
+                return;
+            }
+            request->state = LOAD_DECODED;
+            std::lock_guard<std::mutex> lock( decodedMutex );
+            decoded.push_back( request );
+        });
+        return request;
+    }
+
+    /**
+     * Start opening a font, fonts don't need the main thread so they're ready as soon
+     * as the worker has opened them
+     * @param file The resolved path of the font file
+     * @param ptSize The point size to open the font at
+     * @return a request to poll for the font
+     */
+    FontRequest loadFont( const std::string &file, int ptSize ) {
+        FontRequest request = newRequest( requests->fonts );
+        request->state = LOAD_PENDING;
+        pool.submit( [request, file, ptSize]() {
+            TTF_Font *font;
+            {
+                // FreeType faces can be used from different threads, but creating them
+                // goes through SDL_ttf's single FT_Library which isn't thread safe
+                std::lock_guard<std::mutex> lock( fontMutex() );
+                font = TTF_OpenFont( file.c_str(), ptSize );
+            }
+            if ( font == nullptr ) {
+                request->message = SDL_GetError();
+                request->state = LOAD_FAILED;
+                return;
+            }
+            request->font = FontHandle( font, closeFont );
+            request->state = LOAD_READY;
+        });
+        return request;
+    }
+
+    /**
+     * Upload decoded images to textures, must be called on the main thread. At least
+     * one texture is uploaded per call so loading always makes progress.
+     * @param budgetMs The most time to spend uploading, 0 uploads everything that's ready
+     * @return the number of textures uploaded
+     */
+    size_t update( double budgetMs = 2.0 ) {
+        const Uint64 start = SDL_GetPerformanceCounter();
+        const Uint64 budgetTicks = static_cast<Uint64>( budgetMs * SDL_GetPerformanceFrequency() / 1000.0 );
+        size_t uploaded = 0;
+        for (;;) {
+            TextureRequest request;
+            {
+                std::lock_guard<std::mutex> lock( decodedMutex );
+                if ( decoded.empty() ) {
+                    break;
+                }
+                request = decoded.front();
+                decoded.pop_front();
+            }
+
+            upload( *request );
+            ++uploaded;
+            if ( budgetTicks != 0 && SDL_GetPerformanceCounter() - start >= budgetTicks ) {
+                break;
+            }
+        }
+        return uploaded;
+    }
+
+    // The number of loads that are queued, decoding or waiting to be uploaded
+    size_t pending() const {
+        std::lock_guard<std::mutex> lock( decodedMutex );
+        return pool.pending() + decoded.size();
+    }
+
+    /**
+     * Block until every queued load has been decoded, then upload them all
+     */
+    void finish() {
+        pool.wait();
+        update( 0 );
+    }
+
+    /**
+     * Cancel loads that haven't started, wait for the running ones, throw away anything
+     * not yet uploaded and destroy the placeholder. This must be done before the renderer
+     * is destroyed, requests that were cancelled stay pending forever and requests that
+     * aren't ready stop handing out the placeholder.
+     */
+    void clear() {
+        pool.cancel();
+        pool.wait();
+        std::lock_guard<std::mutex> lock( decodedMutex );
+        for ( size_t i = 0; i < decoded.size(); ++i ) {
+            SDL_FreeSurface( decoded[i]->surface );
+            decoded[i]->surface = nullptr;
+        }
+        decoded.clear();
+        placeholder.reset();
+    }
+
+    /**
+     * The default decoder, loads any image format SDL_image supports
+     */
+    static SDL_Surface* decodeImage( const std::string &file ) {
+        return IMG_Load( file.c_str() );
+    }
+
+private:
+    struct RequestPools {
+        std::mutex mutex;
+        ObjectPool<PendingTexture> textures;
+        ObjectPool<PendingFont> fonts;
+    };
+
+    AsyncLoader( const AsyncLoader& );
+    AsyncLoader& operator=( const AsyncLoader& );
+
+    /**
+     * Create a request from one of the pools, it goes back to the pool when the last
+     * handle to it is released
+     */
+    template<typename T>
+    std::shared_ptr<T> newRequest( ObjectPool<T> &from ) {
+        std::shared_ptr<RequestPools> pools = requests;
+        ObjectPool<T> *objects = &from;
+        T *request;
+        {
+            std::lock_guard<std::mutex> lock( pools->mutex );
+            request = objects->create();
+        }
+        return std::shared_ptr<T>( request, [pools, objects]( T *r ) {
+            std::lock_guard<std::mutex> lock( pools->mutex );
+            objects->destroy( r );
+        });
+    }
+
+    void upload( PendingTexture &request ) {
+        // Normalized surfaces are already in the texture format, the normalizer only has to copy them
+        SDL_Texture *tex = normalizer != nullptr && !request.conversion.name.empty()
+            ? normalizer->upload( request.surface, request.conversion )
+            : SDL_CreateTextureFromSurface( renderer, request.surface );
+        SDL_FreeSurface( request.surface );
+        request.surface = nullptr;
+        if ( tex == nullptr ) {
+            request.message = SDL_GetError();
+            request.state = LOAD_FAILED;
+            return;
+        }
+
+        request.handle = textures != nullptr ? textures->adopt( request.path, tex )
+            : TextureHandle( tex, SDL_DestroyTexture );
+        request.state = LOAD_READY;
+    }
+
+    /**
+     * Make a magenta and black checkerboard so missing art stands out
+     */
+    static TextureHandle createPlaceholder( SDL_Renderer *ren ) {
+        const int SIZE = 32, CHECK = 8;
+        SDL_Texture *tex = SDL_CreateTexture( ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, SIZE, SIZE );
+        if ( tex == nullptr ) {
+            return TextureHandle();
+        }
+
+        Uint32 pixels[SIZE * SIZE];
+        for ( int y = 0; y < SIZE; ++y ) {
+            for ( int x = 0; x < SIZE; ++x ) {
+                pixels[y * SIZE + x] = ( x / CHECK + y / CHECK ) % 2 ? 0xff000000 : 0xffff00ff;
+            }
+        }
+        SDL_UpdateTexture( tex, NULL, pixels, SIZE * 4 );
+        return TextureHandle( tex, SDL_DestroyTexture );
+    }
+
+    static std::mutex& fontMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    // Closing a font frees its face through the same FT_Library that opening it did
+    static void closeFont( TTF_Font *font ) {
+        std::lock_guard<std::mutex> lock( fontMutex() );
+        TTF_CloseFont( font );
+    }
+
+    SDL_Renderer *renderer;
+    TextureCache *textures;
+    Decoder decoder;
+    TextureNormalizer *normalizer;
+    // Requests only hold on to this weakly, so it's gone for them too once we clear it
+    TextureHandle placeholder;
+    mutable std::mutex decodedMutex;
+    std::deque<TextureRequest> decoded;
+    std::shared_ptr<RequestPools> requests;
+    // Declared last so the workers are joined before anything they use is destroyed
+    ThreadPool pool;
+};
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <SDL2/SDL.h>
+
+#include "texture_cache.h"
+
+/*
+ * The atlas index written by atlas_builder and read by TextureAtlas.
+ * Everything is little endian:
+ *
+ * char[4] magic "ATLS"
+ * u16 version
+ * u16 page count
+ * u32 sprite count
+ * pages:   u16 name length, name bytes (atlas image file, relative to the index)
+ * sprites: u16 name length, name bytes, u16 page, u16 x, u16 y, u16 w, u16 h
+ */
+const Uint16 ATLAS_INDEX_VERSION = 1;
+// Sprite rects are stored in 16 bits, so a page can be at most this wide and tall
+const int ATLAS_MAX_PAGE_SIZE = 65535;
+
+struct AtlasIndex {
+    struct Sprite {
+        std::string name;
+        Uint16 page;
+        SDL_Rect clip;
+    };
+
+    std::vector<std::string> pages;
+    std::vector<Sprite> sprites;
+};
+
+namespace atlas_detail {
+    inline void put16( std::vector<Uint8> &out, Uint16 v ) {
+        out.push_back( v & 0xff );
+        out.push_back( v >> 8 );
+    }
+
+    inline void put32( std::vector<Uint8> &out, Uint32 v ) {
+        put16( out, v & 0xffff );
+        put16( out, v >> 16 );
+    }
+
+    inline void putString( std::vector<Uint8> &out, const std::string &s ) {
+        put16( out, static_cast<Uint16>( s.size() ) );
+        out.insert( out.end(), s.begin(), s.end() );
+    }
+
+    // Bounds checked reading over an in memory index
+    struct Reader {
+        const Uint8 *data;
+        size_t size, pos;
+
+        bool get16( Uint16 &v ) {
+            if ( pos + 2 > size ) {
+                return false;
+            }
+            v = static_cast<Uint16>( data[pos] | data[pos + 1] << 8 );
+            pos += 2;
+            return true;
+        }
+
+        bool get32( Uint32 &v ) {
+            Uint16 lo, hi;
+            if ( !get16( lo ) || !get16( hi ) ) {
+                return false;
+            }
+            v = lo | static_cast<Uint32>( hi ) << 16;
+            return true;
+        }
+
+        bool getString( std::string &s ) {
+            Uint16 len;
+            if ( !get16( len ) || pos + len > size ) {
+                return false;
+            }
+            s.assign( reinterpret_cast<const char*>( data + pos ), len );
+            pos += len;
+            return true;
+        }
+    };
+}
+
+/**
+ * Write an atlas index to a file
+ * @return false if the file couldn't be written, the error is in SDL_GetError
+ */
+inline bool writeAtlasIndex( const std::string &file, const AtlasIndex &index ) {
+    std::vector<Uint8> out;
+    const char magic[] = { 'A', 'T', 'L', 'S' };
+    out.insert( out.end(), magic, magic + 4 );
+    atlas_detail::put16( out, ATLAS_INDEX_VERSION );
+    atlas_detail::put16( out, static_cast<Uint16>( index.pages.size() ) );
+    atlas_detail::put32( out, static_cast<Uint32>( index.sprites.size() ) );
+
+    for ( size_t i = 0; i < index.pages.size(); ++i ) {
+        atlas_detail::putString( out, index.pages[i] );
+    }
+    for ( size_t i = 0; i < index.sprites.size(); ++i ) {
+        const AtlasIndex::Sprite &s = index.sprites[i];
+        atlas_detail::putString( out, s.name );
+        atlas_detail::put16( out, s.page );
+        atlas_detail::put16( out, static_cast<Uint16>( s.clip.x ) );
+        atlas_detail::put16( out, static_cast<Uint16>( s.clip.y ) );
+        atlas_detail::put16( out, static_cast<Uint16>( s.clip.w ) );
+        atlas_detail::put16( out, static_cast<Uint16>( s.clip.h ) );
+    }
+
+    SDL_RWops *rw = SDL_RWFromFile( file.c_str(), "wb" );
+    if ( rw == nullptr ) {
+        return false;
+    }
+    const bool ok = SDL_RWwrite( rw, out.data(), 1, out.size() ) == out.size();
+    SDL_RWclose( rw );
+    return ok;
+}
+
+/**
+ * Parse an atlas index from memory
+ * @return false if the data isn't a valid index, the error is in SDL_GetError
+ */
+inline bool parseAtlasIndex( const void *data, size_t size, AtlasIndex &index ) {
+    atlas_detail::Reader in = { static_cast<const Uint8*>( data ), size, 0 };
+    Uint16 version, pageCount;
+    Uint32 spriteCount;
+    if ( size < 4 || SDL_memcmp( data, "ATLS", 4 ) != 0 ) {
+        SDL_SetError( "Not an atlas index" );
+        return false;
+    }
+    in.pos = 4;
+    if ( !in.get16( version ) || !in.get16( pageCount ) || !in.get32( spriteCount ) ) {
+        SDL_SetError( "Truncated atlas index header" );
+        return false;
+    }
+    if ( version != ATLAS_INDEX_VERSION ) {
+        SDL_SetError( "Unsupported atlas index version %d", version );
+        return false;
+    }
+
+    index.pages.resize( pageCount );
+    for ( Uint16 i = 0; i < pageCount; ++i ) {
+        if ( !in.getString( index.pages[i] ) ) {
+            SDL_SetError( "Truncated atlas index pages" );
+            return false;
+        }
+    }
+
+    // Check the sprites can all be there before allocating for them, each takes at
+    // least a name length, a page and a clip
+    if ( ( size - in.pos ) / 12 < spriteCount ) {
+        SDL_SetError( "Truncated atlas index sprites" );
+        return false;
+    }
+    index.sprites.clear();
+    index.sprites.reserve( spriteCount );
+    for ( Uint32 i = 0; i < spriteCount; ++i ) {
+        AtlasIndex::Sprite s;
+        Uint16 x, y, w, h;
+        if ( !in.getString( s.name ) || !in.get16( s.page ) || !in.get16( x ) || !in.get16( y )
+                || !in.get16( w ) || !in.get16( h ) )
+        {
+            SDL_SetError( "Truncated atlas index sprites" );
+            return false;
+        }
+        if ( s.page >= pageCount ) {
+            SDL_SetError( "Atlas sprite %s refers to missing page %d", s.name.c_str(), s.page );
+            return false;
+        }
+        s.clip.x = x;
+        s.clip.y = y;
+        s.clip.w = w;
+        s.clip.h = h;
+        index.sprites.push_back( s );
+    }
+    return true;
+}
+
+/**
+ * Read an atlas index from some SDL_RWops
+ * @param rw The stream to read, it's always closed
+ * @return false if reading failed, the error is in SDL_GetError
+ */
+inline bool readAtlasIndex( SDL_RWops *rw, AtlasIndex &index ) {
+    if ( rw == nullptr ) {
+        return false;
+    }
+
+    const Sint64 size = SDL_RWsize( rw );
+    if ( size < 0 ) {
+        SDL_RWclose( rw );
+        return false;
+    }
+    std::vector<Uint8> data( static_cast<size_t>( size ) );
+    const bool read = data.empty() || SDL_RWread( rw, data.data(), data.size(), 1 ) == 1;
+    SDL_RWclose( rw );
+    if ( !read ) {
+        return false;
+    }
+    return parseAtlasIndex( data.data(), data.size(), index );
+}
+
+/*
+ * A set of atlas pages and the named sprites packed into them. Looking up a sprite
+ * by name is a single hash lookup which gives back the page texture and clip rect
+ * to pass to SDL_RenderCopy.
+ */
+class TextureAtlas {
+public:
+    struct Sprite {
+        SDL_Texture *texture;
+        SDL_Rect clip;
+    };
+
+    /**
+     * Load an atlas index and its pages
+     * @param file The resolved path of the index file
+     * @param textures The cache to load the page textures through
+     * @return false if the index or any page failed to load, the error is in SDL_GetError
+     */
+    bool load( const std::string &file, TextureCache &textures ) {
+        AtlasIndex index;
+        if ( !readAtlasIndex( SDL_RWFromFile( file.c_str(), "rb" ), index ) ) {
+            return false;
+        }
+
+        // Pages are stored relative to the index
+        const size_t sep = file.find_last_of( "/\\" );
+        const std::string dir = sep == std::string::npos ? "" : file.substr( 0, sep + 1 );
+
+        clear();
+        for ( size_t i = 0; i < index.pages.size(); ++i ) {
+            TextureHandle page = textures.get( dir + index.pages[i] );
+            if ( page == nullptr ) {
+                clear();
+                return false;
+            }
+            pages.push_back( page );
+        }
+
+        sprites.reserve( index.sprites.size() );
+        for ( size_t i = 0; i < index.sprites.size(); ++i ) {
+            Sprite s = { pages[index.sprites[i].page].get(), index.sprites[i].clip };
+            sprites[index.sprites[i].name] = s;
+        }
+        return true;
+    }
+
+    /**
+     * Look up a sprite by name
+     * @return the sprite, or nullptr if there's no sprite with that name
+     */
+    const Sprite* find( const std::string &name ) const {
+        auto found = sprites.find( name );
+        return found == sprites.end() ? nullptr : &found->second;
+    }
+
+    /**
+     * Release the atlas pages, this must be done before the renderer is destroyed
+     */
+    void clear() {
+        sprites.clear();
+        pages.clear();
+    }
+
+    size_t pageCount() const {
+        return pages.size();
+    }
+
+    size_t size() const {
+        return sprites.size();
+    }
+
+private:
+    std::vector<TextureHandle> pages;
+    std::unordered_map<std::string, Sprite> sprites;
+};
+
+#endif
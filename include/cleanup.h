@@ -1,45 +1,147 @@
 #ifndef CLEANUP_H
 #define CLEANUP_H
 
+#include <functional>
+#include <memory>
 #include <utility>
 #include <SDL2/SDL.h>
 
+/*
+ * Destroys SDL objects with the matching SDL function, for owning them with
+ * std::unique_ptr and std::shared_ptr. It has no state, so a unique_ptr using it
+ * is the size of a raw pointer and destroying one is a null check and the SDL call.
+ */
+struct SDLDeleter {
+    // unique_ptr only calls its deleter for non-null pointers
+    void operator()( SDL_Window *win ) const {
+        SDL_DestroyWindow( win );
+    }
+
+    void operator()( SDL_Renderer *ren ) const {
+        SDL_DestroyRenderer( ren );
+    }
+
+    void operator()( SDL_Texture *tex ) const {
+        SDL_DestroyTexture( tex );
+    }
+
+    void operator()( SDL_Surface *surf ) const {
+        SDL_FreeSurface( surf );
+    }
+};
+
+/*
+ * Move only handles that own an SDL object and destroy it when they go out of
+ * scope, so error paths don't have to clean up by hand:
+ *
+ * WindowPtr win( SDL_CreateWindow( ... ) );
+ * RendererPtr ren( SDL_CreateRenderer( win.get(), -1, 0 ) );
+ * if ( !ren ) {
+ *     return 1;
+ * }
+ *
+ * Objects are destroyed in the reverse of the order their handles were declared in,
+ * so declare a renderer's handle after its window's and textures' after the
+ * renderer's. A unique handle can be turned into a shared one for caches and
+ * loaders to hold on to, eg. TextureHandle shared( std::move( tex ) ), see
+ * texture_cache.h and FontHandle in async_loader.h. Fonts have FontPtr in
+ * font_cleanup.h.
+ */
+typedef std::unique_ptr<SDL_Window, SDLDeleter> WindowPtr;
+typedef std::unique_ptr<SDL_Renderer, SDLDeleter> RendererPtr;
+typedef std::unique_ptr<SDL_Texture, SDLDeleter> TexturePtr;
+typedef std::unique_ptr<SDL_Surface, SDLDeleter> SurfacePtr;
+static_assert( sizeof( TexturePtr ) == sizeof( SDL_Texture* ), "handles should be the size of a raw pointer" );
+
+/*
+ * Runs a function when it goes out of scope. Declare one right after a library's
+ * initialized so it's shut down after everything declared later has been destroyed:
+ *
+ * if ( SDL_Init( SDL_INIT_VIDEO ) != 0 ) {
+ *     return 1;
+ * }
+ * ScopeExit quitSDL( SDL_Quit );
+ */
+class ScopeExit {
+public:
+    explicit ScopeExit( std::function<void()> f ) : fn( std::move( f ) ) {}
+
+    ~ScopeExit() {
+        if ( fn ) {
+            fn();
+        }
+    }
+
+private:
+    ScopeExit( const ScopeExit& );
+    ScopeExit& operator=( const ScopeExit& );
+
+    std::function<void()> fn;
+};
+
+inline void cleanup() {}
+
+template<typename T, typename... Args>
+void cleanup( std::shared_ptr<T> &t, Args&&... args );
+
+template<typename T, typename D, typename... Args>
+void cleanup( std::unique_ptr<T, D> &t, Args&&... args );
+
 template<typename T, typename... Args>
 void cleanup( T *t, Args&&... args ) {
   cleanup( t );
   cleanup( std::forward<Args>(args)... );
 }
 
+/*
+ * Release a shared handle (eg. a TextureHandle), the object is destroyed
+ * if this was the last reference to it
+ */
+template<typename T, typename... Args>
+void cleanup( std::shared_ptr<T> &t, Args&&... args ) {
+  t.reset();
+  cleanup( std::forward<Args>(args)... );
+}
+
+/*
+ * Destroy the object a handle owns before it goes out of scope
+ */
+template<typename T, typename D, typename... Args>
+void cleanup( std::unique_ptr<T, D> &t, Args&&... args ) {
+  t.reset();
+  cleanup( std::forward<Args>(args)... );
+}
+
 template<>
-void cleanup<SDL_Window>( SDL_Window *win ) {
+inline void cleanup<SDL_Window>( SDL_Window *win ) {
   if ( !win ) {
     return;
   }
-  SDL_DestroyWindow( win );
+  SDLDeleter()( win );
 }
 
 template<>
-void cleanup<SDL_Renderer>( SDL_Renderer *ren ) {
+inline void cleanup<SDL_Renderer>( SDL_Renderer *ren ) {
   if ( !ren ) {
     return;
   }
-  SDL_DestroyRenderer( ren );
+  SDLDeleter()( ren );
 }
 
 template<>
-void cleanup<SDL_Texture>( SDL_Texture *tex ) {
+inline void cleanup<SDL_Texture>( SDL_Texture *tex ) {
   if ( !tex ) {
     return;
   }
-  SDL_DestroyTexture( tex );
+  SDLDeleter()( tex );
 }
 
 template<>
-void cleanup<SDL_Surface>( SDL_Surface *surf ) {
+inline void cleanup<SDL_Surface>( SDL_Surface *surf ) {
   if ( !surf ) {
     return;
   }
-  SDL_FreeSurface( surf );
+  SDLDeleter()( surf );
 }
 
 #endif
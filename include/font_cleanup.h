@@ -0,0 +1,30 @@
+#ifndef FONT_CLEANUP_H
+#define FONT_CLEANUP_H
+
+#include <memory>
+#include <SDL2/SDL.h>
+#include <SDL2_ttf/SDL_TTF.h>
+
+#include "cleanup.h"
+
+/*
+ * The SDL_ttf counterparts of the handles in cleanup.h, kept apart so only code
+ * that uses fonts needs SDL_ttf
+ */
+struct FontDeleter {
+    void operator()( TTF_Font *font ) const {
+        TTF_CloseFont( font );
+    }
+};
+
+typedef std::unique_ptr<TTF_Font, FontDeleter> FontPtr;
+
+template<>
+inline void cleanup<TTF_Font>( TTF_Font *font ) {
+  if ( !font ) {
+    return;
+  }
+  FontDeleter()( font );
+}
+
+#endif
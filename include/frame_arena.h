@@ -0,0 +1,295 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+#include <SDL2/SDL.h>
+
+/*
+ * A linear allocator for memory that only lives for a frame. Allocating bumps a
+ * pointer through a list of blocks and nothing is freed on its own, reset throws
+ * away everything allocated since the last reset in one go:
+ *
+ * FrameArena arena;
+ * while ( !quit ) {
+ *     char *label = arena.copyString( name );
+ *     Particle *sparks = arena.allocArray<Particle>( count );
+ *     ...
+ *     arena.reset();
+ * }
+ *
+ * Blocks are kept across resets, so once the arena's grown to fit a frame's worth of
+ * allocations later frames don't touch the heap at all. Destructors aren't run, use
+ * it for plain data or run them yourself before resetting.
+ */
+class FrameArena {
+public:
+    // A frame's worth of allocations
+    struct Stats {
+        // Bytes handed out, not counting alignment padding
+        size_t bytes;
+        size_t allocations;
+        // Blocks that had to be taken from the heap, 0 once the arena's warmed up
+        size_t heapBlocks;
+    };
+
+    /**
+     * @param blockSize The size of the blocks taken from the heap, allocations bigger
+     * than this get a block of their own
+     */
+    explicit FrameArena( size_t blockSize = 64 * 1024 ) : blockBytes( blockSize ), current( 0 ), offset( 0 ) {
+        std::memset( &stats, 0, sizeof( stats ) );
+        std::memset( &last, 0, sizeof( last ) );
+    }
+
+    ~FrameArena() {
+        for ( size_t i = 0; i < blocks.size(); ++i ) {
+            std::free( blocks[i].data );
+        }
+    }
+
+    /**
+     * Allocate some memory that lives until the next reset
+     * @param size The number of bytes
+     * @param align The alignment, a power of two
+     * @return the memory, never nullptr, std::bad_alloc is thrown if the heap's exhausted
+     */
+    void* allocate( size_t size, size_t align = alignof( std::max_align_t ) ) {
+        ++stats.allocations;
+        stats.bytes += size;
+        while ( current < blocks.size() ) {
+            Block &b = blocks[current];
+            const size_t start = ( reinterpret_cast<size_t>( b.data ) + offset + align - 1 ) & ~( align - 1 );
+            const size_t end = start - reinterpret_cast<size_t>( b.data ) + size;
+            if ( end <= b.size ) {
+                offset = end;
+                return reinterpret_cast<void*>( start );
+            }
+            // Whatever's left of this block is wasted until the next reset
+            ++current;
+            offset = 0;
+        }
+
+        Block b;
+        b.size = SDL_max( blockBytes, size + align );
+        b.data = static_cast<char*>( std::malloc( b.size ) );
+        if ( b.data == nullptr ) {
+            throw std::bad_alloc();
+        }
+        blocks.push_back( b );
+        ++stats.heapBlocks;
+        current = blocks.size() - 1;
+        const size_t start = ( reinterpret_cast<size_t>( b.data ) + align - 1 ) & ~( align - 1 );
+        offset = start - reinterpret_cast<size_t>( b.data ) + size;
+        return reinterpret_cast<void*>( start );
+    }
+
+    /**
+     * Allocate an uninitialized array, T should be plain data since it's never destroyed
+     */
+    template<typename T>
+    T* allocArray( size_t n ) {
+        return static_cast<T*>( allocate( n * sizeof( T ), alignof( T ) ) );
+    }
+
+    /**
+     * Construct an object in the arena. Its destructor won't be run by reset.
+     */
+    template<typename T, typename... Args>
+    T* create( Args&&... args ) {
+        return new ( allocate( sizeof( T ), alignof( T ) ) ) T( std::forward<Args>( args )... );
+    }
+
+    /**
+     * Copy a string into the arena
+     * @return the copy, nul terminated
+     */
+    char* copyString( const char *str ) {
+        const size_t n = std::strlen( str ) + 1;
+        char *copy = static_cast<char*>( allocate( n, 1 ) );
+        std::memcpy( copy, str, n );
+        return copy;
+    }
+
+    /**
+     * Free everything allocated since the last reset, the blocks are kept for the
+     * next frame. Anything still pointing into the arena is left dangling.
+     */
+    void reset() {
+        current = 0;
+        offset = 0;
+        last = stats;
+        std::memset( &stats, 0, sizeof( stats ) );
+    }
+
+    // The allocations made since the last reset
+    const Stats& frame() const {
+        return stats;
+    }
+
+    // The allocations made between the last two resets
+    const Stats& lastFrame() const {
+        return last;
+    }
+
+    // The total size of the blocks taken from the heap
+    size_t capacity() const {
+        size_t total = 0;
+        for ( size_t i = 0; i < blocks.size(); ++i ) {
+            total += blocks[i].size;
+        }
+        return total;
+    }
+
+private:
+    struct Block {
+        char *data;
+        size_t size;
+    };
+
+    FrameArena( const FrameArena& );
+    FrameArena& operator=( const FrameArena& );
+
+    size_t blockBytes;
+    std::vector<Block> blocks;
+    // The block being allocated from and how far into it we are
+    size_t current, offset;
+    Stats stats, last;
+};
+
+/*
+ * Lets STL containers allocate from a FrameArena, for containers built and thrown
+ * away within a frame:
+ *
+ * std::vector<SDL_Rect, ArenaAllocator<SDL_Rect>> dirty( ArenaAllocator<SDL_Rect>( arena ) );
+ *
+ * Freeing does nothing, so a container that grows leaves its old storage in the
+ * arena until the reset, reserve up front where the size is known. The container
+ * must be gone (or at least not used again) by the time the arena's reset.
+ */
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator( FrameArena &a ) : arena( &a ) {}
+
+    template<typename U>
+    ArenaAllocator( const ArenaAllocator<U> &other ) : arena( other.arena ) {}
+
+    T* allocate( size_t n ) {
+        return arena->allocArray<T>( n );
+    }
+
+    void deallocate( T*, size_t ) {}
+
+    template<typename U>
+    bool operator==( const ArenaAllocator<U> &other ) const {
+        return arena == other.arena;
+    }
+
+    template<typename U>
+    bool operator!=( const ArenaAllocator<U> &other ) const {
+        return arena != other.arena;
+    }
+
+private:
+    template<typename U> friend class ArenaAllocator;
+
+    FrameArena *arena;
+};
+
+/*
+ * A pool of fixed size objects for things that are created and destroyed all the
+ * time but live longer than a frame, eg. particles or requests. Objects come from
+ * chunks allocated CHUNK at a time and freed objects go on a free list for the next
+ * create, so once the pool's grown to its high water mark it stops touching the heap.
+ * Objects never move, so pointers to them stay valid until they're destroyed.
+ */
+template<typename T, size_t CHUNK = 256>
+class ObjectPool {
+public:
+    ObjectPool() : freeList( nullptr ), live( 0 ) {}
+
+    /**
+     * Free the pool's memory, every object must have been destroyed already
+     */
+    ~ObjectPool() {
+        for ( size_t i = 0; i < chunks.size(); ++i ) {
+            std::free( chunks[i] );
+        }
+    }
+
+    /**
+     * Construct an object from the pool
+     * @return the object, std::bad_alloc is thrown if a new chunk is needed and the
+     * heap's exhausted
+     */
+    template<typename... Args>
+    T* create( Args&&... args ) {
+        if ( freeList == nullptr ) {
+            grow();
+        }
+        Slot *slot = freeList;
+        freeList = slot->next;
+        T *obj = new ( slot->storage ) T( std::forward<Args>( args )... );
+        ++live;
+        return obj;
+    }
+
+    /**
+     * Destroy an object and return it to the pool
+     * @param obj An object from this pool's create, or nullptr
+     */
+    void destroy( T *obj ) {
+        if ( obj == nullptr ) {
+            return;
+        }
+        obj->~T();
+        Slot *slot = reinterpret_cast<Slot*>( obj );
+        slot->next = freeList;
+        freeList = slot;
+        --live;
+    }
+
+    // The number of objects alive
+    size_t size() const {
+        return live;
+    }
+
+    // The number of objects the pool can hold without growing
+    size_t capacity() const {
+        return chunks.size() * CHUNK;
+    }
+
+private:
+    union Slot {
+        Slot *next;
+        alignas( T ) unsigned char storage[sizeof( T )];
+    };
+
+    ObjectPool( const ObjectPool& );
+    ObjectPool& operator=( const ObjectPool& );
+
+    void grow() {
+        Slot *chunk = static_cast<Slot*>( std::malloc( sizeof( Slot ) * CHUNK ) );
+        if ( chunk == nullptr ) {
+            throw std::bad_alloc();
+        }
+        chunks.push_back( chunk );
+        for ( size_t i = CHUNK; i-- > 0; ) {
+            chunk[i].next = freeList;
+            freeList = &chunk[i];
+        }
+    }
+
+    std::vector<Slot*> chunks;
+    Slot *freeList;
+    size_t live;
+};
+
+#endif
@@ -0,0 +1,460 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <SDL2/SDL.h>
+#include <SDL2_image/SDL_Image.h>
+
+/*
+ * Streams rendered frames to disk, for golden image tests and thumbnails on
+ * machines without a display. The output depends on the path it's opened with:
+ *
+ * frames/%05d.png  a PNG per frame
+ * frames/%05d.bmp  a BMP per frame
+ * frames/%05d.raw  the frame's ARGB8888 pixels, row after row with no padding
+ * out.y4m          a YUV4MPEG2 video (4:2:0, full range BT.601), which can also
+ *                  be a named pipe an encoder's reading, eg. mkfifo out.y4m and
+ *                  ffmpeg -i out.y4m out.mp4
+ *
+ * Sequence paths take the frame number through a single printf style %d, which
+ * may have a 0 flag and a width of up to 2 digits. Call capture after drawing a
+ * frame and before presenting it, drawing into an OffscreenFrame:
+ *
+ * FrameCapture capture;
+ * capture.open( "frames/%05d.png", SCREEN_WIDTH, SCREEN_HEIGHT, 60 );
+ * OffscreenFrame offscreen;
+ * offscreen.create( ren, SCREEN_WIDTH, SCREEN_HEIGHT );
+ * while ( !quit ) {
+ *     offscreen.begin();
+ *     // draw
+ *     capture.capture( ren );
+ *     offscreen.end();
+ *     SDL_RenderPresent( ren );
+ * }
+ * capture.close();
+ *
+ * SDL2 has no asynchronous readback, so capture reads the pixels back straight
+ * away into one of a ring of buffers and everything after that (converting,
+ * encoding and writing) happens on writer threads while the next frames render.
+ * Sequences are written by several threads since each frame is its own file, a
+ * video by one since its frames have to stay in order. When every buffer is
+ * waiting to be written capture waits for one to free up rather than dropping
+ * frames, stallMs says how long it's spent waiting.
+ */
+class FrameCapture {
+public:
+    enum Format {
+        FORMAT_RAW,
+        FORMAT_BMP,
+        FORMAT_PNG,
+        FORMAT_Y4M
+    };
+
+    FrameCapture() : format( FORMAT_RAW ), width( 0 ), height( 0 ), video( nullptr ), stopping( false ), captured( 0 ),
+        readbackTicks( 0 ), stallTicks( 0 )
+    {}
+
+    ~FrameCapture() {
+        close();
+    }
+
+    /**
+     * Start capturing to a file or sequence of files
+     * @param path Where to write the frames, see above
+     * @param w The width of the frames
+     * @param h The height of the frames
+     * @param fps The frame rate written to videos
+     * @param buffers How many frames can be waiting to be written
+     * @return false if the path isn't supported or the video couldn't be created, the
+     * error is in SDL_GetError
+     */
+    bool open( const std::string &path, int w, int h, double fps, size_t buffers = 4 ) {
+        close();
+        if ( w <= 0 || h <= 0 || fps <= 0 ) {
+            SDL_SetError( "Can't capture %dx%d frames at %g fps", w, h, fps );
+            return false;
+        }
+        if ( !formatFor( path, format ) ) {
+            return false;
+        }
+        pattern = path;
+        width = w;
+        height = h;
+        writeError.clear();
+        captured = 0;
+        readbackTicks = stallTicks = 0;
+
+        size_t writers = 1;
+        if ( format == FORMAT_Y4M ) {
+            video = SDL_RWFromFile( path.c_str(), "wb" );
+            if ( video == nullptr ) {
+                return false;
+            }
+            char header[128];
+            SDL_snprintf( header, sizeof( header ), "YUV4MPEG2 W%d H%d F%u:1000 Ip A1:1 C420jpeg\n", w, h,
+                    static_cast<unsigned>( fps * 1000 + 0.5 ) );
+            if ( SDL_RWwrite( video, header, SDL_strlen( header ), 1 ) != 1 ) {
+                SDL_RWclose( video );
+                video = nullptr;
+                return false;
+            }
+        } else {
+            writers = static_cast<size_t>( SDL_max( SDL_GetCPUCount() - 1, 1 ) );
+        }
+
+        slots.resize( SDL_max( buffers, writers + 1 ) );
+        for ( size_t i = 0; i < slots.size(); ++i ) {
+            slots[i].pixels.resize( static_cast<size_t>( w ) * h * 4 );
+            freeSlots.push_back( i );
+        }
+        stopping = false;
+        for ( size_t i = 0; i < writers; ++i ) {
+            threads.push_back( std::thread( &FrameCapture::write, this ) );
+        }
+        return true;
+    }
+
+    /**
+     * Read back the frame that's been drawn and queue it to be written
+     * @param ren The renderer, its current target is what's read back
+     * @return false if the frame couldn't be read back or an earlier frame couldn't be
+     * written, the error is in SDL_GetError
+     */
+    bool capture( SDL_Renderer *ren ) {
+        if ( threads.empty() ) {
+            SDL_SetError( "FrameCapture isn't open" );
+            return false;
+        }
+        size_t slot;
+        {
+            const Uint64 start = SDL_GetPerformanceCounter();
+            std::unique_lock<std::mutex> lock( mutex );
+            wake.wait( lock, [this]{ return !freeSlots.empty() || !writeError.empty(); } );
+            stallTicks += SDL_GetPerformanceCounter() - start;
+            if ( !writeError.empty() ) {
+                SDL_SetError( "%s", writeError.c_str() );
+                return false;
+            }
+            slot = freeSlots.front();
+            freeSlots.pop_front();
+        }
+
+        const Uint64 start = SDL_GetPerformanceCounter();
+        const bool read = SDL_RenderReadPixels( ren, NULL, SDL_PIXELFORMAT_ARGB8888, slots[slot].pixels.data(),
+                width * 4 ) == 0;
+        readbackTicks += SDL_GetPerformanceCounter() - start;
+
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            if ( read ) {
+                slots[slot].frame = captured++;
+                fullSlots.push_back( slot );
+            } else {
+                freeSlots.push_back( slot );
+            }
+        }
+        wake.notify_all();
+        return read;
+    }
+
+    /**
+     * Write the frames still queued and stop capturing
+     * @return false if any frame couldn't be written, the error is in SDL_GetError
+     */
+    bool close() {
+        if ( threads.empty() ) {
+            return true;
+        }
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            stopping = true;
+        }
+        wake.notify_all();
+        for ( size_t i = 0; i < threads.size(); ++i ) {
+            threads[i].join();
+        }
+        threads.clear();
+        slots.clear();
+        freeSlots.clear();
+        fullSlots.clear();
+
+        bool ok = writeError.empty();
+        if ( video != nullptr ) {
+            ok = SDL_RWclose( video ) == 0 && ok;
+            video = nullptr;
+        }
+        if ( !writeError.empty() ) {
+            SDL_SetError( "%s", writeError.c_str() );
+        }
+        return ok;
+    }
+
+    bool isOpen() const {
+        return !threads.empty();
+    }
+
+    // The number of frames captured so far
+    Uint64 frames() const {
+        return captured;
+    }
+
+    // The time spent reading frames back, in milliseconds
+    double readbackMs() const {
+        return readbackTicks * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+
+    // The time capture spent waiting for the writers to free up a buffer, in milliseconds
+    double stallMs() const {
+        return stallTicks * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+
+private:
+    struct Slot {
+        std::vector<Uint8> pixels;
+        Uint64 frame;
+    };
+
+    FrameCapture( const FrameCapture& );
+    FrameCapture& operator=( const FrameCapture& );
+
+    /*
+     * Work out the format from the path, sequences have to have exactly one %d
+     * (with an optional 0 flag and a width of up to 2 digits) for the frame number,
+     * since the path is used as a format string
+     */
+    static bool formatFor( const std::string &path, Format &fmt ) {
+        const size_t dot = path.find_last_of( '.' );
+        const std::string ext = dot == std::string::npos ? "" : path.substr( dot + 1 );
+        if ( ext == "y4m" ) {
+            fmt = FORMAT_Y4M;
+            return true;
+        }
+        if ( ext == "raw" ) {
+            fmt = FORMAT_RAW;
+        } else if ( ext == "bmp" ) {
+            fmt = FORMAT_BMP;
+        } else if ( ext == "png" ) {
+            fmt = FORMAT_PNG;
+        } else {
+            SDL_SetError( "Don't know how to capture frames to %s", path.c_str() );
+            return false;
+        }
+
+        int conversions = 0;
+        for ( size_t i = 0; i < path.size(); ++i ) {
+            if ( path[i] != '%' ) {
+                continue;
+            }
+            if ( i + 1 < path.size() && path[i + 1] == '%' ) {
+                ++i;
+                continue;
+            }
+            size_t j = i + 1;
+            while ( j < path.size() && path[j] >= '0' && path[j] <= '9' ) {
+                ++j;
+            }
+            // Digits past the 0 flag are the width, keep it to something a file name could use
+            const size_t digits = j - i - 1 - ( j > i + 1 && path[i + 1] == '0' ? 1 : 0 );
+            if ( j == path.size() || path[j] != 'd' || digits > 2 ) {
+                conversions = -1;
+                break;
+            }
+            ++conversions;
+            i = j;
+        }
+        if ( conversions != 1 ) {
+            SDL_SetError( "%s needs a single %%d, at most 2 digits wide, for the frame number", path.c_str() );
+            return false;
+        }
+        return true;
+    }
+
+    void write() {
+        std::unique_lock<std::mutex> lock( mutex );
+        for ( ;; ) {
+            wake.wait( lock, [this]{ return !fullSlots.empty() || stopping; } );
+            if ( fullSlots.empty() ) {
+                break;
+            }
+            const size_t slot = fullSlots.front();
+            fullSlots.pop_front();
+            lock.unlock();
+
+            std::string error;
+            if ( !writeFrame( slots[slot] ) ) {
+                error = SDL_GetError();
+            }
+
+            lock.lock();
+            if ( !error.empty() && writeError.empty() ) {
+                writeError = error;
+            }
+            freeSlots.push_back( slot );
+            wake.notify_all();
+        }
+    }
+
+    bool writeFrame( Slot &slot ) {
+        if ( format == FORMAT_Y4M ) {
+            toYUV( slot.pixels, yuv );
+            return SDL_RWwrite( video, "FRAME\n", 6, 1 ) == 1 && SDL_RWwrite( video, yuv.data(), yuv.size(), 1 ) == 1;
+        }
+
+        char file[1024];
+        SDL_snprintf( file, sizeof( file ), pattern.c_str(), static_cast<int>( slot.frame ) );
+        if ( format == FORMAT_RAW ) {
+            SDL_RWops *rw = SDL_RWFromFile( file, "wb" );
+            if ( rw == nullptr ) {
+                return false;
+            }
+            const bool ok = SDL_RWwrite( rw, slot.pixels.data(), slot.pixels.size(), 1 ) == 1;
+            return SDL_RWclose( rw ) == 0 && ok;
+        }
+
+        SDL_Surface *surf = SDL_CreateRGBSurfaceWithFormatFrom( slot.pixels.data(), width, height, 32, width * 4,
+                SDL_PIXELFORMAT_ARGB8888 );
+        if ( surf == nullptr ) {
+            return false;
+        }
+        const bool ok = ( format == FORMAT_PNG ? IMG_SavePNG( surf, file ) : SDL_SaveBMP( surf, file ) ) == 0;
+        SDL_FreeSurface( surf );
+        return ok;
+    }
+
+    /*
+     * Convert a frame to planar 4:2:0 YUV with full range BT.601 coefficients in 8.8
+     * fixed point, chroma is taken from the average of each 2x2 block
+     */
+    void toYUV( const std::vector<Uint8> &argb, std::vector<Uint8> &out ) const {
+        const int cw = ( width + 1 ) / 2, ch = ( height + 1 ) / 2;
+        out.resize( static_cast<size_t>( width ) * height + static_cast<size_t>( cw ) * ch * 2 );
+        Uint8 *yPlane = out.data();
+        Uint8 *uPlane = yPlane + static_cast<size_t>( width ) * height;
+        Uint8 *vPlane = uPlane + static_cast<size_t>( cw ) * ch;
+        const Uint32 *px = reinterpret_cast<const Uint32*>( argb.data() );
+
+        for ( int y = 0; y < height; ++y ) {
+            const Uint32 *row = px + static_cast<size_t>( y ) * width;
+            Uint8 *dst = yPlane + static_cast<size_t>( y ) * width;
+            for ( int x = 0; x < width; ++x ) {
+                const int r = row[x] >> 16 & 0xff, g = row[x] >> 8 & 0xff, b = row[x] & 0xff;
+                dst[x] = static_cast<Uint8>( ( 77 * r + 150 * g + 29 * b + 128 ) >> 8 );
+            }
+        }
+        for ( int cy = 0; cy < ch; ++cy ) {
+            const int y0 = cy * 2, y1 = SDL_min( y0 + 1, height - 1 );
+            for ( int cx = 0; cx < cw; ++cx ) {
+                const int x0 = cx * 2, x1 = SDL_min( x0 + 1, width - 1 );
+                const Uint32 p[4] = {
+                    px[static_cast<size_t>( y0 ) * width + x0], px[static_cast<size_t>( y0 ) * width + x1],
+                    px[static_cast<size_t>( y1 ) * width + x0], px[static_cast<size_t>( y1 ) * width + x1]
+                };
+                int r = 0, g = 0, b = 0;
+                for ( int i = 0; i < 4; ++i ) {
+                    r += p[i] >> 16 & 0xff;
+                    g += p[i] >> 8 & 0xff;
+                    b += p[i] & 0xff;
+                }
+                // The sums are 4x the average so the shift takes 2 more bits off
+                const int u = ( -43 * r - 85 * g + 128 * b + 512 ) >> 10;
+                const int v = ( 128 * r - 107 * g - 21 * b + 512 ) >> 10;
+                uPlane[static_cast<size_t>( cy ) * cw + cx] = static_cast<Uint8>( SDL_min( SDL_max( u + 128, 0 ), 255 ) );
+                vPlane[static_cast<size_t>( cy ) * cw + cx] = static_cast<Uint8>( SDL_min( SDL_max( v + 128, 0 ), 255 ) );
+            }
+        }
+    }
+
+    Format format;
+    std::string pattern;
+    int width, height;
+    // Only used by the writer thread, there's just the one for videos
+    SDL_RWops *video;
+    std::vector<Uint8> yuv;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<std::thread> threads;
+    std::vector<Slot> slots;
+    // Buffers ready to read back into, and frames waiting to be written in capture order
+    std::deque<size_t> freeSlots, fullSlots;
+    std::string writeError;
+    bool stopping;
+    Uint64 captured;
+    Uint64 readbackTicks, stallTicks;
+};
+
+/*
+ * A target texture the size of the window to draw frames into while capturing.
+ * What a window's backbuffer holds once it's been drawn to is up to the driver,
+ * and for hidden windows it's often nothing, so frames are drawn into this, read
+ * back from it and then copied to the window. Destroy it before the renderer.
+ */
+class OffscreenFrame {
+public:
+    OffscreenFrame() : renderer( nullptr ), texture( nullptr ) {}
+
+    ~OffscreenFrame() {
+        destroy();
+    }
+
+    /**
+     * Create the target texture
+     * @param ren The renderer to draw with
+     * @param w The width of the frames
+     * @param h The height of the frames
+     * @return false if the renderer can't render to textures, the error is in SDL_GetError
+     */
+    bool create( SDL_Renderer *ren, int w, int h ) {
+        destroy();
+        if ( SDL_RenderTargetSupported( ren ) != SDL_TRUE ) {
+            SDL_SetError( "The renderer can't render to textures" );
+            return false;
+        }
+        texture = SDL_CreateTexture( ren, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h );
+        if ( texture == nullptr ) {
+            return false;
+        }
+        // The frame replaces what's on the window, it isn't blended over it
+        SDL_SetTextureBlendMode( texture, SDL_BLENDMODE_NONE );
+        renderer = ren;
+        return true;
+    }
+
+    void destroy() {
+        if ( texture != nullptr ) {
+            SDL_DestroyTexture( texture );
+            texture = nullptr;
+        }
+        renderer = nullptr;
+    }
+
+    // Draw into the texture until end is called
+    void begin() {
+        if ( texture != nullptr ) {
+            SDL_SetRenderTarget( renderer, texture );
+        }
+    }
+
+    // Go back to drawing to the window and copy the frame onto it
+    void end() {
+        if ( texture != nullptr ) {
+            SDL_SetRenderTarget( renderer, NULL );
+            SDL_RenderCopy( renderer, texture, NULL, NULL );
+        }
+    }
+
+private:
+    OffscreenFrame( const OffscreenFrame& );
+    OffscreenFrame& operator=( const OffscreenFrame& );
+
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef GAME_LOOP_H
+#define GAME_LOOP_H
+
+#include <SDL2/SDL.h>
+
+/*
+ * Drives a loop with a fixed simulation step decoupled from the render rate.
+ * Real time is accumulated each frame and consumed in whole simulation steps,
+ * whatever is left over is given back as an interpolation alpha so rendering
+ * can blend between the previous and current simulation states. Used like:
+ *
+ * GameLoop loop( 1.0 / 60 );
+ * while ( !quit ) {
+ *     // handle events
+ *     loop.beginFrame();
+ *     while ( loop.step() ) {
+ *         // simulate loop.dt() seconds
+ *     }
+ *     // render using loop.alpha()
+ *     loop.endFrame();
+ * }
+ *
+ * If a frame takes so long that more than maxSteps simulation steps are due, the
+ * extra time is dropped instead of being simulated (the "spiral of death", where
+ * catching up takes so long we fall further behind). The simulation slows down
+ * instead of the frame rate collapsing.
+ */
+class GameLoop {
+public:
+    /**
+     * @param step The length of a simulation step in seconds
+     * @param stepLimit The most simulation steps to run in a single frame
+     */
+    explicit GameLoop( double step = 1.0 / 60, int stepLimit = 8 )
+        : frequency( SDL_GetPerformanceFrequency() ), stepSeconds( step ), maxSteps( stepLimit ),
+        capTicks( 0 ), accumulator( 0 ), ticks( 0 ), dropped( 0 ), started( false ), lockstep( false ), frameStart( 0 )
+    {
+        stepTicks = static_cast<Uint64>( step * frequency + 0.5 );
+        if ( stepTicks == 0 ) {
+            stepTicks = 1;
+        }
+    }
+
+    /**
+     * Limit how often frames are run, sleeping in endFrame if we're ahead
+     * @param fps The most frames to run per second, 0 for no limit
+     */
+    void setFrameCap( double fps ) {
+        capTicks = fps > 0 ? static_cast<Uint64>( frequency / fps ) : 0;
+    }
+
+    /**
+     * Run exactly one simulation step per frame whatever the real time, eg. when
+     * replaying recorded input where the simulation has to see the same ticks as
+     * it did when recording. Combine with a frame cap of 0 to run flat out.
+     */
+    void setLockstep( bool on ) {
+        lockstep = on;
+    }
+
+    /**
+     * Start a frame, adding the real time since the last frame to the simulation
+     * time that's due
+     */
+    void beginFrame() {
+        const Uint64 now = SDL_GetPerformanceCounter();
+        if ( lockstep ) {
+            frameStart = now;
+            accumulator = stepTicks;
+            return;
+        }
+        if ( !started ) {
+            started = true;
+            frameStart = now;
+        }
+
+        accumulator += now - frameStart;
+        frameStart = now;
+
+        const Uint64 maxAccumulated = stepTicks * maxSteps;
+        if ( accumulator > maxAccumulated ) {
+            dropped += ( accumulator - maxAccumulated ) / stepTicks;
+            accumulator = maxAccumulated;
+        }
+    }
+
+    /**
+     * Consume one simulation step if one is due
+     * @return true if the caller should simulate a step of dt() seconds
+     */
+    bool step() {
+        if ( accumulator < stepTicks ) {
+            return false;
+        }
+        accumulator -= stepTicks;
+        ++ticks;
+        return true;
+    }
+
+    /**
+     * Finish a frame, sleeping until the frame cap allows the next one to start
+     */
+    void endFrame() {
+        if ( capTicks != 0 ) {
+            sleepUntil( frameStart + capTicks );
+        }
+    }
+
+    /**
+     * Forget any accumulated time, eg. after a long load so we don't try to
+     * simulate the time spent loading
+     */
+    void reset() {
+        started = false;
+        accumulator = 0;
+    }
+
+    // The length of a simulation step in seconds
+    double dt() const {
+        return stepSeconds;
+    }
+
+    // How far we are between the last simulation step and the next, in [0, 1)
+    double alpha() const {
+        return static_cast<double>( accumulator ) / stepTicks;
+    }
+
+    // The number of simulation steps run so far
+    Uint64 tick() const {
+        return ticks;
+    }
+
+    // The number of simulation steps skipped because frames were too slow
+    Uint64 droppedSteps() const {
+        return dropped;
+    }
+
+    /**
+     * Sleep until the performance counter reaches some value. SDL_Delay only has
+     * millisecond resolution and tends to oversleep, so we delay until we're close
+     * and spin for the rest.
+     */
+    void sleepUntil( Uint64 target ) const {
+        const Uint64 spinTicks = frequency / 500;
+        for ( Uint64 now = SDL_GetPerformanceCounter(); now < target; now = SDL_GetPerformanceCounter() ) {
+            const Uint64 remaining = target - now;
+            if ( remaining > spinTicks ) {
+                SDL_Delay( static_cast<Uint32>( ( remaining - spinTicks ) * 1000 / frequency ) );
+            }
+        }
+    }
+
+private:
+    const Uint64 frequency;
+    const double stepSeconds;
+    const int maxSteps;
+    Uint64 stepTicks;
+    Uint64 capTicks;
+    Uint64 accumulator;
+    Uint64 ticks;
+    Uint64 dropped;
+    bool started;
+    bool lockstep;
+    Uint64 frameStart;
+};
+
+#endif
@@ -0,0 +1,295 @@
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <SDL2/SDL.h>
+#include <SDL2_ttf/SDL_TTF.h>
+
+#include "rect_pack.h"
+#include "sprite_batch.h"
+
+/*
+ * Caches rasterized glyphs in shared atlas textures so text can be laid out and
+ * drawn every frame without rendering surfaces or creating textures. Each glyph
+ * of a font is rendered once, in white, the first time it's drawn and text is
+ * then queued on a SpriteBatch as one quad per glyph, tinted to the text color.
+ *
+ * A TTF_Font is opened at a fixed point size, so glyphs are keyed by the font
+ * pointer and the codepoint. Only the Basic Multilingual Plane is supported since
+ * that's all TTF_RenderGlyph_Blended takes, anything else is drawn as '?'.
+ */
+class GlyphCache {
+public:
+    /**
+     * Create a glyph cache for some renderer
+     * @param ren The renderer to create the atlas textures on
+     * @param size The width and height of each atlas texture
+     */
+    explicit GlyphCache( SDL_Renderer *ren, int size = 512 )
+        : renderer( ren ), pageSize( size )
+    {}
+
+    ~GlyphCache() {
+        clear();
+    }
+
+    /**
+     * Queue some text to be drawn
+     * @param batch The batch to queue the glyph quads on
+     * @param font The font to draw with
+     * @param text The UTF-8 text to draw, newlines start a new line
+     * @param x The x coordinate of the left of the text
+     * @param y The y coordinate of the top of the text
+     * @param color The color to draw the text in
+     * @param layer The batch layer to draw in
+     * @return the width of the widest line drawn
+     */
+    int drawText( SpriteBatch &batch, TTF_Font *font, const char *text, int x, int y,
+            SDL_Color color, int layer = 0 )
+    {
+        return layout( &batch, font, text, x, y, color, layer, nullptr );
+    }
+
+    int drawText( SpriteBatch &batch, TTF_Font *font, const std::string &text, int x, int y,
+            SDL_Color color, int layer = 0 )
+    {
+        return drawText( batch, font, text.c_str(), x, y, color, layer );
+    }
+
+    /**
+     * Get the size some text would be drawn at, rasterizing any glyphs we haven't seen yet
+     * @param w Set to the width of the widest line
+     * @param h Set to the height of all the lines
+     */
+    void measureText( TTF_Font *font, const char *text, int &w, int &h ) {
+        const SDL_Color white = { 255, 255, 255, 255 };
+        int lines;
+        w = layout( nullptr, font, text, 0, 0, white, 0, &lines );
+        h = lines * TTF_FontLineSkip( font );
+    }
+
+    /**
+     * Forget all glyphs and destroy the atlas textures, this must be done before
+     * the renderer is destroyed
+     */
+    void clear() {
+        for ( size_t i = 0; i < pages.size(); ++i ) {
+            SDL_DestroyTexture( pages[i].texture );
+        }
+        pages.clear();
+        fonts.clear();
+    }
+
+    /**
+     * Forget the glyphs of a font that's about to be closed. Its space in the atlas
+     * isn't reclaimed until clear is called.
+     */
+    void forgetFont( TTF_Font *font ) {
+        fonts.erase( font );
+    }
+
+    size_t pageCount() const {
+        return pages.size();
+    }
+
+private:
+    struct Glyph {
+        // -1 for glyphs with nothing to draw (eg. spaces), or that couldn't be rasterized
+        int page;
+        SDL_Rect clip;
+        int advance;
+    };
+
+    struct Page {
+        SDL_Texture *texture;
+        RectPacker packer;
+    };
+
+    typedef std::unordered_map<Uint16, Glyph> GlyphMap;
+
+    /**
+     * Walk the text, queueing a quad per glyph on the batch if there is one
+     * @param lineCount If not null, set to the number of lines in the text
+     * @return the width of the widest line
+     */
+    int layout( SpriteBatch *batch, TTF_Font *font, const char *text, int x, int y,
+            SDL_Color color, int layer, int *lineCount )
+    {
+        GlyphMap &glyphs = fonts[font];
+        const int lineSkip = TTF_FontLineSkip( font );
+        int penX = x, penY = y, widest = 0, lines = 1;
+        Uint16 prev = 0;
+
+        const char *p = text;
+        while ( *p ) {
+            const Uint16 ch = nextCodepoint( p );
+            if ( ch == '\n' ) {
+                widest = SDL_max( widest, penX - x );
+                penX = x;
+                penY += lineSkip;
+                prev = 0;
+                ++lines;
+                continue;
+            }
+
+            const Glyph *glyph = find( glyphs, font, ch );
+            if ( prev != 0 ) {
+                penX += kerning( font, prev, ch );
+            }
+            if ( batch != nullptr && glyph->page >= 0 ) {
+                SDL_Rect dst = { penX, penY, glyph->clip.w, glyph->clip.h };
+                batch->draw( pages[glyph->page].texture, dst, &glyph->clip, layer, color );
+            }
+            penX += glyph->advance;
+            prev = ch;
+        }
+
+        if ( lineCount != nullptr ) {
+            *lineCount = lines;
+        }
+        return SDL_max( widest, penX - x );
+    }
+
+    /**
+     * Look up a glyph, rasterizing it into the atlas if we haven't seen it before.
+     * Glyphs that can't be rasterized are remembered too, with nothing to draw, so
+     * they're only tried once.
+     */
+    const Glyph* find( GlyphMap &glyphs, TTF_Font *font, Uint16 ch ) {
+        auto found = glyphs.find( ch );
+        if ( found != glyphs.end() ) {
+            return &found->second;
+        }
+
+        Glyph glyph;
+        if ( !rasterize( font, ch, glyph ) ) {
+            glyph.page = -1;
+        }
+        return &glyphs.insert( std::make_pair( ch, glyph ) ).first->second;
+    }
+
+    bool rasterize( TTF_Font *font, Uint16 ch, Glyph &glyph ) {
+        glyph.page = -1;
+        glyph.clip.x = glyph.clip.y = glyph.clip.w = glyph.clip.h = 0;
+        int minx, maxx, miny, maxy;
+        if ( TTF_GlyphMetrics( font, ch, &minx, &maxx, &miny, &maxy, &glyph.advance ) != 0 ) {
+            glyph.advance = 0;
+            return false;
+        }
+        if ( maxx <= minx || maxy <= miny ) {
+            return true;
+        }
+
+        // The glyph surface is laid out like a one character TTF_RenderUTF8 surface,
+        // so drawing it at the pen position with the top at the line's top lines up
+        const SDL_Color white = { 255, 255, 255, 255 };
+        SDL_Surface *rendered = TTF_RenderGlyph_Blended( font, ch, white );
+        if ( rendered == nullptr ) {
+            return false;
+        }
+        SDL_Surface *surf = rendered;
+        if ( rendered->format->format != SDL_PIXELFORMAT_ARGB8888 ) {
+            surf = SDL_ConvertSurfaceFormat( rendered, SDL_PIXELFORMAT_ARGB8888, 0 );
+            SDL_FreeSurface( rendered );
+            if ( surf == nullptr ) {
+                return false;
+            }
+        }
+
+        // Pad by a pixel so linear filtering doesn't pull in neighbouring glyphs
+        SDL_Rect placed;
+        bool ok = false;
+        for ( size_t i = 0; i < pages.size() && !ok; ++i ) {
+            if ( pages[i].packer.insert( surf->w + 1, surf->h + 1, placed ) ) {
+                glyph.page = static_cast<int>( i );
+                ok = true;
+            }
+        }
+        // Only start a page for glyphs that fit in one, a bigger one would fail again on every page
+        const bool fits = surf->w + 1 <= pageSize && surf->h + 1 <= pageSize;
+        if ( !ok && fits && addPage() && pages.back().packer.insert( surf->w + 1, surf->h + 1, placed ) ) {
+            glyph.page = static_cast<int>( pages.size() - 1 );
+            ok = true;
+        }
+
+        if ( ok ) {
+            glyph.clip.x = placed.x;
+            glyph.clip.y = placed.y;
+            glyph.clip.w = surf->w;
+            glyph.clip.h = surf->h;
+            ok = SDL_UpdateTexture( pages[glyph.page].texture, &glyph.clip, surf->pixels, surf->pitch ) == 0;
+        }
+        SDL_FreeSurface( surf );
+        return ok;
+    }
+
+    bool addPage() {
+        Page page;
+        page.texture = SDL_CreateTexture( renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC,
+                pageSize, pageSize );
+        if ( page.texture == nullptr ) {
+            return false;
+        }
+
+        // Start out fully transparent so the padding between glyphs is empty
+        std::vector<Uint32> blank( static_cast<size_t>( pageSize ) * pageSize, 0 );
+        SDL_UpdateTexture( page.texture, NULL, blank.data(), pageSize * 4 );
+        SDL_SetTextureBlendMode( page.texture, SDL_BLENDMODE_BLEND );
+        page.packer.reset( pageSize, pageSize );
+        pages.push_back( page );
+        return true;
+    }
+
+    static int kerning( TTF_Font *font, Uint16 prev, Uint16 ch ) {
+#ifdef SDL_TTF_VERSION_ATLEAST
+#if SDL_TTF_VERSION_ATLEAST(2, 0, 14)
+        return TTF_GetFontKerningSizeGlyphs( font, prev, ch );
+#endif
+#endif
+        (void)font;
+        (void)prev;
+        (void)ch;
+        return 0;
+    }
+
+    /**
+     * Decode the next UTF-8 codepoint and advance past it, anything outside the
+     * BMP or malformed comes back as '?'
+     */
+    static Uint16 nextCodepoint( const char *&p ) {
+        const unsigned char c = static_cast<unsigned char>( *p++ );
+        if ( c < 0x80 ) {
+            return c;
+        }
+
+        int extra;
+        Uint32 cp;
+        if ( ( c & 0xe0 ) == 0xc0 ) {
+            extra = 1;
+            cp = c & 0x1f;
+        } else if ( ( c & 0xf0 ) == 0xe0 ) {
+            extra = 2;
+            cp = c & 0x0f;
+        } else {
+            extra = ( c & 0xf8 ) == 0xf0 ? 3 : 0;
+            cp = 0x110000;
+        }
+
+        for ( ; extra > 0; --extra ) {
+            if ( ( static_cast<unsigned char>( *p ) & 0xc0 ) != 0x80 ) {
+                return '?';
+            }
+            cp = cp << 6 | ( static_cast<unsigned char>( *p++ ) & 0x3f );
+        }
+        return cp > 0xffff ? '?' : static_cast<Uint16>( cp );
+    }
+
+    SDL_Renderer *renderer;
+    int pageSize;
+    std::vector<Page> pages;
+    std::unordered_map<TTF_Font*, GlyphMap> fonts;
+};
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+
+/*
+ * A key bound to a named action, bindings are usually given as a table:
+ *
+ * const InputBinding BINDINGS[] = {
+ *     { "up", SDL_SCANCODE_UP },
+ *     { "up", SDL_SCANCODE_W },
+ *     { "quit", SDL_SCANCODE_ESCAPE }
+ * };
+ * Input input( BINDINGS, SDL_arraysize( BINDINGS ) );
+ *
+ * Several keys can drive the same action and a key can drive several actions.
+ */
+struct InputBinding {
+    const char *action;
+    SDL_Scancode key;
+};
+
+/*
+ * Collects a frame's worth of input in one place. Call update once a frame, it
+ * drains the SDL event queue into a buffer, snapshots the keyboard and mouse and
+ * works out the state of every action, after which simulation code can ask about
+ * actions as often as it likes for the cost of a bit test:
+ *
+ * const int UP = input.action( "up" );
+ * while ( !quit ) {
+ *     input.update();
+ *     quit = input.quitRequested() || input.pressed( QUIT );
+ *     while ( loop.step() ) {
+ *         y -= input.held( UP ) * SPEED * loop.dt();
+ *     }
+ * }
+ *
+ * Held state comes from SDL_GetKeyboardState rather than key events, so movement
+ * doesn't depend on the OS key repeat rate. Presses are taken from the events so a
+ * key tapped and released within one frame still registers. Mouse motion is folded
+ * into the mouse position instead of being buffered, so a flood of motion events
+ * doesn't cost anything more than the position update.
+ *
+ * Sessions can be recorded and replayed with InputRecorder and InputReplay, see
+ * input_record.h.
+ */
+class Input {
+public:
+    // The most actions we can track, they're kept as bits in a mask
+    enum { MAX_ACTIONS = 32 };
+
+    Input() : heldMask( 0 ), pressedMask( 0 ), releasedMask( 0 ), quit( false ), fromEvents( false ),
+        mouseX( 0 ), mouseY( 0 ), buttons( 0 ), motionEvents( 0 )
+    {
+        std::memset( keyActions, 0, sizeof( keyActions ) );
+        std::memset( keyState, 0, sizeof( keyState ) );
+        events.reserve( 64 );
+    }
+
+    /**
+     * Create the input state with a table of bindings
+     * @param table The bindings
+     * @param count The number of bindings in the table
+     */
+    Input( const InputBinding *table, size_t count ) : Input() {
+        for ( size_t i = 0; i < count; ++i ) {
+            bind( table[i].action, table[i].key );
+        }
+    }
+
+    /**
+     * Bind a key to an action, creating the action if it's new
+     * @return false if there are already MAX_ACTIONS actions
+     */
+    bool bind( const std::string &name, SDL_Scancode key ) {
+        const int id = action( name );
+        if ( id < 0 || key <= SDL_SCANCODE_UNKNOWN || key >= SDL_NUM_SCANCODES ) {
+            return false;
+        }
+        keyActions[key] |= 1u << id;
+        Binding binding = { key, id };
+        bindings.push_back( binding );
+        return true;
+    }
+
+    /**
+     * Look up an action's id, creating the action if it's new. Do this once up front,
+     * the queries take the id so they don't have to compare strings every frame
+     * @return the action's id, or -1 if there are already MAX_ACTIONS actions
+     */
+    int action( const std::string &name ) {
+        for ( size_t i = 0; i < actions.size(); ++i ) {
+            if ( actions[i] == name ) {
+                return static_cast<int>( i );
+            }
+        }
+        if ( actions.size() == static_cast<size_t>( MAX_ACTIONS ) ) {
+            SDL_SetError( "Too many input actions, %s wasn't added", name.c_str() );
+            return -1;
+        }
+        actions.push_back( name );
+        return static_cast<int>( actions.size() - 1 );
+    }
+
+    /**
+     * Track the keyboard and mouse from the events we see instead of asking SDL.
+     * Events injected with SDL_PushEvent, eg. by InputReplay, don't change SDL's own
+     * keyboard and mouse state, so this has to be on when replaying.
+     */
+    void setEventState( bool on ) {
+        fromEvents = on;
+    }
+
+    /**
+     * Drain the event queue and bring the input state up to date for this frame
+     */
+    void update() {
+        events.clear();
+        pressedMask = 0;
+        releasedMask = 0;
+        motionEvents = 0;
+
+        SDL_Event e;
+        while ( SDL_PollEvent( &e ) ) {
+            switch ( e.type ) {
+                case SDL_QUIT:
+                    quit = true;
+                    break;
+                case SDL_MOUSEMOTION:
+                    mouseX = e.motion.x;
+                    mouseY = e.motion.y;
+                    ++motionEvents;
+                    continue;
+                case SDL_MOUSEBUTTONDOWN:
+                    buttons |= SDL_BUTTON( e.button.button );
+                    break;
+                case SDL_MOUSEBUTTONUP:
+                    buttons &= ~SDL_BUTTON( e.button.button );
+                    break;
+                case SDL_KEYDOWN:
+                    if ( !e.key.repeat ) {
+                        pressedMask |= actionsFor( e.key.keysym.scancode );
+                    }
+                    setKey( e.key.keysym.scancode, 1 );
+                    break;
+                case SDL_KEYUP:
+                    releasedMask |= actionsFor( e.key.keysym.scancode );
+                    setKey( e.key.keysym.scancode, 0 );
+                    break;
+                default:
+                    break;
+            }
+            events.push_back( e );
+        }
+
+        // Everything's been pumped by now so the snapshots match the events we saw
+        const Uint8 *keys = fromEvents ? keyState : SDL_GetKeyboardState( NULL );
+        heldMask = 0;
+        for ( size_t i = 0; i < bindings.size(); ++i ) {
+            if ( keys[bindings[i].key] ) {
+                heldMask |= 1u << bindings[i].action;
+            }
+        }
+        if ( !fromEvents ) {
+            buttons = SDL_GetMouseState( &mouseX, &mouseY );
+        }
+    }
+
+    // Whether any key bound to the action is down
+    bool held( int id ) const {
+        return test( heldMask, id );
+    }
+
+    // Whether a key bound to the action went down this frame, key repeats don't count
+    bool pressed( int id ) const {
+        return test( pressedMask, id );
+    }
+
+    // Whether a key bound to the action was let go this frame
+    bool released( int id ) const {
+        return test( releasedMask, id );
+    }
+
+    // Whether the window was closed, this stays set once it happens
+    bool quitRequested() const {
+        return quit;
+    }
+
+    /**
+     * Get this frame's events, for anything not covered by actions, eg. clicks or
+     * SDL_RENDER_TARGETS_RESET. Mouse motion isn't included, use mouse() instead.
+     */
+    const std::vector<SDL_Event>& frameEvents() const {
+        return events;
+    }
+
+    /**
+     * Get the mouse position and button state as of this frame
+     * @return the button mask, test it with SDL_BUTTON
+     */
+    Uint32 mouse( int *x, int *y ) const {
+        if ( x != nullptr ) {
+            *x = mouseX;
+        }
+        if ( y != nullptr ) {
+            *y = mouseY;
+        }
+        return buttons;
+    }
+
+    // The number of mouse motion events folded into the mouse position this frame
+    size_t motionCount() const {
+        return motionEvents;
+    }
+
+private:
+    struct Binding {
+        SDL_Scancode key;
+        int action;
+    };
+
+    Input( const Input& );
+    Input& operator=( const Input& );
+
+    Uint32 actionsFor( SDL_Scancode key ) const {
+        return key > SDL_SCANCODE_UNKNOWN && key < SDL_NUM_SCANCODES ? keyActions[key] : 0;
+    }
+
+    void setKey( SDL_Scancode key, Uint8 down ) {
+        if ( key > SDL_SCANCODE_UNKNOWN && key < SDL_NUM_SCANCODES ) {
+            keyState[key] = down;
+        }
+    }
+
+    static bool test( Uint32 mask, int id ) {
+        return id >= 0 && ( mask & ( 1u << id ) ) != 0;
+    }
+
+    // The actions each key drives, as a mask of action ids
+    Uint32 keyActions[SDL_NUM_SCANCODES];
+    // The keys held according to the events, used instead of SDL's state with setEventState
+    Uint8 keyState[SDL_NUM_SCANCODES];
+    std::vector<Binding> bindings;
+    std::vector<std::string> actions;
+    std::vector<SDL_Event> events;
+    Uint32 heldMask, pressedMask, releasedMask;
+    bool quit;
+    bool fromEvents;
+    int mouseX, mouseY;
+    Uint32 buttons;
+    size_t motionEvents;
+};
+
+#endif
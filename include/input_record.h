@@ -0,0 +1,327 @@
+#ifndef INPUT_RECORD_H
+#define INPUT_RECORD_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+
+#include "input.h"
+
+/*
+ * Recorded input files written by InputRecorder and played back by InputReplay.
+ * Everything is little endian:
+ *
+ * char[4] magic "IREC"
+ * u16 version
+ * u16 reserved, 0
+ * u32 simulation step in microseconds
+ * records, in tick order:
+ *   u32 simulation tick the event was handled on
+ *   u16 SDL event type
+ *   u16 scancode for key events, button for mouse button events, otherwise 0
+ *   s32 mouse x for mouse events, otherwise 0
+ *   s32 mouse y for mouse events, otherwise 0
+ *
+ * Only what the simulation reacts to is kept: quits, key presses and releases
+ * (not repeats), mouse buttons and the mouse position once per frame it moved.
+ */
+const Uint16 INPUT_RECORD_VERSION = 1;
+const size_t INPUT_RECORD_HEADER_SIZE = 12;
+const size_t INPUT_RECORD_SIZE = 16;
+
+/*
+ * Writes the input a session handled, tagged with the simulation tick it was
+ * handled on, so InputReplay can feed it back at exactly the same point in the
+ * simulation:
+ *
+ * InputRecorder recorder;
+ * recorder.open( "session.rec", loop.dt() );
+ * while ( !quit ) {
+ *     input.update();
+ *     recorder.record( loop.tick(), input );
+ *     ...
+ * }
+ */
+class InputRecorder {
+public:
+    InputRecorder() : rw( nullptr ), failed( false ) {}
+
+    ~InputRecorder() {
+        close();
+    }
+
+    /**
+     * Start recording to a file, replacing it if it exists
+     * @param file The file to write
+     * @param step The length of a simulation step in seconds
+     * @return false if the file couldn't be created, the error is in SDL_GetError
+     */
+    bool open( const std::string &file, double step ) {
+        close();
+        rw = SDL_RWFromFile( file.c_str(), "wb" );
+        if ( rw == nullptr ) {
+            return false;
+        }
+        failed = SDL_RWwrite( rw, "IREC", 1, 4 ) != 4;
+        put16( INPUT_RECORD_VERSION );
+        put16( 0 );
+        put32( static_cast<Uint32>( step * 1e6 + 0.5 ) );
+        return !failed;
+    }
+
+    /**
+     * Record the input handled this frame, call this after Input::update
+     * @param tick The simulation tick the input is handled on, ie. GameLoop::tick before stepping
+     * @param input The input state that was just updated
+     */
+    void record( Uint64 tick, const Input &input ) {
+        if ( rw == nullptr ) {
+            return;
+        }
+        const Uint32 t = static_cast<Uint32>( tick );
+        if ( input.motionCount() != 0 ) {
+            int x, y;
+            input.mouse( &x, &y );
+            put( t, SDL_MOUSEMOTION, 0, x, y );
+        }
+        const std::vector<SDL_Event> &events = input.frameEvents();
+        for ( size_t i = 0; i < events.size(); ++i ) {
+            const SDL_Event &e = events[i];
+            switch ( e.type ) {
+                case SDL_QUIT:
+                    put( t, e.type, 0, 0, 0 );
+                    break;
+                case SDL_KEYDOWN:
+                case SDL_KEYUP:
+                    if ( !e.key.repeat ) {
+                        put( t, e.type, static_cast<Uint16>( e.key.keysym.scancode ), 0, 0 );
+                    }
+                    break;
+                case SDL_MOUSEBUTTONDOWN:
+                case SDL_MOUSEBUTTONUP:
+                    put( t, e.type, e.button.button, e.button.x, e.button.y );
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    /**
+     * Finish the recording
+     * @return false if anything couldn't be written, the error is in SDL_GetError
+     */
+    bool close() {
+        if ( rw == nullptr ) {
+            return true;
+        }
+        failed = SDL_RWclose( rw ) != 0 || failed;
+        rw = nullptr;
+        return !failed;
+    }
+
+    bool isOpen() const {
+        return rw != nullptr;
+    }
+
+private:
+    InputRecorder( const InputRecorder& );
+    InputRecorder& operator=( const InputRecorder& );
+
+    void put( Uint32 tick, Uint32 type, Uint16 code, Sint32 x, Sint32 y ) {
+        put32( tick );
+        put16( static_cast<Uint16>( type ) );
+        put16( code );
+        put32( static_cast<Uint32>( x ) );
+        put32( static_cast<Uint32>( y ) );
+    }
+
+    void put16( Uint16 v ) {
+        failed = SDL_WriteLE16( rw, v ) != 1 || failed;
+    }
+
+    void put32( Uint32 v ) {
+        failed = SDL_WriteLE32( rw, v ) != 1 || failed;
+    }
+
+    SDL_RWops *rw;
+    bool failed;
+};
+
+/*
+ * Plays a recording back by pushing its events onto the SDL queue when the
+ * simulation reaches the tick they were recorded on. For the simulation to see
+ * the same ticks it did while recording, the game loop has to run in lockstep
+ * and Input has to take its state from the events:
+ *
+ * InputReplay replay;
+ * replay.open( "session.rec" );
+ * loop.setLockstep( true );
+ * loop.setFrameCap( 0 );
+ * input.setEventState( true );
+ * while ( !quit ) {
+ *     replay.pump( loop.tick() );
+ *     input.update();
+ *     ...
+ *     quit = quit || replay.finished();
+ * }
+ *
+ * It also times the frames it's pumped on, so a replay doubles as a benchmark.
+ */
+class InputReplay {
+public:
+    InputReplay() : next( 0 ), stepMicros( 0 ), frameCount( 0 ), started( 0 ), last( 0 ), worst( 0 ) {}
+
+    /**
+     * Load a recording
+     * @return false if the file couldn't be read or isn't a recording, the error is in SDL_GetError
+     */
+    bool open( const std::string &file ) {
+        records.clear();
+        next = 0;
+        SDL_RWops *rw = SDL_RWFromFile( file.c_str(), "rb" );
+        if ( rw == nullptr ) {
+            return false;
+        }
+        std::vector<Uint8> data;
+        const Sint64 size = SDL_RWsize( rw );
+        bool ok = size >= 0;
+        if ( ok ) {
+            data.resize( static_cast<size_t>( size ) );
+            ok = data.empty() || SDL_RWread( rw, data.data(), 1, data.size() ) == data.size();
+        }
+        SDL_RWclose( rw );
+        if ( !ok ) {
+            SDL_SetError( "Couldn't read input recording %s", file.c_str() );
+            return false;
+        }
+        if ( data.size() < INPUT_RECORD_HEADER_SIZE || SDL_memcmp( data.data(), "IREC", 4 ) != 0
+                || get( &data[4], 2 ) != INPUT_RECORD_VERSION
+                || ( data.size() - INPUT_RECORD_HEADER_SIZE ) % INPUT_RECORD_SIZE != 0 )
+        {
+            SDL_SetError( "%s isn't a supported input recording", file.c_str() );
+            return false;
+        }
+        stepMicros = get( &data[8], 4 );
+
+        for ( size_t off = INPUT_RECORD_HEADER_SIZE; off < data.size(); off += INPUT_RECORD_SIZE ) {
+            const Uint8 *p = &data[off];
+            Record r;
+            r.tick = get( p, 4 );
+            r.type = get( p + 4, 2 );
+            r.code = static_cast<Uint16>( get( p + 6, 2 ) );
+            r.x = static_cast<Sint32>( get( p + 8, 4 ) );
+            r.y = static_cast<Sint32>( get( p + 12, 4 ) );
+            if ( !records.empty() && r.tick < records.back().tick ) {
+                SDL_SetError( "%s has records out of tick order", file.c_str() );
+                records.clear();
+                return false;
+            }
+            records.push_back( r );
+        }
+        return true;
+    }
+
+    /**
+     * Push the events recorded up to and including a tick, call once a frame before Input::update
+     * @param tick The simulation tick about to be run, ie. GameLoop::tick
+     */
+    void pump( Uint64 tick ) {
+        const Uint64 now = SDL_GetPerformanceCounter();
+        if ( frameCount == 0 ) {
+            started = now;
+        } else {
+            worst = SDL_max( worst, now - last );
+        }
+        last = now;
+        ++frameCount;
+
+        for ( ; next < records.size() && records[next].tick <= tick; ++next ) {
+            SDL_Event e = toEvent( records[next] );
+            SDL_PushEvent( &e );
+        }
+    }
+
+    // Whether every recorded event has been pushed
+    bool finished() const {
+        return next == records.size();
+    }
+
+    // The simulation step the recording was made with, in seconds
+    double step() const {
+        return stepMicros / 1e6;
+    }
+
+    // The number of frames pumped so far
+    Uint64 frames() const {
+        return frameCount;
+    }
+
+    // The time from the first frame pumped to the last, in seconds
+    double seconds() const {
+        return static_cast<double>( last - started ) / SDL_GetPerformanceFrequency();
+    }
+
+    // The longest frame seen so far, in milliseconds
+    double worstFrameMs() const {
+        return worst * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+
+private:
+    struct Record {
+        Uint32 tick;
+        Uint32 type;
+        Uint16 code;
+        Sint32 x, y;
+    };
+
+    InputReplay( const InputReplay& );
+    InputReplay& operator=( const InputReplay& );
+
+    static Uint32 get( const Uint8 *p, int bytes ) {
+        Uint32 v = 0;
+        for ( int i = bytes - 1; i >= 0; --i ) {
+            v = v << 8 | p[i];
+        }
+        return v;
+    }
+
+    static SDL_Event toEvent( const Record &r ) {
+        SDL_Event e;
+        SDL_memset( &e, 0, sizeof( e ) );
+        e.type = r.type;
+        switch ( r.type ) {
+            case SDL_KEYDOWN:
+            case SDL_KEYUP:
+                e.key.state = r.type == SDL_KEYDOWN ? SDL_PRESSED : SDL_RELEASED;
+                e.key.keysym.scancode = static_cast<SDL_Scancode>( r.code );
+                e.key.keysym.sym = SDL_GetKeyFromScancode( e.key.keysym.scancode );
+                break;
+            case SDL_MOUSEBUTTONDOWN:
+            case SDL_MOUSEBUTTONUP:
+                e.button.state = r.type == SDL_MOUSEBUTTONDOWN ? SDL_PRESSED : SDL_RELEASED;
+                e.button.button = static_cast<Uint8>( r.code );
+                e.button.clicks = 1;
+                e.button.x = r.x;
+                e.button.y = r.y;
+                break;
+            case SDL_MOUSEMOTION:
+                e.motion.x = r.x;
+                e.motion.y = r.y;
+                break;
+            default:
+                break;
+        }
+        e.common.timestamp = SDL_GetTicks();
+        return e;
+    }
+
+    std::vector<Record> records;
+    size_t next;
+    Uint32 stepMicros;
+    Uint64 frameCount;
+    Uint64 started, last, worst;
+};
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef MIP_CHAIN_H
+#define MIP_CHAIN_H
+
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+
+#include "cleanup.h"
+#include "simd.h"
+#include "texture_normalizer.h"
+
+/*
+ * A texture along with copies of it at half, a quarter, an eighth... of its size,
+ * down to a single pixel. Drawing something much smaller than its texture makes the
+ * renderer sample a big source for a few pixels, which wastes bandwidth (on the
+ * software renderer especially) and shimmers as the size changes, since most source
+ * pixels are skipped. Drawing from the level closest to the destination size avoids
+ * both:
+ *
+ * MipChain mips;
+ * mips.build( ren, surface );
+ * mips.draw( ren, NULL, dst );
+ *
+ * Each level is a 2x2 box filter of the one above it. Colors are averaged as they
+ * are, so images with straight alpha can pick up a dark fringe where opaque pixels
+ * meet transparent black ones at the smaller levels. Building through a
+ * TextureNormalizer that premultiplies avoids that, and gives every level the
+ * renderer's format and the normalizer's blend mode.
+ */
+class MipChain {
+public:
+    MipChain() {}
+
+    /**
+     * Build the levels for an image and upload them, replacing any we had
+     * @param ren The renderer to create the textures on
+     * @param surf The full size image, it's left alone
+     * @param minSize Stop once a level's width or height would go below this
+     * @return false if something went wrong, the error is in SDL_GetError
+     */
+    bool build( SDL_Renderer *ren, SDL_Surface *surf, int minSize = 1 ) {
+        clear();
+        // The downsampler works on whole 32 bit pixels, the order of the channels doesn't matter
+        const Uint32 format = surf->format->BytesPerPixel == 4 ? surf->format->format
+            : static_cast<Uint32>( SDL_PIXELFORMAT_ARGB8888 );
+        return buildLevels( SDL_ConvertSurfaceFormat( surf, format, 0 ), minSize, [ren]( SDL_Surface *level, int ) {
+            return SDL_CreateTextureFromSurface( ren, level );
+        });
+    }
+
+    /**
+     * Build the levels from an image normalized for the renderer, each level is
+     * uploaded through the normalizer and shows up in its report
+     * @param normalizer The normalizer for the renderer to create the textures on
+     * @param surf The full size image, it's left alone
+     * @param name What to call the image in the report
+     * @param minSize Stop once a level's width or height would go below this
+     * @return false if something went wrong, the error is in SDL_GetError
+     */
+    bool build( TextureNormalizer &normalizer, SDL_Surface *surf, const std::string &name, int minSize = 1 ) {
+        clear();
+        TextureConversion report;
+        report.name = name;
+        SDL_Surface *base = normalizer.normalize( surf, report );
+        return buildLevels( base, minSize, [&normalizer, &report, &name]( SDL_Surface *level, int index ) {
+            TextureConversion levelReport = report;
+            if ( index > 0 ) {
+                // The smaller levels are downsampled from the normalized one, not converted
+                levelReport.name = name + " level " + std::to_string( index );
+                levelReport.sourceFormat = level->format->format;
+                levelReport.converted = false;
+                levelReport.convertMs = levelReport.scanMs = levelReport.premultiplyMs = 0;
+            }
+            return normalizer.upload( level, levelReport );
+        });
+    }
+
+    /**
+     * Destroy the textures, this must be done before the renderer is destroyed
+     */
+    void clear() {
+        textures.clear();
+        sizes.clear();
+    }
+
+    // The number of levels, 0 until something's been built
+    int levels() const {
+        return static_cast<int>( textures.size() );
+    }
+
+    SDL_Texture* texture( int level ) const {
+        return textures[level].get();
+    }
+
+    int width( int level ) const {
+        return sizes[level].w;
+    }
+
+    int height( int level ) const {
+        return sizes[level].h;
+    }
+
+    /**
+     * Pick the level to draw at some size, the smallest level that's still at least
+     * that big so nothing is magnified that doesn't have to be
+     */
+    int pick( int dstW, int dstH ) const {
+        int level = 0;
+        while ( level + 1 < levels() && sizes[level + 1].w >= dstW && sizes[level + 1].h >= dstH ) {
+            ++level;
+        }
+        return level;
+    }
+
+    /**
+     * Draw (part of) the image scaled to some rect, from the level closest to its size
+     * @param ren The renderer to draw with
+     * @param clip The part of the image to draw in full size pixels, NULL for all of it
+     * @param dst Where to draw it
+     * @return the result of SDL_RenderCopy
+     */
+    int draw( SDL_Renderer *ren, const SDL_Rect *clip, const SDL_Rect &dst ) const {
+        if ( textures.empty() ) {
+            return SDL_SetError( "MipChain has no levels" );
+        }
+        if ( clip == nullptr ) {
+            const int level = pick( dst.w, dst.h );
+            return SDL_RenderCopy( ren, textures[level].get(), NULL, &dst );
+        }
+
+        // Pick by how much the clip's shrunk, then scale it down to that level
+        const int level = pick( sizes[0].w * dst.w / SDL_max( clip->w, 1 ), sizes[0].h * dst.h / SDL_max( clip->h, 1 ) );
+        SDL_Rect src = { clip->x >> level, clip->y >> level, SDL_max( clip->w >> level, 1 ), SDL_max( clip->h >> level, 1 ) };
+        return SDL_RenderCopy( ren, textures[level].get(), &src, &dst );
+    }
+
+    /**
+     * Make a half size copy of a 32 bit surface, each pixel the rounded average of a
+     * 2x2 block. An odd last row or column is dropped, except when the image is only a
+     * pixel wide or tall in that direction.
+     * @return the new surface in the same format, or nullptr if it couldn't be created
+     */
+    static SDL_Surface* downsample( SDL_Surface *src ) {
+        const int w = SDL_max( src->w / 2, 1 ), h = SDL_max( src->h / 2, 1 );
+        SDL_Surface *dst = SDL_CreateRGBSurfaceWithFormat( 0, w, h, 32, src->format->format );
+        if ( dst == nullptr ) {
+            return nullptr;
+        }
+        // A source one pixel across is averaged with itself
+        const int dx = src->w > 1 ? 1 : 0;
+        for ( int y = 0; y < h; ++y ) {
+            const Uint8 *base = static_cast<const Uint8*>( src->pixels );
+            const Uint32 *row0 = reinterpret_cast<const Uint32*>( base + 2 * y * src->pitch );
+            const Uint32 *row1 = reinterpret_cast<const Uint32*>( base + SDL_min( 2 * y + 1, src->h - 1 ) * src->pitch );
+            Uint32 *out = reinterpret_cast<Uint32*>( static_cast<Uint8*>( dst->pixels ) + y * dst->pitch );
+            int x = 0;
+#if SIMD_SSE2
+            if ( dx != 0 ) {
+                x = downsampleRow( row0, row1, out, w );
+            }
+#endif
+            for ( ; x < w; ++x ) {
+                const Uint32 a = row0[2 * x], b = row0[2 * x + dx], c = row1[2 * x], d = row1[2 * x + dx];
+                Uint32 p = 0;
+                for ( int shift = 0; shift < 32; shift += 8 ) {
+                    const Uint32 sum = ( a >> shift & 0xff ) + ( b >> shift & 0xff ) + ( c >> shift & 0xff )
+                        + ( d >> shift & 0xff ) + 2;
+                    p |= ( sum >> 2 ) << shift;
+                }
+                out[x] = p;
+            }
+        }
+        return dst;
+    }
+
+private:
+    /**
+     * Upload a 32 bit image and halve it until it's below minSize
+     * @param base The full size level, which we take ownership of, nullptr fails
+     * @param upload Makes a texture from a level's surface and index
+     */
+    template<typename Upload>
+    bool buildLevels( SDL_Surface *base, int minSize, Upload upload ) {
+        SurfacePtr level( base );
+        while ( level != nullptr ) {
+            TexturePtr tex( upload( level.get(), levels() ) );
+            if ( tex == nullptr ) {
+                clear();
+                return false;
+            }
+            Level l = { level->w, level->h };
+            sizes.push_back( l );
+            textures.push_back( std::move( tex ) );
+            if ( level->w / 2 < SDL_max( minSize, 1 ) || level->h / 2 < SDL_max( minSize, 1 ) ) {
+                return true;
+            }
+            level.reset( downsample( level.get() ) );
+        }
+        clear();
+        return false;
+    }
+
+    struct Level {
+        int w, h;
+    };
+
+    MipChain( const MipChain& );
+    MipChain& operator=( const MipChain& );
+
+#if SIMD_SSE2
+    /**
+     * Average 2x2 blocks of two source rows as far as the vector path can take them
+     * @return the number of output pixels written, the rest are left for the scalar loop
+     */
+    static int downsampleRow( const Uint32 *row0, const Uint32 *row1, Uint32 *out, int w ) {
+        int x = 0;
+#if SIMD_AVX2
+        for ( ; x + 8 <= w; x += 8 ) {
+            const __m256i lo = average8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( row0 + 2 * x ) ),
+                    _mm256_loadu_si256( reinterpret_cast<const __m256i*>( row1 + 2 * x ) ) );
+            const __m256i hi = average8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( row0 + 2 * x + 8 ) ),
+                    _mm256_loadu_si256( reinterpret_cast<const __m256i*>( row1 + 2 * x + 8 ) ) );
+            // packus works within 128 bit lanes, put the four pairs of pixels back in order
+            const __m256i packed = _mm256_packus_epi16( lo, hi );
+            _mm256_storeu_si256( reinterpret_cast<__m256i*>( out + x ),
+                    _mm256_permute4x64_epi64( packed, _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+        }
+#endif
+        for ( ; x + 4 <= w; x += 4 ) {
+            const __m128i lo = average4( _mm_loadu_si128( reinterpret_cast<const __m128i*>( row0 + 2 * x ) ),
+                    _mm_loadu_si128( reinterpret_cast<const __m128i*>( row1 + 2 * x ) ) );
+            const __m128i hi = average4( _mm_loadu_si128( reinterpret_cast<const __m128i*>( row0 + 2 * x + 4 ) ),
+                    _mm_loadu_si128( reinterpret_cast<const __m128i*>( row1 + 2 * x + 4 ) ) );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( out + x ), _mm_packus_epi16( lo, hi ) );
+        }
+        return x;
+    }
+
+    // Average four pixels from each of two rows down to two, widened to 16 bits a channel
+    static __m128i average4( __m128i a, __m128i b ) {
+        const __m128i zero = _mm_setzero_si128();
+        // Columns 0 and 1, then 2 and 3, summed down the rows
+        const __m128i left = _mm_add_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ) );
+        const __m128i right = _mm_add_epi16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( b, zero ) );
+        const __m128i sum = _mm_add_epi16( _mm_unpacklo_epi64( left, right ), _mm_unpackhi_epi64( left, right ) );
+        return _mm_srli_epi16( _mm_add_epi16( sum, _mm_set1_epi16( 2 ) ), 2 );
+    }
+#endif
+
+#if SIMD_AVX2
+    static __m256i average8( __m256i a, __m256i b ) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i left = _mm256_add_epi16( _mm256_unpacklo_epi8( a, zero ), _mm256_unpacklo_epi8( b, zero ) );
+        const __m256i right = _mm256_add_epi16( _mm256_unpackhi_epi8( a, zero ), _mm256_unpackhi_epi8( b, zero ) );
+        const __m256i sum = _mm256_add_epi16( _mm256_unpacklo_epi64( left, right ), _mm256_unpackhi_epi64( left, right ) );
+        return _mm256_srli_epi16( _mm256_add_epi16( sum, _mm256_set1_epi16( 2 ) ), 2 );
+    }
+#endif
+
+    std::vector<TexturePtr> textures;
+    std::vector<Level> sizes;
+};
+
+#endif
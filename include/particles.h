@@ -0,0 +1,543 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include <SDL2/SDL.h>
+
+#include "simd.h"
+#include "soft_raster.h"
+#include "sprite_batch.h"
+#include "sprite_store.h"
+
+/*
+ * Where and how a ParticlePool spawns particles. Each particle leaves the emitter
+ * in a random direction within spread of angle, at a random speed and with a random
+ * lifetime in their ranges, and fades from startColor to endColor over its life.
+ */
+struct ParticleEmitter {
+    float x, y;
+    // Particles a second
+    float rate;
+    // Direction and the most a particle may stray either side of it, in radians
+    float angle, spread;
+    // In pixels a second
+    float speedMin, speedMax;
+    // In seconds
+    float lifeMin, lifeMax;
+    SDL_Color startColor, endColor;
+    // The part of a particle left over from the last emit, so low rates still come out right
+    float carry;
+
+    ParticleEmitter() : x( 0 ), y( 0 ), rate( 100 ), angle( 0 ), spread( 3.14159265f ),
+        speedMin( 50 ), speedMax( 100 ), lifeMin( 1 ), lifeMax( 1 ), carry( 0 )
+    {
+        const SDL_Color white = { 255, 255, 255, 255 };
+        const SDL_Color clear = { 255, 255, 255, 0 };
+        startColor = white;
+        endColor = clear;
+    }
+};
+
+/*
+ * A fixed number of particles drawn with one texture, stored as a structure of
+ * arrays so the per frame update streams through packed floats 4 or 8 particles at
+ * a time. All the live particles are drawn with a single SDL_RenderGeometry call
+ * instead of an SDL_RenderCopy each, which saves a draw call per particle on the
+ * GPU renderers:
+ *
+ * ParticlePool sparks( 10000, sparkTexture );
+ * sparks.setGravity( 0, 200 );
+ *
+ * // each update
+ * sparks.emit( emitter, dt );
+ * sparks.update( dt );
+ *
+ * // each frame
+ * sparks.draw( ren );
+ *
+ * SDL's software renderer splits geometry back into a copy per quad, so without a
+ * GPU draw into a SoftRasterizer instead, which spreads the particles over its
+ * threads: sparks.draw( raster, &sparkImage ).
+ *
+ * Particles are squares of size() pixels centered on their position, and the
+ * texture's blend mode is used as it is, so set it to SDL_BLENDMODE_ADD for a glow.
+ * Use a pool per texture. When a pool's full new particles are dropped until some
+ * die, and a dying particle's place is taken by the last one, so particles don't
+ * keep their index from one update to the next.
+ */
+class ParticlePool {
+public:
+    /**
+     * Create a pool, all its memory is allocated up front
+     * @param capacity The most particles that can be alive at once
+     * @param tex The texture to draw the particles with, nullptr draws them as solid squares
+     * @param clip The sub-section of the texture to draw, nullptr draws the entire texture
+     * @param size The width and height of a particle in pixels
+     */
+    explicit ParticlePool( size_t capacity, SDL_Texture *tex = nullptr, const SDL_Rect *clip = nullptr, float size = 4 )
+        : maxParticles( capacity ), texture( nullptr ), particleSize( size ), gravityX( 0 ), gravityY( 0 ),
+        mode( SPRITE_BATCH_HAS_GEOMETRY ? SpriteBatch::SUBMIT_GEOMETRY : SpriteBatch::SUBMIT_COPY ), seed( 0x9e3779b9 )
+    {
+        AlignedArray<float> *fields[FIELD_COUNT];
+        allFields( fields );
+        for ( int f = 0; f < FIELD_COUNT; ++f ) {
+            fields[f]->reserve( capacity );
+        }
+        dead.reserve( capacity );
+        positions.resize( capacity * 8 );
+        colors.resize( capacity * 4 );
+        indices.resize( capacity * 6 );
+        const int quadIndices[] = { 0, 1, 2, 0, 2, 3 };
+        for ( size_t i = 0; i < capacity; ++i ) {
+            for ( int k = 0; k < 6; ++k ) {
+                indices[i * 6 + k] = static_cast<int>( i * 4 ) + quadIndices[k];
+            }
+        }
+        setTexture( tex, clip );
+    }
+
+    /**
+     * Change the texture the particles are drawn with
+     * @param tex The texture, nullptr draws solid squares
+     * @param clip The sub-section of the texture to draw, nullptr draws the entire texture
+     */
+    void setTexture( SDL_Texture *tex, const SDL_Rect *clip = nullptr ) {
+        texture = tex;
+        fullTexture = ( clip == nullptr );
+        if ( clip != nullptr ) {
+            src = *clip;
+        }
+        if ( tex == nullptr ) {
+            uvs.clear();
+            return;
+        }
+        // Every quad samples the same part of the texture, so the coordinates only change with it
+        float u0 = 0, v0 = 0, u1 = 1, v1 = 1;
+        if ( clip != nullptr ) {
+            int texW, texH;
+            SDL_QueryTexture( tex, NULL, NULL, &texW, &texH );
+            u0 = static_cast<float>( clip->x ) / texW;
+            v0 = static_cast<float>( clip->y ) / texH;
+            u1 = static_cast<float>( clip->x + clip->w ) / texW;
+            v1 = static_cast<float>( clip->y + clip->h ) / texH;
+        }
+        const float quad[] = { u0, v0, u1, v0, u1, v1, u0, v1 };
+        uvs.resize( maxParticles * 8 );
+        for ( size_t i = 0; i < uvs.size(); ++i ) {
+            uvs[i] = quad[i % 8];
+        }
+    }
+
+    SDL_Texture* getTexture() const {
+        return texture;
+    }
+
+    void setSize( float size ) {
+        particleSize = size;
+    }
+
+    float size() const {
+        return particleSize;
+    }
+
+    // Acceleration applied to every particle, in pixels a second squared
+    void setGravity( float x, float y ) {
+        gravityX = x;
+        gravityY = y;
+    }
+
+    /**
+     * Pick how draw submits the particles, geometry is only available on SDL 2.0.18 and later
+     * and falls back to copies without it
+     */
+    void setSubmitMode( SpriteBatch::SubmitMode m ) {
+        mode = SPRITE_BATCH_HAS_GEOMETRY ? m : SpriteBatch::SUBMIT_COPY;
+    }
+
+    // The number of live particles
+    size_t count() const {
+        return px.size();
+    }
+
+    size_t capacity() const {
+        return maxParticles;
+    }
+
+    // Kill every particle
+    void clear() {
+        AlignedArray<float> *fields[FIELD_COUNT];
+        allFields( fields );
+        for ( int f = 0; f < FIELD_COUNT; ++f ) {
+            fields[f]->clear();
+        }
+    }
+
+    /**
+     * Add a particle
+     * @param x The x coordinate of the particle's center
+     * @param y The y coordinate of the particle's center
+     * @param vx The particle's velocity along x in pixels a second
+     * @param vy The particle's velocity along y in pixels a second
+     * @param life How long the particle lives for in seconds
+     * @param start The particle's color when it's spawned
+     * @param end The color the particle fades to by the time it dies
+     * @return false if the pool is full and the particle was dropped
+     */
+    bool spawn( float x, float y, float vx, float vy, float life, SDL_Color start, SDL_Color end ) {
+        if ( px.size() == maxParticles || life <= 0 ) {
+            return false;
+        }
+        px.push_back( x );
+        py.push_back( y );
+        pvx.push_back( vx );
+        pvy.push_back( vy );
+        plife.push_back( life );
+        // Colors fade linearly, so each channel has a constant rate of change over the particle's life
+        const float inv = 1.0f / life;
+        pr.push_back( start.r );
+        pg.push_back( start.g );
+        pb.push_back( start.b );
+        pa.push_back( start.a );
+        pdr.push_back( ( end.r - start.r ) * inv );
+        pdg.push_back( ( end.g - start.g ) * inv );
+        pdb.push_back( ( end.b - start.b ) * inv );
+        pda.push_back( ( end.a - start.a ) * inv );
+        return true;
+    }
+
+    /**
+     * Spawn the particles an emitter puts out over some time
+     * @param emitter The emitter, its carry is updated
+     * @param dt The time passed in seconds
+     * @return the number of particles spawned, less than were emitted if the pool filled up
+     */
+    size_t emit( ParticleEmitter &emitter, float dt ) {
+        const float total = emitter.rate * dt + emitter.carry;
+        const int n = static_cast<int>( total );
+        emitter.carry = total - n;
+        size_t spawned = 0;
+        for ( int i = 0; i < n; ++i ) {
+            const float angle = emitter.angle + ( random() * 2 - 1 ) * emitter.spread;
+            const float speed = emitter.speedMin + random() * ( emitter.speedMax - emitter.speedMin );
+            const float life = emitter.lifeMin + random() * ( emitter.lifeMax - emitter.lifeMin );
+            if ( !spawn( emitter.x, emitter.y, std::cos( angle ) * speed, std::sin( angle ) * speed, life,
+                        emitter.startColor, emitter.endColor ) )
+            {
+                break;
+            }
+            ++spawned;
+        }
+        return spawned;
+    }
+
+    /**
+     * Move every particle along by some time, fading its color, and remove the ones that died
+     * @param dt The time to move by in seconds
+     */
+    void update( float dt ) {
+        const size_t n = px.size();
+        const float gx = gravityX * dt, gy = gravityY * dt;
+        float *x = px.data(), *y = py.data(), *vx = pvx.data(), *vy = pvy.data(), *life = plife.data();
+        float *r = pr.data(), *g = pg.data(), *b = pb.data(), *a = pa.data();
+        const float *dr = pdr.data(), *dg = pdg.data(), *db = pdb.data(), *da = pda.data();
+        dead.clear();
+        size_t i = 0;
+#if SIMD_AVX
+        {
+            const __m256 vdt = _mm256_set1_ps( dt ), vgx = _mm256_set1_ps( gx ), vgy = _mm256_set1_ps( gy );
+            const __m256 zero = _mm256_setzero_ps();
+            for ( ; i + 8 <= n; i += 8 ) {
+                const __m256 nvx = _mm256_add_ps( _mm256_load_ps( vx + i ), vgx );
+                const __m256 nvy = _mm256_add_ps( _mm256_load_ps( vy + i ), vgy );
+                _mm256_store_ps( vx + i, nvx );
+                _mm256_store_ps( vy + i, nvy );
+                _mm256_store_ps( x + i, _mm256_add_ps( _mm256_load_ps( x + i ), _mm256_mul_ps( nvx, vdt ) ) );
+                _mm256_store_ps( y + i, _mm256_add_ps( _mm256_load_ps( y + i ), _mm256_mul_ps( nvy, vdt ) ) );
+                _mm256_store_ps( r + i, _mm256_add_ps( _mm256_load_ps( r + i ), _mm256_mul_ps( _mm256_load_ps( dr + i ), vdt ) ) );
+                _mm256_store_ps( g + i, _mm256_add_ps( _mm256_load_ps( g + i ), _mm256_mul_ps( _mm256_load_ps( dg + i ), vdt ) ) );
+                _mm256_store_ps( b + i, _mm256_add_ps( _mm256_load_ps( b + i ), _mm256_mul_ps( _mm256_load_ps( db + i ), vdt ) ) );
+                _mm256_store_ps( a + i, _mm256_add_ps( _mm256_load_ps( a + i ), _mm256_mul_ps( _mm256_load_ps( da + i ), vdt ) ) );
+                const __m256 left = _mm256_sub_ps( _mm256_load_ps( life + i ), vdt );
+                _mm256_store_ps( life + i, left );
+                collectDead( _mm256_movemask_ps( _mm256_cmp_ps( left, zero, _CMP_LE_OQ ) ), i );
+            }
+        }
+#endif
+#if SIMD_SSE2
+        {
+            const __m128 vdt = _mm_set1_ps( dt ), vgx = _mm_set1_ps( gx ), vgy = _mm_set1_ps( gy );
+            const __m128 zero = _mm_setzero_ps();
+            for ( ; i + 4 <= n; i += 4 ) {
+                const __m128 nvx = _mm_add_ps( _mm_load_ps( vx + i ), vgx );
+                const __m128 nvy = _mm_add_ps( _mm_load_ps( vy + i ), vgy );
+                _mm_store_ps( vx + i, nvx );
+                _mm_store_ps( vy + i, nvy );
+                _mm_store_ps( x + i, _mm_add_ps( _mm_load_ps( x + i ), _mm_mul_ps( nvx, vdt ) ) );
+                _mm_store_ps( y + i, _mm_add_ps( _mm_load_ps( y + i ), _mm_mul_ps( nvy, vdt ) ) );
+                _mm_store_ps( r + i, _mm_add_ps( _mm_load_ps( r + i ), _mm_mul_ps( _mm_load_ps( dr + i ), vdt ) ) );
+                _mm_store_ps( g + i, _mm_add_ps( _mm_load_ps( g + i ), _mm_mul_ps( _mm_load_ps( dg + i ), vdt ) ) );
+                _mm_store_ps( b + i, _mm_add_ps( _mm_load_ps( b + i ), _mm_mul_ps( _mm_load_ps( db + i ), vdt ) ) );
+                _mm_store_ps( a + i, _mm_add_ps( _mm_load_ps( a + i ), _mm_mul_ps( _mm_load_ps( da + i ), vdt ) ) );
+                const __m128 left = _mm_sub_ps( _mm_load_ps( life + i ), vdt );
+                _mm_store_ps( life + i, left );
+                collectDead( _mm_movemask_ps( _mm_cmple_ps( left, zero ) ), i );
+            }
+        }
+#endif
+        for ( ; i < n; ++i ) {
+            vx[i] += gx;
+            vy[i] += gy;
+            x[i] += vx[i] * dt;
+            y[i] += vy[i] * dt;
+            r[i] += dr[i] * dt;
+            g[i] += dg[i] * dt;
+            b[i] += db[i] * dt;
+            a[i] += da[i] * dt;
+            life[i] -= dt;
+            if ( life[i] <= 0 ) {
+                dead.push_back( static_cast<Uint32>( i ) );
+            }
+        }
+
+        // Going from the back, anything past the one we're removing is already alive
+        AlignedArray<float> *fields[FIELD_COUNT];
+        allFields( fields );
+        for ( size_t d = dead.size(); d-- > 0; ) {
+            const size_t slot = dead[d], last = px.size() - 1;
+            for ( int f = 0; f < FIELD_COUNT; ++f ) {
+                AlignedArray<float> &field = *fields[f];
+                field[slot] = field[last];
+                field.pop_back();
+            }
+        }
+    }
+
+    /**
+     * Draw every live particle. If the renderer rejects the geometry they're drawn
+     * with copies instead
+     * @param ren The renderer to draw with
+     * @return the number of draw calls made, 1 when submitting geometry
+     */
+    size_t draw( SDL_Renderer *ren ) {
+        const size_t n = px.size();
+        if ( n == 0 ) {
+            return 0;
+        }
+#if SPRITE_BATCH_HAS_GEOMETRY
+        if ( mode == SpriteBatch::SUBMIT_GEOMETRY ) {
+            buildVertices();
+#if SDL_VERSION_ATLEAST(2, 0, 20)
+            const SDL_Color *vertexColors = colors.data();
+#else
+            // SDL 2.0.18 took the colors as ints, the memory layout's the same
+            const int *vertexColors = reinterpret_cast<const int*>( colors.data() );
+#endif
+            if ( SDL_RenderGeometryRaw( ren, texture, positions.data(), 2 * sizeof( float ), vertexColors, sizeof( SDL_Color ),
+                    texture != nullptr ? uvs.data() : NULL, 2 * sizeof( float ), static_cast<int>( n * 4 ),
+                    indices.data(), static_cast<int>( n * 6 ), sizeof( int ) ) == 0 ) {
+                return 1;
+            }
+        }
+#endif
+        return drawCopies( ren );
+    }
+
+    /**
+     * Queue every live particle on a SoftRasterizer, for drawing without a GPU
+     * @param raster The rasterizer to queue the particles on
+     * @param image The pixels of the pool's texture, its clip is used on them too.
+     *        nullptr draws solid squares
+     * @return the number of particles queued
+     */
+    size_t draw( SoftRasterizer &raster, const SoftImage *image ) {
+        const size_t n = px.size();
+        const float half = particleSize * 0.5f;
+        const int s = static_cast<int>( particleSize );
+        for ( size_t i = 0; i < n; ++i ) {
+            const SDL_Color c = { channel( pr[i] ), channel( pg[i] ), channel( pb[i] ), channel( pa[i] ) };
+            const SDL_Rect dst = { static_cast<int>( px[i] - half ), static_cast<int>( py[i] - half ), s, s };
+            if ( image != nullptr ) {
+                raster.draw( *image, dst, fullTexture ? nullptr : &src, c );
+            } else {
+                raster.fill( dst, c );
+            }
+        }
+        return n;
+    }
+
+    const float* x() const {
+        return px.data();
+    }
+
+    const float* y() const {
+        return py.data();
+    }
+
+    // The seconds each particle has left
+    const float* life() const {
+        return plife.data();
+    }
+
+private:
+    enum { FIELD_COUNT = 13 };
+
+    ParticlePool( const ParticlePool& );
+    ParticlePool& operator=( const ParticlePool& );
+
+    void allFields( AlignedArray<float> **fields ) {
+        AlignedArray<float> *all[FIELD_COUNT] = { &px, &py, &pvx, &pvy, &plife, &pr, &pg, &pb, &pa, &pdr, &pdg, &pdb, &pda };
+        for ( int f = 0; f < FIELD_COUNT; ++f ) {
+            fields[f] = all[f];
+        }
+    }
+
+    // Record the particles a comparison mask says died, starting from index base
+    void collectDead( int mask, size_t base ) {
+        while ( mask != 0 ) {
+            int lane = 0;
+            while ( ( mask >> lane & 1 ) == 0 ) {
+                ++lane;
+            }
+            dead.push_back( static_cast<Uint32>( base + lane ) );
+            mask &= mask - 1;
+        }
+    }
+
+    // Uniform in [0, 1), from a xorshift so emitting is cheap and the same every run
+    float random() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return ( seed >> 8 ) * ( 1.0f / 16777216.0f );
+    }
+
+    static Uint8 channel( float c ) {
+        return static_cast<Uint8>( c < 0 ? 0 : c > 255 ? 255 : c );
+    }
+
+    /**
+     * Fill in the corners and colors of each live particle's quad. The texture
+     * coordinates and indices never change so they were written up front.
+     */
+    void buildVertices() {
+        const size_t n = px.size();
+        const float half = particleSize * 0.5f;
+        const float *x = px.data(), *y = py.data();
+        const float *r = pr.data(), *g = pg.data(), *b = pb.data(), *a = pa.data();
+        float *pos = positions.data();
+        SDL_Color *col = colors.data();
+        size_t i = 0;
+#if SIMD_SSE2
+        const __m128 vhalf = _mm_set1_ps( half ), lo = _mm_setzero_ps(), hi = _mm_set1_ps( 255 );
+        for ( ; i + 4 <= n; i += 4 ) {
+            const __m128 cx = _mm_load_ps( x + i ), cy = _mm_load_ps( y + i );
+            const __m128 x0 = _mm_sub_ps( cx, vhalf ), x1 = _mm_add_ps( cx, vhalf );
+            const __m128 y0 = _mm_sub_ps( cy, vhalf ), y1 = _mm_add_ps( cy, vhalf );
+            // Interleave x and y for the corners, two particles at a time
+            storeQuads( pos + i * 8, _mm_unpacklo_ps( x0, y0 ), _mm_unpacklo_ps( x1, y0 ), _mm_unpacklo_ps( x1, y1 ),
+                    _mm_unpacklo_ps( x0, y1 ) );
+            storeQuads( pos + i * 8 + 16, _mm_unpackhi_ps( x0, y0 ), _mm_unpackhi_ps( x1, y0 ), _mm_unpackhi_ps( x1, y1 ),
+                    _mm_unpackhi_ps( x0, y1 ) );
+
+            // Clamp and truncate the channels, then pack them down to bytes as r0..r3 b0..b3 g0..g3 a0..a3
+            const __m128i ri = _mm_cvttps_epi32( _mm_min_ps( _mm_max_ps( _mm_load_ps( r + i ), lo ), hi ) );
+            const __m128i gi = _mm_cvttps_epi32( _mm_min_ps( _mm_max_ps( _mm_load_ps( g + i ), lo ), hi ) );
+            const __m128i bi = _mm_cvttps_epi32( _mm_min_ps( _mm_max_ps( _mm_load_ps( b + i ), lo ), hi ) );
+            const __m128i ai = _mm_cvttps_epi32( _mm_min_ps( _mm_max_ps( _mm_load_ps( a + i ), lo ), hi ) );
+            const __m128i planar = _mm_packus_epi16( _mm_packs_epi32( ri, bi ), _mm_packs_epi32( gi, ai ) );
+            // Interleave to r g b a for each particle, then repeat each one for its four corners
+            const __m128i rg = _mm_unpacklo_epi8( planar, _mm_srli_si128( planar, 8 ) );
+            const __m128i rgba = _mm_unpacklo_epi16( rg, _mm_srli_si128( rg, 8 ) );
+            __m128i *out4 = reinterpret_cast<__m128i*>( col + i * 4 );
+            _mm_storeu_si128( out4, _mm_shuffle_epi32( rgba, _MM_SHUFFLE( 0, 0, 0, 0 ) ) );
+            _mm_storeu_si128( out4 + 1, _mm_shuffle_epi32( rgba, _MM_SHUFFLE( 1, 1, 1, 1 ) ) );
+            _mm_storeu_si128( out4 + 2, _mm_shuffle_epi32( rgba, _MM_SHUFFLE( 2, 2, 2, 2 ) ) );
+            _mm_storeu_si128( out4 + 3, _mm_shuffle_epi32( rgba, _MM_SHUFFLE( 3, 3, 3, 3 ) ) );
+        }
+#endif
+        for ( ; i < n; ++i ) {
+            const float x0 = x[i] - half, x1 = x[i] + half, y0 = y[i] - half, y1 = y[i] + half;
+            const float corners[] = { x0, y0, x1, y0, x1, y1, x0, y1 };
+            for ( int k = 0; k < 8; ++k ) {
+                pos[i * 8 + k] = corners[k];
+            }
+            const SDL_Color c = { channel( r[i] ), channel( g[i] ), channel( b[i] ), channel( a[i] ) };
+            for ( int k = 0; k < 4; ++k ) {
+                col[i * 4 + k] = c;
+            }
+        }
+    }
+
+#if SIMD_SSE2
+    /**
+     * Write the quads of two particles given each corner's x, y for both of them, eg. tl holds
+     * the first particle's top left then the second's
+     */
+    static void storeQuads( float *out, __m128 tl, __m128 tr, __m128 br, __m128 bl ) {
+        _mm_storeu_ps( out, _mm_movelh_ps( tl, tr ) );
+        _mm_storeu_ps( out + 4, _mm_movelh_ps( br, bl ) );
+        _mm_storeu_ps( out + 8, _mm_movehl_ps( tr, tl ) );
+        _mm_storeu_ps( out + 12, _mm_movehl_ps( bl, br ) );
+    }
+#endif
+
+    // Draw each particle with its own SDL_RenderCopy, modulating the texture by its color
+    size_t drawCopies( SDL_Renderer *ren ) {
+        const size_t n = px.size();
+        const float half = particleSize * 0.5f;
+        const int s = static_cast<int>( particleSize );
+        // Each particle's color replaces the texture's mod, put the caller's back after
+        SDL_Color callerMod = { 255, 255, 255, 255 };
+        if ( texture != nullptr ) {
+            SDL_GetTextureColorMod( texture, &callerMod.r, &callerMod.g, &callerMod.b );
+            SDL_GetTextureAlphaMod( texture, &callerMod.a );
+        }
+        const Uint32 untinted = static_cast<Uint32>( callerMod.r ) << 24 | callerMod.g << 16 | callerMod.b << 8 | callerMod.a;
+        Uint32 modColor = untinted;
+        for ( size_t i = 0; i < n; ++i ) {
+            const SDL_Color c = { channel( pr[i] ), channel( pg[i] ), channel( pb[i] ), channel( pa[i] ) };
+            const SDL_Rect dst = { static_cast<int>( px[i] - half ), static_cast<int>( py[i] - half ), s, s };
+            if ( texture == nullptr ) {
+                SDL_SetRenderDrawColor( ren, c.r, c.g, c.b, c.a );
+                SDL_RenderFillRect( ren, &dst );
+                continue;
+            }
+            const Uint32 color = static_cast<Uint32>( c.r ) << 24 | c.g << 16 | c.b << 8 | c.a;
+            if ( color != modColor ) {
+                SDL_SetTextureColorMod( texture, c.r, c.g, c.b );
+                SDL_SetTextureAlphaMod( texture, c.a );
+                modColor = color;
+            }
+            SDL_RenderCopy( ren, texture, fullTexture ? NULL : &src, &dst );
+        }
+        if ( modColor != untinted ) {
+            SDL_SetTextureColorMod( texture, callerMod.r, callerMod.g, callerMod.b );
+            SDL_SetTextureAlphaMod( texture, callerMod.a );
+        }
+        return n;
+    }
+
+    size_t maxParticles;
+    SDL_Texture *texture;
+    bool fullTexture;
+    SDL_Rect src;
+    float particleSize;
+    float gravityX, gravityY;
+    SpriteBatch::SubmitMode mode;
+    Uint32 seed;
+
+    // Position, velocity, seconds left, color and its rate of change a second
+    AlignedArray<float> px, py, pvx, pvy, plife;
+    AlignedArray<float> pr, pg, pb, pa, pdr, pdg, pdb, pda;
+    std::vector<Uint32> dead;
+
+    // The vertex buffer handed to SDL_RenderGeometryRaw, four corners a particle
+    std::vector<float> positions;
+    std::vector<SDL_Color> colors;
+    std::vector<float> uvs;
+    std::vector<int> indices;
+};
+
+#endif
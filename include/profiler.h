@@ -0,0 +1,403 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+
+/*
+ * A lightweight frame profiler. Code is instrumented with RAII zones:
+ *
+ * {
+ *     PROFILE_ZONE( "draw" );
+ *     // ... timed until the end of the scope
+ * }
+ *
+ * Each thread records finished zones into its own lock free ring buffer, which the
+ * main thread drains once a frame in Profiler::collect. Collected zones feed a rolling
+ * history per zone for the p50/p95/p99 overlay and, while capturing, a log that can be
+ * written out in the Chrome trace event format (load it in chrome://tracing or Perfetto).
+ */
+
+struct ProfileEvent {
+    Uint32 zone;
+    Uint32 thread;
+    Uint64 begin;
+    Uint64 end;
+};
+
+/*
+ * Single producer, single consumer ring of events: the owning thread pushes and the
+ * collecting thread drains. When the ring is full new events are dropped.
+ */
+class ProfileRing {
+public:
+    static const Uint32 CAPACITY = 4096;
+
+    explicit ProfileRing( Uint32 threadId ) : thread( threadId ), head( 0 ), tail( 0 ), dropped( 0 ) {}
+
+    void push( Uint32 zone, Uint64 begin, Uint64 end ) {
+        const Uint32 h = head.load( std::memory_order_relaxed );
+        if ( h - tail.load( std::memory_order_acquire ) == CAPACITY ) {
+            dropped.fetch_add( 1, std::memory_order_relaxed );
+            return;
+        }
+        ProfileEvent &e = events[h & ( CAPACITY - 1 )];
+        e.zone = zone;
+        e.thread = thread;
+        e.begin = begin;
+        e.end = end;
+        head.store( h + 1, std::memory_order_release );
+    }
+
+    template<typename F>
+    void drain( F f ) {
+        Uint32 t = tail.load( std::memory_order_relaxed );
+        const Uint32 h = head.load( std::memory_order_acquire );
+        for ( ; t != h; ++t ) {
+            f( events[t & ( CAPACITY - 1 )] );
+        }
+        tail.store( t, std::memory_order_release );
+    }
+
+    Uint32 droppedEvents() const {
+        return dropped.load( std::memory_order_relaxed );
+    }
+
+private:
+    const Uint32 thread;
+    std::atomic<Uint32> head;
+    std::atomic<Uint32> tail;
+    std::atomic<Uint32> dropped;
+    ProfileEvent events[CAPACITY];
+};
+
+class Profiler {
+public:
+    // The number of frames of history the percentiles are computed over
+    static const size_t HISTORY = 240;
+
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    /**
+     * Get the id of a zone, registering it if this is the first time we've seen the name.
+     * The PROFILE_ZONE macro calls this once per call site.
+     */
+    Uint32 zoneId( const char *name ) {
+        std::lock_guard<std::mutex> lock( mutex );
+        for ( size_t i = 0; i < zones.size(); ++i ) {
+            if ( strcmp( zones[i].name, name ) == 0 ) {
+                return static_cast<Uint32>( i );
+            }
+        }
+        zones.push_back( Zone( name ) );
+        return static_cast<Uint32>( zones.size() - 1 );
+    }
+
+    /**
+     * Record a finished zone on the calling thread's ring
+     */
+    void record( Uint32 zone, Uint64 begin, Uint64 end ) {
+        static thread_local ProfileRing *ring = nullptr;
+        if ( ring == nullptr ) {
+            ring = registerThread();
+        }
+        ring->push( zone, begin, end );
+    }
+
+    /**
+     * Mark the start of a frame, the time until endFrame is recorded as the "frame" zone
+     */
+    void beginFrame() {
+        frameBegin = SDL_GetPerformanceCounter();
+    }
+
+    /**
+     * Mark the end of a frame and collect the zones recorded during it
+     */
+    void endFrame() {
+        record( frameZone, frameBegin, SDL_GetPerformanceCounter() );
+        collect();
+    }
+
+    /**
+     * Drain every thread's ring into the zone histories (and the capture if capturing).
+     * This should only be called from one thread.
+     */
+    void collect() {
+        std::lock_guard<std::mutex> lock( mutex );
+        const double toMs = 1000.0 / frequency;
+        for ( size_t i = 0; i < rings.size(); ++i ) {
+            rings[i]->drain( [&]( const ProfileEvent &e ) {
+                zones[e.zone].add( static_cast<float>( ( e.end - e.begin ) * toMs ) );
+                if ( capturing ) {
+                    capture.push_back( e );
+                }
+            });
+        }
+    }
+
+    /**
+     * Get the rolling percentiles of a zone's duration in milliseconds
+     * @return false if the zone hasn't been recorded yet
+     */
+    bool percentiles( Uint32 zone, float &p50, float &p95, float &p99 ) {
+        std::lock_guard<std::mutex> lock( mutex );
+        return zone < zones.size() && zones[zone].percentiles( scratch, p50, p95, p99 );
+    }
+
+    /**
+     * Start or stop keeping every collected event for writeChromeTrace
+     */
+    void setCapture( bool enable ) {
+        std::lock_guard<std::mutex> lock( mutex );
+        capturing = enable;
+    }
+
+    /**
+     * Write the captured events as Chrome trace event JSON
+     * @return false if the file couldn't be written
+     */
+    bool writeChromeTrace( const std::string &file ) {
+        std::lock_guard<std::mutex> lock( mutex );
+        FILE *out = fopen( file.c_str(), "w" );
+        if ( out == nullptr ) {
+            return false;
+        }
+
+        Uint64 origin = capture.empty() ? 0 : capture.front().begin;
+        for ( size_t i = 0; i < capture.size(); ++i ) {
+            origin = std::min( origin, capture[i].begin );
+        }
+        const double toUs = 1000000.0 / frequency;
+        fputs( "{\"traceEvents\":[\n", out );
+        for ( size_t i = 0; i < capture.size(); ++i ) {
+            const ProfileEvent &e = capture[i];
+            fprintf( out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    i ? ",\n" : "", escape( zones[e.zone].name ).c_str(), e.thread,
+                    ( e.begin - origin ) * toUs, ( e.end - e.begin ) * toUs );
+        }
+        fputs( "\n],\"displayTimeUnit\":\"ms\"}\n", out );
+        return fclose( out ) == 0;
+    }
+
+    /**
+     * Draw the per zone p50/p95/p99 table with a bar showing each zone's p95
+     * against a 60fps frame budget
+     * @param ren The renderer to draw to
+     * @param x The x coordinate of the top left of the overlay
+     * @param y The y coordinate of the top left of the overlay
+     */
+    void drawOverlay( SDL_Renderer *ren, int x, int y ) {
+        std::lock_guard<std::mutex> lock( mutex );
+        // Each line is 30 characters of 4 pixels (3 plus a gap) followed by the bar
+        const int scale = 2, lineH = 7 * scale, barX = x + 31 * 4 * scale, barW = 120;
+        const float budgetMs = 1000.0f / 60;
+
+        text.clear();
+        bars.clear();
+        background.x = x;
+        background.y = y;
+        background.w = barX - x + barW + scale;
+        background.h = static_cast<int>( zones.size() + 1 ) * lineH + 2 * scale;
+
+        char line[64];
+        int lineY = y + scale;
+        snprintf( line, sizeof( line ), "%-12.12s %5s %5s %5s", "ZONE", "P50", "P95", "P99" );
+        queueText( line, x + scale, lineY, scale );
+        for ( size_t i = 0; i < zones.size(); ++i ) {
+            lineY += lineH;
+            float p50, p95, p99;
+            if ( !zones[i].percentiles( scratch, p50, p95, p99 ) ) {
+                continue;
+            }
+
+            snprintf( line, sizeof( line ), "%-12.12s %5.2f %5.2f %5.2f", zones[i].name, p50, p95, p99 );
+            queueText( line, x + scale, lineY, scale );
+
+            SDL_Rect bar = { barX, lineY, static_cast<int>( barW * std::min( p95 / budgetMs, 1.0f ) ), 5 * scale };
+            bars.push_back( bar );
+        }
+
+        Uint8 r, g, b, a;
+        SDL_BlendMode blend;
+        SDL_GetRenderDrawColor( ren, &r, &g, &b, &a );
+        SDL_GetRenderDrawBlendMode( ren, &blend );
+
+        SDL_SetRenderDrawBlendMode( ren, SDL_BLENDMODE_BLEND );
+        SDL_SetRenderDrawColor( ren, 0, 0, 0, 180 );
+        SDL_RenderFillRect( ren, &background );
+        SDL_SetRenderDrawColor( ren, 255, 255, 255, 255 );
+        SDL_RenderFillRects( ren, text.data(), static_cast<int>( text.size() ) );
+        SDL_SetRenderDrawColor( ren, 255, 160, 0, 255 );
+        SDL_RenderFillRects( ren, bars.data(), static_cast<int>( bars.size() ) );
+
+        SDL_SetRenderDrawBlendMode( ren, blend );
+        SDL_SetRenderDrawColor( ren, r, g, b, a );
+    }
+
+    // The total number of events dropped because a thread's ring was full
+    Uint32 droppedEvents() {
+        std::lock_guard<std::mutex> lock( mutex );
+        Uint32 dropped = 0;
+        for ( size_t i = 0; i < rings.size(); ++i ) {
+            dropped += rings[i]->droppedEvents();
+        }
+        return dropped;
+    }
+
+private:
+    struct Zone {
+        const char *name;
+        float history[HISTORY];
+        size_t count;
+        size_t next;
+
+        explicit Zone( const char *n ) : name( n ), count( 0 ), next( 0 ) {}
+
+        void add( float ms ) {
+            history[next] = ms;
+            next = ( next + 1 ) % HISTORY;
+            if ( count < HISTORY ) {
+                ++count;
+            }
+        }
+
+        bool percentiles( std::vector<float> &sorted, float &p50, float &p95, float &p99 ) const {
+            if ( count == 0 ) {
+                return false;
+            }
+            sorted.assign( history, history + count );
+            std::sort( sorted.begin(), sorted.end() );
+            p50 = sorted[( count - 1 ) * 50 / 100];
+            p95 = sorted[( count - 1 ) * 95 / 100];
+            p99 = sorted[( count - 1 ) * 99 / 100];
+            return true;
+        }
+    };
+
+    Profiler()
+        : frequency( SDL_GetPerformanceFrequency() ), frameBegin( 0 ), capturing( false )
+    {
+        scratch.reserve( HISTORY );
+        zones.push_back( Zone( "frame" ) );
+        frameZone = 0;
+    }
+
+    ProfileRing* registerThread() {
+        std::lock_guard<std::mutex> lock( mutex );
+        // Rings live as long as the profiler so a thread exiting never leaves a dangling ring
+        rings.push_back( std::unique_ptr<ProfileRing>( new ProfileRing( static_cast<Uint32>( rings.size() ) ) ) );
+        return rings.back().get();
+    }
+
+    /**
+     * Queue the pixels of some text in the built in 3x5 font as rects
+     */
+    void queueText( const char *s, int x, int y, int scale ) {
+        for ( ; *s; ++s, x += 4 * scale ) {
+            const char *bits = glyphBits( static_cast<char>( toupper( static_cast<unsigned char>( *s ) ) ) );
+            for ( int i = 0; bits != nullptr && i < 15; ++i ) {
+                if ( bits[i] == '1' ) {
+                    SDL_Rect px = { x + i % 3 * scale, y + i / 3 * scale, scale, scale };
+                    text.push_back( px );
+                }
+            }
+        }
+    }
+
+    /**
+     * Look up a character of the built in font, rows of 3 pixels from top to bottom
+     * @return the glyph's pixels, or nullptr for characters we don't have (drawn as a space)
+     */
+    static const char* glyphBits( char c ) {
+        static const struct { char c; const char *bits; } font[] = {
+            { '0', "111101101101111" }, { '1', "010110010010111" }, { '2', "111001111100111" },
+            { '3', "111001111001111" }, { '4', "101101111001001" }, { '5', "111100111001111" },
+            { '6', "111100111101111" }, { '7', "111001001001001" }, { '8', "111101111101111" },
+            { '9', "111101111001111" }, { 'A', "010101111101101" }, { 'B', "110101110101110" },
+            { 'C', "011100100100011" }, { 'D', "110101101101110" }, { 'E', "111100110100111" },
+            { 'F', "111100110100100" }, { 'G', "011100101101011" }, { 'H', "101101111101101" },
+            { 'I', "111010010010111" }, { 'J', "001001001101010" }, { 'K', "101101110101101" },
+            { 'L', "100100100100111" }, { 'M', "101111111101101" }, { 'N', "110101101101101" },
+            { 'O', "010101101101010" }, { 'P', "110101110100100" }, { 'Q', "010101101110011" },
+            { 'R', "110101110101101" }, { 'S', "011100010001110" }, { 'T', "111010010010010" },
+            { 'U', "101101101101111" }, { 'V', "101101101101010" }, { 'W', "101101111111101" },
+            { 'X', "101101010101101" }, { 'Y', "101101010010010" }, { 'Z', "111001010100111" },
+            { '.', "000000000000010" }, { ':', "000010000010000" }, { '/', "001001010100100" },
+            { '-', "000000111000000" }, { '_', "000000000000111" }
+        };
+        for ( size_t i = 0; i < sizeof( font ) / sizeof( font[0] ); ++i ) {
+            if ( font[i].c == c ) {
+                return font[i].bits;
+            }
+        }
+        return nullptr;
+    }
+
+    static std::string escape( const char *s ) {
+        std::string out;
+        for ( ; *s; ++s ) {
+            if ( *s == '"' || *s == '\\' ) {
+                out += '\\';
+            }
+            out += *s;
+        }
+        return out;
+    }
+
+    const Uint64 frequency;
+    Uint64 frameBegin;
+    Uint32 frameZone;
+    bool capturing;
+    std::mutex mutex;
+    std::vector<Zone> zones;
+    std::vector<std::unique_ptr<ProfileRing> > rings;
+    std::vector<ProfileEvent> capture;
+    std::vector<float> scratch;
+    std::vector<SDL_Rect> text;
+    std::vector<SDL_Rect> bars;
+    SDL_Rect background;
+};
+
+/*
+ * Times the scope it lives in, see PROFILE_ZONE
+ */
+class ProfileZone {
+public:
+    explicit ProfileZone( Uint32 zoneId ) : zone( zoneId ), begin( SDL_GetPerformanceCounter() ) {}
+
+    ~ProfileZone() {
+        Profiler::instance().record( zone, begin, SDL_GetPerformanceCounter() );
+    }
+
+private:
+    ProfileZone( const ProfileZone& );
+    ProfileZone& operator=( const ProfileZone& );
+
+    const Uint32 zone;
+    const Uint64 begin;
+};
+
+#define PROFILE_CONCAT_IMPL( a, b ) a##b
+#define PROFILE_CONCAT( a, b ) PROFILE_CONCAT_IMPL( a, b )
+
+/*
+ * Time the rest of the enclosing scope as a zone with some name. The name must be
+ * a string literal (or otherwise outlive the profiler) since only the pointer is kept.
+ */
+#define PROFILE_ZONE( name ) \
+    static const Uint32 PROFILE_CONCAT( profileZoneId, __LINE__ ) = Profiler::instance().zoneId( name ); \
+    ProfileZone PROFILE_CONCAT( profileZone, __LINE__ )( PROFILE_CONCAT( profileZoneId, __LINE__ ) )
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef RECT_PACK_H
+#define RECT_PACK_H
+
+#include <vector>
+#include <SDL2/SDL.h>
+
+/*
+ * Packs rectangles into a fixed size area using the skyline bottom-left heuristic:
+ * we track the top edge of the packed rects as a list of horizontal segments and
+ * place each new rect where its top edge ends up lowest, preferring the left.
+ * It's fast enough to use at runtime (eg. for glyphs) and packs well enough
+ * for offline atlases when fed rects sorted by decreasing height.
+ */
+class RectPacker {
+public:
+    RectPacker( int w = 0, int h = 0 ) {
+        reset( w, h );
+    }
+
+    /**
+     * Empty the packer and set the size of the area to pack into
+     */
+    void reset( int w, int h ) {
+        width = w;
+        height = h;
+        usedW = usedH = 0;
+        skyline.clear();
+        Segment seg = { 0, 0, w };
+        skyline.push_back( seg );
+    }
+
+    /**
+     * Find a spot for a w x h rect
+     * @param w The width of the rect
+     * @param h The height of the rect
+     * @param out Set to the placed rect if there was room
+     * @return false if the rect doesn't fit anywhere
+     */
+    bool insert( int w, int h, SDL_Rect &out ) {
+        if ( w <= 0 || h <= 0 || w > width || h > height ) {
+            return false;
+        }
+
+        int bestIndex = -1, bestY = height, bestX = 0;
+        for ( size_t i = 0; i < skyline.size(); ++i ) {
+            int y;
+            if ( fits( i, w, h, y ) && y < bestY ) {
+                bestIndex = static_cast<int>( i );
+                bestY = y;
+                bestX = skyline[i].x;
+            }
+        }
+        if ( bestIndex < 0 ) {
+            return false;
+        }
+
+        Segment seg = { bestX, bestY + h, w };
+        skyline.insert( skyline.begin() + bestIndex, seg );
+
+        // Shrink or remove the segments now covered by the new one
+        for ( size_t i = bestIndex + 1; i < skyline.size(); ) {
+            const int coveredTo = skyline[i - 1].x + skyline[i - 1].w;
+            if ( skyline[i].x >= coveredTo ) {
+                break;
+            }
+            const int shrink = coveredTo - skyline[i].x;
+            skyline[i].x += shrink;
+            skyline[i].w -= shrink;
+            if ( skyline[i].w > 0 ) {
+                break;
+            }
+            skyline.erase( skyline.begin() + i );
+        }
+
+        // Merge neighbouring segments at the same height
+        for ( size_t i = 0; i + 1 < skyline.size(); ) {
+            if ( skyline[i].y == skyline[i + 1].y ) {
+                skyline[i].w += skyline[i + 1].w;
+                skyline.erase( skyline.begin() + i + 1 );
+            } else {
+                ++i;
+            }
+        }
+
+        out.x = bestX;
+        out.y = bestY;
+        out.w = w;
+        out.h = h;
+        if ( bestX + w > usedW ) {
+            usedW = bestX + w;
+        }
+        if ( bestY + h > usedH ) {
+            usedH = bestY + h;
+        }
+        return true;
+    }
+
+    int areaWidth() const {
+        return width;
+    }
+
+    int areaHeight() const {
+        return height;
+    }
+
+    // The extent of the packed rects, useful to crop an atlas down after packing
+    int usedWidth() const {
+        return usedW;
+    }
+
+    int usedHeight() const {
+        return usedH;
+    }
+
+private:
+    struct Segment {
+        int x, y, w;
+    };
+
+    /**
+     * Check if a w x h rect fits with its left edge at the start of skyline segment i
+     * @param y Set to the y the rect would be placed at
+     */
+    bool fits( size_t i, int w, int h, int &y ) const {
+        if ( skyline[i].x + w > width ) {
+            return false;
+        }
+
+        y = 0;
+        int remaining = w;
+        while ( remaining > 0 ) {
+            if ( i >= skyline.size() ) {
+                return false;
+            }
+            if ( skyline[i].y > y ) {
+                y = skyline[i].y;
+            }
+            if ( y + h > height ) {
+                return false;
+            }
+            remaining -= skyline[i].w;
+            ++i;
+        }
+        return true;
+    }
+
+    int width, height;
+    int usedW, usedH;
+    std::vector<Segment> skyline;
+};
+
+#endif
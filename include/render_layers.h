@@ -0,0 +1,304 @@
+#ifndef RENDER_LAYERS_H
+#define RENDER_LAYERS_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <SDL2/SDL.h>
+
+/*
+ * Composites a frame out of layers, only redrawing what changed since the last frame.
+ *
+ * Static layers (eg. a tiled background) are painted once into their own target
+ * texture and after that just copied from. Dynamic layers are repainted, but only
+ * inside the rects marked dirty since the last compose, with the renderer's clip
+ * rect limiting drawing to each rect in turn. The result builds up in a canvas
+ * texture that persists between frames, so the parts of the screen that didn't
+ * change cost nothing to redraw:
+ *
+ * RenderLayers layers( ren, SCREEN_WIDTH, SCREEN_HEIGHT );
+ * layers.addStatic( drawBackground );
+ * layers.addDynamic( drawSprites );
+ * while ( !quit ) {
+ *     // when a sprite moves from old to now
+ *     layers.markDirty( old );
+ *     layers.markDirty( now );
+ *     layers.present();
+ *     // draw overlays on top
+ *     SDL_RenderPresent( ren );
+ * }
+ *
+ * Painters draw in screen coordinates and are free to draw outside the dirty rects,
+ * that's clipped away. If the renderer can't render to textures every layer is
+ * repainted straight to the screen each frame instead.
+ */
+class RenderLayers {
+public:
+    typedef std::function<void( SDL_Renderer* )> Painter;
+
+    /**
+     * Create an empty layer stack
+     * @param ren The renderer to composite with
+     * @param w The width of the area the layers cover
+     * @param h The height of the area the layers cover
+     * @param maxRects The most dirty rects to track before merging them all into one
+     */
+    RenderLayers( SDL_Renderer *ren, int w, int h, size_t maxRects = 8 )
+        : renderer( ren ), width( w ), height( h ), rectLimit( maxRects ), canvas( nullptr ),
+        useTargets( SDL_RenderTargetSupported( ren ) == SDL_TRUE ), everything( true ), dirtyPixels( 0 )
+    {}
+
+    ~RenderLayers() {
+        clear();
+    }
+
+    /**
+     * Add a layer that's painted once and cached, call invalidateLayer if it changes
+     * @return the layer's index
+     */
+    int addStatic( Painter paint ) {
+        return addLayer( paint, true );
+    }
+
+    /**
+     * Add a layer that's repainted inside the dirty rects every frame
+     * @return the layer's index
+     */
+    int addDynamic( Painter paint ) {
+        return addLayer( paint, false );
+    }
+
+    /**
+     * Mark a region as needing to be recomposited, eg. where a sprite was and where it is now
+     */
+    void markDirty( const SDL_Rect &rect ) {
+        SDL_Rect r;
+        const SDL_Rect bounds = { 0, 0, width, height };
+        if ( everything || !SDL_IntersectRect( &rect, &bounds, &r ) ) {
+            return;
+        }
+
+        // Fold in any rect this touches so we never paint the same pixels twice
+        for ( size_t i = 0; i < dirty.size(); ) {
+            if ( SDL_HasIntersection( &r, &dirty[i] ) ) {
+                SDL_UnionRect( &r, &dirty[i], &r );
+                dirty[i] = dirty.back();
+                dirty.pop_back();
+                i = 0;
+            } else {
+                ++i;
+            }
+        }
+        dirty.push_back( r );
+
+        if ( dirty.size() > rectLimit ) {
+            SDL_Rect all = dirty[0];
+            for ( size_t i = 1; i < dirty.size(); ++i ) {
+                SDL_UnionRect( &all, &dirty[i], &all );
+            }
+            dirty.assign( 1, all );
+        }
+    }
+
+    /**
+     * Repaint a static layer the next time we composite, and everything above it
+     */
+    void invalidateLayer( int layer ) {
+        if ( layer < 0 || layer >= static_cast<int>( layers.size() ) ) {
+            return;
+        }
+        layers[layer].valid = false;
+        invalidate();
+    }
+
+    /**
+     * Recomposite everything on the next frame, eg. after SDL_RENDER_TARGETS_RESET
+     * when the contents of our target textures are lost
+     */
+    void invalidate() {
+        everything = true;
+        dirty.clear();
+    }
+
+    /**
+     * Bring the canvas up to date, repainting the dirty rects. Leaves the renderer
+     * drawing to whatever target it had, usually the screen.
+     */
+    void compose() {
+        if ( !useTargets || !ensureTextures() ) {
+            return;
+        }
+
+        const SDL_Rect full = { 0, 0, width, height };
+        if ( everything ) {
+            dirty.assign( 1, full );
+        }
+        dirtyPixels = 0;
+
+        // Painters may change the draw state, the caller's color is what we clear to
+        SDL_Texture *previous = SDL_GetRenderTarget( renderer );
+        Uint8 r, g, b, a;
+        SDL_BlendMode blend;
+        SDL_GetRenderDrawColor( renderer, &r, &g, &b, &a );
+        SDL_GetRenderDrawBlendMode( renderer, &blend );
+
+        for ( size_t i = 0; i < layers.size(); ++i ) {
+            Layer &layer = layers[i];
+            if ( layer.isStatic && !layer.valid ) {
+                SDL_SetRenderTarget( renderer, layer.texture );
+                SDL_SetRenderDrawColor( renderer, 0, 0, 0, 0 );
+                SDL_RenderClear( renderer );
+                layer.paint( renderer );
+                layer.valid = true;
+            }
+        }
+
+        SDL_SetRenderTarget( renderer, canvas );
+        for ( size_t d = 0; d < dirty.size(); ++d ) {
+            const SDL_Rect &rect = dirty[d];
+            dirtyPixels += static_cast<size_t>( rect.w ) * rect.h;
+
+            SDL_SetRenderDrawColor( renderer, r, g, b, a );
+            SDL_SetRenderDrawBlendMode( renderer, SDL_BLENDMODE_NONE );
+            SDL_RenderFillRect( renderer, &rect );
+            SDL_SetRenderDrawBlendMode( renderer, blend );
+
+            SDL_RenderSetClipRect( renderer, &rect );
+            for ( size_t i = 0; i < layers.size(); ++i ) {
+                if ( layers[i].isStatic ) {
+                    SDL_RenderCopy( renderer, layers[i].texture, &rect, &rect );
+                } else {
+                    layers[i].paint( renderer );
+                }
+            }
+            SDL_RenderSetClipRect( renderer, NULL );
+        }
+        SDL_SetRenderTarget( renderer, previous );
+        SDL_SetRenderDrawColor( renderer, r, g, b, a );
+        SDL_SetRenderDrawBlendMode( renderer, blend );
+
+        dirty.clear();
+        everything = false;
+    }
+
+    /**
+     * Compose the layers and copy them to the screen. The canvas is cleared with the
+     * renderer's draw color, so set that to the background color you want.
+     */
+    void present() {
+        compose();
+        draw();
+    }
+
+    /**
+     * Copy the canvas to the current target, call compose first to bring it up to date.
+     * Without render targets this repaints every layer instead.
+     */
+    void draw() {
+        if ( useTargets && canvas != nullptr ) {
+            SDL_RenderCopy( renderer, canvas, NULL, NULL );
+            return;
+        }
+
+        // No render targets, draw it all the slow way
+        SDL_RenderClear( renderer );
+        for ( size_t i = 0; i < layers.size(); ++i ) {
+            layers[i].paint( renderer );
+        }
+        dirtyPixels = static_cast<size_t>( width ) * height;
+    }
+
+    /**
+     * Destroy the layer textures, this must be done before the renderer is destroyed.
+     * They're recreated if the layers are composited again.
+     */
+    void clear() {
+        for ( size_t i = 0; i < layers.size(); ++i ) {
+            if ( layers[i].texture != nullptr ) {
+                SDL_DestroyTexture( layers[i].texture );
+                layers[i].texture = nullptr;
+            }
+            layers[i].valid = false;
+        }
+        if ( canvas != nullptr ) {
+            SDL_DestroyTexture( canvas );
+            canvas = nullptr;
+        }
+        invalidate();
+    }
+
+    // The number of pixels recomposited by the last compose
+    size_t lastDirtyPixels() const {
+        return dirtyPixels;
+    }
+
+    bool usingTargets() const {
+        return useTargets;
+    }
+
+private:
+    struct Layer {
+        Painter paint;
+        bool isStatic;
+        bool valid;
+        SDL_Texture *texture;
+    };
+
+    RenderLayers( const RenderLayers& );
+    RenderLayers& operator=( const RenderLayers& );
+
+    int addLayer( Painter paint, bool isStatic ) {
+        Layer layer = { paint, isStatic, false, nullptr };
+        layers.push_back( layer );
+        invalidate();
+        return static_cast<int>( layers.size() - 1 );
+    }
+
+    /**
+     * Create the canvas and static layer textures if we don't have them yet
+     * @return false if a texture couldn't be created, we fall back to painting directly
+     */
+    bool ensureTextures() {
+        if ( canvas == nullptr ) {
+            canvas = createTarget();
+            if ( canvas == nullptr ) {
+                useTargets = false;
+                return false;
+            }
+            // Every canvas pixel is written opaque, so copying it out needn't blend
+            SDL_SetTextureBlendMode( canvas, SDL_BLENDMODE_NONE );
+            everything = true;
+        }
+        for ( size_t i = 0; i < layers.size(); ++i ) {
+            if ( layers[i].isStatic && layers[i].texture == nullptr ) {
+                layers[i].texture = createTarget();
+                if ( layers[i].texture == nullptr ) {
+                    clear();
+                    useTargets = false;
+                    return false;
+                }
+                SDL_SetTextureBlendMode( layers[i].texture, SDL_BLENDMODE_BLEND );
+                layers[i].valid = false;
+                everything = true;
+            }
+        }
+        return true;
+    }
+
+    SDL_Texture* createTarget() {
+        return SDL_CreateTexture( renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, width, height );
+    }
+
+    SDL_Renderer *renderer;
+    int width, height;
+    size_t rectLimit;
+    SDL_Texture *canvas;
+    bool useTargets;
+    // Set when the whole canvas needs recompositing
+    bool everything;
+    size_t dirtyPixels;
+    std::vector<Layer> layers;
+    std::vector<SDL_Rect> dirty;
+};
+
+#endif
@@ -0,0 +1,482 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <SDL2/SDL.h>
+#include <SDL2_ttf/SDL_TTF.h>
+
+#include "frame_arena.h"
+#include "glyph_cache.h"
+#include "profiler.h"
+#include "sprite_batch.h"
+
+/*
+ * A frame's worth of draw commands, recorded on the simulation thread and replayed
+ * in order on the render thread. Commands only hold on to pointers, so textures and
+ * fonts have to stay alive until the frame they're used in has been rendered.
+ *
+ * The commands themselves, their text and callbacks all live in a FrameArena owned
+ * by the list, so once the arena has grown to fit a frame recording doesn't touch
+ * the heap whatever the text or whatever a callback captures.
+ */
+class CommandList {
+public:
+    CommandList() : commands( ArenaAllocator<Command>( arena ) ), destructors( ArenaAllocator<Destructor>( arena ) ) {
+        commands.reserve( MIN_COMMANDS );
+    }
+
+    ~CommandList() {
+        destroyCallbacks();
+    }
+
+    /**
+     * Clear the render target to a color
+     */
+    void clear( SDL_Color color ) {
+        Command c = command( CMD_CLEAR );
+        c.color = color;
+        commands.push_back( c );
+    }
+
+    /**
+     * Draw a texture, as SDL_RenderCopy
+     * @param tex The texture to draw
+     * @param src The part of the texture to draw, nullptr for all of it
+     * @param dst Where to draw it, nullptr for the whole target
+     */
+    void copy( SDL_Texture *tex, const SDL_Rect *src, const SDL_Rect *dst ) {
+        commands.push_back( copyCommand( CMD_COPY, tex, src, dst ) );
+    }
+
+    /**
+     * Draw a texture rotated and/or flipped, as SDL_RenderCopyEx
+     * @param angle The rotation in degrees, clockwise
+     * @param center The point to rotate around relative to dst, nullptr for the center of dst
+     * @param flip How to flip the texture
+     */
+    void copyEx( SDL_Texture *tex, const SDL_Rect *src, const SDL_Rect *dst, double angle,
+            const SDL_Point *center = nullptr, SDL_RendererFlip flip = SDL_FLIP_NONE )
+    {
+        Command c = copyCommand( CMD_COPY_EX, tex, src, dst );
+        c.angle = angle;
+        c.hasCenter = ( center != nullptr );
+        if ( center != nullptr ) {
+            c.center = *center;
+        }
+        c.flip = flip;
+        commands.push_back( c );
+    }
+
+    /**
+     * Draw some text through the render thread's glyph cache. The text is copied,
+     * so it needn't outlive the call.
+     */
+    void drawText( TTF_Font *font, const char *str, int x, int y, SDL_Color color ) {
+        Command c = command( CMD_TEXT );
+        c.font = font;
+        c.dst.x = x;
+        c.dst.y = y;
+        c.color = color;
+        c.text = arena.copyString( str );
+        commands.push_back( c );
+    }
+
+    void drawText( TTF_Font *font, const std::string &str, int x, int y, SDL_Color color ) {
+        drawText( font, str.c_str(), x, y, color );
+    }
+
+    /**
+     * Run some code on the render thread at this point in the frame, for drawing that
+     * isn't covered by the other commands. Anything it captures by reference has to
+     * be safe to use from the render thread.
+     * @param f Something callable as void( SDL_Renderer* ), eg. a lambda
+     */
+    template<typename F>
+    void call( F f ) {
+        Command c = command( CMD_CALL );
+        c.callback = arena.create<F>( std::move( f ) );
+        c.invoke = &invokeCallback<F>;
+        if ( !std::is_trivially_destructible<F>::value ) {
+            Destructor d = { c.callback, &destroyCallback<F> };
+            destructors.push_back( d );
+        }
+        commands.push_back( c );
+    }
+
+    /**
+     * Empty the list, keeping the arena's blocks for the next frame
+     */
+    void reset() {
+        destroyCallbacks();
+        // The vectors are in the arena, they have to let go of it before it's reset
+        const size_t recorded = commands.size();
+        Commands( commands.get_allocator() ).swap( commands );
+        Destructors( destructors.get_allocator() ).swap( destructors );
+        arena.reset();
+        // Next frame likely records about as much, so it doesn't have to grow into it
+        commands.reserve( SDL_max( recorded, static_cast<size_t>( MIN_COMMANDS ) ) );
+    }
+
+    size_t size() const {
+        return commands.size();
+    }
+
+    // The arena the commands are recorded into, its lastFrame is the frame recorded before the last reset
+    const FrameArena& frameArena() const {
+        return arena;
+    }
+
+private:
+    friend class RenderThread;
+
+    enum CommandType {
+        CMD_CLEAR,
+        CMD_COPY,
+        CMD_COPY_EX,
+        CMD_TEXT,
+        CMD_CALL
+    };
+
+    struct Command {
+        CommandType type;
+        bool hasSrc, hasDst, hasCenter;
+        SDL_RendererFlip flip;
+        SDL_Texture *texture;
+        TTF_Font *font;
+        SDL_Rect src, dst;
+        SDL_Point center;
+        double angle;
+        SDL_Color color;
+        // The text for CMD_TEXT, copied into the arena
+        const char *text;
+        // The callable for CMD_CALL, also in the arena, and how to call it
+        void *callback;
+        void ( *invoke )( void*, SDL_Renderer* );
+    };
+
+    struct Destructor {
+        void *callback;
+        void ( *destroy )( void* );
+    };
+
+    typedef std::vector<Command, ArenaAllocator<Command>> Commands;
+    typedef std::vector<Destructor, ArenaAllocator<Destructor>> Destructors;
+
+    enum { MIN_COMMANDS = 256 };
+
+    CommandList( const CommandList& );
+    CommandList& operator=( const CommandList& );
+
+    static Command command( CommandType type ) {
+        Command c;
+        std::memset( &c, 0, sizeof( c ) );
+        c.type = type;
+        return c;
+    }
+
+    static Command copyCommand( CommandType type, SDL_Texture *tex, const SDL_Rect *src, const SDL_Rect *dst ) {
+        Command c = command( type );
+        c.texture = tex;
+        c.hasSrc = ( src != nullptr );
+        if ( src != nullptr ) {
+            c.src = *src;
+        }
+        c.hasDst = ( dst != nullptr );
+        if ( dst != nullptr ) {
+            c.dst = *dst;
+        }
+        return c;
+    }
+
+    void destroyCallbacks() {
+        for ( size_t i = 0; i < destructors.size(); ++i ) {
+            destructors[i].destroy( destructors[i].callback );
+        }
+        destructors.clear();
+    }
+
+    template<typename Fn>
+    static void invokeCallback( void *f, SDL_Renderer *ren ) {
+        ( *static_cast<Fn*>( f ) )( ren );
+    }
+
+    template<typename Fn>
+    static void destroyCallback( void *f ) {
+        static_cast<Fn*>( f )->~Fn();
+    }
+
+    // Declared first, the vectors allocate from it
+    FrameArena arena;
+    Commands commands;
+    // Callbacks that need destroying before the arena's reset
+    Destructors destructors;
+};
+
+/*
+ * Runs the renderer on a thread of its own. The simulation thread records a frame
+ * into a CommandList and submits it, then carries on with the next frame while the
+ * render thread replays the commands and presents, so a frame's simulation overlaps
+ * the previous frame's rendering and a slow present (eg. waiting on vsync) doesn't
+ * hold up the simulation until the frame after:
+ *
+ * RenderThread render( win, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+ * while ( !quit ) {
+ *     // handle events, simulate
+ *     CommandList &frame = render.commands();
+ *     frame.clear( black );
+ *     frame.copy( tex, nullptr, &dst );
+ *     render.submit();
+ * }
+ * render.stop();
+ *
+ * The render thread owns the SDL_Renderer and nothing else may touch it, so
+ * textures are created and destroyed through invoke, which runs code on the render
+ * thread between frames. Some platforms (notably macOS) only allow rendering on the
+ * main thread, where this can't be used.
+ */
+class RenderThread {
+public:
+    /**
+     * Start the render thread and create the renderer on it
+     * @param win The window to render to
+     * @param flags The SDL_RendererFlags to create the renderer with
+     */
+    RenderThread( SDL_Window *win, Uint32 flags )
+        : renderer( nullptr ), started( false ), stopping( false ), pending( false ), recording( 0 ),
+        tasksQueued( 0 ), tasksRun( 0 ), renderTicks( 0 ), waitTicks( 0 )
+    {
+        thread = std::thread( &RenderThread::run, this, win, flags );
+        std::unique_lock<std::mutex> lock( mutex );
+        wake.wait( lock, [this]{ return started; } );
+    }
+
+    ~RenderThread() {
+        stop();
+    }
+
+    /**
+     * Check the renderer was created
+     * @return false if it wasn't, the reason is in error()
+     */
+    bool ok() const {
+        return renderer != nullptr;
+    }
+
+    const std::string& error() const {
+        return createError;
+    }
+
+    /**
+     * Get the list to record this frame's commands into
+     */
+    CommandList& commands() {
+        return lists[recording];
+    }
+
+    /**
+     * Hand the recorded frame to the render thread to draw and present. Waits for the
+     * previous frame to finish rendering first, so at most one frame is in flight.
+     */
+    void submit() {
+        const Uint64 start = SDL_GetPerformanceCounter();
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            wake.wait( lock, [this]{ return !pending || renderer == nullptr; } );
+            if ( renderer == nullptr ) {
+                lists[recording].reset();
+                return;
+            }
+            recording = 1 - recording;
+            pending = true;
+        }
+        wake.notify_all();
+        lists[recording].reset();
+        waitTicks = SDL_GetPerformanceCounter() - start;
+    }
+
+    /**
+     * Wait for the submitted frame to be rendered
+     */
+    void finish() {
+        std::unique_lock<std::mutex> lock( mutex );
+        wake.wait( lock, [this]{ return !pending; } );
+    }
+
+    /**
+     * Run some code on the render thread and wait for it, eg. to create or destroy
+     * textures. It runs after any frame that's already been submitted.
+     */
+    void invoke( std::function<void( SDL_Renderer* )> task ) {
+        std::unique_lock<std::mutex> lock( mutex );
+        if ( renderer == nullptr ) {
+            return;
+        }
+        tasks.push_back( std::move( task ) );
+        const Uint64 id = ++tasksQueued;
+        wake.notify_all();
+        wake.wait( lock, [this, id]{ return tasksRun >= id; } );
+    }
+
+    /**
+     * Measure some text with the render thread's glyph cache
+     */
+    void measureText( TTF_Font *font, const char *text, int &w, int &h ) {
+        w = h = 0;
+        invoke( [&]( SDL_Renderer* ) {
+            glyphs->measureText( font, text, w, h );
+        });
+    }
+
+    /**
+     * Render whatever's been submitted, destroy the renderer and stop the thread.
+     * This must be done before the window is destroyed.
+     */
+    void stop() {
+        if ( !thread.joinable() ) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+    // How long the render thread took over the last frame, in milliseconds
+    double lastRenderMs() const {
+        return renderTicks.load() * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+
+    // How long the last submit waited on the render thread, in milliseconds
+    double lastWaitMs() const {
+        return waitTicks * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+
+private:
+    RenderThread( const RenderThread& );
+    RenderThread& operator=( const RenderThread& );
+
+    void run( SDL_Window *win, Uint32 flags ) {
+        SDL_Renderer *ren = SDL_CreateRenderer( win, -1, flags );
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            if ( ren == nullptr ) {
+                createError = SDL_GetError();
+            } else {
+                glyphs.reset( new GlyphCache( ren ) );
+                batch.reset( new SpriteBatch( ren ) );
+            }
+            renderer = ren;
+            started = true;
+        }
+        wake.notify_all();
+        if ( ren == nullptr ) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock( mutex );
+        for ( ;; ) {
+            wake.wait( lock, [this]{ return pending || !tasks.empty() || stopping; } );
+            // Frames go first so tasks run after anything submitted before them, eg. a
+            // texture is only destroyed once the frames using it have been drawn
+            if ( pending ) {
+                CommandList &list = lists[1 - recording];
+                lock.unlock();
+                const Uint64 start = SDL_GetPerformanceCounter();
+                execute( list );
+                {
+                    PROFILE_ZONE( "render present" );
+                    SDL_RenderPresent( renderer );
+                }
+                renderTicks = SDL_GetPerformanceCounter() - start;
+                lock.lock();
+                pending = false;
+                wake.notify_all();
+            } else if ( !tasks.empty() ) {
+                std::vector<std::function<void( SDL_Renderer* )>> due;
+                due.swap( tasks );
+                lock.unlock();
+                for ( size_t i = 0; i < due.size(); ++i ) {
+                    due[i]( renderer );
+                }
+                lock.lock();
+                tasksRun += due.size();
+                wake.notify_all();
+            } else if ( stopping ) {
+                break;
+            }
+        }
+
+        glyphs->clear();
+        glyphs.reset();
+        batch.reset();
+        SDL_DestroyRenderer( renderer );
+        renderer = nullptr;
+    }
+
+    void execute( CommandList &list ) {
+        PROFILE_ZONE( "render" );
+        for ( size_t i = 0; i < list.commands.size(); ++i ) {
+            const CommandList::Command &c = list.commands[i];
+            // Consecutive text commands share the batch, anything else has to be
+            // drawn after the text queued before it
+            if ( c.type != CommandList::CMD_TEXT ) {
+                batch->flush();
+            }
+            switch ( c.type ) {
+                case CommandList::CMD_CLEAR:
+                    SDL_SetRenderDrawColor( renderer, c.color.r, c.color.g, c.color.b, c.color.a );
+                    SDL_RenderClear( renderer );
+                    break;
+                case CommandList::CMD_COPY:
+                    SDL_RenderCopy( renderer, c.texture, c.hasSrc ? &c.src : NULL, c.hasDst ? &c.dst : NULL );
+                    break;
+                case CommandList::CMD_COPY_EX:
+                    SDL_RenderCopyEx( renderer, c.texture, c.hasSrc ? &c.src : NULL, c.hasDst ? &c.dst : NULL,
+                            c.angle, c.hasCenter ? &c.center : NULL, c.flip );
+                    break;
+                case CommandList::CMD_TEXT:
+                    glyphs->drawText( *batch, c.font, c.text, c.dst.x, c.dst.y, c.color );
+                    break;
+                case CommandList::CMD_CALL:
+                    c.invoke( c.callback, renderer );
+                    break;
+            }
+        }
+        batch->flush();
+    }
+
+    SDL_Renderer *renderer;
+    std::string createError;
+    // Only used on the render thread
+    std::unique_ptr<GlyphCache> glyphs;
+    std::unique_ptr<SpriteBatch> batch;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool started;
+    bool stopping;
+    // Set while a submitted frame is waiting for or being rendered
+    bool pending;
+    // The list the simulation thread is recording into, the other one belongs to the render thread
+    int recording;
+    CommandList lists[2];
+    std::vector<std::function<void( SDL_Renderer* )>> tasks;
+    Uint64 tasksQueued, tasksRun;
+    std::atomic<Uint64> renderTicks;
+    Uint64 waitTicks;
+    std::thread thread;
+};
+
+#endif
@@ -0,0 +1,506 @@
+#ifndef RES_PACK_H
+#define RES_PACK_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+#include <SDL2_image/SDL_Image.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "res_path.h"
+
+/*
+ * The resource pack written by pack_builder and mounted by ResourcePack.
+ * Everything is little endian:
+ *
+ * char[4] magic "RPAK"
+ * u16 version
+ * u16 reserved, 0
+ * u32 entry count
+ * u32 name table size
+ * entries, sorted by hash:
+ *   u64 hash of the name, see resourceHash
+ *   u64 payload offset from the start of the pack, a multiple of RESOURCE_PACK_ALIGN
+ *   u32 payload size
+ *   u32 name offset into the name table
+ *   u16 name length
+ *   u16 kind, a ResourceKind
+ *   u32 reserved, 0
+ * name table: the entry names, not terminated
+ * payloads
+ *
+ * Names are paths relative to the res directory with / separators, eg. "lesson3/image.png".
+ * A RESOURCE_SURFACE payload is an image decoded ahead of time: u32 SDL pixel format,
+ * u32 width, u32 height, u32 pitch followed by the pixel rows.
+ */
+const Uint16 RESOURCE_PACK_VERSION = 1;
+const size_t RESOURCE_PACK_ALIGN = 64;
+const size_t RESOURCE_PACK_HEADER_SIZE = 16;
+const size_t RESOURCE_PACK_ENTRY_SIZE = 32;
+const size_t RESOURCE_SURFACE_HEADER_SIZE = 16;
+
+enum ResourceKind {
+    // The file's bytes as they were on disk
+    RESOURCE_RAW = 0,
+    // Pixels decoded ahead of time, loadable without running an image decoder
+    RESOURCE_SURFACE = 1
+};
+
+/**
+ * Hash a resource name, this is 64 bit FNV-1a
+ */
+inline Uint64 resourceHash( const char *name, size_t len ) {
+    Uint64 hash = 0xcbf29ce484222325ULL;
+    for ( size_t i = 0; i < len; ++i ) {
+        hash ^= static_cast<unsigned char>( name[i] );
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+inline Uint64 resourceHash( const std::string &name ) {
+    return resourceHash( name.data(), name.size() );
+}
+
+// A resource to be written into a pack by writeResourcePack
+struct ResourcePackEntry {
+    std::string name;
+    ResourceKind kind;
+    std::vector<Uint8> data;
+};
+
+namespace res_pack_detail {
+    inline void put( std::vector<Uint8> &out, Uint64 v, int bytes ) {
+        for ( int i = 0; i < bytes; ++i ) {
+            out.push_back( static_cast<Uint8>( v >> ( i * 8 ) ) );
+        }
+    }
+
+    inline Uint64 get( const Uint8 *p, int bytes ) {
+        Uint64 v = 0;
+        for ( int i = bytes - 1; i >= 0; --i ) {
+            v = v << 8 | p[i];
+        }
+        return v;
+    }
+}
+
+/**
+ * Build the payload for a RESOURCE_SURFACE entry from a surface
+ */
+inline std::vector<Uint8> surfacePayload( SDL_Surface *surf ) {
+    std::vector<Uint8> out;
+    res_pack_detail::put( out, surf->format->format, 4 );
+    res_pack_detail::put( out, static_cast<Uint32>( surf->w ), 4 );
+    res_pack_detail::put( out, static_cast<Uint32>( surf->h ), 4 );
+    res_pack_detail::put( out, static_cast<Uint32>( surf->pitch ), 4 );
+    const Uint8 *pixels = static_cast<const Uint8*>( surf->pixels );
+    out.insert( out.end(), pixels, pixels + static_cast<size_t>( surf->pitch ) * surf->h );
+    return out;
+}
+
+/**
+ * Write a resource pack to a file
+ * @return false if two names hash the same or the file couldn't be written, the error is in SDL_GetError
+ */
+inline bool writeResourcePack( const std::string &file, const std::vector<ResourcePackEntry> &entries ) {
+    using res_pack_detail::put;
+
+    std::vector<const ResourcePackEntry*> sorted;
+    for ( size_t i = 0; i < entries.size(); ++i ) {
+        sorted.push_back( &entries[i] );
+    }
+    std::sort( sorted.begin(), sorted.end(), []( const ResourcePackEntry *a, const ResourcePackEntry *b ) {
+        return resourceHash( a->name ) < resourceHash( b->name );
+    });
+    for ( size_t i = 1; i < sorted.size(); ++i ) {
+        if ( resourceHash( sorted[i - 1]->name ) == resourceHash( sorted[i]->name ) ) {
+            SDL_SetError( "Resource names %s and %s hash the same", sorted[i - 1]->name.c_str(),
+                    sorted[i]->name.c_str() );
+            return false;
+        }
+    }
+
+    std::string names;
+    for ( size_t i = 0; i < sorted.size(); ++i ) {
+        names += sorted[i]->name;
+    }
+
+    std::vector<Uint8> out;
+    const char magic[] = { 'R', 'P', 'A', 'K' };
+    out.insert( out.end(), magic, magic + 4 );
+    put( out, RESOURCE_PACK_VERSION, 2 );
+    put( out, 0, 2 );
+    put( out, sorted.size(), 4 );
+    put( out, names.size(), 4 );
+
+    const size_t namesStart = RESOURCE_PACK_HEADER_SIZE + sorted.size() * RESOURCE_PACK_ENTRY_SIZE;
+    size_t offset = namesStart + names.size(), nameOffset = 0;
+    std::vector<size_t> offsets;
+    for ( size_t i = 0; i < sorted.size(); ++i ) {
+        const ResourcePackEntry &e = *sorted[i];
+        offset = ( offset + RESOURCE_PACK_ALIGN - 1 ) / RESOURCE_PACK_ALIGN * RESOURCE_PACK_ALIGN;
+        offsets.push_back( offset );
+        put( out, resourceHash( e.name ), 8 );
+        put( out, offset, 8 );
+        put( out, e.data.size(), 4 );
+        put( out, nameOffset, 4 );
+        put( out, e.name.size(), 2 );
+        put( out, e.kind, 2 );
+        put( out, 0, 4 );
+        offset += e.data.size();
+        nameOffset += e.name.size();
+    }
+    out.insert( out.end(), names.begin(), names.end() );
+    for ( size_t i = 0; i < sorted.size(); ++i ) {
+        out.resize( offsets[i], 0 );
+        out.insert( out.end(), sorted[i]->data.begin(), sorted[i]->data.end() );
+    }
+
+    SDL_RWops *rw = SDL_RWFromFile( file.c_str(), "wb" );
+    if ( rw == nullptr ) {
+        return false;
+    }
+    const bool ok = SDL_RWwrite( rw, out.data(), 1, out.size() ) == out.size();
+    SDL_RWclose( rw );
+    return ok;
+}
+
+/*
+ * A resource pack mapped into memory. Looking up a resource is a binary search
+ * over the hashed table of contents and reading it is a SDL_RWops over the mapped
+ * bytes, so there's no per-file open or read and pages are only brought in from
+ * disk as they're touched.
+ *
+ * Anything handed out by the pack points into the mapping, so RWops and surfaces
+ * must be closed and freed before the pack is.
+ */
+class ResourcePack {
+public:
+    struct Entry {
+        const Uint8 *data;
+        size_t size;
+        ResourceKind kind;
+    };
+
+    ResourcePack() : base( nullptr ), mappedSize( 0 ), count( 0 ) {
+#ifdef _WIN32
+        fileHandle = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#endif
+    }
+
+    ~ResourcePack() {
+        close();
+    }
+
+    /**
+     * Map a pack file into memory and check its table of contents
+     * @return false if the file couldn't be mapped or isn't a valid pack, the error is in SDL_GetError
+     */
+    bool open( const std::string &file ) {
+        close();
+        if ( !map( file ) || !validate() ) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Unmap the pack, anything read from it must be done with
+     */
+    void close() {
+        if ( mounted() == this ) {
+            mount( nullptr );
+        }
+#ifdef _WIN32
+        if ( base != nullptr ) {
+            UnmapViewOfFile( base );
+        }
+        if ( mapping != NULL ) {
+            CloseHandle( mapping );
+        }
+        if ( fileHandle != INVALID_HANDLE_VALUE ) {
+            CloseHandle( fileHandle );
+        }
+        mapping = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if ( base != nullptr ) {
+            munmap( const_cast<Uint8*>( base ), mappedSize );
+        }
+#endif
+        base = nullptr;
+        mappedSize = 0;
+        count = 0;
+    }
+
+    bool isOpen() const {
+        return base != nullptr;
+    }
+
+    // The number of resources in the pack
+    size_t size() const {
+        return count;
+    }
+
+    /**
+     * Look up a resource by name
+     * @return false if the pack doesn't have it
+     */
+    bool find( const std::string &name, Entry &entry ) const {
+        const Uint64 hash = resourceHash( name );
+        size_t lo = 0, hi = count;
+        while ( lo < hi ) {
+            const size_t mid = lo + ( hi - lo ) / 2;
+            const Uint64 h = res_pack_detail::get( entryAt( mid ), 8 );
+            if ( h < hash ) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if ( lo == count ) {
+            return false;
+        }
+
+        const Uint8 *e = entryAt( lo );
+        const size_t nameLen = static_cast<size_t>( res_pack_detail::get( e + 24, 2 ) );
+        const char *stored = reinterpret_cast<const char*>( namesAt() + res_pack_detail::get( e + 20, 4 ) );
+        if ( res_pack_detail::get( e, 8 ) != hash || nameLen != name.size()
+                || std::memcmp( stored, name.data(), nameLen ) != 0 )
+        {
+            return false;
+        }
+
+        entry.data = base + res_pack_detail::get( e + 8, 8 );
+        entry.size = static_cast<size_t>( res_pack_detail::get( e + 16, 4 ) );
+        entry.kind = static_cast<ResourceKind>( res_pack_detail::get( e + 26, 2 ) );
+        return true;
+    }
+
+    /**
+     * Open a raw resource for reading without copying it
+     * @return the RWops, or nullptr if the pack doesn't have a raw resource by that name
+     */
+    SDL_RWops* openRW( const std::string &name ) const {
+        Entry entry;
+        if ( !find( name, entry ) || entry.kind != RESOURCE_RAW ) {
+            SDL_SetError( "%s isn't a raw resource in the pack", name.c_str() );
+            return nullptr;
+        }
+        return SDL_RWFromConstMem( entry.data, static_cast<int>( entry.size ) );
+    }
+
+    /**
+     * Get a pre-decoded image as a surface whose pixels are the mapped bytes. The
+     * mapping is read only so the surface must not be drawn to or locked for writing.
+     * @return the surface, or nullptr if the pack doesn't have a decoded image by that name
+     */
+    SDL_Surface* surface( const std::string &name ) const {
+        Entry entry;
+        if ( !find( name, entry ) || entry.kind != RESOURCE_SURFACE ) {
+            SDL_SetError( "%s isn't a decoded image in the pack", name.c_str() );
+            return nullptr;
+        }
+        if ( entry.size < RESOURCE_SURFACE_HEADER_SIZE ) {
+            SDL_SetError( "Decoded image %s is truncated", name.c_str() );
+            return nullptr;
+        }
+        const Uint32 format = static_cast<Uint32>( res_pack_detail::get( entry.data, 4 ) );
+        const int w = static_cast<int>( res_pack_detail::get( entry.data + 4, 4 ) );
+        const int h = static_cast<int>( res_pack_detail::get( entry.data + 8, 4 ) );
+        const int pitch = static_cast<int>( res_pack_detail::get( entry.data + 12, 4 ) );
+        const int bpp = SDL_BYTESPERPIXEL( format );
+        if ( w <= 0 || h <= 0 || bpp <= 0 || static_cast<Sint64>( pitch ) < static_cast<Sint64>( w ) * bpp ) {
+            SDL_SetError( "Decoded image %s has a bad size or format", name.c_str() );
+            return nullptr;
+        }
+        if ( RESOURCE_SURFACE_HEADER_SIZE + static_cast<size_t>( pitch ) * h > entry.size ) {
+            SDL_SetError( "Decoded image %s is truncated", name.c_str() );
+            return nullptr;
+        }
+        void *pixels = const_cast<Uint8*>( entry.data + RESOURCE_SURFACE_HEADER_SIZE );
+        return SDL_CreateRGBSurfaceWithFormatFrom( pixels, w, h, SDL_BITSPERPIXEL( format ), pitch, format );
+    }
+
+    /**
+     * Make a pack the one openResource and loadResourceTexture look in first
+     * @param pack The pack to mount, or nullptr to only use loose files
+     */
+    static void mount( ResourcePack *pack ) {
+        mountedPack() = pack;
+    }
+
+    static ResourcePack* mounted() {
+        return mountedPack();
+    }
+
+private:
+    ResourcePack( const ResourcePack& );
+    ResourcePack& operator=( const ResourcePack& );
+
+    static ResourcePack*& mountedPack() {
+        static ResourcePack *pack = nullptr;
+        return pack;
+    }
+
+    const Uint8* entryAt( size_t i ) const {
+        return base + RESOURCE_PACK_HEADER_SIZE + i * RESOURCE_PACK_ENTRY_SIZE;
+    }
+
+    const Uint8* namesAt() const {
+        return entryAt( count );
+    }
+
+    bool map( const std::string &file ) {
+#ifdef _WIN32
+        fileHandle = CreateFileA( file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL, NULL );
+        LARGE_INTEGER fileSize;
+        if ( fileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx( fileHandle, &fileSize ) || fileSize.QuadPart == 0 ) {
+            SDL_SetError( "Couldn't open resource pack %s", file.c_str() );
+            return false;
+        }
+        mapping = CreateFileMappingA( fileHandle, NULL, PAGE_READONLY, 0, 0, NULL );
+        const void *view = mapping != NULL ? MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+        if ( view == NULL ) {
+            SDL_SetError( "Couldn't map resource pack %s", file.c_str() );
+            return false;
+        }
+        base = static_cast<const Uint8*>( view );
+        mappedSize = static_cast<size_t>( fileSize.QuadPart );
+#else
+        const int fd = ::open( file.c_str(), O_RDONLY );
+        struct stat st;
+        if ( fd < 0 || fstat( fd, &st ) != 0 || st.st_size == 0 ) {
+            SDL_SetError( "Couldn't open resource pack %s", file.c_str() );
+            if ( fd >= 0 ) {
+                ::close( fd );
+            }
+            return false;
+        }
+        void *view = mmap( nullptr, static_cast<size_t>( st.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+        // The mapping keeps the file alive, we don't need the descriptor any more
+        ::close( fd );
+        if ( view == MAP_FAILED ) {
+            SDL_SetError( "Couldn't map resource pack %s", file.c_str() );
+            return false;
+        }
+        base = static_cast<const Uint8*>( view );
+        mappedSize = static_cast<size_t>( st.st_size );
+#endif
+        return true;
+    }
+
+    /**
+     * Check the header and that every entry lies within the file, so lookups can trust it
+     */
+    bool validate() {
+        using res_pack_detail::get;
+        if ( mappedSize < RESOURCE_PACK_HEADER_SIZE || std::memcmp( base, "RPAK", 4 ) != 0 ) {
+            SDL_SetError( "Not a resource pack" );
+            return false;
+        }
+        if ( get( base + 4, 2 ) != RESOURCE_PACK_VERSION ) {
+            SDL_SetError( "Unsupported resource pack version %d", static_cast<int>( get( base + 4, 2 ) ) );
+            return false;
+        }
+
+        count = static_cast<size_t>( get( base + 8, 4 ) );
+        const Uint64 namesSize = get( base + 12, 4 );
+        const Uint64 namesEnd = RESOURCE_PACK_HEADER_SIZE + static_cast<Uint64>( count ) * RESOURCE_PACK_ENTRY_SIZE
+            + namesSize;
+        if ( namesEnd > mappedSize ) {
+            SDL_SetError( "Resource pack table of contents is truncated" );
+            return false;
+        }
+
+        Uint64 prevHash = 0;
+        for ( size_t i = 0; i < count; ++i ) {
+            const Uint8 *e = entryAt( i );
+            const Uint64 hash = get( e, 8 ), offset = get( e + 8, 8 ), size = get( e + 16, 4 );
+            if ( ( i > 0 && hash <= prevHash ) || offset % RESOURCE_PACK_ALIGN != 0 || offset > mappedSize
+                    || size > mappedSize - offset || get( e + 20, 4 ) + get( e + 24, 2 ) > namesSize )
+            {
+                SDL_SetError( "Resource pack entry %d is corrupt", static_cast<int>( i ) );
+                return false;
+            }
+            prevHash = hash;
+        }
+        return true;
+    }
+
+    const Uint8 *base;
+    size_t mappedSize;
+    size_t count;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mapping;
+#endif
+};
+
+/**
+ * Open a resource from the mounted pack, falling back to the loose file in the res directory
+ * @param name The resource path relative to the res directory, eg. "lesson3/image.png"
+ * @return the RWops, or nullptr if the resource couldn't be found
+ */
+inline SDL_RWops* openResource( const std::string &name ) {
+    ResourcePack *pack = ResourcePack::mounted();
+    if ( pack != nullptr ) {
+        SDL_RWops *rw = pack->openRW( name );
+        if ( rw != nullptr ) {
+            return rw;
+        }
+    }
+    return SDL_RWFromFile( ( getResourcePath() + name ).c_str(), "rb" );
+}
+
+/**
+ * Load an image resource into a surface, using the mounted pack's pre-decoded pixels if it
+ * has them, otherwise decoding it from the pack or the loose file
+ * @param name The resource path relative to the res directory, eg. "lesson3/image.png"
+ * @return the loaded surface, or nullptr if something went wrong.
+ */
+inline SDL_Surface* loadResourceSurface( const std::string &name ) {
+    ResourcePack *pack = ResourcePack::mounted();
+    SDL_Surface *decoded = pack != nullptr ? pack->surface( name ) : nullptr;
+    if ( decoded != nullptr ) {
+        return decoded;
+    }
+
+    SDL_RWops *rw = openResource( name );
+    return rw != nullptr ? IMG_Load_RW( rw, 1 ) : nullptr;
+}
+
+/**
+ * Load an image resource into a texture, see loadResourceSurface. This fits TextureCache's
+ * loader signature, with resource names as the keys.
+ * @param ren The renderer to load the texture onto
+ * @param name The resource path relative to the res directory, eg. "lesson3/image.png"
+ * @return the loaded texture, or nullptr if something went wrong.
+ */
+inline SDL_Texture* loadResourceTexture( SDL_Renderer *ren, const std::string &name ) {
+    SDL_Surface *surf = loadResourceSurface( name );
+    if ( surf == nullptr ) {
+        return nullptr;
+    }
+    SDL_Texture *tex = SDL_CreateTextureFromSurface( ren, surf );
+    SDL_FreeSurface( surf );
+    return tex;
+}
+
+#endif
@@ -16,7 +16,7 @@
  *
  * Paths returned will be Lessons/res/subDir
  */
-std::string getResourcePath(const std::string &subDir = "") {
+inline std::string getResourcePath(const std::string &subDir = "") {
 #ifdef _WIN32
     const char PATH_SEP = '\\';
 #else
@@ -0,0 +1,209 @@
+#ifndef SESSION_OPTIONS_H
+#define SESSION_OPTIONS_H
+
+#include <ostream>
+#include <string>
+#include <SDL2/SDL.h>
+
+#include "frame_capture.h"
+#include "input_record.h"
+
+/*
+ * The command line the interactive lessons share:
+ *
+ * usage: LessonN [--record file] [--replay file] [--capture path] [--frames N]
+ *
+ * --record writes the input handled during the session to a file. --replay plays a
+ * recording back in a hidden window (on the dummy video driver unless SDL_VIDEODRIVER
+ * is set) with one simulation step per frame and no frame cap, then prints the frame
+ * times, so the same session can be timed across builds. --capture writes every frame
+ * to disk the same way, see FrameCapture for the paths it takes, and --frames stops
+ * after that many frames. Capturing a replay gives the same frames on every run.
+ */
+struct SessionOptions {
+    std::string recordFile;
+    std::string replayFile;
+    std::string captureFile;
+    // Stop after this many frames, 0 to run until quit
+    Uint32 maxFrames;
+
+    SessionOptions() : maxFrames( 0 ) {}
+};
+
+/**
+ * Read a --frames count, strtoul alone would take "abc" as 0 and wrap "-1" around
+ * @param text The argument to read
+ * @param frames Set to the count if it's good
+ * @return false unless the whole argument is a number from 1 to the most a Uint32 holds
+ */
+inline bool parseFrameCount( const char *text, Uint32 &frames ) {
+    if ( text[0] < '0' || text[0] > '9' ) {
+        return false;
+    }
+    char *end = nullptr;
+    const unsigned long n = SDL_strtoul( text, &end, 10 );
+    if ( *end != '\0' || n == 0 || n > 0xFFFFFFFFUL ) {
+        return false;
+    }
+    frames = static_cast<Uint32>( n );
+    return true;
+}
+
+/**
+ * Read the session options from the command line
+ * @param argc The argument count passed to main
+ * @param argv The arguments passed to main
+ * @param options The options to fill out
+ * @return false if the arguments are bad, the usage is in SDL_GetError
+ */
+inline bool parseSessionOptions( int argc, char **argv, SessionOptions &options ) {
+    for ( int i = 1; i < argc; ++i ) {
+        const std::string arg = argv[i];
+        if ( arg == "--record" && i + 1 < argc ) {
+            options.recordFile = argv[++i];
+        } else if ( arg == "--replay" && i + 1 < argc ) {
+            options.replayFile = argv[++i];
+        } else if ( arg == "--capture" && i + 1 < argc ) {
+            options.captureFile = argv[++i];
+        } else if ( arg == "--frames" && i + 1 < argc && parseFrameCount( argv[i + 1], options.maxFrames ) ) {
+            ++i;
+        } else {
+            SDL_SetError( "usage: %s [--record file] [--replay file] [--capture path] [--frames N]", argv[0] );
+            return false;
+        }
+    }
+    if ( !options.captureFile.empty() && options.replayFile.empty() && options.maxFrames == 0 ) {
+        SDL_SetError( "--capture needs --replay or --frames to know when to stop" );
+        return false;
+    }
+    return true;
+}
+
+/*
+ * The recording, replay and capture a lesson's session options ask for:
+ *
+ * SessionOptions options;
+ * Session session;
+ * if ( !parseSessionOptions( argc, argv, options ) || !session.open( options, SIM_RATE, w, h ) ) {
+ *     // report SDL_GetError
+ * }
+ * SDL_Init( SDL_INIT_EVERYTHING );
+ * // run the loop, replaying, recording and capturing each frame
+ * session.closeRecording( cout );
+ * session.closeCapture( cout );
+ *
+ * Open it before SDL_Init, a headless session picks the dummy video driver.
+ */
+class Session {
+public:
+    Session() : frameLimit( 0 ), replayOpen( false ) {}
+
+    /**
+     * Open what the options ask for
+     * @param options The parsed command line
+     * @param simRate The simulation steps per second, replays must have been recorded at it
+     * @param w The width of the frames to capture
+     * @param h The height of the frames to capture
+     * @return false if something couldn't be opened, the error is in SDL_GetError
+     */
+    bool open( const SessionOptions &options, double simRate, int w, int h ) {
+        frameLimit = options.maxFrames;
+        capturePath = options.captureFile;
+
+        if ( !options.recordFile.empty() && !inputRecorder.open( options.recordFile, 1.0 / simRate ) ) {
+            return false;
+        }
+        if ( !options.replayFile.empty() ) {
+            if ( !inputReplay.open( options.replayFile ) ) {
+                return false;
+            }
+            if ( SDL_fabs( inputReplay.step() - 1.0 / simRate ) > 1e-6 ) {
+                SDL_SetError( "%s was recorded at a different simulation rate", options.replayFile.c_str() );
+                return false;
+            }
+            replayOpen = true;
+        }
+        // Frames are captured at the simulation rate, one step per frame like a replay
+        if ( !capturePath.empty() && !frameCapture.open( capturePath, w, h, simRate ) ) {
+            return false;
+        }
+        // Replays and captures don't need a display
+        if ( headless() ) {
+            SDL_setenv( "SDL_VIDEODRIVER", "dummy", 0 );
+        }
+        return true;
+    }
+
+    /**
+     * Stop recording and print how long the replay took, if there was one
+     * @param os The stream to write the timings and any error to
+     */
+    void closeRecording( std::ostream &os ) {
+        if ( !inputRecorder.close() ) {
+            os << "InputRecorder::close error: " << SDL_GetError() << std::endl;
+        }
+        if ( replaying() ) {
+            os << "Replayed " << inputReplay.frames() << " frames in " << inputReplay.seconds() * 1000 << " ms, "
+                << inputReplay.seconds() * 1000 / inputReplay.frames() << " ms per frame, worst frame "
+                << inputReplay.worstFrameMs() << " ms" << std::endl;
+        }
+    }
+
+    /**
+     * Finish writing the captured frames and print what it cost, if we were capturing.
+     * Nothing can still be capturing when this is called.
+     * @param os The stream to write the timings and any error to
+     */
+    void closeCapture( std::ostream &os ) {
+        if ( !frameCapture.isOpen() ) {
+            return;
+        }
+        const Uint64 captured = frameCapture.frames();
+        if ( frameCapture.close() ) {
+            os << "Captured " << captured << " frames to " << capturePath << ", " << frameCapture.readbackMs()
+                << " ms reading back, " << frameCapture.stallMs() << " ms waiting on writes" << std::endl;
+        } else {
+            os << "FrameCapture::close error: " << SDL_GetError() << std::endl;
+        }
+    }
+
+    // True if the session's input comes from a recording
+    bool replaying() const {
+        return replayOpen;
+    }
+
+    // True if nobody's watching, so the loop should run in lockstep with no frame cap
+    bool headless() const {
+        return replaying() || frameCapture.isOpen();
+    }
+
+    // True once the --frames limit has been drawn
+    bool framesDone( Uint32 frames ) const {
+        return frameLimit != 0 && frames >= frameLimit;
+    }
+
+    InputRecorder& recorder() {
+        return inputRecorder;
+    }
+
+    InputReplay& replay() {
+        return inputReplay;
+    }
+
+    FrameCapture& capture() {
+        return frameCapture;
+    }
+
+private:
+    Session( const Session& );
+    Session& operator=( const Session& );
+
+    Uint32 frameLimit;
+    bool replayOpen;
+    std::string capturePath;
+    InputRecorder inputRecorder;
+    InputReplay inputReplay;
+    FrameCapture frameCapture;
+};
+
+#endif
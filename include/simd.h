@@ -0,0 +1,29 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/*
+ * The vector instruction sets the compiler is targeting, each 1 or 0. Kernels
+ * test these and fall back to scalar loops for whatever's missing. SSE2 comes
+ * with every x86-64 build, AVX and AVX2 need the ENABLE_AVX2 build option.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#else
+#define SIMD_SSE2 0
+#endif
+
+#if defined(__AVX__)
+#define SIMD_AVX 1
+#include <immintrin.h>
+#else
+#define SIMD_AVX 0
+#endif
+
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#else
+#define SIMD_AVX2 0
+#endif
+
+#endif
@@ -0,0 +1,474 @@
+#ifndef SOFT_RASTER_H
+#define SOFT_RASTER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <SDL2/SDL.h>
+
+#include "simd.h"
+#include "thread_pool.h"
+
+/*
+ * An image in the layout SoftRasterizer draws from: tightly packed ARGB8888 with
+ * straight (not premultiplied) alpha.
+ */
+class SoftImage {
+public:
+    SoftImage() : width( 0 ), height( 0 ), isOpaque( true ) {}
+
+    /**
+     * Copy the pixels of a surface, converting them if needed
+     * @return false if the surface couldn't be converted, the error is in SDL_GetError
+     */
+    bool load( SDL_Surface *surf ) {
+        SDL_Surface *argb = SDL_ConvertSurfaceFormat( surf, SDL_PIXELFORMAT_ARGB8888, 0 );
+        if ( argb == nullptr ) {
+            return false;
+        }
+        width = argb->w;
+        height = argb->h;
+        pixels.resize( static_cast<size_t>( width ) * height );
+        isOpaque = true;
+        for ( int y = 0; y < height; ++y ) {
+            const Uint32 *row = reinterpret_cast<const Uint32*>( static_cast<const Uint8*>( argb->pixels ) + y * argb->pitch );
+            std::memcpy( &pixels[static_cast<size_t>( y ) * width], row, width * sizeof( Uint32 ) );
+            for ( int x = 0; x < width && isOpaque; ++x ) {
+                isOpaque = ( row[x] >> 24 ) == 0xff;
+            }
+        }
+        SDL_FreeSurface( argb );
+        return true;
+    }
+
+    const Uint32* row( int y ) const {
+        return &pixels[static_cast<size_t>( y ) * width];
+    }
+
+    int w() const {
+        return width;
+    }
+
+    int h() const {
+        return height;
+    }
+
+    // Whether every pixel is fully opaque, these are copied instead of blended
+    bool opaque() const {
+        return isOpaque;
+    }
+
+private:
+    std::vector<Uint32> pixels;
+    int width, height;
+    bool isOpaque;
+};
+
+/*
+ * Draws images into an ARGB8888 surface on the CPU, for machines without a GPU where
+ * SDL's software renderer would do everything on one thread. Draws are queued like
+ * on a SpriteBatch and flush splits the surface into bands of rows that are drawn in
+ * parallel on a thread pool. Each band is only touched by one thread and draws
+ * everything overlapping it in the order it was queued, so the result is exactly
+ * what drawing the queue serially would give.
+ *
+ * Supports what the lessons' renderTexture does: copying a whole image or a clip of
+ * one to a destination rect, scaled with nearest neighbour sampling if the sizes
+ * differ, alpha blended like SDL_BLENDMODE_BLEND. Images can be tinted like an
+ * SDL_SetTextureColorMod and SDL_SetTextureAlphaMod would, and rects filled with a
+ * translucent color are blended the same way, which is enough to draw particles.
+ *
+ * SoftRasterizer raster( SCREEN_WIDTH, SCREEN_HEIGHT );
+ * raster.clear( black );
+ * raster.draw( background, dst );
+ * raster.flush();
+ * // raster.surface() holds the frame, eg. SDL_UpdateTexture it or save it
+ */
+class SoftRasterizer {
+public:
+    /**
+     * Create a rasterizer and the surface it draws into
+     * @param w The width of the surface
+     * @param h The height of the surface
+     * @param threads The number of threads to draw with, 0 for one per CPU
+     * @param bandRows The height of the bands the surface is split into
+     */
+    SoftRasterizer( int w, int h, size_t threads = 0, int bandRows = 32 )
+        : width( w ), height( h ), bandHeight( SDL_max( bandRows, 1 ) ), queued( 0 )
+    {
+        target = SDL_CreateRGBSurfaceWithFormat( 0, w, h, 32, SDL_PIXELFORMAT_ARGB8888 );
+        if ( threads == 0 ) {
+            threads = static_cast<size_t>( SDL_max( SDL_GetCPUCount(), 1 ) );
+        }
+        // The calling thread just waits during flush, so a single thread is run inline
+        if ( threads > 1 ) {
+            pool.reset( new ThreadPool( threads ) );
+        }
+        bands.resize( ( h + bandHeight - 1 ) / bandHeight );
+    }
+
+    ~SoftRasterizer() {
+        if ( target != nullptr ) {
+            SDL_FreeSurface( target );
+        }
+    }
+
+    /**
+     * Check the target surface was created
+     * @return false if it wasn't, the error is in SDL_GetError
+     */
+    bool ok() const {
+        return target != nullptr;
+    }
+
+    /**
+     * Queue filling the whole surface with a color
+     */
+    void clear( SDL_Color color ) {
+        Op op;
+        op.image = nullptr;
+        op.color = argb( color );
+        op.blend = false;
+        op.dst.x = op.dst.y = 0;
+        op.dst.w = width;
+        op.dst.h = height;
+        op.src = op.dst;
+        queue( op );
+    }
+
+    /**
+     * Queue filling a rect with a color, blended if it isn't opaque
+     */
+    void fill( const SDL_Rect &dst, SDL_Color color ) {
+        if ( color.a == 0 ) {
+            return;
+        }
+        Op op;
+        op.image = nullptr;
+        op.color = argb( color );
+        op.blend = color.a != 255;
+        op.dst = dst;
+        op.src = dst;
+        queue( op );
+    }
+
+    /**
+     * Queue drawing an image
+     * @param image The image to draw, it must stay alive until flush
+     * @param dst The rect to draw it to, the image is scaled to fit
+     * @param clip The part of the image to draw, nullptr draws all of it
+     * @param tint The color to modulate the image by, white leaves it as it is
+     */
+    void draw( const SoftImage &image, const SDL_Rect &dst, const SDL_Rect *clip = nullptr, SDL_Color tint = white() ) {
+        if ( tint.a == 0 ) {
+            return;
+        }
+        Op op;
+        op.image = &image;
+        op.color = argb( tint );
+        op.blend = !image.opaque() || tint.a != 255;
+        op.dst = dst;
+        const SDL_Rect all = { 0, 0, image.w(), image.h() };
+        if ( clip == nullptr ) {
+            op.src = all;
+        } else if ( !SDL_IntersectRect( clip, &all, &op.src ) ) {
+            return;
+        }
+        if ( dst.w <= 0 || dst.h <= 0 ) {
+            return;
+        }
+        queue( op );
+    }
+
+    /**
+     * Draw everything queued into the surface and empty the queue
+     * @return the number of draws made
+     */
+    size_t flush() {
+        const size_t drawn = queued;
+        queued = 0;
+        if ( target == nullptr || drawn == 0 ) {
+            for ( size_t b = 0; b < bands.size(); ++b ) {
+                bands[b].clear();
+            }
+            return 0;
+        }
+        for ( size_t b = 0; b < bands.size(); ++b ) {
+            if ( bands[b].empty() ) {
+                continue;
+            }
+            if ( pool ) {
+                pool->submit( [this, b]{ drawBand( b ); } );
+            } else {
+                drawBand( b );
+            }
+        }
+        if ( pool ) {
+            pool->wait();
+        }
+        for ( size_t b = 0; b < bands.size(); ++b ) {
+            bands[b].clear();
+        }
+        return drawn;
+    }
+
+    // The surface drawn into, it's ARGB8888
+    SDL_Surface* surface() const {
+        return target;
+    }
+
+    size_t threadCount() const {
+        return pool ? pool->threadCount() : 1;
+    }
+
+    /**
+     * Blend a row of straight alpha pixels over another, as SDL_BLENDMODE_BLEND:
+     * dstRGB = srcRGB * srcA + dstRGB * (1 - srcA), dstA = srcA + dstA * (1 - srcA).
+     * The vector and scalar paths give identical results.
+     */
+    static void blendRow( Uint32 *dst, const Uint32 *src, int n ) {
+        int i = 0;
+#if SIMD_AVX2
+        const __m256i zero8 = _mm256_setzero_si256(), alpha8 = _mm256_set1_epi32( static_cast<int>( 0xff000000 ) );
+        const __m256i full8 = _mm256_set1_epi16( 255 ), round8 = _mm256_set1_epi16( 128 );
+        for ( ; i + 8 <= n; i += 8 ) {
+            const __m256i s = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( src + i ) );
+            const int opaque = _mm256_movemask_epi8( _mm256_cmpeq_epi32( _mm256_and_si256( s, alpha8 ), alpha8 ) );
+            if ( opaque == -1 ) {
+                _mm256_storeu_si256( reinterpret_cast<__m256i*>( dst + i ), s );
+                continue;
+            }
+            if ( _mm256_testz_si256( s, alpha8 ) ) {
+                continue;
+            }
+            const __m256i d = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( dst + i ) );
+            const __m256i s1 = _mm256_or_si256( s, alpha8 );
+            const __m256i lo = blend16( _mm256_unpacklo_epi8( s1, zero8 ), _mm256_unpacklo_epi8( d, zero8 ),
+                    alpha16( _mm256_unpacklo_epi8( s, zero8 ) ), full8, round8 );
+            const __m256i hi = blend16( _mm256_unpackhi_epi8( s1, zero8 ), _mm256_unpackhi_epi8( d, zero8 ),
+                    alpha16( _mm256_unpackhi_epi8( s, zero8 ) ), full8, round8 );
+            _mm256_storeu_si256( reinterpret_cast<__m256i*>( dst + i ), _mm256_packus_epi16( lo, hi ) );
+        }
+#endif
+#if SIMD_SSE2
+        const __m128i zero = _mm_setzero_si128(), alpha = _mm_set1_epi32( static_cast<int>( 0xff000000 ) );
+        const __m128i full = _mm_set1_epi16( 255 ), round = _mm_set1_epi16( 128 );
+        for ( ; i + 4 <= n; i += 4 ) {
+            const __m128i s = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) );
+            const __m128i a = _mm_and_si128( s, alpha );
+            const int opaque = _mm_movemask_epi8( _mm_cmpeq_epi32( a, alpha ) );
+            if ( opaque == 0xffff ) {
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + i ), s );
+                continue;
+            }
+            if ( _mm_movemask_epi8( _mm_cmpeq_epi32( a, zero ) ) == 0xffff ) {
+                continue;
+            }
+            const __m128i d = _mm_loadu_si128( reinterpret_cast<const __m128i*>( dst + i ) );
+            const __m128i s1 = _mm_or_si128( s, alpha );
+            const __m128i lo = blend16( _mm_unpacklo_epi8( s1, zero ), _mm_unpacklo_epi8( d, zero ),
+                    alpha16( _mm_unpacklo_epi8( s, zero ) ), full, round );
+            const __m128i hi = blend16( _mm_unpackhi_epi8( s1, zero ), _mm_unpackhi_epi8( d, zero ),
+                    alpha16( _mm_unpackhi_epi8( s, zero ) ), full, round );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + i ), _mm_packus_epi16( lo, hi ) );
+        }
+#endif
+        for ( ; i < n; ++i ) {
+            const Uint32 s = src[i], a = s >> 24;
+            if ( a == 0xff ) {
+                dst[i] = s;
+                continue;
+            }
+            if ( a == 0 ) {
+                continue;
+            }
+            // Blending the alpha channel against 255 gives srcA + dstA * (1 - srcA)
+            const Uint32 s1 = s | 0xff000000, d = dst[i];
+            Uint32 out = 0;
+            for ( int shift = 0; shift < 32; shift += 8 ) {
+                const Uint32 t = ( s1 >> shift & 0xff ) * a + ( d >> shift & 0xff ) * ( 255 - a ) + 128;
+                out |= ( ( t + ( t >> 8 ) ) >> 8 ) << shift;
+            }
+            dst[i] = out;
+        }
+    }
+
+    /**
+     * Modulate a row of pixels by a color, as SDL_SetTextureColorMod and
+     * SDL_SetTextureAlphaMod do: each channel becomes channel * mod / 255
+     * @param dst Where to write the tinted pixels, may be the same as src
+     */
+    static void tintRow( Uint32 *dst, const Uint32 *src, int n, Uint32 mod ) {
+        int i = 0;
+#if SIMD_SSE2
+        const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16( 1 );
+        const __m128i m = _mm_unpacklo_epi8( _mm_set1_epi32( static_cast<int>( mod ) ), zero );
+        for ( ; i + 4 <= n; i += 4 ) {
+            const __m128i s = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) );
+            const __m128i lo = div255( _mm_mullo_epi16( _mm_unpacklo_epi8( s, zero ), m ), one );
+            const __m128i hi = div255( _mm_mullo_epi16( _mm_unpackhi_epi8( s, zero ), m ), one );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( dst + i ), _mm_packus_epi16( lo, hi ) );
+        }
+#endif
+        const Uint32 ma = mod >> 24, mr = mod >> 16 & 0xff, mg = mod >> 8 & 0xff, mb = mod & 0xff;
+        for ( ; i < n; ++i ) {
+            const Uint32 s = src[i];
+            dst[i] = ( s >> 24 ) * ma / 255 << 24 | ( s >> 16 & 0xff ) * mr / 255 << 16
+                | ( s >> 8 & 0xff ) * mg / 255 << 8 | ( s & 0xff ) * mb / 255;
+        }
+    }
+
+private:
+    struct Op {
+        // The image to draw, or nullptr to fill with color
+        const SoftImage *image;
+        // The fill color, or the tint for images, as ARGB8888
+        Uint32 color;
+        // Whether the op's pixels are blended rather than written over what's there
+        bool blend;
+        SDL_Rect src, dst;
+    };
+
+    SoftRasterizer( const SoftRasterizer& );
+    SoftRasterizer& operator=( const SoftRasterizer& );
+
+    static SDL_Color white() {
+        const SDL_Color c = { 255, 255, 255, 255 };
+        return c;
+    }
+
+    static Uint32 argb( SDL_Color c ) {
+        return static_cast<Uint32>( c.a ) << 24 | c.r << 16 | c.g << 8 | c.b;
+    }
+
+#if SIMD_SSE2
+    // Broadcast each pixel's alpha across its four 16 bit channels
+    static __m128i alpha16( __m128i px ) {
+        return _mm_shufflehi_epi16( _mm_shufflelo_epi16( px, _MM_SHUFFLE( 3, 3, 3, 3 ) ), _MM_SHUFFLE( 3, 3, 3, 3 ) );
+    }
+
+    // ( s * a + d * ( 255 - a ) + 128 ) / 255 per 16 bit channel, rounded the same as the scalar path
+    static __m128i blend16( __m128i s, __m128i d, __m128i a, __m128i full, __m128i round ) {
+        const __m128i t = _mm_add_epi16( _mm_add_epi16( _mm_mullo_epi16( s, a ),
+                _mm_mullo_epi16( d, _mm_sub_epi16( full, a ) ) ), round );
+        return _mm_srli_epi16( _mm_add_epi16( t, _mm_srli_epi16( t, 8 ) ), 8 );
+    }
+
+    // t / 255 rounded down per 16 bit channel, exact for t up to 255 * 255
+    static __m128i div255( __m128i t, __m128i one ) {
+        return _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( t, one ), _mm_srli_epi16( t, 8 ) ), 8 );
+    }
+#endif
+
+#if SIMD_AVX2
+    static __m256i alpha16( __m256i px ) {
+        return _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( px, _MM_SHUFFLE( 3, 3, 3, 3 ) ), _MM_SHUFFLE( 3, 3, 3, 3 ) );
+    }
+
+    static __m256i blend16( __m256i s, __m256i d, __m256i a, __m256i full, __m256i round ) {
+        const __m256i t = _mm256_add_epi16( _mm256_add_epi16( _mm256_mullo_epi16( s, a ),
+                _mm256_mullo_epi16( d, _mm256_sub_epi16( full, a ) ) ), round );
+        return _mm256_srli_epi16( _mm256_add_epi16( t, _mm256_srli_epi16( t, 8 ) ), 8 );
+    }
+#endif
+
+    /**
+     * Add an op to every band it overlaps. Each band keeps its own copy so drawing
+     * a band streams through its ops instead of picking them out of the whole queue.
+     */
+    void queue( const Op &op ) {
+        const int y0 = SDL_max( op.dst.y, 0 ), y1 = SDL_min( op.dst.y + op.dst.h, height );
+        const int x0 = SDL_max( op.dst.x, 0 ), x1 = SDL_min( op.dst.x + op.dst.w, width );
+        if ( y0 >= y1 || x0 >= x1 ) {
+            return;
+        }
+        ++queued;
+        for ( int b = y0 / bandHeight; b <= ( y1 - 1 ) / bandHeight; ++b ) {
+            bands[b].push_back( op );
+        }
+    }
+
+    void drawBand( size_t band ) {
+        const int bandY0 = static_cast<int>( band ) * bandHeight;
+        const int bandY1 = SDL_min( bandY0 + bandHeight, height );
+        // Scaled rows are sampled into here before being copied or blended
+        static thread_local std::vector<Uint32> scratchRow;
+        scratchRow.resize( width );
+        Uint32 *scratch = scratchRow.data();
+        const std::vector<Op> &bandOps = bands[band];
+        SDL_Rect stepSrc = { 0, 0, 0, 0 }, stepDst = { 0, 0, 0, 0 };
+        Uint32 stepX = 0, stepY = 0;
+        for ( size_t i = 0; i < bandOps.size(); ++i ) {
+            const Op &op = bandOps[i];
+            const int y0 = SDL_max( op.dst.y, bandY0 ), y1 = SDL_min( op.dst.y + op.dst.h, bandY1 );
+            const int x0 = SDL_max( op.dst.x, 0 ), x1 = SDL_min( op.dst.x + op.dst.w, width );
+            const int n = x1 - x0;
+            if ( op.image == nullptr && !op.blend ) {
+                for ( int y = y0; y < y1; ++y ) {
+                    std::fill( targetRow( y ) + x0, targetRow( y ) + x1, op.color );
+                }
+                continue;
+            }
+            if ( op.image == nullptr ) {
+                std::fill( scratch, scratch + n, op.color );
+                for ( int y = y0; y < y1; ++y ) {
+                    blendRow( targetRow( y ) + x0, scratch, n );
+                }
+                continue;
+            }
+
+            const bool scaledX = op.src.w != op.dst.w;
+            const bool tinted = op.color != 0xffffffff;
+            // 16.16 fixed point source steps, only worked out again when the sizes change
+            // since runs of draws (eg. particles) tend to share them
+            if ( op.src.w != stepSrc.w || op.src.h != stepSrc.h || op.dst.w != stepDst.w || op.dst.h != stepDst.h ) {
+                stepX = static_cast<Uint32>( ( static_cast<Uint64>( op.src.w ) << 16 ) / op.dst.w );
+                stepY = static_cast<Uint32>( ( static_cast<Uint64>( op.src.h ) << 16 ) / op.dst.h );
+                stepSrc = op.src;
+                stepDst = op.dst;
+            }
+            // The source x and y of the first pixel drawn
+            const Uint32 startX = static_cast<Uint32>( x0 - op.dst.x ) * stepX;
+            Uint32 fy = static_cast<Uint32>( y0 - op.dst.y ) * stepY;
+            for ( int y = y0; y < y1; ++y, fy += stepY ) {
+                const Uint32 *src = op.image->row( op.src.y + static_cast<int>( fy >> 16 ) ) + op.src.x;
+                if ( scaledX ) {
+                    Uint32 fx = startX;
+                    for ( int x = 0; x < n; ++x, fx += stepX ) {
+                        scratch[x] = src[fx >> 16];
+                    }
+                    src = scratch;
+                } else {
+                    src += x0 - op.dst.x;
+                }
+                if ( tinted ) {
+                    tintRow( scratch, src, n, op.color );
+                    src = scratch;
+                }
+                Uint32 *dst = targetRow( y ) + x0;
+                if ( !op.blend ) {
+                    std::memcpy( dst, src, n * sizeof( Uint32 ) );
+                } else {
+                    blendRow( dst, src, n );
+                }
+            }
+        }
+    }
+
+    Uint32* targetRow( int y ) const {
+        return reinterpret_cast<Uint32*>( static_cast<Uint8*>( target->pixels ) + y * target->pitch );
+    }
+
+    int width, height;
+    int bandHeight;
+    SDL_Surface *target;
+    // The number of ops queued since the last flush
+    size_t queued;
+    // The ops touching each band, in queue order
+    std::vector<std::vector<Op>> bands;
+    std::unique_ptr<ThreadPool> pool;
+};
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+#include <SDL2/SDL.h>
+
+/*
+ * A uniform grid over an unbounded world, hashed so only cells that hold
+ * something take any memory. Rects are registered under every cell they overlap,
+ * so finding what overlaps an area only looks at the cells under that area and
+ * the cost of a query tracks what's in view rather than the size of the world.
+ *
+ * Ids are small dense integers, eg. SpriteHandle::slot, and index straight into
+ * the grid's own table of rects.
+ *
+ * The cell size should be a few times the size of a typical object, too small and
+ * objects span many cells, too large and queries test many objects they don't touch.
+ * The default is four 40px lesson tiles.
+ */
+class SpatialGrid {
+public:
+    typedef Uint32 Id;
+
+    /**
+     * @param size The width and height of a cell
+     */
+    explicit SpatialGrid( int size = 160 ) : cellSize( size ), count( 0 ), queryStamp( 0 ) {}
+
+    /**
+     * Add an object, replacing it if the id is already in the grid
+     */
+    void insert( Id id, const SDL_Rect &rect ) {
+        if ( id >= entries.size() ) {
+            Entry empty;
+            empty.present = false;
+            empty.stamp = 0;
+            entries.resize( id + 1, empty );
+        }
+        Entry &entry = entries[id];
+        if ( entry.present ) {
+            move( id, rect );
+            return;
+        }
+
+        entry.present = true;
+        entry.rect = rect;
+        cellRange( rect, entry.cells );
+        link( id, entry.cells );
+        ++count;
+    }
+
+    /**
+     * Update an object's rect, cells are only touched if it moved into different ones
+     * @return false if the id isn't in the grid
+     */
+    bool move( Id id, const SDL_Rect &rect ) {
+        if ( !contains( id ) ) {
+            return false;
+        }
+        Entry &entry = entries[id];
+        entry.rect = rect;
+        CellRange cells;
+        cellRange( rect, cells );
+        if ( cells.x0 != entry.cells.x0 || cells.y0 != entry.cells.y0
+                || cells.x1 != entry.cells.x1 || cells.y1 != entry.cells.y1 )
+        {
+            unlink( id, entry.cells );
+            entry.cells = cells;
+            link( id, cells );
+        }
+        return true;
+    }
+
+    /**
+     * Remove an object
+     * @return false if the id isn't in the grid
+     */
+    bool remove( Id id ) {
+        if ( !contains( id ) ) {
+            return false;
+        }
+        unlink( id, entries[id].cells );
+        entries[id].present = false;
+        --count;
+        return true;
+    }
+
+    bool contains( Id id ) const {
+        return id < entries.size() && entries[id].present;
+    }
+
+    /**
+     * Find every object overlapping an area
+     * @param area The area to look in
+     * @param out The ids found are appended to this, each at most once
+     * @return the number of ids found
+     */
+    size_t query( const SDL_Rect &area, std::vector<Id> &out ) {
+        CellRange cells;
+        cellRange( area, cells );
+        if ( ++queryStamp == 0 ) {
+            for ( size_t i = 0; i < entries.size(); ++i ) {
+                entries[i].stamp = 0;
+            }
+            queryStamp = 1;
+        }
+        const size_t before = out.size();
+        for ( int cy = cells.y0; cy <= cells.y1; ++cy ) {
+            for ( int cx = cells.x0; cx <= cells.x1; ++cx ) {
+                auto cell = grid.find( cellKey( cx, cy ) );
+                if ( cell == grid.end() ) {
+                    continue;
+                }
+                const std::vector<Id> &ids = cell->second;
+                for ( size_t i = 0; i < ids.size(); ++i ) {
+                    Entry &entry = entries[ids[i]];
+                    // Objects spanning several cells would otherwise be found once per cell
+                    if ( entry.stamp == queryStamp ) {
+                        continue;
+                    }
+                    entry.stamp = queryStamp;
+                    if ( SDL_HasIntersection( &entry.rect, &area ) ) {
+                        out.push_back( ids[i] );
+                    }
+                }
+            }
+        }
+        return out.size() - before;
+    }
+
+    /**
+     * Find the objects under a point, eg. for picking with the mouse
+     * @param out The ids found are appended to this
+     * @return the number of ids found
+     */
+    size_t pick( int x, int y, std::vector<Id> &out ) {
+        const SDL_Rect point = { x, y, 1, 1 };
+        return query( point, out );
+    }
+
+    /**
+     * Remove everything
+     */
+    void clear() {
+        grid.clear();
+        entries.clear();
+        count = 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    int cellWidth() const {
+        return cellSize;
+    }
+
+private:
+    struct CellRange {
+        int x0, y0, x1, y1;
+    };
+
+    struct Entry {
+        SDL_Rect rect;
+        CellRange cells;
+        bool present;
+        // The last query that saw this entry
+        Uint32 stamp;
+    };
+
+    int cellOf( int v ) const {
+        // Round towards negative infinity so cells left of and above the origin work too
+        return v >= 0 ? v / cellSize : -( ( -v + cellSize - 1 ) / cellSize );
+    }
+
+    void cellRange( const SDL_Rect &rect, CellRange &cells ) const {
+        cells.x0 = cellOf( rect.x );
+        cells.y0 = cellOf( rect.y );
+        cells.x1 = cellOf( rect.x + SDL_max( rect.w, 1 ) - 1 );
+        cells.y1 = cellOf( rect.y + SDL_max( rect.h, 1 ) - 1 );
+    }
+
+    static Uint64 cellKey( int cx, int cy ) {
+        return static_cast<Uint64>( static_cast<Uint32>( cx ) ) << 32 | static_cast<Uint32>( cy );
+    }
+
+    void link( Id id, const CellRange &cells ) {
+        for ( int cy = cells.y0; cy <= cells.y1; ++cy ) {
+            for ( int cx = cells.x0; cx <= cells.x1; ++cx ) {
+                grid[cellKey( cx, cy )].push_back( id );
+            }
+        }
+    }
+
+    void unlink( Id id, const CellRange &cells ) {
+        for ( int cy = cells.y0; cy <= cells.y1; ++cy ) {
+            for ( int cx = cells.x0; cx <= cells.x1; ++cx ) {
+                auto cell = grid.find( cellKey( cx, cy ) );
+                if ( cell == grid.end() ) {
+                    continue;
+                }
+                std::vector<Id> &ids = cell->second;
+                for ( size_t i = 0; i < ids.size(); ++i ) {
+                    if ( ids[i] == id ) {
+                        ids[i] = ids.back();
+                        ids.pop_back();
+                        break;
+                    }
+                }
+                // Drop emptied cells so the map only holds cells something is in
+                if ( ids.empty() ) {
+                    grid.erase( cell );
+                }
+            }
+        }
+    }
+
+    int cellSize;
+    size_t count;
+    Uint32 queryStamp;
+    std::unordered_map<Uint64, std::vector<Id>> grid;
+    std::vector<Entry> entries;
+};
+
+#endif
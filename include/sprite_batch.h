@@ -0,0 +1,256 @@
+#ifndef SPRITE_BATCH_H
+#define SPRITE_BATCH_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <SDL2/SDL.h>
+
+// SDL_RenderGeometry was added in SDL 2.0.18, older versions fall back to SDL_RenderCopy runs
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#define SPRITE_BATCH_HAS_GEOMETRY 1
+#else
+#define SPRITE_BATCH_HAS_GEOMETRY 0
+#endif
+
+/*
+ * Accumulates textured quads for a frame and submits them in bulk. Quads are
+ * sorted by layer and then by texture so each texture is bound once per layer,
+ * and each run of quads sharing a texture goes out in a single SDL_RenderGeometry
+ * call when the SDL we're built against supports it.
+ *
+ * Sorting means that within a layer quads using different textures may be drawn
+ * in a different order than they were queued, so anything that has to appear on
+ * top of something else should go in a higher layer.
+ */
+class SpriteBatch {
+public:
+    enum SubmitMode {
+        // One SDL_RenderGeometry call per texture run
+        SUBMIT_GEOMETRY,
+        // One SDL_RenderCopy per quad, still in texture sorted order
+        SUBMIT_COPY
+    };
+
+    /**
+     * Create a sprite batch for some renderer
+     * @param ren The renderer to submit to
+     * @param reserve The number of quads to reserve space for up front
+     */
+    explicit SpriteBatch( SDL_Renderer *ren, size_t reserve = 256 )
+        : renderer( ren ), mode( SPRITE_BATCH_HAS_GEOMETRY ? SUBMIT_GEOMETRY : SUBMIT_COPY ), drawCalls( 0 )
+    {
+        quads.reserve( reserve );
+    }
+
+    /**
+     * Queue a texture to be drawn at some destination rect
+     * @param tex The source texture we want to draw
+     * @param dst The destination rectangle to render the texture to
+     * @param clip The sub-section of the texture to draw, nullptr draws the entire texture
+     * @param layer The layer to draw in, lower layers are drawn first
+     */
+    void draw( SDL_Texture *tex, const SDL_Rect &dst, const SDL_Rect *clip = nullptr, int layer = 0 ) {
+        const SDL_Color white = { 255, 255, 255, 255 };
+        draw( tex, dst, clip, layer, white );
+    }
+
+    /**
+     * Queue a texture to be drawn at some destination rect, modulated by a color
+     * @param tex The source texture we want to draw
+     * @param dst The destination rectangle to render the texture to
+     * @param clip The sub-section of the texture to draw, nullptr draws the entire texture
+     * @param layer The layer to draw in, lower layers are drawn first
+     * @param color The color and alpha to multiply the texture by, when copying white
+     *        leaves whatever color and alpha mod the texture already has
+     */
+    void draw( SDL_Texture *tex, const SDL_Rect &dst, const SDL_Rect *clip, int layer, SDL_Color color ) {
+        Quad q;
+        q.tex = tex;
+        q.layer = layer;
+        q.color = color;
+        q.dst = dst;
+        q.fullTexture = ( clip == nullptr );
+        if ( clip != nullptr ) {
+            q.src = *clip;
+        }
+        quads.push_back( q );
+    }
+
+    /**
+     * Queue a texture to be drawn at some position preserving its width and height
+     * @param tex The source texture we want to draw
+     * @param x The x coordinate to draw to
+     * @param y The y coordinate to draw to
+     * @param layer The layer to draw in, lower layers are drawn first
+     */
+    void draw( SDL_Texture *tex, int x, int y, int layer = 0 ) {
+        SDL_Rect dst;
+        dst.x = x;
+        dst.y = y;
+        SDL_QueryTexture( tex, NULL, NULL, &dst.w, &dst.h );
+        draw( tex, dst, nullptr, layer );
+    }
+
+    /**
+     * Sort and submit all queued quads to the renderer, then empty the batch
+     * @return the number of draw calls that were made
+     */
+    size_t flush() {
+        drawCalls = 0;
+        if ( quads.empty() ) {
+            return 0;
+        }
+
+        std::stable_sort( quads.begin(), quads.end(), []( const Quad &a, const Quad &b ) {
+            return a.layer != b.layer ? a.layer < b.layer : std::less<SDL_Texture*>()( a.tex, b.tex );
+        });
+
+        size_t begin = 0;
+        while ( begin < quads.size() ) {
+            size_t end = begin + 1;
+            while ( end < quads.size() && quads[end].tex == quads[begin].tex
+                    && quads[end].layer == quads[begin].layer )
+            {
+                ++end;
+            }
+            submitRun( begin, end );
+            begin = end;
+        }
+
+        quads.clear();
+        return drawCalls;
+    }
+
+    /**
+     * Drop all queued quads without drawing them
+     */
+    void clear() {
+        quads.clear();
+    }
+
+    void setSubmitMode( SubmitMode m ) {
+        mode = SPRITE_BATCH_HAS_GEOMETRY ? m : SUBMIT_COPY;
+    }
+
+    SubmitMode submitMode() const {
+        return mode;
+    }
+
+    size_t size() const {
+        return quads.size();
+    }
+
+    // The number of draw calls made by the last flush
+    size_t lastDrawCalls() const {
+        return drawCalls;
+    }
+
+private:
+    struct Quad {
+        SDL_Texture *tex;
+        int layer;
+        SDL_Color color;
+        bool fullTexture;
+        SDL_Rect src;
+        SDL_Rect dst;
+    };
+
+    void submitRun( size_t begin, size_t end ) {
+        SDL_Texture *tex = quads[begin].tex;
+#if SPRITE_BATCH_HAS_GEOMETRY
+        if ( mode == SUBMIT_GEOMETRY ) {
+            int texW, texH;
+            SDL_QueryTexture( tex, NULL, NULL, &texW, &texH );
+            const float invW = 1.0f / texW;
+            const float invH = 1.0f / texH;
+
+            vertices.clear();
+            indices.clear();
+            for ( size_t i = begin; i < end; ++i ) {
+                const Quad &q = quads[i];
+                float u0 = 0, v0 = 0, u1 = 1, v1 = 1;
+                if ( !q.fullTexture ) {
+                    u0 = q.src.x * invW;
+                    v0 = q.src.y * invH;
+                    u1 = ( q.src.x + q.src.w ) * invW;
+                    v1 = ( q.src.y + q.src.h ) * invH;
+                }
+                const float x0 = static_cast<float>( q.dst.x );
+                const float y0 = static_cast<float>( q.dst.y );
+                const float x1 = static_cast<float>( q.dst.x + q.dst.w );
+                const float y1 = static_cast<float>( q.dst.y + q.dst.h );
+
+                const int base = static_cast<int>( vertices.size() );
+                vertices.push_back( vertex( x0, y0, u0, v0, q.color ) );
+                vertices.push_back( vertex( x1, y0, u1, v0, q.color ) );
+                vertices.push_back( vertex( x1, y1, u1, v1, q.color ) );
+                vertices.push_back( vertex( x0, y1, u0, v1, q.color ) );
+
+                const int quadIndices[] = { 0, 1, 2, 0, 2, 3 };
+                for ( int k = 0; k < 6; ++k ) {
+                    indices.push_back( base + quadIndices[k] );
+                }
+            }
+
+            SDL_RenderGeometry( renderer, tex, vertices.data(), static_cast<int>( vertices.size() ),
+                    indices.data(), static_cast<int>( indices.size() ) );
+            ++drawCalls;
+            return;
+        }
+#endif
+        // White quads are drawn with whatever mod the caller left on the texture, and
+        // it's put back after the tinted ones
+        SDL_Color callerMod;
+        SDL_GetTextureColorMod( tex, &callerMod.r, &callerMod.g, &callerMod.b );
+        SDL_GetTextureAlphaMod( tex, &callerMod.a );
+        const Uint32 untinted = packColor( callerMod );
+        Uint32 modColor = untinted;
+        for ( size_t i = begin; i < end; ++i ) {
+            const Quad &q = quads[i];
+            const SDL_Color &mod = packColor( q.color ) == 0xffffffff ? callerMod : q.color;
+            const Uint32 color = packColor( mod );
+            if ( color != modColor ) {
+                setMod( tex, mod );
+                modColor = color;
+            }
+            SDL_RenderCopy( renderer, tex, q.fullTexture ? NULL : &q.src, &q.dst );
+            ++drawCalls;
+        }
+        if ( modColor != untinted ) {
+            setMod( tex, callerMod );
+        }
+    }
+
+    static void setMod( SDL_Texture *tex, SDL_Color mod ) {
+        SDL_SetTextureColorMod( tex, mod.r, mod.g, mod.b );
+        SDL_SetTextureAlphaMod( tex, mod.a );
+    }
+
+    static Uint32 packColor( SDL_Color c ) {
+        return static_cast<Uint32>( c.r ) << 24 | c.g << 16 | c.b << 8 | c.a;
+    }
+
+#if SPRITE_BATCH_HAS_GEOMETRY
+    static SDL_Vertex vertex( float x, float y, float u, float v, SDL_Color color ) {
+        SDL_Vertex vert;
+        vert.position.x = x;
+        vert.position.y = y;
+        vert.color = color;
+        vert.tex_coord.x = u;
+        vert.tex_coord.y = v;
+        return vert;
+    }
+
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+#endif
+
+    SDL_Renderer *renderer;
+    SubmitMode mode;
+    size_t drawCalls;
+    std::vector<Quad> quads;
+};
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef SPRITE_STORE_H
+#define SPRITE_STORE_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <SDL2/SDL.h>
+
+#include "simd.h"
+
+/*
+ * A growable array of plain old data whose storage is aligned for SIMD loads.
+ * Elements are moved with memcpy when it grows, so T must be trivially copyable.
+ */
+template<typename T, size_t ALIGN = 32>
+class AlignedArray {
+public:
+    AlignedArray() : block( nullptr ), items( nullptr ), count( 0 ), capacity( 0 ) {}
+
+    ~AlignedArray() {
+        std::free( block );
+    }
+
+    void push_back( const T &v ) {
+        if ( count == capacity ) {
+            reserve( capacity ? capacity * 2 : 64 );
+        }
+        items[count++] = v;
+    }
+
+    void pop_back() {
+        --count;
+    }
+
+    void clear() {
+        count = 0;
+    }
+
+    void reserve( size_t n ) {
+        if ( n <= capacity ) {
+            return;
+        }
+        void *grown = std::malloc( n * sizeof( T ) + ALIGN );
+        if ( grown == nullptr ) {
+            throw std::bad_alloc();
+        }
+        T *aligned = reinterpret_cast<T*>( ( reinterpret_cast<size_t>( grown ) + ALIGN ) & ~( ALIGN - 1 ) );
+        if ( count != 0 ) {
+            std::memcpy( aligned, items, count * sizeof( T ) );
+        }
+        std::free( block );
+        block = grown;
+        items = aligned;
+        capacity = n;
+    }
+
+    T& operator[]( size_t i ) {
+        return items[i];
+    }
+
+    const T& operator[]( size_t i ) const {
+        return items[i];
+    }
+
+    T* data() {
+        return items;
+    }
+
+    const T* data() const {
+        return items;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+private:
+    AlignedArray( const AlignedArray& );
+    AlignedArray& operator=( const AlignedArray& );
+
+    void *block;
+    T *items;
+    size_t count;
+    size_t capacity;
+};
+
+/*
+ * A handle to a sprite in a SpriteStore. Handles stay valid while sprites around
+ * them are created and destroyed, and a handle to a destroyed sprite is detected
+ * by its generation no longer matching even if the slot has been reused.
+ */
+struct SpriteHandle {
+    Uint32 slot;
+    Uint32 generation;
+};
+
+/*
+ * Sprites stored as a structure of arrays, so the per frame passes over every
+ * sprite (integrate, bounce, cull) stream through tightly packed floats and can
+ * run 4 or 8 sprites at a time with SSE2/AVX.
+ *
+ * The arrays stay dense: destroying a sprite moves the last sprite into its place,
+ * so the dense index of a sprite can change and should only be held for the
+ * duration of a pass. Use handles to refer to sprites across frames.
+ */
+class SpriteStore {
+public:
+    SpriteStore() {}
+
+    /**
+     * Add a sprite
+     * @param x The x coordinate of the sprite's top left
+     * @param y The y coordinate of the sprite's top left
+     * @param w The width the sprite is drawn at
+     * @param h The height the sprite is drawn at
+     * @param texture The id of the texture to draw the sprite with, it's up to the caller what this means
+     * @param clip The index of the clip in the texture to draw
+     * @return the sprite's handle
+     */
+    SpriteHandle create( float x, float y, float w, float h, Uint16 texture = 0, Uint16 clip = 0 ) {
+        SpriteHandle handle;
+        if ( freeSlots.empty() ) {
+            handle.slot = static_cast<Uint32>( slots.size() );
+            Slot s = { 0, 0 };
+            slots.push_back( s );
+        } else {
+            handle.slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        Slot &slot = slots[handle.slot];
+        slot.dense = static_cast<Uint32>( px.size() );
+        handle.generation = slot.generation;
+
+        px.push_back( x );
+        py.push_back( y );
+        pvx.push_back( 0 );
+        pvy.push_back( 0 );
+        pw.push_back( w );
+        ph.push_back( h );
+        ptexture.push_back( texture );
+        pclip.push_back( clip );
+        owner.push_back( handle.slot );
+        return handle;
+    }
+
+    /**
+     * Remove a sprite, the last sprite is moved into its place in the arrays
+     * @return false if the handle was already stale
+     */
+    bool destroy( SpriteHandle handle ) {
+        if ( !valid( handle ) ) {
+            return false;
+        }
+        Slot &slot = slots[handle.slot];
+        const Uint32 i = slot.dense;
+        const Uint32 last = static_cast<Uint32>( px.size() - 1 );
+        if ( i != last ) {
+            px[i] = px[last];
+            py[i] = py[last];
+            pvx[i] = pvx[last];
+            pvy[i] = pvy[last];
+            pw[i] = pw[last];
+            ph[i] = ph[last];
+            ptexture[i] = ptexture[last];
+            pclip[i] = pclip[last];
+            owner[i] = owner[last];
+            slots[owner[i]].dense = i;
+        }
+        px.pop_back();
+        py.pop_back();
+        pvx.pop_back();
+        pvy.pop_back();
+        pw.pop_back();
+        ph.pop_back();
+        ptexture.pop_back();
+        pclip.pop_back();
+        owner.pop_back();
+
+        ++slot.generation;
+        freeSlots.push_back( handle.slot );
+        return true;
+    }
+
+    bool valid( SpriteHandle handle ) const {
+        return handle.slot < slots.size() && slots[handle.slot].generation == handle.generation;
+    }
+
+    /**
+     * Get the current dense index of a sprite, for indexing the arrays
+     */
+    size_t index( SpriteHandle handle ) const {
+        return slots[handle.slot].dense;
+    }
+
+    void setVelocity( SpriteHandle handle, float vx, float vy ) {
+        const size_t i = index( handle );
+        pvx[i] = vx;
+        pvy[i] = vy;
+    }
+
+    /**
+     * Remove every sprite, all outstanding handles become stale
+     */
+    void clear() {
+        for ( size_t i = 0; i < owner.size(); ++i ) {
+            ++slots[owner[i]].generation;
+            freeSlots.push_back( owner[i] );
+        }
+        px.clear();
+        py.clear();
+        pvx.clear();
+        pvy.clear();
+        pw.clear();
+        ph.clear();
+        ptexture.clear();
+        pclip.clear();
+        owner.clear();
+    }
+
+    /**
+     * Move every sprite by its velocity
+     * @param dt The time step, velocities are in units per dt
+     */
+    void integrate( float dt ) {
+        integrateAxis( px.data(), pvx.data(), dt );
+        integrateAxis( py.data(), pvy.data(), dt );
+    }
+
+    /**
+     * Reverse the velocity of sprites that have left an area and are still heading away from it
+     */
+    void bounce( const SDL_Rect &area ) {
+        bounceAxis( px.data(), pw.data(), pvx.data(), static_cast<float>( area.x ),
+                static_cast<float>( area.x + area.w ) );
+        bounceAxis( py.data(), ph.data(), pvy.data(), static_cast<float>( area.y ),
+                static_cast<float>( area.y + area.h ) );
+    }
+
+    /**
+     * Find the sprites that overlap a view rect
+     * @return the dense indices of the visible sprites, valid until the next cull
+     */
+    const std::vector<Uint32>& cull( const SDL_Rect &view ) {
+        const float left = static_cast<float>( view.x ), right = static_cast<float>( view.x + view.w );
+        const float top = static_cast<float>( view.y ), bottom = static_cast<float>( view.y + view.h );
+        const size_t n = px.size();
+        visible.clear();
+        size_t i = 0;
+#if SIMD_SSE2
+        const __m128 l = _mm_set1_ps( left ), r = _mm_set1_ps( right );
+        const __m128 t = _mm_set1_ps( top ), b = _mm_set1_ps( bottom );
+        for ( ; i + 4 <= n; i += 4 ) {
+            const __m128 x = _mm_load_ps( px.data() + i ), y = _mm_load_ps( py.data() + i );
+            const __m128 x1 = _mm_add_ps( x, _mm_load_ps( pw.data() + i ) );
+            const __m128 y1 = _mm_add_ps( y, _mm_load_ps( ph.data() + i ) );
+            const __m128 in = _mm_and_ps( _mm_and_ps( _mm_cmplt_ps( x, r ), _mm_cmpgt_ps( x1, l ) ),
+                    _mm_and_ps( _mm_cmplt_ps( y, b ), _mm_cmpgt_ps( y1, t ) ) );
+            const int mask = _mm_movemask_ps( in );
+            for ( int lane = 0; mask != 0 && lane < 4; ++lane ) {
+                if ( mask & ( 1 << lane ) ) {
+                    visible.push_back( static_cast<Uint32>( i + lane ) );
+                }
+            }
+        }
+#endif
+        for ( ; i < n; ++i ) {
+            if ( px[i] < right && px[i] + pw[i] > left && py[i] < bottom && py[i] + ph[i] > top ) {
+                visible.push_back( static_cast<Uint32>( i ) );
+            }
+        }
+        return visible;
+    }
+
+    size_t size() const {
+        return px.size();
+    }
+
+    // The arrays, indexed by dense index
+    float* x() { return px.data(); }
+    float* y() { return py.data(); }
+    float* vx() { return pvx.data(); }
+    float* vy() { return pvy.data(); }
+    float* w() { return pw.data(); }
+    float* h() { return ph.data(); }
+    Uint16* texture() { return ptexture.data(); }
+    Uint16* clip() { return pclip.data(); }
+
+private:
+    struct Slot {
+        Uint32 dense;
+        Uint32 generation;
+    };
+
+    SpriteStore( const SpriteStore& );
+    SpriteStore& operator=( const SpriteStore& );
+
+    void integrateAxis( float *pos, const float *vel, float dt ) {
+        const size_t n = px.size();
+        size_t i = 0;
+#if SIMD_AVX
+        const __m256 step8 = _mm256_set1_ps( dt );
+        for ( ; i + 8 <= n; i += 8 ) {
+            _mm256_store_ps( pos + i, _mm256_add_ps( _mm256_load_ps( pos + i ),
+                    _mm256_mul_ps( _mm256_load_ps( vel + i ), step8 ) ) );
+        }
+#endif
+#if SIMD_SSE2
+        const __m128 step4 = _mm_set1_ps( dt );
+        for ( ; i + 4 <= n; i += 4 ) {
+            _mm_store_ps( pos + i, _mm_add_ps( _mm_load_ps( pos + i ), _mm_mul_ps( _mm_load_ps( vel + i ), step4 ) ) );
+        }
+#endif
+        for ( ; i < n; ++i ) {
+            pos[i] += vel[i] * dt;
+        }
+    }
+
+    void bounceAxis( const float *pos, const float *size, float *vel, float lo, float hi ) {
+        const size_t n = px.size();
+        size_t i = 0;
+#if SIMD_SSE2
+        // Flip the sign bit of the lanes that are out and moving further out
+        const __m128 sign = _mm_set1_ps( -0.0f ), zero = _mm_setzero_ps();
+        const __m128 lo4 = _mm_set1_ps( lo ), hi4 = _mm_set1_ps( hi );
+        for ( ; i + 4 <= n; i += 4 ) {
+            const __m128 p = _mm_load_ps( pos + i ), v = _mm_load_ps( vel + i );
+            const __m128 under = _mm_and_ps( _mm_cmplt_ps( p, lo4 ), _mm_cmplt_ps( v, zero ) );
+            const __m128 over = _mm_and_ps( _mm_cmpgt_ps( _mm_add_ps( p, _mm_load_ps( size + i ) ), hi4 ),
+                    _mm_cmpgt_ps( v, zero ) );
+            _mm_store_ps( vel + i, _mm_xor_ps( v, _mm_and_ps( _mm_or_ps( under, over ), sign ) ) );
+        }
+#endif
+        for ( ; i < n; ++i ) {
+            if ( ( pos[i] < lo && vel[i] < 0 ) || ( pos[i] + size[i] > hi && vel[i] > 0 ) ) {
+                vel[i] = -vel[i];
+            }
+        }
+    }
+
+    AlignedArray<float> px, py, pvx, pvy, pw, ph;
+    AlignedArray<Uint16> ptexture, pclip;
+    // The slot owning each dense index, so swap-remove can fix up the moved sprite's slot
+    AlignedArray<Uint32> owner;
+    std::vector<Slot> slots;
+    std::vector<Uint32> freeSlots;
+    std::vector<Uint32> visible;
+};
+
+#endif
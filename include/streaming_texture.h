@@ -0,0 +1,251 @@
+#ifndef STREAMING_TEXTURE_H
+#define STREAMING_TEXTURE_H
+
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <SDL2/SDL.h>
+
+/*
+ * A texture whose pixels are generated on the CPU and change every frame, eg.
+ * procedural effects or graphs, without creating a texture each time. The pixels
+ * are kept in two buffers: a producer writes the back buffer while the renderer's
+ * thread uploads the one last published, so the two don't wait on each other.
+ * Only the rectangles marked dirty are uploaded.
+ *
+ * StreamingTexture graph;
+ * graph.create( ren, 256, 64 );
+ *
+ * // on the producer's thread
+ * Uint32 *pixels = graph.beginWrite();
+ * ... write column x ...
+ * graph.markDirty( column );
+ * graph.endWrite();
+ *
+ * // on the renderer's thread
+ * graph.upload();
+ * SDL_RenderCopy( ren, graph.texture(), NULL, &dst );
+ *
+ * Each beginWrite starts from the latest published pixels, so the producer only has
+ * to write what's changed. If the producer publishes again before the last one's
+ * uploaded, the newer pixels replace it and their dirty rects are merged. There may
+ * be one producer thread, which needn't be the one the texture was created on.
+ */
+class StreamingTexture {
+public:
+    struct Stats {
+        size_t uploads;
+        size_t rects;
+        size_t bytes;
+    };
+
+    StreamingTexture() : tex( nullptr ), texW( 0 ), texH( 0 ), back( 0 ), pending( -1 ), uploading( -1 ) {
+        std::memset( &stats, 0, sizeof( stats ) );
+    }
+
+    /**
+     * Create the texture and its buffers, cleared to transparent black, replacing any
+     * we had. Call this on the renderer's thread before anyone starts writing.
+     * @param ren The renderer to create the texture on
+     * @param w The width of the texture
+     * @param h The height of the texture
+     * @param format A 32 bit pixel format for the buffers and the texture
+     * @return false if the texture couldn't be created, the error is in SDL_GetError
+     */
+    bool create( SDL_Renderer *ren, int w, int h, Uint32 format = SDL_PIXELFORMAT_ARGB8888 ) {
+        destroy();
+        tex = SDL_CreateTexture( ren, format, SDL_TEXTUREACCESS_STREAMING, w, h );
+        if ( tex == nullptr ) {
+            return false;
+        }
+        SDL_SetTextureBlendMode( tex, SDL_BLENDMODE_BLEND );
+        texW = w;
+        texH = h;
+        for ( int i = 0; i < 2; ++i ) {
+            buffers[i].assign( static_cast<size_t>( w ) * h, 0 );
+            stale[i].clear();
+        }
+        back = 0;
+        pending = uploading = -1;
+        dirty.clear();
+        if ( SDL_UpdateTexture( tex, NULL, buffers[0].data(), w * 4 ) != 0 ) {
+            destroy();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Destroy the texture, this must be done on the renderer's thread before the renderer is destroyed
+     */
+    void destroy() {
+        if ( tex != nullptr ) {
+            SDL_DestroyTexture( tex );
+            tex = nullptr;
+        }
+    }
+
+    SDL_Texture* texture() const {
+        return tex;
+    }
+
+    int width() const {
+        return texW;
+    }
+
+    int height() const {
+        return texH;
+    }
+
+    /**
+     * Start writing a frame's pixels, this only waits if the buffer we'd write is being uploaded
+     * @return the back buffer, width() pixels a row, holding the latest published pixels
+     */
+    Uint32* beginWrite() {
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            wake.wait( lock, [this]{ return uploading != back; } );
+        }
+        // Bring the back buffer up to date with what was published since we last wrote it
+        const Uint32 *latest = buffers[1 - back].data();
+        Uint32 *pixels = buffers[back].data();
+        for ( size_t i = 0; i < stale[back].size(); ++i ) {
+            const SDL_Rect &r = stale[back][i];
+            for ( int y = r.y; y < r.y + r.h; ++y ) {
+                const size_t row = static_cast<size_t>( y ) * texW + r.x;
+                std::memcpy( pixels + row, latest + row, r.w * sizeof( Uint32 ) );
+            }
+        }
+        stale[back].clear();
+        return pixels;
+    }
+
+    /**
+     * Mark part of the back buffer as changed, it's clipped to the texture
+     */
+    void markDirty( const SDL_Rect &rect ) {
+        const SDL_Rect bounds = { 0, 0, texW, texH };
+        SDL_Rect r;
+        if ( SDL_IntersectRect( &rect, &bounds, &r ) ) {
+            addRect( dirty, r );
+        }
+    }
+
+    /**
+     * Publish the back buffer for the next upload and move on to the other one
+     */
+    void endWrite() {
+        std::lock_guard<std::mutex> lock( mutex );
+        // Whatever's still waiting to be uploaded is replaced, but its rects have to be too
+        for ( size_t i = 0; i < dirty.size(); ++i ) {
+            addRect( pendingRects, dirty[i] );
+            addRect( stale[1 - back], dirty[i] );
+        }
+        dirty.clear();
+        pending = back;
+        back = 1 - back;
+    }
+
+    /**
+     * Upload the dirty parts of the latest published pixels, call this on the renderer's
+     * thread before drawing the texture
+     * @return false if the texture couldn't be locked, the error is in SDL_GetError
+     */
+    bool upload() {
+        int index;
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            if ( pending < 0 || tex == nullptr ) {
+                return true;
+            }
+            index = uploading = pending;
+            pending = -1;
+            // Trading vectors leaves both with storage, so this doesn't allocate once warmed up
+            uploadRects.swap( pendingRects );
+        }
+
+        bool ok = true;
+        const Uint32 *pixels = buffers[index].data();
+        for ( size_t i = 0; i < uploadRects.size() && ok; ++i ) {
+            const SDL_Rect &r = uploadRects[i];
+            void *dst;
+            int pitch;
+            ok = SDL_LockTexture( tex, &r, &dst, &pitch ) == 0;
+            if ( ok ) {
+                // The locked memory is write only and every pixel of it has to be written
+                for ( int y = 0; y < r.h; ++y ) {
+                    std::memcpy( static_cast<Uint8*>( dst ) + y * pitch, pixels + static_cast<size_t>( r.y + y ) * texW + r.x,
+                            r.w * sizeof( Uint32 ) );
+                }
+                SDL_UnlockTexture( tex );
+                ++stats.rects;
+                stats.bytes += static_cast<size_t>( r.w ) * r.h * sizeof( Uint32 );
+            }
+        }
+        ++stats.uploads;
+        uploadRects.clear();
+
+        std::lock_guard<std::mutex> lock( mutex );
+        uploading = -1;
+        wake.notify_all();
+        return ok;
+    }
+
+    // What's been uploaded so far, only read this on the renderer's thread
+    const Stats& uploadStats() const {
+        return stats;
+    }
+
+private:
+    // More dirty rects than this are merged into their bounding box
+    static const size_t MAX_RECTS = 16;
+
+    StreamingTexture( const StreamingTexture& );
+    StreamingTexture& operator=( const StreamingTexture& );
+
+    /**
+     * Add a rect to a list, merging it with any it overlaps so no pixel is uploaded twice
+     */
+    static void addRect( std::vector<SDL_Rect> &rects, SDL_Rect r ) {
+        for ( size_t i = 0; i < rects.size(); ) {
+            if ( SDL_HasIntersection( &rects[i], &r ) ) {
+                SDL_UnionRect( &rects[i], &r, &r );
+                rects[i] = rects.back();
+                rects.pop_back();
+                // The grown rect may overlap ones we've already checked
+                i = 0;
+            } else {
+                ++i;
+            }
+        }
+        rects.push_back( r );
+        if ( rects.size() > MAX_RECTS ) {
+            SDL_Rect bounds = rects[0];
+            for ( size_t i = 1; i < rects.size(); ++i ) {
+                SDL_UnionRect( &bounds, &rects[i], &bounds );
+            }
+            rects.assign( 1, bounds );
+        }
+    }
+
+    SDL_Texture *tex;
+    int texW, texH;
+    std::vector<Uint32> buffers[2];
+    // The buffer the producer writes, and the rects it's marked dirty in it so far
+    int back;
+    std::vector<SDL_Rect> dirty;
+    // For each buffer, the rects published since it was last written, which beginWrite copies in
+    std::vector<SDL_Rect> stale[2];
+    // The buffer waiting to be uploaded and its dirty rects, and the one being uploaded
+    int pending;
+    std::vector<SDL_Rect> pendingRects;
+    int uploading;
+    // The rects being uploaded, only touched on the renderer's thread
+    std::vector<SDL_Rect> uploadRects;
+    std::mutex mutex;
+    std::condition_variable wake;
+    Stats stats;
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <SDL2/SDL.h>
+
+/*
+ * A reference counted handle to a texture owned by a TextureCache. The texture
+ * is destroyed once the cache has evicted it and the last handle is released,
+ * so all handles must be released before the renderer is destroyed.
+ */
+typedef std::shared_ptr<SDL_Texture> TextureHandle;
+
+/**
+ * Loads a BMP image into a texture on the rendering device, this is the
+ * default loader used by the TextureCache
+ * @param ren The renderer to load the texture onto
+ * @param file The BMP image file to load
+ * @return the loaded texture, or nullptr if something went wrong.
+ */
+inline SDL_Texture* loadBMPTexture( SDL_Renderer *ren, const std::string &file ) {
+    SDL_Surface *loadedImage = SDL_LoadBMP( file.c_str() );
+    if ( loadedImage == nullptr ) {
+        return nullptr;
+    }
+
+    SDL_Texture *texture = SDL_CreateTextureFromSurface( ren, loadedImage );
+    SDL_FreeSurface( loadedImage );
+    return texture;
+}
+
+/*
+ * Caches textures keyed by their resolved file path (eg. getResourcePath( "lesson3" ) + "image.png")
+ * so that repeated requests for the same file share one texture instead of decoding
+ * it from disk again.
+ *
+ * The cache keeps an estimate of the VRAM used by its textures and, when a budget is
+ * set, evicts the least recently requested textures that aren't referenced by anyone
+ * else until it fits. Textures that are still held by a handle are never evicted, so
+ * the budget is a soft limit.
+ */
+class TextureCache {
+public:
+    typedef std::function<SDL_Texture*( SDL_Renderer*, const std::string& )> Loader;
+
+    struct Stats {
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+    };
+
+    /**
+     * Create a texture cache for some renderer
+     * @param ren The renderer to load textures onto
+     * @param budget The number of bytes of texture memory we'd like to stay under,
+     *        0 means unlimited
+     * @param load The function used to load a texture on a cache miss, it should
+     *        return nullptr and leave the error in SDL_GetError if something went wrong
+     */
+    explicit TextureCache( SDL_Renderer *ren, size_t budget = 0, Loader load = loadBMPTexture )
+        : renderer( ren ), loader( load ), budgetBytes( budget ), residentBytes( 0 )
+    {
+        stats.hits = stats.misses = stats.evictions = 0;
+    }
+
+    ~TextureCache() {
+        clear();
+    }
+
+    /**
+     * Get the texture for some file, loading it if it's not already resident
+     * @param file The resolved path of the file to load
+     * @return a handle to the texture, or an empty handle if loading failed
+     */
+    TextureHandle get( const std::string &file ) {
+        auto found = entries.find( file );
+        if ( found != entries.end() ) {
+            ++stats.hits;
+            lru.splice( lru.begin(), lru, found->second.lruPos );
+            return found->second.texture;
+        }
+
+        ++stats.misses;
+        SDL_Texture *tex = loader( renderer, file );
+        if ( tex == nullptr ) {
+            return TextureHandle();
+        }
+        return insert( file, tex );
+    }
+
+    /**
+     * Hand a texture that was loaded elsewhere over to the cache, if the key is already
+     * resident the existing texture is kept and the new one is destroyed
+     * @param file The key to store the texture under
+     * @param tex The texture, the cache takes ownership of it
+     * @return a handle to the cached texture
+     */
+    TextureHandle adopt( const std::string &file, SDL_Texture *tex ) {
+        auto found = entries.find( file );
+        if ( found != entries.end() ) {
+            SDL_DestroyTexture( tex );
+            lru.splice( lru.begin(), lru, found->second.lruPos );
+            return found->second.texture;
+        }
+        return insert( file, tex );
+    }
+
+    /**
+     * Check if some file is resident without loading it or touching its LRU position
+     */
+    bool contains( const std::string &file ) const {
+        return entries.find( file ) != entries.end();
+    }
+
+    /**
+     * Change the texture memory budget, evicting unused textures if we're now over it
+     * @param bytes The new budget, 0 means unlimited
+     */
+    void setBudget( size_t bytes ) {
+        budgetBytes = bytes;
+        trim();
+    }
+
+    /**
+     * Evict least recently used textures which aren't referenced outside the cache
+     * until we're within budget
+     */
+    void trim() {
+        if ( budgetBytes == 0 ) {
+            return;
+        }
+
+        auto it = lru.end();
+        while ( residentBytes > budgetBytes && it != lru.begin() ) {
+            --it;
+            auto entry = entries.find( *it );
+            if ( entry->second.texture.use_count() > 1 ) {
+                continue;
+            }
+
+            residentBytes -= entry->second.bytes;
+            ++stats.evictions;
+            entries.erase( entry );
+            it = lru.erase( it );
+        }
+    }
+
+    /**
+     * Drop the cache's references to all textures. Textures still held by a handle
+     * stay alive until that handle is released.
+     */
+    void clear() {
+        entries.clear();
+        lru.clear();
+        residentBytes = 0;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    size_t budget() const {
+        return budgetBytes;
+    }
+
+    size_t bytesResident() const {
+        return residentBytes;
+    }
+
+    const Stats& statistics() const {
+        return stats;
+    }
+
+private:
+    struct Entry {
+        TextureHandle texture;
+        size_t bytes;
+        std::list<std::string>::iterator lruPos;
+    };
+
+    TextureHandle insert( const std::string &file, SDL_Texture *tex ) {
+        Entry entry;
+        entry.texture = TextureHandle( tex, SDL_DestroyTexture );
+        entry.bytes = textureBytes( tex );
+        lru.push_front( file );
+        entry.lruPos = lru.begin();
+
+        residentBytes += entry.bytes;
+        TextureHandle handle = entries.insert( std::make_pair( file, entry ) ).first->second.texture;
+        trim();
+        return handle;
+    }
+
+    static size_t textureBytes( SDL_Texture *tex ) {
+        Uint32 format;
+        int w, h;
+        if ( SDL_QueryTexture( tex, &format, NULL, &w, &h ) != 0 ) {
+            return 0;
+        }
+
+        // Compressed/planar formats report 0 bytes per pixel, assume 32bpp for those
+        size_t bpp = SDL_ISPIXELFORMAT_FOURCC( format ) ? 0 : SDL_BYTESPERPIXEL( format );
+        return static_cast<size_t>( w ) * h * ( bpp ? bpp : 4 );
+    }
+
+    SDL_Renderer *renderer;
+    Loader loader;
+    size_t budgetBytes;
+    size_t residentBytes;
+    Stats stats;
+    std::unordered_map<std::string, Entry> entries;
+    // Keys ordered from most to least recently requested
+    std::list<std::string> lru;
+};
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef TEXTURE_NORMALIZER_H
+#define TEXTURE_NORMALIZER_H
+
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+
+#include "simd.h"
+#include "texture_cache.h"
+
+/*
+ * What was done to a surface on its way to becoming a texture, and how long it took
+ */
+struct TextureConversion {
+    std::string name;
+    Uint32 sourceFormat;
+    Uint32 textureFormat;
+    // Whether the pixels had to be converted to textureFormat
+    bool converted;
+    // Whether every pixel was opaque, so the texture's drawn without blending
+    bool opaque;
+    bool premultiplied;
+    double convertMs, scanMs, premultiplyMs, uploadMs;
+};
+
+/*
+ * Turns decoded surfaces into textures in the renderer's preferred format, so
+ * drawing them never needs a per-pixel conversion. Along the way:
+ *
+ * - images that are fully opaque lose their alpha channel (where the renderer has a
+ *   format without one) and are drawn with SDL_BLENDMODE_NONE, skipping blending
+ * - images with alpha can be premultiplied and drawn with a premultiplied blend mode,
+ *   when the renderer supports custom blend modes
+ *
+ * normalize only works on surfaces, so it can run on a loader thread, upload has to
+ * be called on the thread that owns the renderer. For a TextureCache use loader():
+ *
+ * TextureNormalizer normalizer( ren );
+ * TextureCache textures( ren, 0, normalizer.loader( []( const std::string &file ) {
+ *     return IMG_Load( file.c_str() );
+ * }));
+ *
+ * Every texture made records a TextureConversion, writeReport prints them and
+ * printReportIfRequested does when TEXTURE_REPORT is set.
+ */
+class TextureNormalizer {
+public:
+    typedef std::function<SDL_Surface*( const std::string& )> Decoder;
+
+    /**
+     * @param ren The renderer the textures are for
+     * @param premultiply Whether to premultiply the alpha of images that aren't opaque
+     */
+    explicit TextureNormalizer( SDL_Renderer *ren, bool premultiply = false )
+        : renderer( ren ), alphaFmt( SDL_PIXELFORMAT_ARGB8888 ), opaqueFmt( SDL_PIXELFORMAT_ARGB8888 ),
+        blendPremultiplied( SDL_BLENDMODE_BLEND ), premultiplyAlpha( false )
+    {
+        SDL_RendererInfo info;
+        if ( SDL_GetRendererInfo( ren, &info ) == 0 ) {
+            // The first format with alpha the renderer lists is its native one
+            for ( Uint32 i = 0; i < info.num_texture_formats; ++i ) {
+                const Uint32 f = info.texture_formats[i];
+                if ( isPacked32( f ) && SDL_ISPIXELFORMAT_ALPHA( f ) ) {
+                    alphaFmt = f;
+                    break;
+                }
+            }
+            // And the format with the same channels but no alpha, if it has one
+            opaqueFmt = alphaFmt;
+            int bpp;
+            Uint32 r, g, b, a, r2, g2, b2, a2;
+            SDL_PixelFormatEnumToMasks( alphaFmt, &bpp, &r, &g, &b, &a );
+            for ( Uint32 i = 0; i < info.num_texture_formats; ++i ) {
+                const Uint32 f = info.texture_formats[i];
+                if ( isPacked32( f ) && SDL_PixelFormatEnumToMasks( f, &bpp, &r2, &g2, &b2, &a2 )
+                        && r2 == r && g2 == g && b2 == b && a2 == 0 )
+                {
+                    opaqueFmt = f;
+                    break;
+                }
+            }
+        }
+
+#if SDL_VERSION_ATLEAST(2, 0, 6)
+        if ( premultiply ) {
+            // Not every renderer supports custom blend modes, try it out on a scratch texture
+            const SDL_BlendMode mode = SDL_ComposeCustomBlendMode( SDL_BLENDFACTOR_ONE,
+                    SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD, SDL_BLENDFACTOR_ONE,
+                    SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD );
+            SDL_Texture *probe = SDL_CreateTexture( ren, alphaFmt, SDL_TEXTUREACCESS_STATIC, 1, 1 );
+            if ( probe != nullptr && SDL_SetTextureBlendMode( probe, mode ) == 0 ) {
+                blendPremultiplied = mode;
+                premultiplyAlpha = true;
+            }
+            SDL_DestroyTexture( probe );
+        }
+#endif
+    }
+
+    // The format textures with alpha are created in
+    Uint32 format() const {
+        return alphaFmt;
+    }
+
+    // The format opaque textures are created in, the same as format() if the renderer has no format without alpha
+    Uint32 opaqueFormat() const {
+        return opaqueFmt;
+    }
+
+    // Whether textures with alpha are premultiplied, false if it wasn't asked for or the renderer can't blend them
+    bool premultiplies() const {
+        return premultiplyAlpha;
+    }
+
+    /**
+     * Convert a surface to the texture format, stripping or premultiplying alpha as
+     * needed. Doesn't touch the renderer so it's safe to call from any thread.
+     * @param surf The surface to convert, it's left alone
+     * @param report Filled in with what was done, everything except the upload time
+     * @return the converted surface, which the caller owns, or nullptr if it couldn't
+     * be converted, the error is in SDL_GetError
+     */
+    SDL_Surface* normalize( SDL_Surface *surf, TextureConversion &report ) const {
+        report.sourceFormat = surf->format->format;
+        report.converted = report.opaque = report.premultiplied = false;
+        report.convertMs = report.scanMs = report.premultiplyMs = report.uploadMs = 0;
+
+        // Without an alpha channel or color key every pixel's opaque and there's nothing to scan
+        Uint32 key;
+        const bool hasAlpha = surf->format->Amask != 0 || SDL_GetColorKey( surf, &key ) == 0;
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        SDL_Surface *out = SDL_ConvertSurfaceFormat( surf, hasAlpha ? alphaFmt : opaqueFmt, 0 );
+        if ( out == nullptr ) {
+            return nullptr;
+        }
+        report.converted = ( surf->format->format != out->format->format );
+        report.convertMs = elapsedMs( start );
+
+        report.opaque = !hasAlpha;
+        if ( hasAlpha ) {
+            start = SDL_GetPerformanceCounter();
+            report.opaque = isOpaque( out );
+            report.scanMs = elapsedMs( start );
+
+            if ( report.opaque && opaqueFmt != alphaFmt ) {
+                start = SDL_GetPerformanceCounter();
+                SDL_Surface *stripped = SDL_ConvertSurfaceFormat( out, opaqueFmt, 0 );
+                SDL_FreeSurface( out );
+                if ( stripped == nullptr ) {
+                    return nullptr;
+                }
+                out = stripped;
+                report.converted = true;
+                report.convertMs += elapsedMs( start );
+            } else if ( !report.opaque && premultiplyAlpha ) {
+                start = SDL_GetPerformanceCounter();
+                const int shift = out->format->Ashift;
+                for ( int y = 0; y < out->h; ++y ) {
+                    premultiplyRow( reinterpret_cast<Uint32*>( static_cast<Uint8*>( out->pixels ) + y * out->pitch ),
+                            out->w, shift );
+                }
+                report.premultiplied = true;
+                report.premultiplyMs = elapsedMs( start );
+            }
+        }
+        report.textureFormat = out->format->format;
+        return out;
+    }
+
+    /**
+     * Create a texture from a surface made by normalize and record its report
+     * @param surf The normalized surface, it's left alone
+     * @param report The report from normalize, the upload time is filled in
+     * @return the texture, or nullptr if it couldn't be created, the error is in SDL_GetError
+     */
+    SDL_Texture* upload( SDL_Surface *surf, TextureConversion &report ) {
+        const Uint64 start = SDL_GetPerformanceCounter();
+        SDL_Texture *tex = SDL_CreateTexture( renderer, surf->format->format, SDL_TEXTUREACCESS_STATIC, surf->w, surf->h );
+        if ( tex == nullptr ) {
+            return nullptr;
+        }
+        if ( SDL_UpdateTexture( tex, NULL, surf->pixels, surf->pitch ) != 0 ) {
+            SDL_DestroyTexture( tex );
+            return nullptr;
+        }
+        SDL_SetTextureBlendMode( tex, report.opaque ? SDL_BLENDMODE_NONE
+                : report.premultiplied ? blendPremultiplied : SDL_BLENDMODE_BLEND );
+        report.uploadMs = elapsedMs( start );
+        conversions.push_back( report );
+        return tex;
+    }
+
+    /**
+     * Normalize a surface and upload it, a drop in for SDL_CreateTextureFromSurface
+     * @param surf The surface, it's left alone
+     * @param name What to call the texture in the report
+     * @return the texture, or nullptr if something went wrong, the error is in SDL_GetError
+     */
+    SDL_Texture* createTexture( SDL_Surface *surf, const std::string &name ) {
+        TextureConversion report;
+        report.name = name;
+        SDL_Surface *normalized = normalize( surf, report );
+        if ( normalized == nullptr ) {
+            return nullptr;
+        }
+        SDL_Texture *tex = upload( normalized, report );
+        SDL_FreeSurface( normalized );
+        return tex;
+    }
+
+    /**
+     * Make a TextureCache loader that decodes files with some decoder and normalizes
+     * them, the normalizer has to outlive the cache
+     * @param decode Decodes a file to a surface, returning nullptr with the error in
+     *        SDL_GetError if it can't
+     */
+    TextureCache::Loader loader( Decoder decode ) {
+        return [this, decode]( SDL_Renderer*, const std::string &file ) -> SDL_Texture* {
+            SDL_Surface *surf = decode( file );
+            if ( surf == nullptr ) {
+                return nullptr;
+            }
+            SDL_Texture *tex = createTexture( surf, file );
+            SDL_FreeSurface( surf );
+            return tex;
+        };
+    }
+
+    // The conversions made for each texture created so far
+    const std::vector<TextureConversion>& reports() const {
+        return conversions;
+    }
+
+    /**
+     * Write a line per texture created saying what was done to it and how long it took
+     */
+    void writeReport( std::ostream &os ) const {
+        for ( size_t i = 0; i < conversions.size(); ++i ) {
+            const TextureConversion &c = conversions[i];
+            os << c.name << ": " << SDL_GetPixelFormatName( c.sourceFormat );
+            if ( c.converted ) {
+                os << " -> " << SDL_GetPixelFormatName( c.textureFormat ) << " in " << c.convertMs << " ms";
+            } else {
+                os << " (native)";
+            }
+            if ( c.scanMs > 0 ) {
+                os << ", alpha scanned in " << c.scanMs << " ms";
+            }
+            if ( c.opaque ) {
+                os << ", opaque (no blending)";
+            }
+            if ( c.premultiplied ) {
+                os << ", premultiplied in " << c.premultiplyMs << " ms";
+            }
+            os << ", uploaded in " << c.uploadMs << " ms" << std::endl;
+        }
+    }
+
+    /**
+     * Check whether every pixel of a 32 bit surface is opaque
+     */
+    static bool isOpaque( SDL_Surface *surf ) {
+        const Uint32 amask = surf->format->Amask;
+        for ( int y = 0; y < surf->h; ++y ) {
+            const Uint32 *px = reinterpret_cast<const Uint32*>( static_cast<const Uint8*>( surf->pixels ) + y * surf->pitch );
+            if ( ( andRow( px, surf->w ) & amask ) != amask ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Multiply the color channels of a row of 32 bit pixels by their alpha, rounding to
+     * nearest. The vector and scalar paths give identical results.
+     * @param px The pixels
+     * @param n The number of pixels
+     * @param ashift Where the alpha is in each pixel, 0, 8, 16 or 24
+     */
+    static void premultiplyRow( Uint32 *px, int n, int ashift ) {
+        int i = 0;
+#if SIMD_SSE2
+        // The vector paths cover alpha in the top or bottom byte, eg. ARGB8888 and RGBA8888
+        if ( ashift == 24 ) {
+            i = premultiplyVector<3>( px, n );
+        } else if ( ashift == 0 ) {
+            i = premultiplyVector<0>( px, n );
+        }
+#endif
+        const Uint32 amask = 0xffu << ashift;
+        for ( ; i < n; ++i ) {
+            const Uint32 p = px[i], a = p >> ashift & 0xff;
+            Uint32 out = p & amask;
+            for ( int shift = 0; shift < 32; shift += 8 ) {
+                if ( shift != ashift ) {
+                    const Uint32 t = ( p >> shift & 0xff ) * a + 128;
+                    out |= ( ( t + ( t >> 8 ) ) >> 8 ) << shift;
+                }
+            }
+            px[i] = out;
+        }
+    }
+
+private:
+    TextureNormalizer( const TextureNormalizer& );
+    TextureNormalizer& operator=( const TextureNormalizer& );
+
+    static bool isPacked32( Uint32 f ) {
+        return !SDL_ISPIXELFORMAT_FOURCC( f ) && SDL_BYTESPERPIXEL( f ) == 4;
+    }
+
+    static double elapsedMs( Uint64 start ) {
+        return ( SDL_GetPerformanceCounter() - start ) * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+
+    // AND of every pixel in a row, a channel's all ones only if it's all ones in every pixel
+    static Uint32 andRow( const Uint32 *px, int n ) {
+        int i = 0;
+        Uint32 acc = 0xffffffff;
+#if SIMD_AVX2
+        __m256i acc8 = _mm256_set1_epi32( -1 );
+        for ( ; i + 8 <= n; i += 8 ) {
+            acc8 = _mm256_and_si256( acc8, _mm256_loadu_si256( reinterpret_cast<const __m256i*>( px + i ) ) );
+        }
+        acc8 = _mm256_and_si256( acc8, _mm256_permute2x128_si256( acc8, acc8, 1 ) );
+        const __m128i acc4 = _mm256_castsi256_si128( acc8 );
+#elif SIMD_SSE2
+        __m128i acc4 = _mm_set1_epi32( -1 );
+        for ( ; i + 4 <= n; i += 4 ) {
+            acc4 = _mm_and_si128( acc4, _mm_loadu_si128( reinterpret_cast<const __m128i*>( px + i ) ) );
+        }
+#endif
+#if SIMD_SSE2
+        Uint32 lanes[4];
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( lanes ), acc4 );
+        acc = lanes[0] & lanes[1] & lanes[2] & lanes[3];
+#endif
+        for ( ; i < n; ++i ) {
+            acc &= px[i];
+        }
+        return acc;
+    }
+
+#if SIMD_SSE2
+    /*
+     * Premultiply 4 (or with AVX2 8) pixels at a time, LANE is the 16 bit lane alpha
+     * lands in once a pixel's bytes are widened
+     * @return the number of pixels done, the rest are left for the scalar loop
+     */
+    template<int LANE>
+    static int premultiplyVector( Uint32 *px, int n ) {
+        int i = 0;
+#if SIMD_AVX2
+        const __m256i zero8 = _mm256_setzero_si256(), round8 = _mm256_set1_epi16( 128 );
+        const __m256i keep8 = _mm256_set1_epi64x( static_cast<long long>( 0xffffull << ( LANE * 16 ) ) );
+        for ( ; i + 8 <= n; i += 8 ) {
+            const __m256i p = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( px + i ) );
+            const __m256i lo = premultiply16<LANE>( _mm256_unpacklo_epi8( p, zero8 ), round8, keep8 );
+            const __m256i hi = premultiply16<LANE>( _mm256_unpackhi_epi8( p, zero8 ), round8, keep8 );
+            _mm256_storeu_si256( reinterpret_cast<__m256i*>( px + i ), _mm256_packus_epi16( lo, hi ) );
+        }
+#endif
+        const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16( 128 );
+        const __m128i keep = _mm_set1_epi64x( static_cast<long long>( 0xffffull << ( LANE * 16 ) ) );
+        for ( ; i + 4 <= n; i += 4 ) {
+            const __m128i p = _mm_loadu_si128( reinterpret_cast<const __m128i*>( px + i ) );
+            const __m128i lo = premultiply16<LANE>( _mm_unpacklo_epi8( p, zero ), round, keep );
+            const __m128i hi = premultiply16<LANE>( _mm_unpackhi_epi8( p, zero ), round, keep );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( px + i ), _mm_packus_epi16( lo, hi ) );
+        }
+        return i;
+    }
+
+    // ( c * a + 128 ) / 255 for the color channels of two widened pixels, the alpha lanes (set in keep) pass through
+    template<int LANE>
+    static __m128i premultiply16( __m128i c, __m128i round, __m128i keep ) {
+        const __m128i a = _mm_shufflehi_epi16( _mm_shufflelo_epi16( c, _MM_SHUFFLE( LANE, LANE, LANE, LANE ) ),
+                _MM_SHUFFLE( LANE, LANE, LANE, LANE ) );
+        const __m128i t = _mm_add_epi16( _mm_mullo_epi16( c, a ), round );
+        const __m128i m = _mm_srli_epi16( _mm_add_epi16( t, _mm_srli_epi16( t, 8 ) ), 8 );
+        return _mm_or_si128( _mm_and_si128( keep, c ), _mm_andnot_si128( keep, m ) );
+    }
+#endif
+
+#if SIMD_AVX2
+    template<int LANE>
+    static __m256i premultiply16( __m256i c, __m256i round, __m256i keep ) {
+        const __m256i a = _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( c, _MM_SHUFFLE( LANE, LANE, LANE, LANE ) ),
+                _MM_SHUFFLE( LANE, LANE, LANE, LANE ) );
+        const __m256i t = _mm256_add_epi16( _mm256_mullo_epi16( c, a ), round );
+        const __m256i m = _mm256_srli_epi16( _mm256_add_epi16( t, _mm256_srli_epi16( t, 8 ) ), 8 );
+        return _mm256_or_si256( _mm256_and_si256( keep, c ), _mm256_andnot_si256( keep, m ) );
+    }
+#endif
+
+    SDL_Renderer *renderer;
+    Uint32 alphaFmt, opaqueFmt;
+    SDL_BlendMode blendPremultiplied;
+    bool premultiplyAlpha;
+    std::vector<TextureConversion> conversions;
+};
+
+/**
+ * Print a normalizer's report to stdout if the TEXTURE_REPORT environment variable is set.
+ * The lessons call this once their textures are loaded, so running one with
+ * TEXTURE_REPORT=1 shows what was done to each of its images.
+ */
+inline void printReportIfRequested( const TextureNormalizer &normalizer ) {
+    if ( SDL_getenv( "TEXTURE_REPORT" ) != nullptr ) {
+        normalizer.writeReport( std::cout );
+    }
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <SDL2/SDL.h>
+
+/*
+ * A fixed set of worker threads running jobs from a shared FIFO queue. Jobs must
+ * not touch the renderer or anything else that's only safe on the main thread,
+ * they should hand their results back for the main thread to pick up instead.
+ */
+class ThreadPool {
+public:
+    /**
+     * Start the worker threads
+     * @param threads The number of workers, 0 picks one less than the number of
+     *        CPUs so the main thread keeps a core to itself
+     */
+    explicit ThreadPool( size_t threads = 0 ) : running( 0 ), stopping( false ) {
+        if ( threads == 0 ) {
+            threads = SDL_GetCPUCount() > 1 ? SDL_GetCPUCount() - 1 : 1;
+        }
+        for ( size_t i = 0; i < threads; ++i ) {
+            workers.push_back( std::thread( &ThreadPool::work, this ) );
+        }
+    }
+
+    /**
+     * Drop any jobs that haven't started and wait for the running ones to finish
+     */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            stopping = true;
+            jobs.clear();
+        }
+        wake.notify_all();
+        for ( size_t i = 0; i < workers.size(); ++i ) {
+            workers[i].join();
+        }
+    }
+
+    /**
+     * Queue a job to be run on one of the workers
+     */
+    void submit( std::function<void()> job ) {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            jobs.push_back( std::move( job ) );
+        }
+        wake.notify_one();
+    }
+
+    /**
+     * Drop all jobs that haven't started yet
+     * @return the number of jobs dropped
+     */
+    size_t cancel() {
+        std::lock_guard<std::mutex> lock( mutex );
+        const size_t dropped = jobs.size();
+        jobs.clear();
+        if ( running == 0 ) {
+            idle.notify_all();
+        }
+        return dropped;
+    }
+
+    /**
+     * Block until the queue is empty and no job is running
+     */
+    void wait() {
+        std::unique_lock<std::mutex> lock( mutex );
+        idle.wait( lock, [this] { return jobs.empty() && running == 0; } );
+    }
+
+    // The number of jobs queued or running
+    size_t pending() const {
+        std::lock_guard<std::mutex> lock( mutex );
+        return jobs.size() + running;
+    }
+
+    size_t threadCount() const {
+        return workers.size();
+    }
+
+private:
+    ThreadPool( const ThreadPool& );
+    ThreadPool& operator=( const ThreadPool& );
+
+    void work() {
+        std::unique_lock<std::mutex> lock( mutex );
+        for (;;) {
+            wake.wait( lock, [this] { return stopping || !jobs.empty(); } );
+            if ( stopping ) {
+                return;
+            }
+
+            std::function<void()> job = std::move( jobs.front() );
+            jobs.pop_front();
+            ++running;
+            lock.unlock();
+            job();
+            lock.lock();
+            --running;
+            if ( running == 0 && jobs.empty() ) {
+                idle.notify_all();
+            }
+        }
+    }
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<std::function<void()>> jobs;
+    size_t running;
+    bool stopping;
+    std::vector<std::thread> workers;
+};
+
+#endif
@@ -0,0 +1,462 @@
+#ifndef TILEMAP_H
+#define TILEMAP_H
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <SDL2/SDL.h>
+
+#include "sprite_batch.h"
+
+// The tile index of a cell with nothing in it
+const Uint16 TILE_EMPTY = 0xffff;
+
+/*
+ * A grid of tile indices, each indexing a clip of a TileSet. Stored as one
+ * Uint16 per tile so a 10000x10000 map fits in 200MB.
+ */
+class TileMap {
+public:
+    TileMap() : mapW( 0 ), mapH( 0 ) {}
+
+    TileMap( int w, int h, Uint16 fill = TILE_EMPTY ) : mapW( 0 ), mapH( 0 ) {
+        resize( w, h, fill );
+    }
+
+    /**
+     * Resize the map, throwing away what was in it
+     */
+    void resize( int w, int h, Uint16 fill = TILE_EMPTY ) {
+        mapW = w;
+        mapH = h;
+        tiles.assign( static_cast<size_t>( w ) * h, fill );
+    }
+
+    Uint16 at( int x, int y ) const {
+        return tiles[static_cast<size_t>( y ) * mapW + x];
+    }
+
+    void set( int x, int y, Uint16 tile ) {
+        tiles[static_cast<size_t>( y ) * mapW + x] = tile;
+    }
+
+    int width() const {
+        return mapW;
+    }
+
+    int height() const {
+        return mapH;
+    }
+
+    const Uint16* data() const {
+        return tiles.data();
+    }
+
+    Uint16* data() {
+        return tiles.data();
+    }
+
+private:
+    int mapW, mapH;
+    std::vector<Uint16> tiles;
+};
+
+/*
+ * Map files come in two flavours. Binary maps are little endian:
+ *
+ * char[4] magic "TMAP"
+ * u16 version
+ * u16 reserved, 0
+ * u32 width in tiles
+ * u32 height in tiles
+ * u16 tile indices, row by row
+ *
+ * Anything not starting with the magic is read as CSV, one row of comma separated
+ * tile indices per line, with an empty cell or -1 meaning TILE_EMPTY. Every row
+ * must have the same number of tiles.
+ */
+const Uint16 TILE_MAP_VERSION = 1;
+
+/**
+ * Read a map from a binary or CSV map file
+ * @param rw The file to read, it's closed when we're done
+ * @param map The map to fill in
+ * @return false if the file couldn't be read or is malformed, the error is in SDL_GetError
+ */
+inline bool readTileMap( SDL_RWops *rw, TileMap &map ) {
+    if ( rw == nullptr ) {
+        return false;
+    }
+    std::vector<Uint8> data;
+    const Sint64 size = SDL_RWsize( rw );
+    bool ok = size >= 0;
+    if ( ok ) {
+        data.resize( static_cast<size_t>( size ) );
+        ok = data.empty() || SDL_RWread( rw, data.data(), 1, data.size() ) == data.size();
+    }
+    SDL_RWclose( rw );
+    if ( !ok ) {
+        SDL_SetError( "Couldn't read tile map" );
+        return false;
+    }
+
+    if ( data.size() >= 16 && SDL_memcmp( data.data(), "TMAP", 4 ) == 0 ) {
+        const Uint8 *p = data.data();
+        const Uint16 version = static_cast<Uint16>( p[4] | p[5] << 8 );
+        const Uint32 w = p[8] | p[9] << 8 | p[10] << 16 | static_cast<Uint32>( p[11] ) << 24;
+        const Uint32 h = p[12] | p[13] << 8 | p[14] << 16 | static_cast<Uint32>( p[15] ) << 24;
+        if ( version != TILE_MAP_VERSION || w > 0xffff || h > 0xffff
+                || data.size() < 16 + static_cast<size_t>( w ) * h * 2 )
+        {
+            SDL_SetError( "Unsupported or truncated tile map" );
+            return false;
+        }
+        map.resize( static_cast<int>( w ), static_cast<int>( h ) );
+        Uint16 *tiles = map.data();
+        for ( size_t i = 0; i < static_cast<size_t>( w ) * h; ++i ) {
+            tiles[i] = static_cast<Uint16>( p[16 + i * 2] | p[17 + i * 2] << 8 );
+        }
+        return true;
+    }
+
+    std::vector<Uint16> tiles;
+    int columns = -1, rows = 0;
+    size_t pos = 0;
+    while ( pos < data.size() ) {
+        size_t end = pos;
+        while ( end < data.size() && data[end] != '\n' ) {
+            ++end;
+        }
+        std::string line( data.begin() + pos, data.begin() + end );
+        pos = end + 1;
+        if ( !line.empty() && line[line.size() - 1] == '\r' ) {
+            line.erase( line.size() - 1 );
+        }
+        if ( line.empty() ) {
+            continue;
+        }
+
+        int count = 0;
+        size_t cell = 0;
+        for (;;) {
+            const size_t comma = line.find( ',', cell );
+            const std::string value = line.substr( cell, comma == std::string::npos ? std::string::npos : comma - cell );
+            const int tile = value.empty() ? -1 : SDL_atoi( value.c_str() );
+            tiles.push_back( tile < 0 || tile >= TILE_EMPTY ? TILE_EMPTY : static_cast<Uint16>( tile ) );
+            ++count;
+            if ( comma == std::string::npos ) {
+                break;
+            }
+            cell = comma + 1;
+        }
+        if ( columns >= 0 && count != columns ) {
+            SDL_SetError( "Tile map row %d has %d tiles, expected %d", rows + 1, count, columns );
+            return false;
+        }
+        columns = count;
+        ++rows;
+    }
+
+    map.resize( SDL_max( columns, 0 ), rows );
+    if ( !tiles.empty() ) {
+        SDL_memcpy( map.data(), tiles.data(), tiles.size() * sizeof( Uint16 ) );
+    }
+    return true;
+}
+
+/**
+ * Write a map as a binary map file
+ * @return false if the file couldn't be written, the error is in SDL_GetError
+ */
+inline bool writeTileMap( const std::string &file, const TileMap &map ) {
+    std::vector<Uint8> out;
+    const char magic[] = { 'T', 'M', 'A', 'P' };
+    out.insert( out.end(), magic, magic + 4 );
+    // The version and reserved u16s go out as one u32
+    const Uint32 header[] = { TILE_MAP_VERSION, static_cast<Uint32>( map.width() ), static_cast<Uint32>( map.height() ) };
+    for ( int i = 0; i < 3; ++i ) {
+        for ( int b = 0; b < 4; ++b ) {
+            out.push_back( static_cast<Uint8>( header[i] >> ( b * 8 ) ) );
+        }
+    }
+    const size_t count = static_cast<size_t>( map.width() ) * map.height();
+    for ( size_t i = 0; i < count; ++i ) {
+        out.push_back( static_cast<Uint8>( map.data()[i] ) );
+        out.push_back( static_cast<Uint8>( map.data()[i] >> 8 ) );
+    }
+
+    SDL_RWops *rw = SDL_RWFromFile( file.c_str(), "wb" );
+    if ( rw == nullptr ) {
+        return false;
+    }
+    const bool ok = SDL_RWwrite( rw, out.data(), 1, out.size() ) == out.size();
+    SDL_RWclose( rw );
+    return ok;
+}
+
+/*
+ * A texture cut into a grid of equally sized cells, numbered row by row. Tile n of a
+ * map is drawn with cell n. A texture holding a single tile has one cell covering
+ * all of it, whatever size the tiles are drawn at.
+ */
+struct TileSet {
+    SDL_Texture *texture;
+    int cellW, cellH;
+};
+
+/*
+ * Draws a TileMap by splitting it into square chunks of tiles, each rendered once
+ * into a target texture and then drawn with a single copy. Scrolling costs one copy
+ * per chunk on screen, and chunks are only re-rendered when a tile in them changes.
+ *
+ * Only the most recently drawn chunks keep a texture, textures of chunks that
+ * scrolled away are reused for the ones coming into view. Chunks are never bigger
+ * than the map or the renderer's largest texture. If the renderer can't render to
+ * textures the visible tiles are drawn directly instead.
+ */
+class TileMapRenderer {
+public:
+    /**
+     * @param ren The renderer to draw with
+     * @param tileMap The map to draw, it must outlive the renderer
+     * @param tileSet The tiles to draw the map with
+     * @param tileWidth The width each tile is drawn at
+     * @param tileHeight The height each tile is drawn at
+     * @param chunkTiles The width and height of a chunk in tiles, it's cut down to the
+     *        map's size and to what fits in the renderer's largest texture
+     * @param maxChunks The most chunk textures to keep
+     */
+    TileMapRenderer( SDL_Renderer *ren, TileMap &tileMap, const TileSet &tileSet, int tileWidth, int tileHeight,
+            int chunkTiles = 16, size_t maxChunks = 16 )
+        : renderer( ren ), map( tileMap ), tiles( tileSet ), tileW( tileWidth ), tileH( tileHeight ),
+        chunkCols( SDL_min( chunkTiles, map.width() ) ), chunkRows( SDL_min( chunkTiles, map.height() ) ),
+        chunkLimit( maxChunks ), useTargets( SDL_RenderTargetSupported( ren ) == SDL_TRUE ),
+        frame( 0 ), redraws( 0 ), batch( ren )
+    {
+        int texW, texH;
+        SDL_QueryTexture( tiles.texture, NULL, NULL, &texW, &texH );
+        tileColumns = SDL_max( texW / tiles.cellW, 1 );
+        tileCount = tileColumns * SDL_max( texH / tiles.cellH, 1 );
+
+        // A max of 0 means the renderer doesn't have one
+        SDL_RendererInfo info;
+        if ( SDL_GetRendererInfo( ren, &info ) == 0 ) {
+            if ( info.max_texture_width > 0 ) {
+                chunkCols = SDL_min( chunkCols, info.max_texture_width / tileW );
+            }
+            if ( info.max_texture_height > 0 ) {
+                chunkRows = SDL_min( chunkRows, info.max_texture_height / tileH );
+            }
+        }
+        chunkCols = SDL_max( chunkCols, 1 );
+        chunkRows = SDL_max( chunkRows, 1 );
+    }
+
+    ~TileMapRenderer() {
+        clear();
+    }
+
+    /**
+     * Change a tile, re-rendering its chunk the next time it's drawn
+     */
+    void setTile( int x, int y, Uint16 tile ) {
+        map.set( x, y, tile );
+        auto found = chunks.find( chunkKey( x / chunkCols, y / chunkRows ) );
+        if ( found != chunks.end() ) {
+            found->second.dirty = true;
+        }
+    }
+
+    /**
+     * Draw the part of the map under a camera
+     * @param camera The area of the map to draw, in pixels
+     * @param x The x coordinate on screen to draw the camera's top left at
+     * @param y The y coordinate on screen to draw the camera's top left at
+     * @return the number of draw calls made
+     */
+    size_t draw( const SDL_Rect &camera, int x = 0, int y = 0 ) {
+        ++frame;
+        if ( map.width() == 0 || map.height() == 0 ) {
+            return 0;
+        }
+        if ( !useTargets ) {
+            return drawTiles( camera, x, y );
+        }
+
+        const int chunkW = chunkCols * tileW, chunkH = chunkRows * tileH;
+        const int cx0 = SDL_max( camera.x / chunkW, 0 );
+        const int cy0 = SDL_max( camera.y / chunkH, 0 );
+        const int cx1 = SDL_min( ( camera.x + camera.w - 1 ) / chunkW, ( map.width() - 1 ) / chunkCols );
+        const int cy1 = SDL_min( ( camera.y + camera.h - 1 ) / chunkH, ( map.height() - 1 ) / chunkRows );
+
+        size_t calls = 0;
+        for ( int cy = cy0; cy <= cy1; ++cy ) {
+            for ( int cx = cx0; cx <= cx1; ++cx ) {
+                SDL_Texture *tex = chunkTexture( cx, cy );
+                if ( tex == nullptr ) {
+                    // Out of textures, draw what's left tile by tile
+                    useTargets = false;
+                    return calls + drawTiles( camera, x, y );
+                }
+                SDL_Rect dst = { cx * chunkW - camera.x + x, cy * chunkH - camera.y + y, chunkW, chunkH };
+                SDL_RenderCopy( renderer, tex, NULL, &dst );
+                ++calls;
+            }
+        }
+        return calls;
+    }
+
+    /**
+     * Re-render every chunk, eg. after SDL_RENDER_TARGETS_RESET
+     */
+    void invalidate() {
+        for ( auto it = chunks.begin(); it != chunks.end(); ++it ) {
+            it->second.dirty = true;
+        }
+    }
+
+    /**
+     * Destroy the chunk textures, this must be done before the renderer is destroyed
+     */
+    void clear() {
+        for ( auto it = chunks.begin(); it != chunks.end(); ++it ) {
+            SDL_DestroyTexture( it->second.texture );
+        }
+        chunks.clear();
+        lru.clear();
+    }
+
+    // The number of chunks rendered into their textures so far
+    size_t chunkRedraws() const {
+        return redraws;
+    }
+
+private:
+    struct Chunk {
+        SDL_Texture *texture;
+        bool dirty;
+        Uint32 lastFrame;
+        std::list<Uint64>::iterator lruPos;
+    };
+
+    static Uint64 chunkKey( int cx, int cy ) {
+        return static_cast<Uint64>( static_cast<Uint32>( cx ) ) << 32 | static_cast<Uint32>( cy );
+    }
+
+    /**
+     * Get an up to date texture for a chunk, rendering it if needed
+     */
+    SDL_Texture* chunkTexture( int cx, int cy ) {
+        const Uint64 key = chunkKey( cx, cy );
+        auto found = chunks.find( key );
+        if ( found == chunks.end() ) {
+            Chunk chunk;
+            chunk.texture = takeTexture();
+            if ( chunk.texture == nullptr ) {
+                return nullptr;
+            }
+            chunk.dirty = true;
+            lru.push_front( key );
+            chunk.lruPos = lru.begin();
+            found = chunks.insert( std::make_pair( key, chunk ) ).first;
+        } else {
+            lru.splice( lru.begin(), lru, found->second.lruPos );
+        }
+
+        Chunk &chunk = found->second;
+        chunk.lastFrame = frame;
+        if ( chunk.dirty ) {
+            renderChunk( cx, cy, chunk.texture );
+            chunk.dirty = false;
+        }
+        return chunk.texture;
+    }
+
+    /**
+     * Get a texture for a chunk coming into view, reusing the least recently drawn
+     * chunk's if we're at the limit and it wasn't drawn this frame
+     */
+    SDL_Texture* takeTexture() {
+        if ( chunks.size() >= chunkLimit && !lru.empty() ) {
+            auto oldest = chunks.find( lru.back() );
+            if ( oldest->second.lastFrame != frame ) {
+                SDL_Texture *tex = oldest->second.texture;
+                chunks.erase( oldest );
+                lru.pop_back();
+                return tex;
+            }
+        }
+        SDL_Texture *tex = SDL_CreateTexture( renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                chunkCols * tileW, chunkRows * tileH );
+        if ( tex != nullptr ) {
+            SDL_SetTextureBlendMode( tex, SDL_BLENDMODE_BLEND );
+        }
+        return tex;
+    }
+
+    void renderChunk( int cx, int cy, SDL_Texture *tex ) {
+        SDL_Texture *previous = SDL_GetRenderTarget( renderer );
+        Uint8 r, g, b, a;
+        SDL_GetRenderDrawColor( renderer, &r, &g, &b, &a );
+
+        SDL_SetRenderTarget( renderer, tex );
+        SDL_SetRenderDrawColor( renderer, 0, 0, 0, 0 );
+        SDL_RenderClear( renderer );
+        const int tx0 = cx * chunkCols, ty0 = cy * chunkRows;
+        const int tx1 = SDL_min( tx0 + chunkCols, map.width() ), ty1 = SDL_min( ty0 + chunkRows, map.height() );
+        queueTiles( tx0, ty0, tx1, ty1, -tx0 * tileW, -ty0 * tileH );
+        batch.flush();
+
+        SDL_SetRenderTarget( renderer, previous );
+        SDL_SetRenderDrawColor( renderer, r, g, b, a );
+        ++redraws;
+    }
+
+    size_t drawTiles( const SDL_Rect &camera, int x, int y ) {
+        const int tx0 = SDL_max( camera.x / tileW, 0 );
+        const int ty0 = SDL_max( camera.y / tileH, 0 );
+        const int tx1 = SDL_min( ( camera.x + camera.w - 1 ) / tileW + 1, map.width() );
+        const int ty1 = SDL_min( ( camera.y + camera.h - 1 ) / tileH + 1, map.height() );
+        queueTiles( tx0, ty0, tx1, ty1, x - camera.x, y - camera.y );
+        return batch.flush();
+    }
+
+    /**
+     * Queue the tiles in [tx0, tx1) x [ty0, ty1) on the batch, offset by some number of pixels
+     */
+    void queueTiles( int tx0, int ty0, int tx1, int ty1, int offsetX, int offsetY ) {
+        SDL_Rect clip = { 0, 0, tiles.cellW, tiles.cellH };
+        for ( int ty = ty0; ty < ty1; ++ty ) {
+            for ( int tx = tx0; tx < tx1; ++tx ) {
+                const Uint16 tile = map.at( tx, ty );
+                if ( tile >= tileCount ) {
+                    continue;
+                }
+                clip.x = tile % tileColumns * tiles.cellW;
+                clip.y = tile / tileColumns * tiles.cellH;
+                SDL_Rect dst = { tx * tileW + offsetX, ty * tileH + offsetY, tileW, tileH };
+                batch.draw( tiles.texture, dst, &clip );
+            }
+        }
+    }
+
+    SDL_Renderer *renderer;
+    TileMap &map;
+    TileSet tiles;
+    int tileW, tileH;
+    int tileColumns, tileCount;
+    // The size of a chunk in tiles
+    int chunkCols, chunkRows;
+    size_t chunkLimit;
+    bool useTargets;
+    Uint32 frame;
+    size_t redraws;
+    SpriteBatch batch;
+    std::unordered_map<Uint64, Chunk> chunks;
+    // Chunk keys ordered from most to least recently drawn
+    std::list<Uint64> lru;
+};
+
+#endif
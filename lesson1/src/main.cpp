@@ -6,59 +6,64 @@
 #include "res_path.h"
 #include "cleanup.h"
 
-int main() {
-    if ( SDL_Init(SDL_INIT_EVERYTHING ) != 0 ) {
-        std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
-        return 1;
-    }
-
-    SDL_Window *win = SDL_CreateWindow( "Hello World!", 100, 100, 640, 480, SDL_WINDOW_SHOWN );
+/**
+ * Open a window and show hello.bmp in it for a couple of seconds. Everything's
+ * destroyed when this returns, the window closes before main carries on.
+ * @return false if something couldn't be created, the error's already been printed
+ */
+bool showHello() {
+    WindowPtr win( SDL_CreateWindow( "Hello World!", 100, 100, 640, 480, SDL_WINDOW_SHOWN ) );
     if ( win == nullptr ) {
         std::cout << "SDL_CreateWindow Error: " << SDL_GetError() << std::endl;
-        SDL_Quit();
-        return 1;
+        return false;
     }
     std::cout << "SDL Window created." << std::endl;
 
-    SDL_Renderer *ren = SDL_CreateRenderer( win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+    RendererPtr ren( SDL_CreateRenderer( win.get(), -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC ) );
     if ( ren == nullptr ) {
-        cleanup( win );
         std::cout << "SDL_CreateRenderer Error: " << SDL_GetError() << std::endl;
-        SDL_Quit();
-        return 1;
+        return false;
     }
     std::cout << "SDL Renderer created." << std::endl;
 
     std::cout << "Loading bitmap..." << std::endl;
     std::string imagePath = getResourcePath( "Lesson1" ) + "hello.bmp";
-    SDL_Surface *bmp = SDL_LoadBMP( imagePath.c_str() );
-    if ( bmp == nullptr ) {
-        cleanup( win, ren );
-        std::cout << "SDL_LoadBMP Error: " << SDL_GetError() << std::endl;
-        SDL_Quit();
-        return 1;
+    TexturePtr tex;
+    {
+        // The surface is only needed until it's uploaded
+        SurfacePtr bmp( SDL_LoadBMP( imagePath.c_str() ) );
+        if ( bmp == nullptr ) {
+            std::cout << "SDL_LoadBMP Error: " << SDL_GetError() << std::endl;
+            return false;
+        }
+        tex.reset( SDL_CreateTextureFromSurface( ren.get(), bmp.get() ) );
     }
-
-    SDL_Texture *tex = SDL_CreateTextureFromSurface( ren, bmp );
-    cleanup( bmp );
     if ( tex == nullptr ) {
-        cleanup( win, ren );
         std::cout << "SDL_CreateTextureFromSurface Error: " << SDL_GetError() << std::endl;
-        SDL_Quit();
-        return 1;
+        return false;
     }
 
-    SDL_RenderClear( ren );
-    SDL_RenderCopy( ren, tex, NULL, NULL );
-    SDL_RenderPresent( ren );
+    SDL_RenderClear( ren.get() );
+    SDL_RenderCopy( ren.get(), tex.get(), NULL, NULL );
+    SDL_RenderPresent( ren.get() );
 
     SDL_Delay(2000);
+    return true;
+}
+
+int main() {
+    if ( SDL_Init(SDL_INIT_EVERYTHING ) != 0 ) {
+        std::cerr << "SDL_Init Error: " << SDL_GetError() << std::endl;
+        return 1;
+    }
+    ScopeExit quitSDL( SDL_Quit );
 
-    cleanup( tex, ren, win );
+    if ( !showHello() ) {
+        return 1;
+    }
 
     SDL_Delay( 2000 );
     std::cout << "Resource path is: " << getResourcePath() << std::endl;
 
-    SDL_Quit();
     return 0;
 }
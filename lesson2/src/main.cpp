@@ -5,6 +5,9 @@
 
 #include "res_path.h"
 #include "cleanup.h"
+#include "texture_cache.h"
+#include "texture_normalizer.h"
+#include "tilemap.h"
 
 const int SCREEN_WIDTH  = 640;
 const int SCREEN_HEIGHT = 480;
@@ -20,35 +23,6 @@ void logSDLError( ostream &os, const string &msg ) {
     os << msg << " error: " << SDL_GetError() << endl;
 }
 
-/**
-* Loads a BMP image into a texture on the rendering device
-* @param file The BMP image file to load
-* @param ren The renderer to load the texture onto
-* @return the loaded texture, or nullptr if something went wrong.
-*/
-SDL_Texture *loadTexture( const string &file, SDL_Renderer *ren ) {
-    // Initialize to nullptr to avoid dangling pointer issues
-    SDL_Texture *texture = nullptr;
-
-    // Load the image
-    SDL_Surface *loadedImage = SDL_LoadBMP( file.c_str() );
-
-    if ( loadedImage == nullptr ) {
-        logSDLError( cout, "SDL_LoadBMP" );
-        return texture;
-    }
-
-    texture = SDL_CreateTextureFromSurface( ren, loadedImage );
-    SDL_FreeSurface( loadedImage );
-
-    if ( texture == nullptr ) {
-        logSDLError( cout, "SDL_CreateTextureFromSurface" );
-        return texture;
-    }
-
-    return texture;
-}
-
 /**
  * Draw an SDL_Texture to an SDL_Renderer at position x, y, preserving
  * the texture's width and height.
@@ -71,51 +45,54 @@ int main() {
         logSDLError( cout, "SDL_Init" );
         return 1;
     }
+    ScopeExit quitSDL( SDL_Quit );
 
-    SDL_Window *win = SDL_CreateWindow( "Hello World!", 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN );
+    WindowPtr win( SDL_CreateWindow( "Hello World!", 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN ) );
     if ( win == nullptr ) {
         logSDLError( cout, "SDL_CreateWindow" );
-        SDL_Quit();
         return 1;
     }
 
-    SDL_Renderer *ren = SDL_CreateRenderer( win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+    RendererPtr ren( SDL_CreateRenderer( win.get(), -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC ) );
     if ( ren == nullptr ) {
-        cleanup( win );
         logSDLError( cout, "SDL_CreateRenderer" );
-        SDL_Quit();
         return 1;
     }
 
+    // Everything below holds on to textures, so it's declared after the renderer to
+    // be destroyed before it
+    TextureNormalizer normalizer( ren.get() );
+    TextureCache textures( ren.get(), 0, normalizer.loader( []( const string &file ) {
+        return SDL_LoadBMP( file.c_str() );
+    }));
     const string resPath = getResourcePath( "lesson2" );
-    SDL_Texture *background = loadTexture( resPath + "background.bmp", ren );
-    SDL_Texture *image = loadTexture( resPath + "image.bmp", ren );
+    TextureHandle background = textures.get( resPath + "background.bmp" );
+    TextureHandle image = textures.get( resPath + "image.bmp" );
     if ( background == nullptr || image == nullptr ) {
-        cleanup( background, image, ren, win );
-        SDL_Quit();
+        logSDLError( cout, "TextureCache::get" );
         return 1;
     }
+    printReportIfRequested( normalizer );
 
-    SDL_RenderClear( ren );
+    SDL_RenderClear( ren.get() );
+    // The background is a map of as many whole copies of the tile as fit on the screen
     int bW, bH;
-    SDL_QueryTexture( background, NULL, NULL, &bW, &bH );
-    for ( int y = 0; y < SCREEN_HEIGHT / bH; y++ ) {
-        for ( int x = 0; x < SCREEN_WIDTH; x++ ) {
-            renderTexture( background, ren, bW * x, bH * y );
-        }
-    }
+    SDL_QueryTexture( background.get(), NULL, NULL, &bW, &bH );
+    TileMap map( SCREEN_WIDTH / bW, SCREEN_HEIGHT / bH, 0 );
+    TileSet tileSet = { background.get(), bW, bH };
+    // It all fits on screen, so the whole map is one chunk
+    TileMapRenderer tiles( ren.get(), map, tileSet, bW, bH, SDL_max( map.width(), map.height() ), 1 );
+    SDL_Rect screen = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+    tiles.draw( screen );
 
     int iW, iH;
-    SDL_QueryTexture( image, NULL, NULL, &iW, &iH );
+    SDL_QueryTexture( image.get(), NULL, NULL, &iW, &iH );
     int x = SCREEN_WIDTH / 2 - iW / 2;
     int y = SCREEN_HEIGHT / 2 - iH / 2;
-    renderTexture( image, ren, x, y );
+    renderTexture( image.get(), ren.get(), x, y );
 
-    SDL_RenderPresent( ren );
+    SDL_RenderPresent( ren.get() );
     SDL_Delay( 2000 );
 
-    cleanup( background, image, ren, win );
-    SDL_Quit();
     return 0;
 }
-
@@ -6,6 +6,12 @@
 
 #include "res_path.h"
 #include "cleanup.h"
+#include "mip_chain.h"
+#include "render_layers.h"
+#include "res_pack.h"
+#include "texture_cache.h"
+#include "texture_normalizer.h"
+#include "tilemap.h"
 
 using namespace std;
 
@@ -22,23 +28,6 @@ void logSDLError( ostream &os, const string &msg ) {
     os << msg << " error: " << SDL_GetError() << endl;
 }
 
-/**
-* Loads a BMP image into a texture on the rendering device
-* @param file The BMP image file to load
-* @param ren The renderer to load the texture onto
-* @return the loaded texture, or nullptr if something went wrong.
-*/
-SDL_Texture *loadTexture( const string &file, SDL_Renderer *ren ) {
-    // Initialize to nullptr to avoid dangling pointer issues
-    SDL_Texture *texture = IMG_LoadTexture( ren, file.c_str() );
-
-    if ( texture == nullptr ) {
-        logSDLError( cout, "IMG_LoadTexture" );
-    }
-
-    return texture;
-}
-
 /**
  * Draw an SDL_Texture to an SDL_Renderer at position x, y, with some desired
  * width and height
@@ -78,56 +67,77 @@ int main() {
         logSDLError( cout, "SDL_Init" );
         return 1;
     }
+    ScopeExit quitSDL( SDL_Quit );
 
     if ( ( IMG_Init( IMG_INIT_PNG ) & IMG_INIT_PNG ) != IMG_INIT_PNG ) {
         logSDLError( cout, "IMG_Init" );
-        SDL_Quit();
         return 1;
     }
+    ScopeExit quitIMG( IMG_Quit );
 
-    SDL_Window *win = SDL_CreateWindow( "Lesson 3", 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN );
+    WindowPtr win( SDL_CreateWindow( "Lesson 3", 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN ) );
     if ( win == nullptr ) {
         logSDLError( cout, "SDL_CreateWindow" );
-        SDL_Quit();
         return 1;
     }
 
-    SDL_Renderer *ren = SDL_CreateRenderer( win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+    RendererPtr ren( SDL_CreateRenderer( win.get(), -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC ) );
     if ( ren == nullptr ) {
-        cleanup( win );
         logSDLError( cout, "SDL_CreateRenderer" );
-        SDL_Quit();
         return 1;
     }
 
-    const string resPath = getResourcePath( "lesson3" );
-    SDL_Texture *background = loadTexture( resPath + "background.png", ren );
-    SDL_Texture *image = loadTexture( resPath + "image.png", ren );
-    if ( background == nullptr || image == nullptr ) {
-        cleanup( background, image, ren, win );
-        SDL_Quit();
-        return 1;
+    // Load from the resource pack if it's been built, falling back to the loose files in res/
+    ResourcePack pack;
+    if ( pack.open( getResourcePath( "pack" ) + "lessons.pack" ) ) {
+        ResourcePack::mount( &pack );
     }
 
-    SDL_RenderClear( ren );
+    TextureNormalizer normalizer( ren.get() );
+    TextureCache textures( ren.get(), 0, normalizer.loader( loadResourceSurface ) );
+    TextureHandle image = textures.get( "lesson3/image.png" );
+    if ( image == nullptr ) {
+        logSDLError( cout, "loadResourceTexture" );
+        return 1;
+    }
 
-    for ( int y = 0; y < SCREEN_HEIGHT; y += TILE_SIZE ) {
-        for ( int x = 0; x < SCREEN_WIDTH; x += TILE_SIZE ) {
-            renderTexture( background, ren, x, y, TILE_SIZE, TILE_SIZE );
-        }
+    // The whole background image is tile 0, squeezed into each TILE_SIZE cell of the map
+    TileMap map;
+    if ( !readTileMap( openResource( "lesson3/background.csv" ), map ) ) {
+        logSDLError( cout, "readTileMap" );
+        return 1;
     }
+    // It's far bigger than a cell, so the tiles are drawn from the mip level closest to TILE_SIZE
+    SurfacePtr background( loadResourceSurface( "lesson3/background.png" ) );
+    MipChain backgroundMips;
+    if ( background == nullptr || !backgroundMips.build( normalizer, background.get(), "lesson3/background.png" ) ) {
+        logSDLError( cout, "MipChain::build" );
+        return 1;
+    }
+    printReportIfRequested( normalizer );
+    const int level = backgroundMips.pick( TILE_SIZE, TILE_SIZE );
+    TileSet tileSet = { backgroundMips.texture( level ), backgroundMips.width( level ), backgroundMips.height( level ) };
+    TileMapRenderer tiles( ren.get(), map, tileSet, TILE_SIZE, TILE_SIZE );
 
     int iW, iH;
-    SDL_QueryTexture( image, NULL, NULL, &iW, &iH );
+    SDL_QueryTexture( image.get(), NULL, NULL, &iW, &iH );
     int x = SCREEN_WIDTH / 2 - iW / 2;
     int y = SCREEN_HEIGHT / 2 - iH / 2;
-    renderTexture( image, ren, x, y );
 
-    SDL_RenderPresent( ren );
+    // The tiled background never changes, so it's painted once into its own layer
+    // and the image is composited on top of it
+    RenderLayers layers( ren.get(), SCREEN_WIDTH, SCREEN_HEIGHT );
+    layers.addStatic( [&]( SDL_Renderer* ) {
+        SDL_Rect screen = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+        tiles.draw( screen );
+    });
+    layers.addDynamic( [&]( SDL_Renderer *r ) {
+        renderTexture( image.get(), r, x, y );
+    });
+
+    layers.present();
+    SDL_RenderPresent( ren.get() );
     SDL_Delay( 2000 );
 
-    cleanup( background, image, ren, win );
-    SDL_Quit();
     return 0;
 }
-
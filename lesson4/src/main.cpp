@@ -1,16 +1,40 @@
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <SDL2/SDL.h>
 #include <SDL2_image/SDL_Image.h>
 
 #include "res_path.h"
+#include "async_loader.h"
 #include "cleanup.h"
+#include "game_loop.h"
+#include "input.h"
+#include "profiler.h"
+#include "render_layers.h"
+#include "session_options.h"
+#include "texture_cache.h"
+#include "texture_normalizer.h"
 
 using namespace std;
 
 const int SCREEN_WIDTH  = 640;
 const int SCREEN_HEIGHT = 480;
+// Simulation steps per second, and the most frames we'll render per second
+const double SIM_RATE  = 60;
+const double FRAME_CAP = 120;
+// How fast the image moves while a direction key is held, in pixels per second
+const double SPEED = 120;
+
+// Each direction can be driven by the arrow keys, esdf or vim's hjkl
+const InputBinding BINDINGS[] = {
+    { "up", SDL_SCANCODE_UP }, { "up", SDL_SCANCODE_E }, { "up", SDL_SCANCODE_K },
+    { "down", SDL_SCANCODE_DOWN }, { "down", SDL_SCANCODE_D }, { "down", SDL_SCANCODE_J },
+    { "left", SDL_SCANCODE_LEFT }, { "left", SDL_SCANCODE_S }, { "left", SDL_SCANCODE_H },
+    { "right", SDL_SCANCODE_RIGHT }, { "right", SDL_SCANCODE_F }, { "right", SDL_SCANCODE_L },
+    { "profile", SDL_SCANCODE_F3 },
+    { "quit", SDL_SCANCODE_ESCAPE }
+};
 
 /**
  * Log an SDL error with some error message to the output stream of our choice
@@ -21,23 +45,6 @@ void logSDLError( ostream &os, const string &msg ) {
     os << msg << " error: " << SDL_GetError() << endl;
 }
 
-/**
-* Loads a BMP image into a texture on the rendering device
-* @param file The BMP image file to load
-* @param ren The renderer to load the texture onto
-* @return the loaded texture, or nullptr if something went wrong.
-*/
-SDL_Texture* loadTexture( const string &file, SDL_Renderer *ren ) {
-    // Initialize to nullptr to avoid dangling pointer issues
-    SDL_Texture *texture = IMG_LoadTexture( ren, file.c_str() );
-
-    if ( texture == nullptr ) {
-        logSDLError( cout, "IMG_LoadTexture" );
-    }
-
-    return texture;
-}
-
 /**
  * Draw an SDL_Texture to an SDL_Renderer at position x, y, with some desired
  * width and height
@@ -72,89 +79,200 @@ void renderTexture( SDL_Texture *tex, SDL_Renderer *ren, int x, int y ) {
     renderTexture( tex, ren, x, y, w, h );
 }
 
-int main() {
+/**
+ * usage: Lesson4 [--record file] [--replay file] [--capture path] [--frames N]
+ * see SessionOptions for what they do
+ */
+int main( int argc, char **argv ) {
+    SessionOptions options;
+    if ( !parseSessionOptions( argc, argv, options ) ) {
+        cout << SDL_GetError() << endl;
+        return 1;
+    }
+    Session session;
+    if ( !session.open( options, SIM_RATE, SCREEN_WIDTH, SCREEN_HEIGHT ) ) {
+        logSDLError( cout, "Session::open" );
+        return 1;
+    }
+    InputRecorder &recorder = session.recorder();
+    InputReplay &replay = session.replay();
+    FrameCapture &capture = session.capture();
+    const bool replaying = session.replaying();
+    const bool headless = session.headless();
+
     if ( SDL_Init(SDL_INIT_EVERYTHING ) != 0 ) {
         logSDLError( cout, "SDL_Init" );
         return 1;
     }
+    ScopeExit quitSDL( SDL_Quit );
 
     if ( ( IMG_Init( IMG_INIT_PNG ) & IMG_INIT_PNG ) != IMG_INIT_PNG ) {
         logSDLError( cout, "IMG_Init" );
-        SDL_Quit();
         return 1;
     }
+    ScopeExit quitIMG( IMG_Quit );
 
-    SDL_Window *win = SDL_CreateWindow( "Lesson 3", 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN );
+    WindowPtr win( SDL_CreateWindow( "Lesson 3", 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT,
+            headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN ) );
     if ( win == nullptr ) {
         logSDLError( cout, "SDL_CreateWindow" );
-        SDL_Quit();
         return 1;
     }
 
-    SDL_Renderer *ren = SDL_CreateRenderer( win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+    RendererPtr ren( SDL_CreateRenderer( win.get(), -1,
+            headless ? 0 : SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC ) );
     if ( ren == nullptr ) {
-        cleanup( win );
         logSDLError( cout, "SDL_CreateRenderer" );
-        SDL_Quit();
         return 1;
     }
-
-    string filePath = getResourcePath( "lesson4/image.png" );
-    SDL_Texture *image = loadTexture( filePath, ren );
-    if ( image == nullptr ) {
-        cleanup( win, ren );
-        logSDLError( cout, "loadTexture" );
-        SDL_Quit();
+    // Captured frames are drawn offscreen and read back from there
+    OffscreenFrame offscreen;
+    if ( capture.isOpen() && !offscreen.create( ren.get(), SCREEN_WIDTH, SCREEN_HEIGHT ) ) {
+        logSDLError( cout, "OffscreenFrame::create" );
         return 1;
     }
 
-    int x, y, w, h, v = 2;
-    SDL_QueryTexture( image, NULL, NULL, &w, &h );
-    x = SCREEN_WIDTH/2 - w/2;
-    y = SCREEN_HEIGHT/2 - h/2;
+    TextureNormalizer normalizer( ren.get() );
+    TextureCache textures( ren.get(), 0, normalizer.loader( AsyncLoader::decodeImage ) );
+    // The image is decoded and normalized in the background and a placeholder is drawn
+    // until it's uploaded, so the window starts responding straight away
+    AsyncLoader loader( ren.get(), &textures );
+    loader.setNormalizer( &normalizer );
+    AsyncLoader::TextureRequest image = loader.loadTexture( getResourcePath( "lesson4" ) + "image.png" );
+
+    // x and y track the center of the image since its size changes once it's loaded
+    double x = SCREEN_WIDTH/2;
+    double y = SCREEN_HEIGHT/2;
+    double prevX = x, prevY = y;
+
+    Input input( BINDINGS, SDL_arraysize( BINDINGS ) );
+    const int UP = input.action( "up" ), DOWN = input.action( "down" );
+    const int LEFT = input.action( "left" ), RIGHT = input.action( "right" );
+    const int PROFILE = input.action( "profile" ), QUIT = input.action( "quit" );
+
+    // Only the area the image moved across is recomposited each frame, the rest of the
+    // screen is reused from the last frame
+    RenderLayers layers( ren.get(), SCREEN_WIDTH, SCREEN_HEIGHT );
+    SDL_Rect imageRect = { 0, 0, 0, 0 };
+    SDL_Texture *drawnTexture = nullptr;
+    layers.addDynamic( [&]( SDL_Renderer *r ) {
+        renderTexture( drawnTexture, r, imageRect.x, imageRect.y, imageRect.w, imageRect.h );
+    });
+
+    GameLoop loop( 1.0 / SIM_RATE );
+    loop.setFrameCap( FRAME_CAP );
+    if ( headless ) {
+        // The simulation has to see the same ticks it saw when recording, and captured
+        // frames have to be a step apart whatever the time it took to write them
+        loop.setLockstep( true );
+        loop.setFrameCap( 0 );
+        input.setEventState( replaying );
+    }
+
+    // F3 toggles the profiler overlay, set PROFILE_TRACE to a file to get a Chrome trace on exit
+    Profiler &profiler = Profiler::instance();
+    const char *tracePath = SDL_getenv( "PROFILE_TRACE" );
+    profiler.setCapture( tracePath != nullptr );
+    bool showProfile = false;
 
+    Uint32 frames = 0;
     bool quit = false;
-    SDL_Event e;
     while ( !quit ) {
-        while ( SDL_PollEvent( &e ) ) {
-            quit = ( e.type == SDL_QUIT || e.type == SDL_MOUSEBUTTONDOWN );
-
-            if ( e.type == SDL_KEYDOWN ) {
-                switch ( e.key.keysym.sym ) {
-                    case SDLK_UP:
-                    case SDLK_e:
-                    case SDLK_k:
-                        y -= v;
-                        break;
-                    case SDLK_DOWN:
-                    case SDLK_d:
-                    case SDLK_j:
-                        y += v;
-                        break;
-                    case SDLK_LEFT:
-                    case SDLK_s:
-                    case SDLK_h:
-                        x -= v;
-                        break;
-                    case SDLK_RIGHT:
-                    case SDLK_f:
-                    case SDLK_l:
-                        x += v;
-                        break;
-                    default:
-                        quit = true;
-                        break;
+        profiler.beginFrame();
+
+        {
+            PROFILE_ZONE( "events" );
+            // Stop once the frame after the last recorded event has run
+            const bool replayDone = replaying && replay.finished();
+            if ( replaying ) {
+                replay.pump( loop.tick() );
+            }
+            input.update();
+            recorder.record( loop.tick(), input );
+            quit = input.quitRequested() || input.pressed( QUIT ) || replayDone
+                || session.framesDone( frames );
+            if ( input.pressed( PROFILE ) ) {
+                showProfile = !showProfile;
+            }
+            const vector<SDL_Event> &events = input.frameEvents();
+            for ( size_t i = 0; i < events.size(); ++i ) {
+                quit = quit || events[i].type == SDL_MOUSEBUTTONDOWN;
+                if ( events[i].type == SDL_RENDER_TARGETS_RESET || events[i].type == SDL_RENDER_DEVICE_RESET ) {
+                    layers.invalidate();
                 }
             }
         }
 
-        SDL_RenderClear( ren );
-        renderTexture( image, ren, x, y );
-        SDL_RenderPresent( ren );
+        {
+            PROFILE_ZONE( "load" );
+            loader.update();
+            if ( image->failed() ) {
+                cout << "IMG_Load error: " << image->error() << endl;
+                quit = true;
+            }
+        }
+
+        {
+            PROFILE_ZONE( "simulate" );
+            loop.beginFrame();
+            while ( loop.step() ) {
+                prevX = x;
+                prevY = y;
+                x += ( input.held( RIGHT ) - input.held( LEFT ) ) * SPEED * loop.dt();
+                y += ( input.held( DOWN ) - input.held( UP ) ) * SPEED * loop.dt();
+            }
+        }
+
+        // Draw between the last two simulation steps so movement stays smooth
+        // when the render rate doesn't match the simulation rate
+        const double alpha = loop.alpha();
+        offscreen.begin();
+        {
+            PROFILE_ZONE( "clear" );
+            SDL_Rect rect;
+            SDL_QueryTexture( image->texture(), NULL, NULL, &rect.w, &rect.h );
+            rect.x = static_cast<int>( prevX + ( x - prevX ) * alpha ) - rect.w/2;
+            rect.y = static_cast<int>( prevY + ( y - prevY ) * alpha ) - rect.h/2;
+            if ( !SDL_RectEquals( &rect, &imageRect ) || drawnTexture != image->texture() ) {
+                layers.markDirty( imageRect );
+                layers.markDirty( rect );
+                imageRect = rect;
+                drawnTexture = image->texture();
+            }
+            layers.compose();
+        }
+        {
+            PROFILE_ZONE( "draw" );
+            layers.draw();
+            if ( showProfile ) {
+                profiler.drawOverlay( ren.get(), 0, 0 );
+            }
+        }
+        if ( capture.isOpen() ) {
+            PROFILE_ZONE( "capture" );
+            if ( !capture.capture( ren.get() ) ) {
+                logSDLError( cout, "FrameCapture::capture" );
+                quit = true;
+            }
+        }
+        offscreen.end();
+        {
+            PROFILE_ZONE( "present" );
+            SDL_RenderPresent( ren.get() );
+        }
+        ++frames;
+
+        profiler.endFrame();
+        loop.endFrame();
+    }
+
+    if ( tracePath != nullptr && !profiler.writeChromeTrace( tracePath ) ) {
+        cout << "Failed to write profile trace to " << tracePath << endl;
     }
+    printReportIfRequested( normalizer );
+    session.closeRecording( cout );
+    session.closeCapture( cout );
 
-    cleanup( image, ren, win );
-    SDL_Quit();
     return 0;
 }
 
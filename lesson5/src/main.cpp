@@ -1,20 +1,46 @@
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <SDL2/SDL.h>
 #include <SDL2_image/SDL_Image.h>
 
 #include "res_path.h"
+#include "animation.h"
+#include "atlas.h"
 #include "cleanup.h"
+#include "game_loop.h"
+#include "input.h"
+#include "profiler.h"
+#include "render_layers.h"
+#include "session_options.h"
+#include "spatial_grid.h"
+#include "texture_cache.h"
+#include "texture_normalizer.h"
 
 using namespace std;
 
 const int SCREEN_WIDTH  = 640;
 const int SCREEN_HEIGHT = 480;
-const int SPRITE_W = 100;
-const int SPRITE_H = 100;
-const int SPRITE_ROWS = 2;
-const int SPRITE_COLS = 2;
+const int SPRITE_COUNT = 4;
+// Simulation steps per second, and the most frames we'll render per second
+const double SIM_RATE  = 60;
+const double FRAME_CAP = 120;
+// How fast the sprite moves while a direction key is held, in pixels per second
+const double SPEED = 300;
+
+// Each direction can be driven by the arrow keys, esdf or vim's hjkl, 1-4 pick an animation.
+// Key N's animation starts on the sheet cell key N always showed: top left, bottom left,
+// top right, then bottom right.
+const InputBinding BINDINGS[] = {
+    { "up", SDL_SCANCODE_UP }, { "up", SDL_SCANCODE_E }, { "up", SDL_SCANCODE_K },
+    { "down", SDL_SCANCODE_DOWN }, { "down", SDL_SCANCODE_D }, { "down", SDL_SCANCODE_J },
+    { "left", SDL_SCANCODE_LEFT }, { "left", SDL_SCANCODE_S }, { "left", SDL_SCANCODE_H },
+    { "right", SDL_SCANCODE_RIGHT }, { "right", SDL_SCANCODE_F }, { "right", SDL_SCANCODE_L },
+    { "clip1", SDL_SCANCODE_1 }, { "clip2", SDL_SCANCODE_2 }, { "clip3", SDL_SCANCODE_3 }, { "clip4", SDL_SCANCODE_4 },
+    { "profile", SDL_SCANCODE_F3 },
+    { "quit", SDL_SCANCODE_ESCAPE }
+};
 
 /**
  * Log an SDL error with some error message to the output stream of our choice
@@ -25,23 +51,6 @@ void logSDLError( ostream &os, const string &msg ) {
     os << msg << " error: " << SDL_GetError() << endl;
 }
 
-/**
-* Loads a BMP image into a texture on the rendering device
-* @param file The BMP image file to load
-* @param ren The renderer to load the texture onto
-* @return the loaded texture, or nullptr if something went wrong.
-*/
-SDL_Texture* loadTexture( const string &file, SDL_Renderer *ren ) {
-    // Initialize to nullptr to avoid dangling pointer issues
-    SDL_Texture *texture = IMG_LoadTexture( ren, file.c_str() );
-
-    if ( texture == nullptr ) {
-        logSDLError( cout, "IMG_LoadTexture" );
-    }
-
-    return texture;
-}
-
 /**
 * Draw an SDL_Texture to an SDL_Renderer at some destination rect
 * taking a clip of the texture if desired
@@ -51,7 +60,7 @@ SDL_Texture* loadTexture( const string &file, SDL_Renderer *ren ) {
 * @param clip The sub-section of the texture to draw (clipping rect)
 *		default of nullptr draws the entire texture
 */
-void renderTexture( SDL_Texture *tex, SDL_Renderer *ren, SDL_Rect dst, SDL_Rect *clip = nullptr ) {
+void renderTexture( SDL_Texture *tex, SDL_Renderer *ren, SDL_Rect dst, const SDL_Rect *clip = nullptr ) {
     SDL_RenderCopy( ren, tex, clip, &dst );
 }
 
@@ -67,7 +76,7 @@ void renderTexture( SDL_Texture *tex, SDL_Renderer *ren, SDL_Rect dst, SDL_Rect
 * @param clip The sub-section of the texture to draw (clipping rect)
 *		default of nullptr draws the entire texture
 */
-void renderTexture( SDL_Texture *tex, SDL_Renderer *ren, int x, int y, SDL_Rect *clip = nullptr ) {
+void renderTexture( SDL_Texture *tex, SDL_Renderer *ren, int x, int y, const SDL_Rect *clip = nullptr ) {
     SDL_Rect dst;
     dst.x = x;
     dst.y = y;
@@ -80,113 +89,239 @@ void renderTexture( SDL_Texture *tex, SDL_Renderer *ren, int x, int y, SDL_Rect
     renderTexture( tex, ren, dst, clip );
 }
 
-int main() {
+/**
+ * usage: Lesson5 [--record file] [--replay file] [--capture path] [--frames N]
+ * see SessionOptions for what they do
+ */
+int main( int argc, char **argv ) {
+    SessionOptions options;
+    if ( !parseSessionOptions( argc, argv, options ) ) {
+        cout << SDL_GetError() << endl;
+        return 1;
+    }
+    Session session;
+    if ( !session.open( options, SIM_RATE, SCREEN_WIDTH, SCREEN_HEIGHT ) ) {
+        logSDLError( cout, "Session::open" );
+        return 1;
+    }
+    InputRecorder &recorder = session.recorder();
+    InputReplay &replay = session.replay();
+    FrameCapture &capture = session.capture();
+    const bool replaying = session.replaying();
+    const bool headless = session.headless();
+
     if ( SDL_Init(SDL_INIT_EVERYTHING ) != 0 ) {
         logSDLError( cout, "SDL_Init" );
         return 1;
     }
+    ScopeExit quitSDL( SDL_Quit );
 
     if ( ( IMG_Init( IMG_INIT_PNG ) & IMG_INIT_PNG ) != IMG_INIT_PNG ) {
         logSDLError( cout, "IMG_Init" );
-        SDL_Quit();
         return 1;
     }
+    ScopeExit quitIMG( IMG_Quit );
 
-    SDL_Window *win = SDL_CreateWindow( "Lesson 3", 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN );
+    WindowPtr win( SDL_CreateWindow( "Lesson 3", 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT,
+            headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN ) );
     if ( win == nullptr ) {
         logSDLError( cout, "SDL_CreateWindow" );
-        SDL_Quit();
         return 1;
     }
 
-    SDL_Renderer *ren = SDL_CreateRenderer( win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+    RendererPtr ren( SDL_CreateRenderer( win.get(), -1,
+            headless ? 0 : SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC ) );
     if ( ren == nullptr ) {
-        cleanup( win );
         logSDLError( cout, "SDL_CreateRenderer" );
-        SDL_Quit();
+        return 1;
+    }
+    // Captured frames are drawn offscreen and read back from there
+    OffscreenFrame offscreen;
+    if ( capture.isOpen() && !offscreen.create( ren.get(), SCREEN_WIDTH, SCREEN_HEIGHT ) ) {
+        logSDLError( cout, "OffscreenFrame::create" );
+        return 1;
+    }
+
+    TextureNormalizer normalizer( ren.get() );
+    TextureCache textures( ren.get(), 0, normalizer.loader( []( const string &file ) {
+        return IMG_Load( file.c_str() );
+    }));
+    TextureAtlas atlas;
+    if ( !atlas.load( getResourcePath( "atlas" ) + "sprites.atlas", textures ) ) {
+        logSDLError( cout, "TextureAtlas::load" );
+        return 1;
+    }
+
+    const TextureAtlas::Sprite *sheet = atlas.find( "lesson5/image" );
+    if ( sheet == nullptr ) {
+        cout << "lesson5/image is missing from the atlas" << endl;
         return 1;
     }
 
-    string filePath = getResourcePath( "lesson5/image.png" );
-    SDL_Texture *image = loadTexture( filePath, ren );
-    if ( image == nullptr ) {
-        cleanup( win, ren );
-        logSDLError( cout, "loadTexture" );
-        SDL_Quit();
+    // The animations are cut from the sheet, their frame rects are relative to its place in the atlas
+    AnimationSet animations;
+    if ( !readAnimationSet( SDL_RWFromFile( ( getResourcePath( "lesson5" ) + "image.anim" ).c_str(), "rb" ), animations ) ) {
+        logSDLError( cout, "readAnimationSet" );
         return 1;
     }
+    const Uint16 animationCount = static_cast<Uint16>( animations.clips.size() );
+    Animator animator( animations );
+    const size_t SPRITE = animator.add( 0 );
 
-    int v = 10;
     SDL_Rect dest;
-    SDL_QueryTexture( image, NULL, NULL, &dest.w, &dest.h );
-    dest.x = SCREEN_WIDTH/2 - dest.w/2;
-    dest.y = SCREEN_HEIGHT/2 - dest.h/2;
-
-    // Set up clipping
-    SDL_Rect clips[SPRITE_COLS * SPRITE_ROWS];
-    for ( int i=0; i < SPRITE_COLS * SPRITE_ROWS; i++ ) {
-        clips[i].x = i / SPRITE_ROWS * SPRITE_W;
-        clips[i].y = i % SPRITE_COLS * SPRITE_H;
-        clips[i].w = SPRITE_W;
-        clips[i].h = SPRITE_H;
+    dest.w = sheet->clip.w;
+    dest.h = sheet->clip.h;
+    double x = SCREEN_WIDTH/2 - dest.w/2;
+    double y = SCREEN_HEIGHT/2 - dest.h/2;
+    double prevX = x, prevY = y;
+    dest.x = static_cast<int>( x );
+    dest.y = static_cast<int>( y );
+
+    Input input( BINDINGS, SDL_arraysize( BINDINGS ) );
+    const int UP = input.action( "up" ), DOWN = input.action( "down" );
+    const int LEFT = input.action( "left" ), RIGHT = input.action( "right" );
+    const int PROFILE = input.action( "profile" ), QUIT = input.action( "quit" );
+    int clipActions[SPRITE_COUNT];
+    for ( int i = 0; i < SPRITE_COUNT; i++ ) {
+        clipActions[i] = input.action( "clip" + to_string( i + 1 ) );
     }
 
-    int clipIndex = 0;
+    // Only the area the sprite moved across is recomposited each frame
+    RenderLayers layers( ren.get(), SCREEN_WIDTH, SCREEN_HEIGHT );
+    SDL_Rect drawnRect = { 0, 0, 0, 0 };
+    Uint32 drawnFrame = 0xffffffff;
+    layers.addDynamic( [&]( SDL_Renderer *r ) {
+        SDL_Rect clip = animations.frames[drawnFrame].rect;
+        clip.x += sheet->clip.x;
+        clip.y += sheet->clip.y;
+        renderTexture( sheet->texture, r, drawnRect, &clip );
+    });
 
+    // Clicking the sprite moves on to the next animation, clicking anywhere else quits
+    const SpatialGrid::Id SPRITE_ID = 0;
+    SpatialGrid grid;
+    grid.insert( SPRITE_ID, dest );
+    vector<SpatialGrid::Id> picked;
+
+    GameLoop loop( 1.0 / SIM_RATE );
+    loop.setFrameCap( FRAME_CAP );
+    if ( headless ) {
+        // The simulation has to see the same ticks it saw when recording, and captured
+        // frames have to be a step apart whatever the time it took to write them
+        loop.setLockstep( true );
+        loop.setFrameCap( 0 );
+        input.setEventState( replaying );
+    }
+
+    // F3 toggles the profiler overlay, set PROFILE_TRACE to a file to get a Chrome trace on exit
+    Profiler &profiler = Profiler::instance();
+    const char *tracePath = SDL_getenv( "PROFILE_TRACE" );
+    profiler.setCapture( tracePath != nullptr );
+    bool showProfile = false;
+
+    Uint32 frames = 0;
     bool quit = false;
-    SDL_Event e;
     while ( !quit ) {
-        while ( SDL_PollEvent( &e ) ) {
-            quit = ( e.type == SDL_QUIT || e.type == SDL_MOUSEBUTTONDOWN );
-
-            if ( e.type == SDL_KEYDOWN ) {
-                switch ( e.key.keysym.sym ) {
-                    case SDLK_UP:
-                    case SDLK_e:
-                    case SDLK_k:
-                        dest.y -= v;
-                        break;
-                    case SDLK_DOWN:
-                    case SDLK_d:
-                    case SDLK_j:
-                        dest.y += v;
-                        break;
-                    case SDLK_LEFT:
-                    case SDLK_s:
-                    case SDLK_h:
-                        dest.x -= v;
-                        break;
-                    case SDLK_RIGHT:
-                    case SDLK_f:
-                    case SDLK_l:
-                        dest.x += v;
-                        break;
-                    case SDLK_1:
-                        clipIndex = 0;
-                        break;
-                    case SDLK_2:
-                        clipIndex = 1;
-                        break;
-                    case SDLK_3:
-                        clipIndex = 2;
-                        break;
-                    case SDLK_4:
-                        clipIndex = 3;
-                        break;
-                    default:
+        profiler.beginFrame();
+
+        {
+            PROFILE_ZONE( "events" );
+            // Stop once the frame after the last recorded event has run
+            const bool replayDone = replaying && replay.finished();
+            if ( replaying ) {
+                replay.pump( loop.tick() );
+            }
+            input.update();
+            recorder.record( loop.tick(), input );
+            quit = input.quitRequested() || input.pressed( QUIT ) || replayDone
+                || session.framesDone( frames );
+            if ( input.pressed( PROFILE ) ) {
+                showProfile = !showProfile;
+            }
+            for ( int i = 0; i < SPRITE_COUNT && i < animationCount; i++ ) {
+                if ( input.pressed( clipActions[i] ) ) {
+                    animator.play( SPRITE, static_cast<Uint16>( i ) );
+                }
+            }
+            const vector<SDL_Event> &events = input.frameEvents();
+            for ( size_t i = 0; i < events.size(); ++i ) {
+                const SDL_Event &e = events[i];
+                if ( e.type == SDL_MOUSEBUTTONDOWN ) {
+                    picked.clear();
+                    if ( grid.pick( e.button.x, e.button.y, picked ) != 0 ) {
+                        animator.play( SPRITE, static_cast<Uint16>( ( animator.clip( SPRITE ) + 1 ) % animationCount ) );
+                    } else {
                         quit = true;
-                        break;
+                    }
                 }
+                if ( e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET ) {
+                    layers.invalidate();
+                }
+            }
+        }
+
+        {
+            PROFILE_ZONE( "simulate" );
+            loop.beginFrame();
+            while ( loop.step() ) {
+                prevX = x;
+                prevY = y;
+                x += ( input.held( RIGHT ) - input.held( LEFT ) ) * SPEED * loop.dt();
+                y += ( input.held( DOWN ) - input.held( UP ) ) * SPEED * loop.dt();
+                animator.advance( static_cast<float>( loop.dt() ) );
+            }
+        }
+
+        // Draw between the last two simulation steps so movement stays smooth
+        // when the render rate doesn't match the simulation rate
+        const double alpha = loop.alpha();
+        dest.x = static_cast<int>( prevX + ( x - prevX ) * alpha );
+        dest.y = static_cast<int>( prevY + ( y - prevY ) * alpha );
+
+        offscreen.begin();
+        {
+            PROFILE_ZONE( "clear" );
+            if ( !SDL_RectEquals( &dest, &drawnRect ) || animator.frame( SPRITE ) != drawnFrame ) {
+                layers.markDirty( drawnRect );
+                layers.markDirty( dest );
+                grid.move( SPRITE_ID, dest );
+                drawnRect = dest;
+                drawnFrame = animator.frame( SPRITE );
+            }
+            layers.compose();
+        }
+        {
+            PROFILE_ZONE( "draw" );
+            layers.draw();
+            if ( showProfile ) {
+                profiler.drawOverlay( ren.get(), 0, 0 );
+            }
+        }
+        if ( capture.isOpen() ) {
+            PROFILE_ZONE( "capture" );
+            if ( !capture.capture( ren.get() ) ) {
+                logSDLError( cout, "FrameCapture::capture" );
+                quit = true;
             }
         }
+        offscreen.end();
+        {
+            PROFILE_ZONE( "present" );
+            SDL_RenderPresent( ren.get() );
+        }
+        ++frames;
+
+        profiler.endFrame();
+        loop.endFrame();
+    }
 
-        SDL_RenderClear( ren );
-        renderTexture( image, ren, dest, &clips[clipIndex] );
-        SDL_RenderPresent( ren );
+    if ( tracePath != nullptr && !profiler.writeChromeTrace( tracePath ) ) {
+        cout << "Failed to write profile trace to " << tracePath << endl;
     }
+    printReportIfRequested( normalizer );
+    session.closeRecording( cout );
+    session.closeCapture( cout );
 
-    cleanup( image, ren, win );
-    SDL_Quit();
     return 0;
 }
 
@@ -1,16 +1,38 @@
+#include <atomic>
+#include <cstdio>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <SDL2/SDL.h>
 #include <SDL2_ttf/SDL_TTF.h>
 
 #include "res_path.h"
 #include "cleanup.h"
+#include "font_cleanup.h"
+#include "game_loop.h"
+#include "input.h"
+#include "profiler.h"
+#include "render_thread.h"
+#include "session_options.h"
+#include "streaming_texture.h"
 
 using namespace std;
 
 const int SCREEN_WIDTH  = 640;
 const int SCREEN_HEIGHT = 480;
+// Simulation steps per second, and the most frames we'll render per second
+const double SIM_RATE  = 60;
+const double FRAME_CAP = 120;
+// The size of the frame time graph, and the frame time that fills it
+const int GRAPH_WIDTH     = 240;
+const int GRAPH_HEIGHT    = 48;
+const double GRAPH_MAX_MS = 50;
+
+const InputBinding BINDINGS[] = {
+    { "profile", SDL_SCANCODE_F3 },
+    { "quit", SDL_SCANCODE_ESCAPE }
+};
 
 /**
  * Log an SDL error with some error message to the output stream of our choice
@@ -21,97 +43,250 @@ void logSDLError( ostream &os, const string &msg ) {
     os << msg << " error: " << SDL_GetError() << endl;
 }
 
-SDL_Texture* renderText( const string &message, TTF_Font *font, SDL_Color color, SDL_Renderer *renderer ) {
-    SDL_Surface *surf = TTF_RenderText_Blended( font, message.c_str(), color);
-    if ( surf == nullptr ) {
-        TTF_CloseFont( font );
-        logSDLError( cout, "TTF_RenderText_Blended" );
-        return nullptr;
+/**
+ * usage: Lesson6 [--record file] [--replay file] [--capture path] [--frames N]
+ * see SessionOptions for what they do
+ */
+int main( int argc, char **argv ) {
+    SessionOptions options;
+    if ( !parseSessionOptions( argc, argv, options ) ) {
+        cout << SDL_GetError() << endl;
+        return 1;
     }
-
-    SDL_Texture *tex = SDL_CreateTextureFromSurface( renderer, surf );
-    if ( tex == nullptr ) {
-        logSDLError( cout, "SDL_CreateTexture" );
+    Session session;
+    if ( !session.open( options, SIM_RATE, SCREEN_WIDTH, SCREEN_HEIGHT ) ) {
+        logSDLError( cout, "Session::open" );
+        return 1;
     }
+    InputRecorder &recorder = session.recorder();
+    InputReplay &replay = session.replay();
+    FrameCapture &capture = session.capture();
+    const bool replaying = session.replaying();
+    const bool headless = session.headless();
 
-    SDL_FreeSurface( surf );
-    return tex;
-}
-
-int main() {
     if ( SDL_Init(SDL_INIT_EVERYTHING ) != 0 ) {
         logSDLError( cout, "SDL_Init" );
         return 1;
     }
+    ScopeExit quitSDL( SDL_Quit );
 
     if ( TTF_Init() != 0 ) {
         logSDLError( cout, "TTF_Init" );
-        SDL_Quit();
         return 1;
     }
+    ScopeExit quitTTF( TTF_Quit );
 
-    SDL_Window *win = SDL_CreateWindow( "Lesson 3", 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN );
+    WindowPtr win( SDL_CreateWindow( "Lesson 3", 100, 100, SCREEN_WIDTH, SCREEN_HEIGHT,
+            headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN ) );
     if ( win == nullptr ) {
         logSDLError( cout, "SDL_CreateWindow" );
-        SDL_Quit();
         return 1;
     }
 
-    SDL_Renderer *ren = SDL_CreateRenderer( win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
-    if ( ren == nullptr ) {
-        cleanup( win );
-        logSDLError( cout, "SDL_CreateRenderer" );
-        SDL_Quit();
+    // The fonts are opened before the render thread starts so they're closed after
+    // it's stopped drawing with them
+    string filePath = getResourcePath( "lesson6") + "sample.ttf";
+    FontPtr font( TTF_OpenFont( filePath.c_str(), 64 ) );
+    FontPtr hudFont( TTF_OpenFont( filePath.c_str(), 16 ) );
+    if ( font == nullptr || hudFont == nullptr ) {
+        logSDLError( cout, "TTF_OpenFont" );
         return 1;
     }
 
-    string filePath = getResourcePath( "lesson6") + "sample.ttf";
-    TTF_Font *font = TTF_OpenFont( filePath.c_str(), 64 );
-    if ( font == nullptr ) {
-        logSDLError( cout, "TTF_OpenFont" );
-        cleanup( win, ren );
-        SDL_Quit();
+    // The renderer lives on its own thread, each frame is recorded as a list of commands
+    // that thread draws while we get on with the next frame
+    RenderThread render( win.get(), headless ? 0 : SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC );
+    if ( !render.ok() ) {
+        cout << "SDL_CreateRenderer error: " << render.error() << endl;
         return 1;
     }
 
-    SDL_Color color = { 255, 255, 255, 255 };
-    SDL_Texture *image = renderText( "TTF fonts are cool!", font, color, ren );
-    if ( image == nullptr ) {
-        cleanup( ren, win );
-        TTF_Quit();
-        SDL_Quit();
+    // The frame time graph is drawn a column a frame on this thread, while the render
+    // thread uploads and draws the last column we finished
+    StreamingTexture graph;
+    string graphError;
+    render.invoke( [&graph, &graphError]( SDL_Renderer *r ) {
+        if ( !graph.create( r, GRAPH_WIDTH, GRAPH_HEIGHT ) ) {
+            graphError = SDL_GetError();
+        }
+    });
+    if ( !graphError.empty() ) {
+        cout << "StreamingTexture::create error: " << graphError << endl;
+        return 1;
+    }
+    // Captured frames are drawn offscreen and read back from there
+    OffscreenFrame offscreen;
+    string offscreenError;
+    if ( capture.isOpen() ) {
+        render.invoke( [&offscreen, &offscreenError]( SDL_Renderer *r ) {
+            if ( !offscreen.create( r, SCREEN_WIDTH, SCREEN_HEIGHT ) ) {
+                offscreenError = SDL_GetError();
+            }
+        });
+    }
+    if ( !offscreenError.empty() ) {
+        cout << "OffscreenFrame::create error: " << offscreenError << endl;
         return 1;
     }
+    SDL_Rect graphDst = { 8, SCREEN_HEIGHT - GRAPH_HEIGHT - 8, GRAPH_WIDTH, GRAPH_HEIGHT };
+    Uint64 lastFrame = SDL_GetPerformanceCounter();
 
+    const char *message = "TTF fonts are cool!";
+    SDL_Color color = { 255, 255, 255, 255 };
+    SDL_Color hudColor = { 255, 255, 0, 255 };
+    SDL_Color black = { 0, 0, 0, 255 };
     SDL_Rect dst;
-    SDL_QueryTexture( image, NULL, NULL, &dst.w, &dst.h );
+    render.measureText( font.get(), message, dst.w, dst.h );
     dst.x = SCREEN_WIDTH/2 - dst.w/2;
     dst.y = SCREEN_HEIGHT/2 - dst.h/2;
 
+    char hud[128];
+    Uint32 frames = 0, fpsFrames = 0, fpsStart = SDL_GetTicks();
+    double fps = 0;
+
+    Input input( BINDINGS, SDL_arraysize( BINDINGS ) );
+    const int PROFILE = input.action( "profile" ), QUIT = input.action( "quit" );
+
+    GameLoop loop( 1.0 / SIM_RATE );
+    loop.setFrameCap( FRAME_CAP );
+    if ( headless ) {
+        // The simulation has to see the same ticks it saw when recording, and captured
+        // frames have to be a step apart whatever the time it took to write them
+        loop.setLockstep( true );
+        loop.setFrameCap( 0 );
+        input.setEventState( replaying );
+    }
+
+    // F3 toggles the profiler overlay, set PROFILE_TRACE to a file to get a Chrome trace on exit
+    Profiler &profiler = Profiler::instance();
+    const char *tracePath = SDL_getenv( "PROFILE_TRACE" );
+    profiler.setCapture( tracePath != nullptr );
+    bool showProfile = false;
+
+    // Frames are read back on the render thread, which tells us here if that fails
+    atomic<bool> captureFailed( false );
     bool quit = false;
-    SDL_Event e;
     while ( !quit ) {
-        while ( SDL_PollEvent( &e ) ) {
-            quit = ( e.type == SDL_QUIT || e.type == SDL_MOUSEBUTTONDOWN );
-
-            if ( e.type == SDL_KEYDOWN ) {
-                switch ( e.key.keysym.sym ) {
-                    default:
-                        quit = true;
-                        break;
-                }
+        profiler.beginFrame();
+
+        {
+            PROFILE_ZONE( "events" );
+            // Stop once the frame after the last recorded event has run
+            const bool replayDone = replaying && replay.finished();
+            if ( replaying ) {
+                replay.pump( loop.tick() );
+            }
+            input.update();
+            recorder.record( loop.tick(), input );
+            quit = input.quitRequested() || input.pressed( QUIT ) || replayDone || captureFailed
+                || session.framesDone( frames );
+            if ( input.pressed( PROFILE ) ) {
+                showProfile = !showProfile;
+            }
+            const vector<SDL_Event> &events = input.frameEvents();
+            for ( size_t i = 0; i < events.size(); ++i ) {
+                quit = quit || events[i].type == SDL_MOUSEBUTTONDOWN;
             }
         }
 
-        SDL_RenderClear( ren );
+        {
+            PROFILE_ZONE( "simulate" );
+            // Nothing to simulate, but stepping keeps the tick count in simulation time
+            loop.beginFrame();
+            while ( loop.step() ) {}
+        }
 
-        SDL_RenderCopy( ren, image, NULL, &dst );
+        ++frames;
+        ++fpsFrames;
+        const Uint32 now = SDL_GetTicks();
+        if ( now - fpsStart >= 500 ) {
+            fps = fpsFrames * 1000.0 / ( now - fpsStart );
+            fpsFrames = 0;
+            fpsStart = now;
+        }
+        {
+            PROFILE_ZONE( "graph" );
+            const Uint64 frameStart = SDL_GetPerformanceCounter();
+            const double frameMs = ( frameStart - lastFrame ) * 1000.0 / SDL_GetPerformanceFrequency();
+            lastFrame = frameStart;
+            // Sweep across the graph, clearing the column ahead so the newest bar stands out
+            const int column = frames % GRAPH_WIDTH, next = ( column + 1 ) % GRAPH_WIDTH;
+            const int bar = SDL_min( static_cast<int>( frameMs / GRAPH_MAX_MS * GRAPH_HEIGHT ), GRAPH_HEIGHT );
+            const Uint32 barColor = frameMs <= 1000.0 / 60 ? 0xff00c000 : frameMs <= 1000.0 / 30 ? 0xffe0e000 : 0xffe00000;
+            Uint32 *pixels = graph.beginWrite();
+            for ( int y = 0; y < GRAPH_HEIGHT; ++y ) {
+                pixels[y * GRAPH_WIDTH + column] = y >= GRAPH_HEIGHT - bar ? barColor : 0x80000000;
+                pixels[y * GRAPH_WIDTH + next] = 0;
+            }
+            SDL_Rect dirty = { column, 0, 1, GRAPH_HEIGHT };
+            graph.markDirty( dirty );
+            dirty.x = next;
+            graph.markDirty( dirty );
+            graph.endWrite();
+        }
+
+        // The list we're about to record into was last used two frames ago
+        const FrameArena::Stats &arena = render.commands().frameArena().lastFrame();
+        snprintf( hud, sizeof( hud ), "frame %u  fps %.1f  tick %lu  arena %lu bytes %lu allocs %lu blocks", frames,
+                fps, static_cast<unsigned long>( loop.tick() ), static_cast<unsigned long>( arena.bytes ),
+                static_cast<unsigned long>( arena.allocations ), static_cast<unsigned long>( arena.heapBlocks ) );
+
+        {
+            PROFILE_ZONE( "record" );
+            // Text goes through the render thread's glyph cache, glyphs are rasterized once
+            // into its atlas and after that drawing text doesn't create any textures
+            CommandList &frame = render.commands();
+            if ( capture.isOpen() ) {
+                frame.call( [&offscreen]( SDL_Renderer* ) {
+                    offscreen.begin();
+                });
+            }
+            frame.clear( black );
+            frame.drawText( font.get(), message, dst.x, dst.y, color );
+            frame.drawText( hudFont.get(), hud, 8, 8, hudColor );
+            frame.call( [&graph]( SDL_Renderer* ) {
+                if ( !graph.upload() ) {
+                    logSDLError( cout, "StreamingTexture::upload" );
+                }
+            });
+            frame.copy( graph.texture(), nullptr, &graphDst );
+            if ( showProfile ) {
+                frame.call( [&profiler]( SDL_Renderer *r ) {
+                    profiler.drawOverlay( r, 0, 32 );
+                });
+            }
+            if ( capture.isOpen() ) {
+                frame.call( [&capture, &captureFailed, &offscreen]( SDL_Renderer *r ) {
+                    PROFILE_ZONE( "capture" );
+                    if ( !capture.capture( r ) ) {
+                        logSDLError( cout, "FrameCapture::capture" );
+                        captureFailed = true;
+                    }
+                    offscreen.end();
+                });
+            }
+        }
+        {
+            PROFILE_ZONE( "submit" );
+            render.submit();
+        }
+
+        profiler.endFrame();
+        loop.endFrame();
+    }
 
-        SDL_RenderPresent( ren );
+    if ( tracePath != nullptr && !profiler.writeChromeTrace( tracePath ) ) {
+        cout << "Failed to write profile trace to " << tracePath << endl;
     }
+    session.closeRecording( cout );
 
-    cleanup( ren, win );
-    SDL_Quit();
+    // The capture's in use until the render thread's drawn the last frame
+    render.invoke( [&graph, &offscreen]( SDL_Renderer* ) {
+        graph.destroy();
+        offscreen.destroy();
+    });
+    render.stop();
+    session.closeCapture( cout );
     return 0;
 }
 
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <SDL2/SDL.h>
+#include <SDL2_image/SDL_Image.h>
+
+#include "atlas.h"
+#include "cleanup.h"
+#include "rect_pack.h"
+
+using namespace std;
+
+/*
+ * Packs images into one or more atlas pages and writes an atlas index naming
+ * the sub-rect of each image.
+ *
+ * usage: atlas_builder [--size N] [--padding N] <output base> <root dir> <image>...
+ *
+ * Images are given relative to the root dir and named by that path without the
+ * extension, so res/lesson5/image.png packed with root res is "lesson5/image".
+ * A sprite sheet can be given as image.png@WxH to also name each WxH cell
+ * of it, row by row, as "lesson5/image:0", "lesson5/image:1", ...
+ *
+ * Writes <output base>.atlas and <output base>N.png for each page.
+ */
+
+/**
+ * Log an SDL error with some error message to the output stream of our choice
+ * @param os The output stream to write the message to
+ * @param msg The error message to write, format will be msg error: SDL_GetError()
+ */
+void logSDLError( ostream &os, const string &msg ) {
+    os << msg << " error: " << SDL_GetError() << endl;
+}
+
+struct Image {
+    string name;
+    SurfacePtr surface;
+    int cellW, cellH;
+    int page;
+    SDL_Rect rect;
+};
+
+/**
+ * Split an image argument into its path and optional sprite sheet cell size
+ * @return false if the cell size is malformed
+ */
+bool parseImageArg( const string &arg, string &path, int &cellW, int &cellH ) {
+    cellW = cellH = 0;
+    const size_t at = arg.find( '@' );
+    path = arg.substr( 0, at );
+    if ( at == string::npos ) {
+        return true;
+    }
+
+    char x;
+    istringstream cell( arg.substr( at + 1 ) );
+    return ( cell >> cellW >> x >> cellH ) && x == 'x' && cellW > 0 && cellH > 0;
+}
+
+/**
+ * Pack the images into as few pages as we can, filling in each image's page and rect
+ * @return the number of pages used, or -1 if an image is too big for a page
+ */
+int packImages( vector<Image*> &images, int pageSize, int padding, vector<RectPacker> &pages ) {
+    // Packing tallest first gives the skyline packer a much flatter skyline to work with
+    stable_sort( images.begin(), images.end(), []( const Image *a, const Image *b ) {
+        return a->surface->h > b->surface->h;
+    });
+
+    for ( size_t i = 0; i < images.size(); ++i ) {
+        Image *img = images[i];
+        SDL_Rect padded;
+        bool placed = false;
+        for ( size_t p = 0; p < pages.size() && !placed; ++p ) {
+            if ( pages[p].insert( img->surface->w + padding, img->surface->h + padding, padded ) ) {
+                img->page = static_cast<int>( p );
+                placed = true;
+            }
+        }
+        if ( !placed ) {
+            pages.push_back( RectPacker( pageSize, pageSize ) );
+            if ( !pages.back().insert( img->surface->w + padding, img->surface->h + padding, padded ) ) {
+                cerr << img->name << " (" << img->surface->w << "x" << img->surface->h
+                    << ") doesn't fit in a " << pageSize << "x" << pageSize << " page" << endl;
+                return -1;
+            }
+            img->page = static_cast<int>( pages.size() - 1 );
+        }
+        img->rect.x = padded.x;
+        img->rect.y = padded.y;
+        img->rect.w = img->surface->w;
+        img->rect.h = img->surface->h;
+    }
+    return static_cast<int>( pages.size() );
+}
+
+/**
+ * Blit the images for a page into a surface cropped to the packed area and save it
+ * @return false if the page couldn't be written
+ */
+bool writePage( const vector<Image*> &images, int page, const RectPacker &packer, const string &file ) {
+    SurfacePtr surf( SDL_CreateRGBSurfaceWithFormat( 0, packer.usedWidth(), packer.usedHeight(),
+            32, SDL_PIXELFORMAT_RGBA32 ) );
+    if ( surf == nullptr ) {
+        logSDLError( cerr, "SDL_CreateRGBSurfaceWithFormat" );
+        return false;
+    }
+    SDL_FillRect( surf.get(), NULL, SDL_MapRGBA( surf->format, 0, 0, 0, 0 ) );
+
+    for ( size_t i = 0; i < images.size(); ++i ) {
+        if ( images[i]->page != page ) {
+            continue;
+        }
+        SDL_Rect dst = images[i]->rect;
+        SDL_BlitSurface( images[i]->surface.get(), NULL, surf.get(), &dst );
+    }
+
+    if ( IMG_SavePNG( surf.get(), file.c_str() ) != 0 ) {
+        logSDLError( cerr, "IMG_SavePNG" );
+        return false;
+    }
+    return true;
+}
+
+int main( int argc, char **argv ) {
+    int pageSize = 2048;
+    int padding = 1;
+    int arg = 1;
+    for ( ; arg + 1 < argc && string( argv[arg] ).compare( 0, 2, "--" ) == 0; arg += 2 ) {
+        const string opt = argv[arg];
+        if ( opt == "--size" ) {
+            pageSize = atoi( argv[arg + 1] );
+        } else if ( opt == "--padding" ) {
+            padding = atoi( argv[arg + 1] );
+        } else {
+            cerr << "Unknown option " << opt << endl;
+            return 1;
+        }
+    }
+    if ( argc - arg < 3 || pageSize <= 0 || padding < 0 ) {
+        cerr << "usage: " << argv[0] << " [--size N] [--padding N] <output base> <root dir> <image[@WxH]>..." << endl;
+        return 1;
+    }
+    if ( pageSize > ATLAS_MAX_PAGE_SIZE ) {
+        cerr << "--size " << pageSize << " is more than the index can hold, using " << ATLAS_MAX_PAGE_SIZE << endl;
+        pageSize = ATLAS_MAX_PAGE_SIZE;
+    }
+
+    const string outBase = argv[arg++];
+    const string root = argv[arg++];
+
+    if ( SDL_Init( 0 ) != 0 ) {
+        logSDLError( cerr, "SDL_Init" );
+        return 1;
+    }
+    ScopeExit quitSDL( SDL_Quit );
+    if ( ( IMG_Init( IMG_INIT_PNG ) & IMG_INIT_PNG ) != IMG_INIT_PNG ) {
+        logSDLError( cerr, "IMG_Init" );
+        return 1;
+    }
+    ScopeExit quitIMG( IMG_Quit );
+
+    vector<Image> images;
+    bool failed = false;
+    for ( ; arg < argc && !failed; ++arg ) {
+        Image img;
+        string path;
+        if ( !parseImageArg( argv[arg], path, img.cellW, img.cellH ) ) {
+            cerr << "Bad sprite sheet cell size in " << argv[arg] << endl;
+            failed = true;
+            break;
+        }
+
+        SurfacePtr loaded( IMG_Load( ( root + "/" + path ).c_str() ) );
+        if ( loaded == nullptr ) {
+            logSDLError( cerr, "IMG_Load " + path );
+            failed = true;
+            break;
+        }
+        // Copy the pixels, alpha and all, rather than blending them onto the page
+        img.surface.reset( SDL_ConvertSurfaceFormat( loaded.get(), SDL_PIXELFORMAT_RGBA32, 0 ) );
+        if ( img.surface == nullptr ) {
+            logSDLError( cerr, "SDL_ConvertSurfaceFormat " + path );
+            failed = true;
+            break;
+        }
+        SDL_SetSurfaceBlendMode( img.surface.get(), SDL_BLENDMODE_NONE );
+
+        img.name = path.substr( 0, path.find_last_of( '.' ) );
+        img.page = -1;
+        images.push_back( std::move( img ) );
+    }
+
+    vector<Image*> packOrder;
+    for ( size_t i = 0; i < images.size(); ++i ) {
+        packOrder.push_back( &images[i] );
+    }
+
+    vector<RectPacker> pages;
+    AtlasIndex index;
+    if ( !failed && packImages( packOrder, pageSize, padding, pages ) < 0 ) {
+        failed = true;
+    }
+
+    // Page images are referred to by file name since they sit next to the index
+    const size_t sep = outBase.find_last_of( "/\\" );
+    const string baseName = sep == string::npos ? outBase : outBase.substr( sep + 1 );
+    for ( size_t p = 0; p < pages.size() && !failed; ++p ) {
+        ostringstream page;
+        page << p << ".png";
+        index.pages.push_back( baseName + page.str() );
+        failed = !writePage( packOrder, static_cast<int>( p ), pages[p], outBase + page.str() );
+    }
+
+    // Keep the index in command line order so it's stable between runs
+    for ( size_t i = 0; i < images.size() && !failed; ++i ) {
+        const Image &img = images[i];
+        AtlasIndex::Sprite s = { img.name, static_cast<Uint16>( img.page ), img.rect };
+        index.sprites.push_back( s );
+        if ( img.cellW == 0 ) {
+            continue;
+        }
+
+        int cell = 0;
+        for ( int y = 0; y + img.cellH <= img.rect.h; y += img.cellH ) {
+            for ( int x = 0; x + img.cellW <= img.rect.w; x += img.cellW ) {
+                ostringstream name;
+                name << img.name << ":" << cell++;
+                SDL_Rect clip = { img.rect.x + x, img.rect.y + y, img.cellW, img.cellH };
+                AtlasIndex::Sprite c = { name.str(), s.page, clip };
+                index.sprites.push_back( c );
+            }
+        }
+    }
+
+    if ( !failed && !writeAtlasIndex( outBase + ".atlas", index ) ) {
+        logSDLError( cerr, "writeAtlasIndex" );
+        failed = true;
+    }
+    if ( !failed ) {
+        cout << "Packed " << images.size() << " images (" << index.sprites.size() << " sprites) into "
+            << pages.size() << " page(s)" << endl;
+    }
+
+    return failed ? 1 : 0;
+}
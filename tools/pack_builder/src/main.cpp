@@ -0,0 +1,145 @@
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <SDL2/SDL.h>
+#include <SDL2_image/SDL_Image.h>
+
+#include "cleanup.h"
+#include "res_pack.h"
+
+using namespace std;
+
+/*
+ * Packs resource files into a single resource pack that ResourcePack can map.
+ *
+ * usage: pack_builder [--decode] <output pack> <root dir> <file>...
+ *
+ * Files are given relative to the root dir and named by that path, so
+ * res/lesson3/image.png packed with root res is "lesson3/image.png".
+ * With --decode, images are decoded to ARGB8888 pixels when the pack is built
+ * so loading them at runtime skips the image decoder. This trades pack size
+ * for load time. Anything that isn't an image is stored as is.
+ */
+
+/**
+ * Log an SDL error with some error message to the output stream of our choice
+ * @param os The output stream to write the message to
+ * @param msg The error message to write, format will be msg error: SDL_GetError()
+ */
+void logSDLError( ostream &os, const string &msg ) {
+    os << msg << " error: " << SDL_GetError() << endl;
+}
+
+/**
+ * Check if a file is an image we'd decode ahead of time, going by its extension
+ */
+bool isImage( const string &path ) {
+    const size_t dot = path.find_last_of( '.' );
+    if ( dot == string::npos ) {
+        return false;
+    }
+    string ext = path.substr( dot + 1 );
+    for ( size_t i = 0; i < ext.size(); ++i ) {
+        ext[i] = static_cast<char>( tolower( static_cast<unsigned char>( ext[i] ) ) );
+    }
+    return ext == "png" || ext == "bmp" || ext == "jpg" || ext == "jpeg" || ext == "tga";
+}
+
+/**
+ * Read a whole file into memory
+ * @return false if the file couldn't be read
+ */
+bool readFile( const string &file, vector<Uint8> &data ) {
+    SDL_RWops *rw = SDL_RWFromFile( file.c_str(), "rb" );
+    if ( rw == nullptr ) {
+        return false;
+    }
+    const Sint64 size = SDL_RWsize( rw );
+    bool ok = size >= 0;
+    if ( ok ) {
+        data.resize( static_cast<size_t>( size ) );
+        ok = data.empty() || SDL_RWread( rw, data.data(), 1, data.size() ) == data.size();
+    }
+    SDL_RWclose( rw );
+    return ok;
+}
+
+/**
+ * Decode an image to the pixels stored in a RESOURCE_SURFACE entry
+ * @return false if the image couldn't be decoded
+ */
+bool decodeImage( const string &file, vector<Uint8> &data ) {
+    SurfacePtr loaded( IMG_Load( file.c_str() ) );
+    if ( loaded == nullptr ) {
+        return false;
+    }
+    SurfacePtr surf( SDL_ConvertSurfaceFormat( loaded.get(), SDL_PIXELFORMAT_ARGB8888, 0 ) );
+    if ( surf == nullptr ) {
+        return false;
+    }
+    data = surfacePayload( surf.get() );
+    return true;
+}
+
+int main( int argc, char **argv ) {
+    bool decode = false;
+    int arg = 1;
+    if ( arg < argc && string( argv[arg] ) == "--decode" ) {
+        decode = true;
+        ++arg;
+    }
+    if ( argc - arg < 3 ) {
+        cerr << "usage: " << argv[0] << " [--decode] <output pack> <root dir> <file>..." << endl;
+        return 1;
+    }
+
+    const string output = argv[arg++];
+    const string root = argv[arg++];
+
+    if ( SDL_Init( 0 ) != 0 ) {
+        logSDLError( cerr, "SDL_Init" );
+        return 1;
+    }
+    ScopeExit quitSDL( SDL_Quit );
+    if ( decode && ( IMG_Init( IMG_INIT_PNG ) & IMG_INIT_PNG ) != IMG_INIT_PNG ) {
+        logSDLError( cerr, "IMG_Init" );
+        return 1;
+    }
+    // Only shut down what we started
+    ScopeExit quitIMG( decode ? IMG_Quit : std::function<void()>() );
+
+    vector<ResourcePackEntry> entries;
+    size_t bytes = 0;
+    bool failed = false;
+    for ( ; arg < argc && !failed; ++arg ) {
+        ResourcePackEntry entry;
+        entry.name = argv[arg];
+        const string path = root + "/" + entry.name;
+        if ( decode && isImage( entry.name ) ) {
+            entry.kind = RESOURCE_SURFACE;
+            failed = !decodeImage( path, entry.data );
+        } else {
+            entry.kind = RESOURCE_RAW;
+            failed = !readFile( path, entry.data );
+        }
+        if ( failed ) {
+            logSDLError( cerr, "Reading " + path );
+            break;
+        }
+        bytes += entry.data.size();
+        entries.push_back( entry );
+    }
+
+    if ( !failed && !writeResourcePack( output, entries ) ) {
+        logSDLError( cerr, "writeResourcePack" );
+        failed = true;
+    }
+    if ( !failed ) {
+        cout << "Packed " << entries.size() << " resources (" << bytes << " bytes) into " << output << endl;
+    }
+
+    return failed ? 1 : 0;
+}